@@ -63,6 +63,7 @@
 #include <sys/dsl_dataset.h>
 #include <sys/dsl_pool.h>
 #include <sys/dsl_bookmark.h>
+#include <sys/dsl_change_log.h>
 #include <sys/dbuf.h>
 #include <sys/zil.h>
 #include <sys/zil_impl.h>
@@ -1982,6 +1983,14 @@ dump_dedup_ratio(const ddt_stat_t *dds)
 	    dedup, compress, copies, dedup * compress / copies);
 }
 
+static void
+dump_ddt_log_entry(ddt_t *ddt, const ddt_lightweight_entry_t *ddlwe,
+    void *arg)
+{
+	uint64_t *index = arg;
+	dump_ddt_entry(ddt, ddlwe, (*index)++);
+}
+
 static void
 dump_ddt_log(ddt_t *ddt)
 {
@@ -2010,7 +2019,7 @@ dump_ddt_log(ddt_t *ddt)
 			flagstr[c] = ']';
 		}
 
-		uint64_t count = avl_numnodes(&ddl->ddl_tree);
+		uint64_t count = ddt_log_count(ddl);
 
 		printf(DMU_POOL_DDT_LOG ": flags=0x%02x%s; obj=%llu; "
 		    "len=%llu; txg=%llu; entries=%llu\n",
@@ -2034,13 +2043,8 @@ dump_ddt_log(ddt_t *ddt)
 		if (count == 0 || dump_opt['D'] < 4)
 			continue;
 
-		ddt_lightweight_entry_t ddlwe;
 		uint64_t index = 0;
-		for (ddt_log_entry_t *ddle = avl_first(&ddl->ddl_tree);
-		    ddle; ddle = AVL_NEXT(&ddl->ddl_tree, ddle)) {
-			DDT_LOG_ENTRY_TO_LIGHTWEIGHT(ddt, ddle, &ddlwe);
-			dump_ddt_entry(ddt, &ddlwe, index++);
-		}
+		ddt_log_foreach(ddt, ddl, dump_ddt_log_entry, &index);
 	}
 }
 
@@ -4095,6 +4099,7 @@ count_ds_mos_objects(dsl_dataset_t *ds)
 	mos_obj_refd(ds->ds_bookmarks_obj);
 
 	if (!dsl_dataset_is_snapshot(ds)) {
+		mos_obj_refd(dsl_change_log_object(ds));
 		count_dir_mos_objects(ds->ds_dir);
 	}
 }
@@ -5242,8 +5247,8 @@ dump_backup(const char *pool, uint64_t objset_id, const char *flagstr)
 	};
 
 	int err = dmu_send_obj(pool, objset_id, /* fromsnap */0, embed,
-	    large_block, compress, raw, /* saved */ B_FALSE, STDOUT_FILENO,
-	    &off, &out);
+	    large_block, compress, raw, /* saved */ B_FALSE, ZIO_COMPRESS_OFF,
+	    STDOUT_FILENO, &off, &out);
 	if (err != 0) {
 		fprintf(stderr, "dump_backup: dmu_send_obj: %s\n",
 		    strerror(err));
@@ -5608,6 +5613,10 @@ dump_one_objset(const char *dsname, void *arg)
 		global_feature_count[SPA_FEATURE_LIVELIST]++;
 	}
 
+	if (!dmu_objset_is_snapshot(os) &&
+	    dsl_change_log_object(dmu_objset_ds(os)) != 0)
+		global_feature_count[SPA_FEATURE_CHANGE_LOG]++;
+
 	dump_objset(os);
 	close_objset(os, FTAG);
 	fuid_table_destroy();
@@ -8285,6 +8294,7 @@ dump_mos_leaks(spa_t *spa)
 	mos_obj_refd(spa->spa_dsl_pool->dp_bptree_obj);
 	mos_obj_refd(spa->spa_dsl_pool->dp_tmp_userrefs_obj);
 	mos_obj_refd(spa->spa_dsl_pool->dp_scan->scn_phys.scn_queue_obj);
+	mos_obj_refd(spa->spa_dsl_pool->dp_scan->scn_spill_obj);
 	bpobj_count_refd(&spa->spa_deferred_bpobj);
 	mos_obj_refd(dp->dp_empty_bpobj);
 	bpobj_count_refd(&dp->dp_obsolete_bpobj);
@@ -8549,6 +8559,9 @@ dump_zpool(spa_t *spa)
 		global_feature_count[SPA_FEATURE_REDACTION_LIST_SPILL] = 0;
 		global_feature_count[SPA_FEATURE_BOOKMARK_WRITTEN] = 0;
 		global_feature_count[SPA_FEATURE_LIVELIST] = 0;
+		global_feature_count[SPA_FEATURE_CHANGE_LOG] = 0;
+		global_feature_count[SPA_FEATURE_SCAN_SPILL] =
+		    (dp->dp_scan->scn_spill_obj != 0);
 
 		(void) dmu_objset_find(spa_name(spa), dump_one_objset,
 		    NULL, DS_FIND_SNAPSHOTS | DS_FIND_CHILDREN);
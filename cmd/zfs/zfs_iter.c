@@ -97,6 +97,15 @@ zfs_callback(zfs_handle_t *zhp, void *data)
 	boolean_t include_snaps = zfs_include_snapshots(zhp, cb);
 	boolean_t include_bmarks = (cb->cb_types & ZFS_TYPE_BOOKMARK);
 
+	/*
+	 * Prune even datasets that will not be listed themselves, since the
+	 * handles libzfs makes for their children take the props table from
+	 * them and only fetch those properties.
+	 */
+	if (cb->cb_proplist && (*cb->cb_proplist) &&
+	    !(*cb->cb_proplist)->pl_all)
+		zfs_prune_proplist(zhp, cb->cb_props_table);
+
 	if ((zfs_get_type(zhp) & cb->cb_types) ||
 	    ((zfs_get_type(zhp) == ZFS_TYPE_SNAPSHOT) && include_snaps)) {
 		uu_avl_index_t idx;
@@ -107,11 +116,6 @@ zfs_callback(zfs_handle_t *zhp, void *data)
 		if (uu_avl_find(cb->cb_avl, node, cb->cb_sortcol,
 		    &idx) == NULL) {
 			if (cb->cb_proplist) {
-				if ((*cb->cb_proplist) &&
-				    !(*cb->cb_proplist)->pl_all)
-					zfs_prune_proplist(zhp,
-					    cb->cb_props_table);
-
 				if (zfs_expand_proplist(zhp, cb->cb_proplist,
 				    (cb->cb_flags & ZFS_ITER_RECVD_PROPS),
 				    (cb->cb_flags & ZFS_ITER_LITERAL_PROPS))
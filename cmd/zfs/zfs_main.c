@@ -123,6 +123,7 @@ static int zfs_do_project(int argc, char **argv);
 static int zfs_do_version(int argc, char **argv);
 static int zfs_do_redact(int argc, char **argv);
 static int zfs_do_rewrite(int argc, char **argv);
+static int zfs_do_dedup(int argc, char **argv);
 static int zfs_do_wait(int argc, char **argv);
 
 #ifdef __FreeBSD__
@@ -138,7 +139,8 @@ static int zfs_do_unzone(int argc, char **argv);
 static int zfs_do_help(int argc, char **argv);
 
 enum zfs_options {
-	ZFS_OPTION_JSON_NUMS_AS_INT = 1024
+	ZFS_OPTION_JSON_NUMS_AS_INT = 1024,
+	ZFS_OPTION_STREAM_COMPRESS
 };
 
 /*
@@ -196,6 +198,7 @@ typedef enum {
 	HELP_VERSION,
 	HELP_REDACT,
 	HELP_REWRITE,
+	HELP_DEDUP,
 	HELP_JAIL,
 	HELP_UNJAIL,
 	HELP_WAIT,
@@ -267,6 +270,7 @@ static zfs_command_t command_table[] = {
 	{ NULL },
 	{ "program",	zfs_do_channel_program,	HELP_CHANNEL_PROGRAM	},
 	{ "rewrite",	zfs_do_rewrite,		HELP_REWRITE		},
+	{ "dedup",	zfs_do_dedup,		HELP_DEDUP		},
 	{ "wait",	zfs_do_wait,		HELP_WAIT		},
 
 #ifdef __FreeBSD__
@@ -302,7 +306,7 @@ get_usage(zfs_help_t idx)
 		    "-V <size> <volume>\n"));
 	case HELP_DESTROY:
 		return (gettext("\tdestroy [-fnpRrv] <filesystem|volume>\n"
-		    "\tdestroy [-dnpRrv] "
+		    "\tdestroy [-dnpRrv] [-b count] "
 		    "<filesystem|volume>@<snap>[%<snap>][,...]\n"
 		    "\tdestroy <filesystem|volume>#<bookmark>\n"));
 	case HELP_GET:
@@ -346,9 +350,10 @@ get_usage(zfs_help_t idx)
 		return (gettext("\trollback [-rRf] <snapshot>\n"));
 	case HELP_SEND:
 		return (gettext("\tsend [-DLPbcehnpsVvw] "
-		    "[-i|-I snapshot]\n"
+		    "[--stream-compress lz4|zstd] [-i|-I snapshot]\n"
 		    "\t     [-R [-X dataset[,dataset]...]]     <snapshot>\n"
-		    "\tsend [-DnVvPLecw] [-i snapshot|bookmark] "
+		    "\tsend [-DnVvPLecw] [--stream-compress lz4|zstd]\n"
+		    "\t     [-i snapshot|bookmark] "
 		    "<filesystem|volume|snapshot>\n"
 		    "\tsend [-DnPpVvLec] [-i bookmark|snapshot] "
 		    "--redact <bookmark> <snapshot>\n"
@@ -442,6 +447,8 @@ get_usage(zfs_help_t idx)
 	case HELP_REWRITE:
 		return (gettext("\trewrite [-Prvx] [-o <offset>] [-l <length>] "
 		    "<directory|file ...>\n"));
+	case HELP_DEDUP:
+		return (gettext("\tdedup [-s] <filesystem|directory>\n"));
 	case HELP_JAIL:
 		return (gettext("\tjail <jailid|jailname> <filesystem>\n"));
 	case HELP_UNJAIL:
@@ -1364,6 +1371,7 @@ typedef struct destroy_cbdata {
 	char		*cb_snapspec;
 	char		*cb_bookmark;
 	uint64_t	cb_snap_count;
+	uint64_t	cb_snaps_per_txg;
 } destroy_cbdata_t;
 
 /*
@@ -1436,6 +1444,39 @@ destroy_batched(destroy_cbdata_t *cb)
 	return (error);
 }
 
+/*
+ * Destroy the snapshots in nvl, cb_snaps_per_txg at a time if it is set.
+ * Each batch is destroyed atomically, but a failure leaves the batches
+ * before it destroyed.
+ */
+static int
+destroy_snaps_batched(destroy_cbdata_t *cb, nvlist_t *nvl, boolean_t defer)
+{
+	if (cb->cb_snaps_per_txg == 0)
+		return (zfs_destroy_snaps_nvl(g_zfs, nvl, defer));
+
+	nvlist_t *batch = fnvlist_alloc();
+	uint64_t count = 0;
+	int error = 0;
+
+	for (nvpair_t *pair = nvlist_next_nvpair(nvl, NULL);
+	    pair != NULL; pair = nvlist_next_nvpair(nvl, pair)) {
+		fnvlist_add_boolean(batch, nvpair_name(pair));
+		if (++count < cb->cb_snaps_per_txg)
+			continue;
+		error = zfs_destroy_snaps_nvl(g_zfs, batch, defer);
+		fnvlist_free(batch);
+		batch = fnvlist_alloc();
+		count = 0;
+		if (error != 0)
+			break;
+	}
+	if (error == 0 && count != 0)
+		error = zfs_destroy_snaps_nvl(g_zfs, batch, defer);
+	fnvlist_free(batch);
+	return (error);
+}
+
 static int
 destroy_callback(zfs_handle_t *zhp, void *data)
 {
@@ -1663,8 +1704,23 @@ zfs_do_destroy(int argc, char **argv)
 	zfs_type_t type = ZFS_TYPE_DATASET;
 
 	/* check options */
-	while ((c = getopt(argc, argv, "vpndfrR")) != -1) {
+	while ((c = getopt(argc, argv, "b:vpndfrR")) != -1) {
 		switch (c) {
+		case 'b': {
+			char *endp;
+
+			errno = 0;
+			cb.cb_snaps_per_txg = strtoull(optarg, &endp, 0);
+			if (errno != 0 || *endp != '\0' ||
+			    cb.cb_snaps_per_txg == 0) {
+				(void) fprintf(stderr, gettext("invalid batch "
+				    "size '%s': expected positive integer\n"),
+				    optarg);
+				usage(B_FALSE);
+			}
+			type = ZFS_TYPE_SNAPSHOT;
+			break;
+		}
 		case 'v':
 			cb.cb_verbose = B_TRUE;
 			break;
@@ -1768,7 +1824,7 @@ zfs_do_destroy(int argc, char **argv)
 				}
 			}
 			if (err == 0) {
-				err = zfs_destroy_snaps_nvl(g_zfs, cb.cb_nvl,
+				err = destroy_snaps_batched(&cb, cb.cb_nvl,
 				    cb.cb_defer_destroy);
 			}
 		}
@@ -2152,7 +2208,7 @@ static int
 zfs_do_get(int argc, char **argv)
 {
 	zprop_get_cbdata_t cb = { 0 };
-	int i, c, flags = ZFS_ITER_ARGS_CAN_BE_PATHS;
+	int i, c, flags = ZFS_ITER_ARGS_CAN_BE_PATHS | ZFS_ITER_BATCH;
 	int types = ZFS_TYPE_DATASET | ZFS_TYPE_BOOKMARK;
 	char *fields;
 	int ret = 0;
@@ -3866,7 +3922,8 @@ zfs_do_list(int argc, char **argv)
 	int limit = 0;
 	int ret = 0;
 	zfs_sort_column_t *sortcol = NULL;
-	int flags = ZFS_ITER_PROP_LISTSNAPS | ZFS_ITER_ARGS_CAN_BE_PATHS;
+	int flags = ZFS_ITER_PROP_LISTSNAPS | ZFS_ITER_ARGS_CAN_BE_PATHS |
+	    ZFS_ITER_BATCH;
 	nvlist_t *data = NULL;
 
 	struct option long_options[] = {
@@ -4756,6 +4813,8 @@ zfs_do_send(int argc, char **argv)
 		{"holds",	no_argument,		NULL, 'h'},
 		{"saved",	no_argument,		NULL, 'S'},
 		{"exclude",	required_argument,	NULL, 'X'},
+		{"stream-compress", required_argument, NULL,
+		    ZFS_OPTION_STREAM_COMPRESS},
 		{0, 0, 0, 0}
 	};
 
@@ -4846,6 +4905,16 @@ zfs_do_send(int argc, char **argv)
 		case 'S':
 			flags.saved = B_TRUE;
 			break;
+		case ZFS_OPTION_STREAM_COMPRESS:
+			if (strcmp(optarg, "lz4") != 0 &&
+			    strcmp(optarg, "zstd") != 0) {
+				(void) fprintf(stderr, gettext("invalid stream "
+				    "compression algorithm '%s'\n"), optarg);
+				free(excludes.list);
+				usage(B_FALSE);
+			}
+			flags.stream_compress = optarg;
+			break;
 		case ':':
 			/*
 			 * If a parameter was not passed, optopt contains the
@@ -9232,6 +9301,98 @@ zfs_do_rewrite(int argc, char **argv)
 	return (ret);
 }
 
+/*
+ * zfs dedup [-s] <filesystem|directory>
+ *
+ * Start (or with -s, stop) a background scan that merges duplicate blocks
+ * of a mounted filesystem.  Progress is reported by 'zpool status'.
+ */
+static int
+zfs_do_dedup(int argc, char **argv)
+{
+	zfs_dedup_scan_args_t args;
+	zfs_handle_t *zhp = NULL;
+	char *mountpoint = NULL;
+	const char *path;
+	int c, fd, ret = 0;
+
+	memset(&args, 0, sizeof (args));
+
+	while ((c = getopt(argc, argv, "s")) != -1) {
+		switch (c) {
+		case 's':
+			args.flags |= ZFS_DEDUP_SCAN_STOP;
+			break;
+		default:
+			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
+			    optopt);
+			usage(B_FALSE);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1) {
+		(void) fprintf(stderr,
+		    gettext("missing filesystem or directory argument\n"));
+		usage(B_FALSE);
+	}
+	if (argc > 1) {
+		(void) fprintf(stderr, gettext("too many arguments\n"));
+		usage(B_FALSE);
+	}
+
+	/*
+	 * The scan is started through an ioctl on any file of the mounted
+	 * filesystem, so translate a dataset name to its mountpoint.
+	 */
+	path = argv[0];
+	if (path[0] != '/') {
+		zhp = zfs_open(g_zfs, path, ZFS_TYPE_FILESYSTEM);
+		if (zhp == NULL)
+			return (1);
+		if (!zfs_is_mounted(zhp, &mountpoint)) {
+			(void) fprintf(stderr, gettext("'%s' is not mounted\n"),
+			    zfs_get_name(zhp));
+			zfs_close(zhp);
+			return (1);
+		}
+		path = mountpoint;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		ret = errno;
+		(void) fprintf(stderr, gettext("failed to open %s: %s\n"),
+		    path, strerror(errno));
+	} else {
+		if (ioctl(fd, ZFS_IOC_DEDUP_SCAN, &args) < 0) {
+			ret = errno;
+			if (errno == ENOENT && (args.flags &
+			    ZFS_DEDUP_SCAN_STOP)) {
+				(void) fprintf(stderr, gettext("no dedup scan "
+				    "is running on %s\n"), path);
+			} else if (errno == EBUSY) {
+				(void) fprintf(stderr, gettext("a dedup scan "
+				    "is already running in this pool\n"));
+			} else {
+				(void) fprintf(stderr, gettext("failed to "
+				    "%s dedup scan on %s: %s\n"),
+				    (args.flags & ZFS_DEDUP_SCAN_STOP) ?
+				    "stop" : "start", path, strerror(errno));
+			}
+		}
+		close(fd);
+	}
+
+	free(mountpoint);
+	if (zhp != NULL)
+		zfs_close(zhp);
+
+	return (ret != 0);
+}
+
 static int
 zfs_do_wait(int argc, char **argv)
 {
@@ -9790,6 +9790,40 @@ raidz_expand_status_nvlist(zpool_handle_t *zhp, status_cbdata_t *cb,
 	}
 }
 
+static void
+dedup_scan_status_nvlist(status_cbdata_t *cb, nvlist_t *nvroot,
+    nvlist_t *item)
+{
+	uint_t c;
+	pool_dedup_scan_stat_t *pdss = NULL;
+	if (nvlist_lookup_uint64_array(nvroot,
+	    ZPOOL_CONFIG_DEDUP_SCAN_STATS, (uint64_t **)&pdss, &c) == 0) {
+		nvlist_t *nv = fnvlist_alloc();
+		const char *dsname = NULL;
+		(void) nvlist_lookup_string(nvroot,
+		    ZPOOL_CONFIG_DEDUP_SCAN_DATASET, &dsname);
+		if (dsname != NULL)
+			fnvlist_add_string(nv, "dataset", dsname);
+		fnvlist_add_string(nv, "state",
+		    pool_scan_state_str[pdss->pdss_state]);
+		nice_num_str_nvlist(nv, "start_time", pdss->pdss_start_time,
+		    cb->cb_literal, cb->cb_json_as_int, ZFS_NICE_TIMESTAMP);
+		nice_num_str_nvlist(nv, "end_time", pdss->pdss_end_time,
+		    cb->cb_literal, cb->cb_json_as_int, ZFS_NICE_TIMESTAMP);
+		nice_num_str_nvlist(nv, "to_examine", pdss->pdss_to_examine,
+		    cb->cb_literal, cb->cb_json_as_int, ZFS_NICENUM_BYTES);
+		nice_num_str_nvlist(nv, "examined", pdss->pdss_examined,
+		    cb->cb_literal, cb->cb_json_as_int, ZFS_NICENUM_BYTES);
+		nice_num_str_nvlist(nv, "deduped", pdss->pdss_deduped,
+		    cb->cb_literal, cb->cb_json_as_int, ZFS_NICENUM_BYTES);
+		nice_num_str_nvlist(nv, "deduped_blocks",
+		    pdss->pdss_deduped_blocks, B_TRUE, cb->cb_json_as_int,
+		    ZFS_NICENUM_1024);
+		fnvlist_add_nvlist(item, ZPOOL_CONFIG_DEDUP_SCAN_STATS, nv);
+		fnvlist_free(nv);
+	}
+}
+
 static void
 checkpoint_status_nvlist(nvlist_t *nvroot, status_cbdata_t *cb,
     nvlist_t *item)
@@ -10270,6 +10304,54 @@ print_raidz_expand_status(zpool_handle_t *zhp, pool_raidz_expand_stat_t *pres)
 	}
 	free(vname);
 }
+
+/*
+ * Print out offline dedup scan status.
+ */
+static void
+print_dedup_scan_status(pool_dedup_scan_stat_t *pdss, const char *dsname)
+{
+	char examined_buf[7], total_buf[7], deduped_buf[7];
+
+	if (pdss == NULL || pdss->pdss_state == DSS_NONE)
+		return;
+
+	printf_color(ANSI_BOLD, gettext("dedup: "));
+
+	time_t start = pdss->pdss_start_time;
+	time_t end = pdss->pdss_end_time;
+	zfs_nicenum(pdss->pdss_examined, examined_buf, sizeof (examined_buf));
+	zfs_nicenum(pdss->pdss_to_examine, total_buf, sizeof (total_buf));
+	zfs_nicebytes(pdss->pdss_deduped, deduped_buf, sizeof (deduped_buf));
+
+	if (pdss->pdss_state == DSS_FINISHED ||
+	    pdss->pdss_state == DSS_CANCELED) {
+		char time_buf[32];
+		secs_to_dhms(end - start, time_buf);
+
+		(void) printf(gettext("scan of %s %s, merged %s in %llu "
+		    "blocks in %s, on %s"), dsname,
+		    pdss->pdss_state == DSS_FINISHED ? "finished" : "canceled",
+		    deduped_buf, (u_longlong_t)pdss->pdss_deduped_blocks,
+		    time_buf, ctime(&end));
+		return;
+	}
+
+	assert(pdss->pdss_state == DSS_SCANNING);
+
+	(void) printf(gettext("scan of %s in progress since %s"), dsname,
+	    ctime(&start));
+
+	uint64_t total = MAX(pdss->pdss_to_examine, 1);
+	double fraction_done =
+	    MIN((double)pdss->pdss_examined / total, 1.0);
+
+	(void) printf(gettext("\t%s / %s examined, %.2f%% done, "
+	    "%s merged in %llu blocks\n"), examined_buf, total_buf,
+	    100 * fraction_done, deduped_buf,
+	    (u_longlong_t)pdss->pdss_deduped_blocks);
+}
+
 static void
 print_checkpoint_status(pool_checkpoint_stat_t *pcs)
 {
@@ -10831,6 +10913,7 @@ status_callback_json(zpool_handle_t *zhp, void *data)
 		removal_status_nvlist(zhp, cbp, nvroot, item);
 		checkpoint_status_nvlist(nvroot, cbp, item);
 		raidz_expand_status_nvlist(zhp, cbp, nvroot, item);
+		dedup_scan_status_nvlist(cbp, nvroot, item);
 		vdev_stats_nvlist(zhp, cbp, nvroot, 0, B_FALSE, NULL, vds);
 		if (cbp->cb_flat_vdevs) {
 			class_vdevs_nvlist(zhp, cbp, nvroot,
@@ -10977,6 +11060,14 @@ status_callback(zpool_handle_t *zhp, void *data)
 		    ZPOOL_CONFIG_RAIDZ_EXPAND_STATS, (uint64_t **)&pres, &c);
 		print_raidz_expand_status(zhp, pres);
 
+		pool_dedup_scan_stat_t *pdss = NULL;
+		const char *dsname = "";
+		(void) nvlist_lookup_uint64_array(nvroot,
+		    ZPOOL_CONFIG_DEDUP_SCAN_STATS, (uint64_t **)&pdss, &c);
+		(void) nvlist_lookup_string(nvroot,
+		    ZPOOL_CONFIG_DEDUP_SCAN_DATASET, &dsname);
+		print_dedup_scan_status(pdss, dsname);
+
 		cbp->cb_namewidth = max_width(zhp, nvroot, 0, 0,
 		    cbp->cb_name_flags | VDEV_NAME_TYPE_ID);
 		if (cbp->cb_namewidth < 10)
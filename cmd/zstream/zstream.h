@@ -21,10 +21,37 @@
 #ifndef	_ZSTREAM_H
 #define	_ZSTREAM_H
 
+#include <sys/zfs_ioctl.h>
+
 #ifdef	__cplusplus
 extern "C" {
 #endif
 
+/*
+ * One record travelling through a zstream_pipeline_t, see
+ * zstream_pipeline.c.
+ */
+typedef struct zstream_job {
+	dmu_replay_record_t	zj_drr;
+	char			*zj_buf;	/* payload */
+	size_t			zj_bufsz;
+	uint64_t		zj_payload_size;
+} zstream_job_t;
+
+typedef struct zstream_pipeline zstream_pipeline_t;
+typedef void (*zstream_job_func_t)(zstream_job_t *, void *);
+
+extern zstream_pipeline_t *zstream_pipeline_create(int, zstream_job_func_t,
+    void *, int);
+extern zstream_job_t *zstream_pipeline_next(zstream_pipeline_t *);
+extern void zstream_pipeline_submit(zstream_pipeline_t *, zstream_job_t *,
+    boolean_t);
+extern int zstream_pipeline_destroy(zstream_pipeline_t *);
+extern void zstream_job_reserve(zstream_job_t *, size_t);
+extern int zstream_dump_record(dmu_replay_record_t *, void *, int,
+    zio_cksum_t *, int);
+extern int zstream_default_threads(void);
+
 extern void *safe_calloc(size_t n);
 extern int sfread(void *buf, size_t size, FILE *fp);
 extern void *safe_malloc(size_t size);
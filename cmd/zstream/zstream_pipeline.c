@@ -0,0 +1,305 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * An ordered record pipeline shared by the zstream subcommands that rewrite
+ * a stream.  The reading thread fills jobs in stream order and submits them;
+ * jobs that need work are picked up by a pool of worker threads, and a
+ * single writer thread emits the jobs in their original order, regenerating
+ * the stream checksum as it goes.  At most zp_nslots jobs are in flight,
+ * and each job's buffer only grows to the largest payload it has carried
+ * (see zstream_job_reserve()), so memory use is bounded by the number of
+ * slots times the largest record in the stream.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/zfs_ioctl.h>
+#include <sys/zio_checksum.h>
+#include "zfs_fletcher.h"
+#include "zstream.h"
+
+typedef enum zstream_job_state {
+	ZJ_FREE,	/* unused, owned by the reader */
+	ZJ_QUEUED,	/* submitted, waiting for a worker */
+	ZJ_RUNNING,	/* being processed by a worker */
+	ZJ_DONE		/* ready to be written */
+} zstream_job_state_t;
+
+struct zstream_pipeline {
+	pthread_mutex_t		zp_lock;
+	pthread_cond_t		zp_cv;
+	zstream_job_t		*zp_jobs;
+	zstream_job_state_t	*zp_state;
+	uint64_t		zp_nslots;
+	uint64_t		zp_head;	/* next job to write */
+	uint64_t		zp_tail;	/* next job to fill */
+	uint64_t		zp_work;	/* next job for a worker */
+	boolean_t		zp_exiting;
+	int			zp_err;
+	int			zp_outfd;
+	zio_cksum_t		zp_cksum;
+	zstream_job_func_t	zp_func;
+	void			*zp_arg;
+	int			zp_nthreads;
+	pthread_t		*zp_workers;
+	pthread_t		zp_writer;
+};
+
+int
+zstream_dump_record(dmu_replay_record_t *drr, void *payload, int payload_len,
+    zio_cksum_t *zc, int outfd)
+{
+	assert(offsetof(dmu_replay_record_t, drr_u.drr_checksum.drr_checksum)
+	    == sizeof (dmu_replay_record_t) - sizeof (zio_cksum_t));
+	fletcher_4_incremental_native(drr,
+	    offsetof(dmu_replay_record_t, drr_u.drr_checksum.drr_checksum), zc);
+	if (drr->drr_type != DRR_BEGIN) {
+		assert(ZIO_CHECKSUM_IS_ZERO(&drr->drr_u.
+		    drr_checksum.drr_checksum));
+		drr->drr_u.drr_checksum.drr_checksum = *zc;
+	}
+	fletcher_4_incremental_native(&drr->drr_u.drr_checksum.drr_checksum,
+	    sizeof (zio_cksum_t), zc);
+	if (write(outfd, drr, sizeof (*drr)) == -1)
+		return (errno);
+	if (payload_len != 0) {
+		fletcher_4_incremental_native(payload, payload_len, zc);
+		if (write(outfd, payload, payload_len) == -1)
+			return (errno);
+	}
+	return (0);
+}
+
+/*
+ * Make sure the job's buffer can hold size bytes of payload.  Callers
+ * reserve what each record needs before reading its payload, rather than
+ * the largest possible block, so buffers are sized by the stream.
+ */
+void
+zstream_job_reserve(zstream_job_t *job, size_t size)
+{
+	if (size <= job->zj_bufsz)
+		return;
+	free(job->zj_buf);
+	job->zj_buf = safe_malloc(size);
+	job->zj_bufsz = size;
+}
+
+static void *
+zstream_worker(void *arg)
+{
+	zstream_pipeline_t *zp = arg;
+
+	pthread_mutex_lock(&zp->zp_lock);
+	for (;;) {
+		while (zp->zp_work < zp->zp_tail &&
+		    zp->zp_state[zp->zp_work % zp->zp_nslots] != ZJ_QUEUED)
+			zp->zp_work++;
+		if (zp->zp_work == zp->zp_tail) {
+			if (zp->zp_exiting)
+				break;
+			pthread_cond_wait(&zp->zp_cv, &zp->zp_lock);
+			continue;
+		}
+
+		uint64_t slot = zp->zp_work++ % zp->zp_nslots;
+		zp->zp_state[slot] = ZJ_RUNNING;
+		pthread_mutex_unlock(&zp->zp_lock);
+
+		zp->zp_func(&zp->zp_jobs[slot], zp->zp_arg);
+
+		pthread_mutex_lock(&zp->zp_lock);
+		zp->zp_state[slot] = ZJ_DONE;
+		pthread_cond_broadcast(&zp->zp_cv);
+	}
+	pthread_mutex_unlock(&zp->zp_lock);
+	return (NULL);
+}
+
+static void *
+zstream_writer(void *arg)
+{
+	zstream_pipeline_t *zp = arg;
+
+	pthread_mutex_lock(&zp->zp_lock);
+	for (;;) {
+		if (zp->zp_head == zp->zp_tail) {
+			if (zp->zp_exiting)
+				break;
+			pthread_cond_wait(&zp->zp_cv, &zp->zp_lock);
+			continue;
+		}
+		uint64_t slot = zp->zp_head % zp->zp_nslots;
+		if (zp->zp_state[slot] != ZJ_DONE) {
+			pthread_cond_wait(&zp->zp_cv, &zp->zp_lock);
+			continue;
+		}
+		pthread_mutex_unlock(&zp->zp_lock);
+
+		zstream_job_t *job = &zp->zp_jobs[slot];
+		dmu_replay_record_t *drr = &job->zj_drr;
+		if (zp->zp_err == 0) {
+			/*
+			 * BEGIN records start a new checksum, and END
+			 * records carry the checksum of what we actually
+			 * wrote, unless this is the END record of a stream
+			 * package, which has no checksum.
+			 */
+			if (drr->drr_type == DRR_BEGIN) {
+				ZIO_SET_CHECKSUM(&zp->zp_cksum, 0, 0, 0, 0);
+			} else {
+				memset(&drr->drr_u.drr_checksum.drr_checksum,
+				    0, sizeof (zio_cksum_t));
+			}
+			if (drr->drr_type == DRR_END &&
+			    !ZIO_CHECKSUM_IS_ZERO(
+			    &drr->drr_u.drr_end.drr_checksum))
+				drr->drr_u.drr_end.drr_checksum = zp->zp_cksum;
+			int err = zstream_dump_record(drr, job->zj_buf,
+			    job->zj_payload_size, &zp->zp_cksum, zp->zp_outfd);
+			/*
+			 * A stream package ends with two END records, and
+			 * the checksum of the last one starts from zero.
+			 */
+			if (drr->drr_type == DRR_END)
+				ZIO_SET_CHECKSUM(&zp->zp_cksum, 0, 0, 0, 0);
+
+			pthread_mutex_lock(&zp->zp_lock);
+			if (err != 0)
+				zp->zp_err = err;
+		} else {
+			pthread_mutex_lock(&zp->zp_lock);
+		}
+		zp->zp_state[slot] = ZJ_FREE;
+		zp->zp_head++;
+		pthread_cond_broadcast(&zp->zp_cv);
+	}
+	pthread_mutex_unlock(&zp->zp_lock);
+	return (NULL);
+}
+
+/*
+ * Create a pipeline writing to outfd, with nthreads workers calling func on
+ * each job submitted with work to do.
+ */
+zstream_pipeline_t *
+zstream_pipeline_create(int nthreads, zstream_job_func_t func, void *arg,
+    int outfd)
+{
+	zstream_pipeline_t *zp = safe_calloc(sizeof (*zp));
+
+	if (nthreads < 1)
+		nthreads = 1;
+	pthread_mutex_init(&zp->zp_lock, NULL);
+	pthread_cond_init(&zp->zp_cv, NULL);
+	zp->zp_nslots = 4 * nthreads;
+	zp->zp_jobs = safe_calloc(zp->zp_nslots * sizeof (zstream_job_t));
+	zp->zp_state = safe_calloc(zp->zp_nslots *
+	    sizeof (zstream_job_state_t));
+	zp->zp_outfd = outfd;
+	zp->zp_func = func;
+	zp->zp_arg = arg;
+	zp->zp_nthreads = nthreads;
+	zp->zp_workers = safe_calloc(nthreads * sizeof (pthread_t));
+
+	for (int i = 0; i < nthreads; i++) {
+		VERIFY0(pthread_create(&zp->zp_workers[i], NULL,
+		    zstream_worker, zp));
+	}
+	VERIFY0(pthread_create(&zp->zp_writer, NULL, zstream_writer, zp));
+	return (zp);
+}
+
+/*
+ * Return the next free job, waiting for the writer if every slot is in
+ * flight.  Returns NULL once writing the output has failed.
+ */
+zstream_job_t *
+zstream_pipeline_next(zstream_pipeline_t *zp)
+{
+	pthread_mutex_lock(&zp->zp_lock);
+	while (zp->zp_err == 0 && zp->zp_tail - zp->zp_head == zp->zp_nslots)
+		pthread_cond_wait(&zp->zp_cv, &zp->zp_lock);
+	int err = zp->zp_err;
+	pthread_mutex_unlock(&zp->zp_lock);
+
+	if (err != 0)
+		return (NULL);
+
+	zstream_job_t *job = &zp->zp_jobs[zp->zp_tail % zp->zp_nslots];
+	job->zj_payload_size = 0;
+	return (job);
+}
+
+/*
+ * Hand the job returned by zstream_pipeline_next() back to the pipeline.  If
+ * work is set, a worker runs the pipeline's function on it before it is
+ * written.
+ */
+void
+zstream_pipeline_submit(zstream_pipeline_t *zp, zstream_job_t *job,
+    boolean_t work)
+{
+	pthread_mutex_lock(&zp->zp_lock);
+	ASSERT3P(job, ==, &zp->zp_jobs[zp->zp_tail % zp->zp_nslots]);
+	zp->zp_state[zp->zp_tail % zp->zp_nslots] = work ? ZJ_QUEUED : ZJ_DONE;
+	zp->zp_tail++;
+	pthread_cond_broadcast(&zp->zp_cv);
+	pthread_mutex_unlock(&zp->zp_lock);
+}
+
+/*
+ * Wait for every submitted job to be written, then tear the pipeline down.
+ * Returns the first error hit while writing the output.
+ */
+int
+zstream_pipeline_destroy(zstream_pipeline_t *zp)
+{
+	pthread_mutex_lock(&zp->zp_lock);
+	zp->zp_exiting = B_TRUE;
+	pthread_cond_broadcast(&zp->zp_cv);
+	pthread_mutex_unlock(&zp->zp_lock);
+
+	for (int i = 0; i < zp->zp_nthreads; i++)
+		VERIFY0(pthread_join(zp->zp_workers[i], NULL));
+	VERIFY0(pthread_join(zp->zp_writer, NULL));
+
+	int err = zp->zp_err;
+	for (uint64_t i = 0; i < zp->zp_nslots; i++)
+		free(zp->zp_jobs[i].zj_buf);
+	free(zp->zp_jobs);
+	free(zp->zp_state);
+	free(zp->zp_workers);
+	pthread_cond_destroy(&zp->zp_cv);
+	pthread_mutex_destroy(&zp->zp_lock);
+	free(zp);
+	return (err);
+}
+
+/*
+ * Default number of worker threads: one per online CPU.
+ */
+int
+zstream_default_threads(void)
+{
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return (ncpus > 0 ? (int)ncpus : 1);
+}
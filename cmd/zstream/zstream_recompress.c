@@ -29,6 +29,7 @@
  */
 
 #include <err.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -38,46 +39,123 @@
 #include "zfs_fletcher.h"
 #include "zstream.h"
 
-static int
-dump_record(dmu_replay_record_t *drr, void *payload, int payload_len,
-    zio_cksum_t *zc, int outfd)
+typedef struct recompress_arg {
+	enum zio_compress	ra_ctype;
+	int			ra_level;
+} recompress_arg_t;
+
+/*
+ * Decompress and recompress the payload of one WRITE record.  This runs on
+ * the pipeline's worker threads, so it must only touch the job.
+ */
+static void
+recompress_write(zstream_job_t *job, void *arg)
 {
-	assert(offsetof(dmu_replay_record_t, drr_u.drr_checksum.drr_checksum)
-	    == sizeof (dmu_replay_record_t) - sizeof (zio_cksum_t));
-	fletcher_4_incremental_native(drr,
-	    offsetof(dmu_replay_record_t, drr_u.drr_checksum.drr_checksum), zc);
-	if (drr->drr_type != DRR_BEGIN) {
-		assert(ZIO_CHECKSUM_IS_ZERO(&drr->drr_u.
-		    drr_checksum.drr_checksum));
-		drr->drr_u.drr_checksum.drr_checksum = *zc;
+	recompress_arg_t *ra = arg;
+	enum zio_compress ctype = ra->ra_ctype;
+	struct drr_write *drrw = &job->zj_drr.drr_u.drr_write;
+	size_t bufsz = drrw->drr_logical_size;
+	uint64_t payload_size = job->zj_payload_size;
+
+	/*
+	 * In order to recompress an encrypted block, you have
+	 * to decrypt, decompress, recompress, and
+	 * re-encrypt. That can be a future enhancement (along
+	 * with decryption or re-encryption), but for now we
+	 * skip encrypted blocks.
+	 */
+	for (int i = 0; i < ZIO_DATA_SALT_LEN; i++) {
+		if (drrw->drr_salt[i] != 0)
+			return;
 	}
-	fletcher_4_incremental_native(&drr->drr_u.drr_checksum.drr_checksum,
-	    sizeof (zio_cksum_t), zc);
-	if (write(outfd, drr, sizeof (*drr)) == -1)
-		return (errno);
-	if (payload_len != 0) {
-		fletcher_4_incremental_native(payload, payload_len, zc);
-		if (write(outfd, payload, payload_len) == -1)
-			return (errno);
+	enum zio_compress dtype = drrw->drr_compressiontype;
+	if (dtype >= ZIO_COMPRESS_FUNCTIONS) {
+		fprintf(stderr, "Invalid compression type in "
+		    "stream: %d\n", dtype);
+		exit(3);
 	}
-	return (0);
+	if (zio_compress_table[dtype].ci_decompress == NULL)
+		dtype = ZIO_COMPRESS_OFF;
+
+	/* Decompress the payload, unless it is stored uncompressed */
+	char *dbuf = job->zj_buf;
+	if (dtype != ZIO_COMPRESS_OFF) {
+		abd_t cabd, dabd;
+		dbuf = safe_calloc(bufsz);
+		abd_get_from_buf_struct(&cabd, job->zj_buf, payload_size);
+		abd_get_from_buf_struct(&dabd, dbuf, bufsz);
+		if (zio_decompress_data(dtype, &cabd, &dabd,
+		    payload_size, abd_get_size(&dabd), NULL) != 0) {
+			warnx("decompression type %d failed "
+			    "for ino %llu offset %llu",
+			    dtype,
+			    (u_longlong_t)drrw->drr_object,
+			    (u_longlong_t)drrw->drr_offset);
+			exit(4);
+		}
+		payload_size = drrw->drr_logical_size;
+		abd_free(&dabd);
+		abd_free(&cabd);
+	}
+
+	/* Recompress the payload */
+	char *obuf = dbuf;
+	drrw->drr_compressiontype = 0;
+	drrw->drr_compressed_size = 0;
+	if (ctype != ZIO_COMPRESS_OFF) {
+		abd_t dabd, abd;
+		char *cbuf = safe_malloc(bufsz);
+		abd_get_from_buf_struct(&dabd, dbuf, drrw->drr_logical_size);
+		abd_t *pabd = abd_get_from_buf_struct(&abd, cbuf, bufsz);
+		size_t csize = zio_compress_data(ctype, &dabd, &pabd,
+		    drrw->drr_logical_size, drrw->drr_logical_size,
+		    ra->ra_level);
+		size_t rounded = P2ROUNDUP(csize, SPA_MINBLOCKSIZE);
+		if (rounded >= drrw->drr_logical_size) {
+			free(cbuf);
+		} else {
+			abd_zero_off(pabd, csize, rounded - csize);
+			drrw->drr_compressiontype = ctype;
+			drrw->drr_compressed_size = payload_size = rounded;
+			obuf = cbuf;
+		}
+		abd_free(&abd);
+		abd_free(&dabd);
+	}
+
+	/* Swap the result in as the job's payload */
+	if (dbuf != job->zj_buf && dbuf != obuf)
+		free(dbuf);
+	if (obuf != job->zj_buf) {
+		free(job->zj_buf);
+		job->zj_buf = obuf;
+		job->zj_bufsz = bufsz;
+	}
+	job->zj_payload_size = payload_size;
 }
 
 int
 zstream_do_recompress(int argc, char *argv[])
 {
-	int bufsz = SPA_MAXBLOCKSIZE;
-	char *buf = safe_malloc(bufsz);
 	dmu_replay_record_t thedrr;
 	dmu_replay_record_t *drr = &thedrr;
-	zio_cksum_t stream_cksum;
+	recompress_arg_t ra = { 0 };
+	int nthreads = zstream_default_threads();
 	int c;
-	int level = 0;
 
-	while ((c = getopt(argc, argv, "l:")) != -1) {
+	while ((c = getopt(argc, argv, "j:l:")) != -1) {
 		switch (c) {
+		case 'j':
+			if (sscanf(optarg, "%d", &nthreads) != 1 ||
+			    nthreads < 1) {
+				fprintf(stderr,
+				    "failed to parse thread count '%s'\n",
+				    optarg);
+				zstream_usage();
+			}
+			break;
 		case 'l':
-			if (sscanf(optarg, "%d", &level) != 1) {
+			if (sscanf(optarg, "%d", &ra.ra_level) != 1) {
 				fprintf(stderr,
 				    "failed to parse level '%s'\n",
 				    optarg);
@@ -114,6 +192,7 @@ zstream_do_recompress(int argc, char *argv[])
 			exit(2);
 		}
 	}
+	ra.ra_ctype = ctype;
 
 	if (isatty(STDIN_FILENO)) {
 		(void) fprintf(stderr,
@@ -127,25 +206,22 @@ zstream_do_recompress(int argc, char *argv[])
 	fletcher_4_init();
 	zio_init();
 	zstd_init();
+	zstream_pipeline_t *zp = zstream_pipeline_create(nthreads,
+	    recompress_write, &ra, STDOUT_FILENO);
 	int begin = 0;
 	boolean_t seen = B_FALSE;
 	while (sfread(drr, sizeof (*drr), stdin) != 0) {
-		struct drr_write *drrw;
-		uint64_t payload_size = 0;
-
-		/*
-		 * We need to regenerate the checksum.
-		 */
-		if (drr->drr_type != DRR_BEGIN) {
-			memset(&drr->drr_u.drr_checksum.drr_checksum, 0,
-			    sizeof (drr->drr_u.drr_checksum.drr_checksum));
-		}
+		zstream_job_t *job = zstream_pipeline_next(zp);
+		boolean_t work = B_FALSE;
 
+		if (job == NULL)
+			break;
+		job->zj_drr = *drr;
+		drr = &job->zj_drr;
 
 		switch (drr->drr_type) {
 		case DRR_BEGIN:
 		{
-			ZIO_SET_CHECKSUM(&stream_cksum, 0, 0, 0, 0);
 			VERIFY0(begin++);
 			seen = B_TRUE;
 
@@ -154,34 +230,22 @@ zstream_do_recompress(int argc, char *argv[])
 			VERIFY3U(sz, <=, 1U << 28);
 
 			if (sz != 0) {
-				if (sz > bufsz) {
-					buf = realloc(buf, sz);
-					if (buf == NULL)
-						err(1, "realloc");
-					bufsz = sz;
-				}
-				(void) sfread(buf, sz, stdin);
+				zstream_job_reserve(job, sz);
+				(void) sfread(job->zj_buf, sz, stdin);
 			}
-			payload_size = sz;
+			job->zj_payload_size = sz;
 			break;
 		}
 		case DRR_END:
 		{
-			struct drr_end *drre = &drr->drr_u.drr_end;
 			/*
 			 * We would prefer to just check --begin == 0, but
 			 * replication streams have an end of stream END
-			 * record, so we must avoid tripping it.
+			 * record, so we must avoid tripping it.  The
+			 * pipeline recalculates the END record's checksum.
 			 */
 			VERIFY3B(seen, ==, B_TRUE);
 			begin--;
-			/*
-			 * Use the recalculated checksum, unless this is
-			 * the END record of a stream package, which has
-			 * no checksum.
-			 */
-			if (!ZIO_CHECKSUM_IS_ZERO(&drre->drr_checksum))
-				drre->drr_checksum = stream_cksum;
 			break;
 		}
 
@@ -191,8 +255,11 @@ zstream_do_recompress(int argc, char *argv[])
 			VERIFY3S(begin, ==, 1);
 
 			if (drro->drr_bonuslen > 0) {
-				payload_size = DRR_OBJECT_PAYLOAD_SIZE(drro);
-				(void) sfread(buf, payload_size, stdin);
+				job->zj_payload_size =
+				    DRR_OBJECT_PAYLOAD_SIZE(drro);
+				zstream_job_reserve(job, job->zj_payload_size);
+				(void) sfread(job->zj_buf,
+				    job->zj_payload_size, stdin);
 			}
 			break;
 		}
@@ -201,8 +268,10 @@ zstream_do_recompress(int argc, char *argv[])
 		{
 			struct drr_spill *drrs = &drr->drr_u.drr_spill;
 			VERIFY3S(begin, ==, 1);
-			payload_size = DRR_SPILL_PAYLOAD_SIZE(drrs);
-			(void) sfread(buf, payload_size, stdin);
+			job->zj_payload_size = DRR_SPILL_PAYLOAD_SIZE(drrs);
+			zstream_job_reserve(job, job->zj_payload_size);
+			(void) sfread(job->zj_buf, job->zj_payload_size,
+			    stdin);
 			break;
 		}
 
@@ -215,102 +284,13 @@ zstream_do_recompress(int argc, char *argv[])
 
 		case DRR_WRITE:
 		{
+			struct drr_write *drrw = &drr->drr_u.drr_write;
 			VERIFY3S(begin, ==, 1);
-			drrw = &thedrr.drr_u.drr_write;
-			payload_size = DRR_WRITE_PAYLOAD_SIZE(drrw);
-			/*
-			 * In order to recompress an encrypted block, you have
-			 * to decrypt, decompress, recompress, and
-			 * re-encrypt. That can be a future enhancement (along
-			 * with decryption or re-encryption), but for now we
-			 * skip encrypted blocks.
-			 */
-			boolean_t encrypted = B_FALSE;
-			for (int i = 0; i < ZIO_DATA_SALT_LEN; i++) {
-				if (drrw->drr_salt[i] != 0) {
-					encrypted = B_TRUE;
-					break;
-				}
-			}
-			if (encrypted) {
-				(void) sfread(buf, payload_size, stdin);
-				break;
-			}
-			enum zio_compress dtype = drrw->drr_compressiontype;
-			if (dtype >= ZIO_COMPRESS_FUNCTIONS) {
-				fprintf(stderr, "Invalid compression type in "
-				    "stream: %d\n", dtype);
-				exit(3);
-			}
-			if (zio_compress_table[dtype].ci_decompress == NULL)
-				dtype = ZIO_COMPRESS_OFF;
-
-			/* Set up buffers to minimize memcpys */
-			char *cbuf, *dbuf;
-			if (ctype == ZIO_COMPRESS_OFF)
-				dbuf = buf;
-			else
-				dbuf = safe_calloc(bufsz);
-
-			if (dtype == ZIO_COMPRESS_OFF)
-				cbuf = dbuf;
-			else
-				cbuf = safe_calloc(payload_size);
-
-			/* Read and decompress the payload */
-			(void) sfread(cbuf, payload_size, stdin);
-			if (dtype != ZIO_COMPRESS_OFF) {
-				abd_t cabd, dabd;
-				abd_get_from_buf_struct(&cabd,
-				    cbuf, payload_size);
-				abd_get_from_buf_struct(&dabd, dbuf,
-				    MIN(bufsz, drrw->drr_logical_size));
-				if (zio_decompress_data(dtype, &cabd, &dabd,
-				    payload_size, abd_get_size(&dabd),
-				    NULL) != 0) {
-					warnx("decompression type %d failed "
-					    "for ino %llu offset %llu",
-					    dtype,
-					    (u_longlong_t)drrw->drr_object,
-					    (u_longlong_t)drrw->drr_offset);
-					exit(4);
-				}
-				payload_size = drrw->drr_logical_size;
-				abd_free(&dabd);
-				abd_free(&cabd);
-				free(cbuf);
-			}
-
-			/* Recompress the payload */
-			if (ctype != ZIO_COMPRESS_OFF) {
-				abd_t dabd, abd;
-				abd_get_from_buf_struct(&dabd,
-				    dbuf, drrw->drr_logical_size);
-				abd_t *pabd =
-				    abd_get_from_buf_struct(&abd, buf, bufsz);
-				size_t csize = zio_compress_data(ctype, &dabd,
-				    &pabd, drrw->drr_logical_size,
-				    drrw->drr_logical_size, level);
-				size_t rounded =
-				    P2ROUNDUP(csize, SPA_MINBLOCKSIZE);
-				if (rounded >= drrw->drr_logical_size) {
-					memcpy(buf, dbuf, payload_size);
-					drrw->drr_compressiontype = 0;
-					drrw->drr_compressed_size = 0;
-				} else {
-					abd_zero_off(pabd, csize,
-					    rounded - csize);
-					drrw->drr_compressiontype = ctype;
-					drrw->drr_compressed_size =
-					    payload_size = rounded;
-				}
-				abd_free(&abd);
-				abd_free(&dabd);
-				free(dbuf);
-			} else {
-				drrw->drr_compressiontype = 0;
-				drrw->drr_compressed_size = 0;
-			}
+			job->zj_payload_size = DRR_WRITE_PAYLOAD_SIZE(drrw);
+			zstream_job_reserve(job, job->zj_payload_size);
+			(void) sfread(job->zj_buf, job->zj_payload_size,
+			    stdin);
+			work = B_TRUE;
 			break;
 		}
 
@@ -319,9 +299,11 @@ zstream_do_recompress(int argc, char *argv[])
 			struct drr_write_embedded *drrwe =
 			    &drr->drr_u.drr_write_embedded;
 			VERIFY3S(begin, ==, 1);
-			payload_size =
+			job->zj_payload_size =
 			    P2ROUNDUP((uint64_t)drrwe->drr_psize, 8);
-			(void) sfread(buf, payload_size, stdin);
+			zstream_job_reserve(job, job->zj_payload_size);
+			(void) sfread(job->zj_buf, job->zj_payload_size,
+			    stdin);
 			break;
 		}
 
@@ -348,31 +330,10 @@ zstream_do_recompress(int argc, char *argv[])
 			exit(1);
 		}
 
-		/*
-		 * We need to recalculate the checksum, and it needs to be
-		 * initially zero to do that.  BEGIN records don't have
-		 * a checksum.
-		 */
-		if (drr->drr_type != DRR_BEGIN) {
-			memset(&drr->drr_u.drr_checksum.drr_checksum, 0,
-			    sizeof (drr->drr_u.drr_checksum.drr_checksum));
-		}
-		if (dump_record(drr, buf, payload_size,
-		    &stream_cksum, STDOUT_FILENO) != 0)
-			break;
-		if (drr->drr_type == DRR_END) {
-			/*
-			 * Typically the END record is either the last
-			 * thing in the stream, or it is followed
-			 * by a BEGIN record (which also zeros the checksum).
-			 * However, a stream package ends with two END
-			 * records.  The last END record's checksum starts
-			 * from zero.
-			 */
-			ZIO_SET_CHECKSUM(&stream_cksum, 0, 0, 0, 0);
-		}
+		zstream_pipeline_submit(zp, job, work);
+		drr = &thedrr;
 	}
-	free(buf);
+	(void) zstream_pipeline_destroy(zp);
 	fletcher_4_fini();
 	zio_fini();
 	zstd_fini();
@@ -29,6 +29,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <umem.h>
 #include <unistd.h>
 #include <sys/debug.h>
@@ -50,11 +51,51 @@ typedef struct redup_entry {
 	uint64_t rde_stream_offset;
 } redup_entry_t;
 
+/*
+ * Once the in-memory table is full, further entries go to an open-addressed
+ * hash table in an unlinked temporary file, probed one block of slots at a
+ * time.  A slot with rdde_stream_offset == 0 is empty; stored offsets are
+ * biased by one.
+ *
+ * New entries are first collected in a small in-memory table, and written
+ * out RDT_DISK_BATCH at a time, sorted by block, so that each block is read
+ * and written once per batch rather than once per entry.  The file is sized
+ * from the number of entries seen so far, and doubled (rehashing the entries
+ * into a new file) whenever a batch would take it over half full.
+ *
+ * If ZSTREAM_REDUP_NO_MEM is set in the environment, every entry goes to
+ * the file, RDT_DISK_TEST_BATCH at a time, so that the tests can exercise
+ * it with small streams.
+ */
+typedef struct redup_disk_entry {
+	uint64_t rdde_guid;
+	uint64_t rdde_object;
+	uint64_t rdde_offset;
+	uint64_t rdde_stream_offset;
+} redup_disk_entry_t;
+
+#define	RDT_DISK_BLOCK_ENTRIES	(4096 / sizeof (redup_disk_entry_t))
+#define	RDT_DISK_BATCH		(1 << 16)
+#define	RDT_DISK_TEST_BATCH	8
+
+typedef struct redup_disk_slot {
+	uint64_t		rdds_block;	/* home block */
+	redup_disk_entry_t	rdds_entry;
+} redup_disk_slot_t;
+
 typedef struct redup_table {
 	redup_entry_t	**redup_hash_array;
 	umem_cache_t	*ddecache;
 	uint64_t	ddt_count;
+	uint64_t	max_mem_count;
 	int		numhashbits;
+	pthread_rwlock_t lock;
+	int		disk_fd;	/* -1 until the table spills */
+	uint64_t	disk_nblocks;	/* power of 2 */
+	uint64_t	disk_count;
+	redup_entry_t	**pend_hash_array; /* RDT_DISK_BATCH buckets */
+	uint64_t	pend_count;	/* entries not yet in the file */
+	uint64_t	pend_max;	/* flush when pend_count gets here */
 } redup_table_t;
 
 void *
@@ -104,29 +145,241 @@ spread(int fd, void *buf, size_t count, off_t offset)
 	}
 }
 
+/*
+ * Safe version of pwrite(), exits on error.
+ */
+static void
+spwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+	if (pwrite(fd, buf, count, offset) != count) {
+		(void) fprintf(stderr,
+		    "Error while writing index file: %s\n",
+		    strerror(errno));
+		exit(1);
+	}
+}
+
 static int
-dump_record(dmu_replay_record_t *drr, void *payload, int payload_len,
-    zio_cksum_t *zc, int outfd)
+rdt_disk_open(uint64_t nblocks)
 {
-	assert(offsetof(dmu_replay_record_t, drr_u.drr_checksum.drr_checksum)
-	    == sizeof (dmu_replay_record_t) - sizeof (zio_cksum_t));
-	fletcher_4_incremental_native(drr,
-	    offsetof(dmu_replay_record_t, drr_u.drr_checksum.drr_checksum), zc);
-	if (drr->drr_type != DRR_BEGIN) {
-		assert(ZIO_CHECKSUM_IS_ZERO(&drr->drr_u.
-		    drr_checksum.drr_checksum));
-		drr->drr_u.drr_checksum.drr_checksum = *zc;
+	const char *tmpdir = getenv("TMPDIR");
+	char path[MAXPATHLEN];
+
+	(void) snprintf(path, sizeof (path), "%s/zstream-redup.XXXXXX",
+	    tmpdir != NULL ? tmpdir : "/tmp");
+	int fd = mkstemp(path);
+	if (fd == -1) {
+		(void) fprintf(stderr,
+		    "Error while creating index file '%s': %s\n",
+		    path, strerror(errno));
+		exit(1);
 	}
-	fletcher_4_incremental_native(&drr->drr_u.drr_checksum.drr_checksum,
-	    sizeof (zio_cksum_t), zc);
-	if (write(outfd, drr, sizeof (*drr)) == -1)
-		return (errno);
-	if (payload_len != 0) {
-		fletcher_4_incremental_native(payload, payload_len, zc);
-		if (write(outfd, payload, payload_len) == -1)
-			return (errno);
+	(void) unlink(path);
+
+	/* The file is sparse, so blocks never written take no space. */
+	if (ftruncate(fd, nblocks * 4096) != 0) {
+		(void) fprintf(stderr,
+		    "Error while sizing index file: %s\n", strerror(errno));
+		exit(1);
 	}
-	return (0);
+	return (fd);
+}
+
+static int
+rdt_disk_slot_compare(const void *x1, const void *x2)
+{
+	const redup_disk_slot_t *s1 = x1;
+	const redup_disk_slot_t *s2 = x2;
+
+	return (TREE_CMP(s1->rdds_block, s2->rdds_block));
+}
+
+/*
+ * Add entries to the file, in block order.  A block is only read and
+ * written again if the entries homed in it overflow into the next one.
+ */
+static void
+rdt_disk_place(int fd, uint64_t nblocks, redup_disk_slot_t *slots,
+    uint64_t count)
+{
+	redup_disk_entry_t blk[RDT_DISK_BLOCK_ENTRIES];
+	uint64_t cur = UINT64_MAX;
+	boolean_t dirty = B_FALSE;
+
+	qsort(slots, count, sizeof (*slots), rdt_disk_slot_compare);
+	for (uint64_t i = 0; i < count; i++) {
+		uint64_t b = slots[i].rdds_block;
+		for (;;) {
+			if (b != cur) {
+				if (dirty) {
+					spwrite(fd, blk, sizeof (blk),
+					    cur * sizeof (blk));
+				}
+				spread(fd, blk, sizeof (blk), b * sizeof (blk));
+				cur = b;
+				dirty = B_FALSE;
+			}
+			int j = 0;
+			while (j < RDT_DISK_BLOCK_ENTRIES &&
+			    blk[j].rdde_stream_offset != 0)
+				j++;
+			if (j < RDT_DISK_BLOCK_ENTRIES) {
+				blk[j] = slots[i].rdds_entry;
+				dirty = B_TRUE;
+				break;
+			}
+			b = (b + 1) & (nblocks - 1);
+		}
+	}
+	if (dirty)
+		spwrite(fd, blk, sizeof (blk), cur * sizeof (blk));
+}
+
+/*
+ * Move the on-disk table to a new file of nblocks blocks.  The old file is
+ * read sequentially, and its entries placed in the new one a batch at a time.
+ */
+static void
+rdt_disk_grow(redup_table_t *rdt, uint64_t nblocks)
+{
+	redup_disk_entry_t blk[RDT_DISK_BLOCK_ENTRIES];
+	int fd = rdt_disk_open(nblocks);
+
+	if (rdt->disk_fd != -1) {
+		redup_disk_slot_t *slots =
+		    safe_calloc(RDT_DISK_BATCH * sizeof (*slots));
+		uint64_t n = 0;
+
+		for (uint64_t b = 0; b < rdt->disk_nblocks; b++) {
+			spread(rdt->disk_fd, blk, sizeof (blk),
+			    b * sizeof (blk));
+			for (int i = 0; i < RDT_DISK_BLOCK_ENTRIES; i++) {
+				redup_disk_entry_t *rdde = &blk[i];
+				if (rdde->rdde_stream_offset == 0)
+					continue;
+				slots[n].rdds_block = cityhash3(rdde->rdde_guid,
+				    rdde->rdde_object, rdde->rdde_offset) &
+				    (nblocks - 1);
+				slots[n].rdds_entry = *rdde;
+				n++;
+			}
+			if (n > RDT_DISK_BATCH - RDT_DISK_BLOCK_ENTRIES) {
+				rdt_disk_place(fd, nblocks, slots, n);
+				n = 0;
+			}
+		}
+		rdt_disk_place(fd, nblocks, slots, n);
+		free(slots);
+		(void) close(rdt->disk_fd);
+	}
+	rdt->disk_fd = fd;
+	rdt->disk_nblocks = nblocks;
+}
+
+/*
+ * Write the pending entries out to the file, growing it first if that
+ * would take it over half full.  The first time, the file is sized for at
+ * least as many entries again as the in-memory table holds.
+ */
+static void
+rdt_disk_flush(redup_table_t *rdt)
+{
+	uint64_t need = rdt->disk_count + rdt->pend_count;
+	uint64_t nblocks = MAX(rdt->disk_nblocks, 1);
+
+	if (rdt->disk_fd == -1)
+		need = MAX(need, rdt->ddt_count);
+	while (nblocks * RDT_DISK_BLOCK_ENTRIES < 2 * need)
+		nblocks <<= 1;
+	if (rdt->disk_fd == -1 || nblocks != rdt->disk_nblocks)
+		rdt_disk_grow(rdt, nblocks);
+
+	redup_disk_slot_t *slots =
+	    safe_calloc(rdt->pend_count * sizeof (*slots));
+	uint64_t n = 0;
+	for (uint64_t h = 0; h < RDT_DISK_BATCH; h++) {
+		redup_entry_t *rde, *next;
+		for (rde = rdt->pend_hash_array[h]; rde != NULL; rde = next) {
+			next = rde->rde_next;
+			slots[n].rdds_block = cityhash3(rde->rde_guid,
+			    rde->rde_object, rde->rde_offset) & (nblocks - 1);
+			redup_disk_entry_t *rdde = &slots[n].rdds_entry;
+			rdde->rdde_guid = rde->rde_guid;
+			rdde->rdde_object = rde->rde_object;
+			rdde->rdde_offset = rde->rde_offset;
+			rdde->rdde_stream_offset = rde->rde_stream_offset + 1;
+			n++;
+			umem_cache_free(rdt->ddecache, rde);
+		}
+		rdt->pend_hash_array[h] = NULL;
+	}
+	ASSERT3U(n, ==, rdt->pend_count);
+	rdt_disk_place(rdt->disk_fd, nblocks, slots, n);
+	free(slots);
+	rdt->disk_count += n;
+	rdt->pend_count = 0;
+}
+
+static void
+rdt_pend_insert(redup_table_t *rdt, uint64_t ch,
+    uint64_t guid, uint64_t object, uint64_t offset, uint64_t stream_offset)
+{
+	redup_entry_t **rdepp =
+	    &rdt->pend_hash_array[ch & (RDT_DISK_BATCH - 1)];
+	redup_entry_t *rde = umem_cache_alloc(rdt->ddecache, UMEM_NOFAIL);
+
+	rde->rde_next = *rdepp;
+	rde->rde_guid = guid;
+	rde->rde_object = object;
+	rde->rde_offset = offset;
+	rde->rde_stream_offset = stream_offset;
+	*rdepp = rde;
+	if (++rdt->pend_count == rdt->pend_max)
+		rdt_disk_flush(rdt);
+}
+
+static boolean_t
+rdt_pend_lookup(redup_table_t *rdt, uint64_t ch,
+    uint64_t guid, uint64_t object, uint64_t offset,
+    uint64_t *stream_offsetp)
+{
+	for (redup_entry_t *rde = rdt->pend_hash_array[ch &
+	    (RDT_DISK_BATCH - 1)]; rde != NULL; rde = rde->rde_next) {
+		if (rde->rde_guid == guid &&
+		    rde->rde_object == object &&
+		    rde->rde_offset == offset) {
+			*stream_offsetp = rde->rde_stream_offset;
+			return (B_TRUE);
+		}
+	}
+	return (B_FALSE);
+}
+
+static boolean_t
+rdt_disk_lookup(redup_table_t *rdt, uint64_t ch,
+    uint64_t guid, uint64_t object, uint64_t offset,
+    uint64_t *stream_offsetp)
+{
+	redup_disk_entry_t blk[RDT_DISK_BLOCK_ENTRIES];
+
+	if (rdt->disk_fd == -1)
+		return (B_FALSE);
+
+	for (uint64_t b = ch & (rdt->disk_nblocks - 1), n = 0;
+	    n < rdt->disk_nblocks; b = (b + 1) & (rdt->disk_nblocks - 1), n++) {
+		spread(rdt->disk_fd, blk, sizeof (blk), b * sizeof (blk));
+		for (int i = 0; i < RDT_DISK_BLOCK_ENTRIES; i++) {
+			if (blk[i].rdde_stream_offset == 0)
+				return (B_FALSE);
+			if (blk[i].rdde_guid == guid &&
+			    blk[i].rdde_object == object &&
+			    blk[i].rdde_offset == offset) {
+				*stream_offsetp = blk[i].rdde_stream_offset - 1;
+				return (B_TRUE);
+			}
+		}
+	}
+	return (B_FALSE);
 }
 
 static void
@@ -137,6 +390,13 @@ rdt_insert(redup_table_t *rdt,
 	uint64_t hashcode = BF64_GET(ch, 0, rdt->numhashbits);
 	redup_entry_t **rdepp;
 
+	VERIFY0(pthread_rwlock_wrlock(&rdt->lock));
+	if (rdt->ddt_count >= rdt->max_mem_count) {
+		rdt_pend_insert(rdt, ch, guid, object, offset, stream_offset);
+		VERIFY0(pthread_rwlock_unlock(&rdt->lock));
+		return;
+	}
+
 	rdepp = &(rdt->redup_hash_array[hashcode]);
 	redup_entry_t *rde = umem_cache_alloc(rdt->ddecache, UMEM_NOFAIL);
 	rde->rde_next = *rdepp;
@@ -146,6 +406,7 @@ rdt_insert(redup_table_t *rdt,
 	rde->rde_stream_offset = stream_offset;
 	*rdepp = rde;
 	rdt->ddt_count++;
+	VERIFY0(pthread_rwlock_unlock(&rdt->lock));
 }
 
 static void
@@ -156,16 +417,68 @@ rdt_lookup(redup_table_t *rdt,
 	uint64_t ch = cityhash3(guid, object, offset);
 	uint64_t hashcode = BF64_GET(ch, 0, rdt->numhashbits);
 
+	VERIFY0(pthread_rwlock_rdlock(&rdt->lock));
 	for (redup_entry_t *rde = rdt->redup_hash_array[hashcode];
 	    rde != NULL; rde = rde->rde_next) {
 		if (rde->rde_guid == guid &&
 		    rde->rde_object == object &&
 		    rde->rde_offset == offset) {
 			*stream_offsetp = rde->rde_stream_offset;
+			VERIFY0(pthread_rwlock_unlock(&rdt->lock));
 			return;
 		}
 	}
-	assert(!"could not find expected redup table entry");
+	boolean_t found = rdt_pend_lookup(rdt, ch, guid, object, offset,
+	    stream_offsetp) || rdt_disk_lookup(rdt, ch, guid, object, offset,
+	    stream_offsetp);
+	VERIFY0(pthread_rwlock_unlock(&rdt->lock));
+	if (!found)
+		assert(!"could not find expected redup table entry");
+}
+
+typedef struct redup_arg {
+	redup_table_t	*ra_rdt;
+	int		ra_infd;
+} redup_arg_t;
+
+/*
+ * Replace a WRITE_BYREF record with the WRITE record it refers to, but with
+ * drr_object, drr_offset and drr_toguid replaced with ours.  This runs on
+ * the pipeline's worker threads, which lets the preads of many records
+ * proceed in parallel.
+ */
+static void
+redup_write_byref(zstream_job_t *job, void *arg)
+{
+	redup_arg_t *ra = arg;
+	dmu_replay_record_t *drr = &job->zj_drr;
+	struct drr_write_byref drrwb = drr->drr_u.drr_write_byref;
+
+	/*
+	 * Look up in hash table by drrwb->drr_refguid,
+	 * drr_refobject, drr_refoffset.
+	 */
+	uint64_t stream_offset = 0;
+	rdt_lookup(ra->ra_rdt, drrwb.drr_refguid,
+	    drrwb.drr_refobject, drrwb.drr_refoffset,
+	    &stream_offset);
+
+	spread(ra->ra_infd, drr, sizeof (*drr), stream_offset);
+
+	assert(drr->drr_type == DRR_WRITE);
+	struct drr_write *drrw = &drr->drr_u.drr_write;
+	assert(drrw->drr_toguid == drrwb.drr_refguid);
+	assert(drrw->drr_object == drrwb.drr_refobject);
+	assert(drrw->drr_offset == drrwb.drr_refoffset);
+
+	job->zj_payload_size = DRR_WRITE_PAYLOAD_SIZE(drrw);
+	zstream_job_reserve(job, job->zj_payload_size);
+	spread(ra->ra_infd, job->zj_buf, job->zj_payload_size,
+	    stream_offset + sizeof (*drr));
+
+	drrw->drr_toguid = drrwb.drr_toguid;
+	drrw->drr_object = drrwb.drr_object;
+	drrw->drr_offset = drrwb.drr_offset;
 }
 
 /*
@@ -175,13 +488,11 @@ rdt_lookup(redup_table_t *rdt,
  * infd must be seekable.
  */
 static void
-zfs_redup_stream(int infd, int outfd, boolean_t verbose)
+zfs_redup_stream(int infd, int outfd, boolean_t verbose, int nthreads)
 {
-	int bufsz = SPA_MAXBLOCKSIZE;
 	dmu_replay_record_t thedrr;
 	dmu_replay_record_t *drr = &thedrr;
 	redup_table_t rdt;
-	zio_cksum_t stream_cksum;
 	uint64_t numbuckets;
 	uint64_t num_records = 0;
 	uint64_t num_write_byref_records = 0;
@@ -212,30 +523,48 @@ zfs_redup_stream(int infd, int outfd, boolean_t verbose)
 	    NULL, NULL, NULL, NULL, NULL, 0);
 	rdt.numhashbits = highbit64(numbuckets) - 1;
 	rdt.ddt_count = 0;
+	/*
+	 * Entries beyond what fits in the memory budget go to the on-disk
+	 * table.
+	 */
+	rdt.max_mem_count = max_rde_size /
+	    (sizeof (redup_entry_t) + sizeof (redup_entry_t *));
+	rdt.disk_fd = -1;
+	rdt.disk_nblocks = 0;
+	rdt.disk_count = 0;
+	rdt.pend_hash_array =
+	    safe_calloc(RDT_DISK_BATCH * sizeof (redup_entry_t *));
+	rdt.pend_count = 0;
+	rdt.pend_max = RDT_DISK_BATCH;
+	if (getenv("ZSTREAM_REDUP_NO_MEM") != NULL) {
+		rdt.max_mem_count = 0;
+		rdt.pend_max = RDT_DISK_TEST_BATCH;
+	}
+	VERIFY0(pthread_rwlock_init(&rdt.lock, NULL));
+
+	redup_arg_t ra = { .ra_rdt = &rdt, .ra_infd = infd };
+	zstream_pipeline_t *zp = zstream_pipeline_create(nthreads,
+	    redup_write_byref, &ra, outfd);
 
-	char *buf = safe_calloc(bufsz);
 	FILE *ofp = fdopen(infd, "r");
 	long offset = ftell(ofp);
 	int begin = 0;
 	boolean_t seen = B_FALSE;
 	while (sfread(drr, sizeof (*drr), ofp) != 0) {
-		num_records++;
+		zstream_job_t *job = zstream_pipeline_next(zp);
+		boolean_t work = B_FALSE;
 
-		/*
-		 * We need to regenerate the checksum.
-		 */
-		if (drr->drr_type != DRR_BEGIN) {
-			memset(&drr->drr_u.drr_checksum.drr_checksum, 0,
-			    sizeof (drr->drr_u.drr_checksum.drr_checksum));
-		}
+		if (job == NULL)
+			break;
+		job->zj_drr = *drr;
+		drr = &job->zj_drr;
+		num_records++;
 
-		uint64_t payload_size = 0;
 		switch (drr->drr_type) {
 		case DRR_BEGIN:
 		{
 			struct drr_begin *drrb = &drr->drr_u.drr_begin;
 			int fflags;
-			ZIO_SET_CHECKSUM(&stream_cksum, 0, 0, 0, 0);
 			VERIFY0(begin++);
 			seen = B_TRUE;
 
@@ -253,34 +582,23 @@ zfs_redup_stream(int infd, int outfd, boolean_t verbose)
 			VERIFY3U(sz, <=, 1U << 28);
 
 			if (sz != 0) {
-				if (sz > bufsz) {
-					free(buf);
-					buf = safe_calloc(sz);
-					bufsz = sz;
-				}
-				(void) sfread(buf, sz, ofp);
+				zstream_job_reserve(job, sz);
+				(void) sfread(job->zj_buf, sz, ofp);
 			}
-			payload_size = sz;
+			job->zj_payload_size = sz;
 			break;
 		}
 
 		case DRR_END:
 		{
-			struct drr_end *drre = &drr->drr_u.drr_end;
 			/*
 			 * We would prefer to just check --begin == 0, but
 			 * replication streams have an end of stream END
-			 * record, so we must avoid tripping it.
+			 * record, so we must avoid tripping it.  The
+			 * pipeline recalculates the END record's checksum.
 			 */
 			VERIFY3B(seen, ==, B_TRUE);
 			begin--;
-			/*
-			 * Use the recalculated checksum, unless this is
-			 * the END record of a stream package, which has
-			 * no checksum.
-			 */
-			if (!ZIO_CHECKSUM_IS_ZERO(&drre->drr_checksum))
-				drre->drr_checksum = stream_cksum;
 			break;
 		}
 
@@ -290,8 +608,11 @@ zfs_redup_stream(int infd, int outfd, boolean_t verbose)
 			VERIFY3S(begin, ==, 1);
 
 			if (drro->drr_bonuslen > 0) {
-				payload_size = DRR_OBJECT_PAYLOAD_SIZE(drro);
-				(void) sfread(buf, payload_size, ofp);
+				job->zj_payload_size =
+				    DRR_OBJECT_PAYLOAD_SIZE(drro);
+				zstream_job_reserve(job, job->zj_payload_size);
+				(void) sfread(job->zj_buf,
+				    job->zj_payload_size, ofp);
 			}
 			break;
 		}
@@ -300,45 +621,18 @@ zfs_redup_stream(int infd, int outfd, boolean_t verbose)
 		{
 			struct drr_spill *drrs = &drr->drr_u.drr_spill;
 			VERIFY3S(begin, ==, 1);
-			payload_size = DRR_SPILL_PAYLOAD_SIZE(drrs);
-			(void) sfread(buf, payload_size, ofp);
+			job->zj_payload_size = DRR_SPILL_PAYLOAD_SIZE(drrs);
+			zstream_job_reserve(job, job->zj_payload_size);
+			(void) sfread(job->zj_buf, job->zj_payload_size, ofp);
 			break;
 		}
 
 		case DRR_WRITE_BYREF:
 		{
-			struct drr_write_byref drrwb =
-			    drr->drr_u.drr_write_byref;
 			VERIFY3S(begin, ==, 1);
 
 			num_write_byref_records++;
-
-			/*
-			 * Look up in hash table by drrwb->drr_refguid,
-			 * drr_refobject, drr_refoffset.  Replace this
-			 * record with the found WRITE record, but with
-			 * drr_object,drr_offset,drr_toguid replaced with ours.
-			 */
-			uint64_t stream_offset = 0;
-			rdt_lookup(&rdt, drrwb.drr_refguid,
-			    drrwb.drr_refobject, drrwb.drr_refoffset,
-			    &stream_offset);
-
-			spread(infd, drr, sizeof (*drr), stream_offset);
-
-			assert(drr->drr_type == DRR_WRITE);
-			struct drr_write *drrw = &drr->drr_u.drr_write;
-			assert(drrw->drr_toguid == drrwb.drr_refguid);
-			assert(drrw->drr_object == drrwb.drr_refobject);
-			assert(drrw->drr_offset == drrwb.drr_refoffset);
-
-			payload_size = DRR_WRITE_PAYLOAD_SIZE(drrw);
-			spread(infd, buf, payload_size,
-			    stream_offset + sizeof (*drr));
-
-			drrw->drr_toguid = drrwb.drr_toguid;
-			drrw->drr_object = drrwb.drr_object;
-			drrw->drr_offset = drrwb.drr_offset;
+			work = B_TRUE;
 			break;
 		}
 
@@ -346,8 +640,9 @@ zfs_redup_stream(int infd, int outfd, boolean_t verbose)
 		{
 			struct drr_write *drrw = &drr->drr_u.drr_write;
 			VERIFY3S(begin, ==, 1);
-			payload_size = DRR_WRITE_PAYLOAD_SIZE(drrw);
-			(void) sfread(buf, payload_size, ofp);
+			job->zj_payload_size = DRR_WRITE_PAYLOAD_SIZE(drrw);
+			zstream_job_reserve(job, job->zj_payload_size);
+			(void) sfread(job->zj_buf, job->zj_payload_size, ofp);
 
 			rdt_insert(&rdt, drrw->drr_toguid,
 			    drrw->drr_object, drrw->drr_offset, offset);
@@ -359,9 +654,10 @@ zfs_redup_stream(int infd, int outfd, boolean_t verbose)
 			struct drr_write_embedded *drrwe =
 			    &drr->drr_u.drr_write_embedded;
 			VERIFY3S(begin, ==, 1);
-			payload_size =
+			job->zj_payload_size =
 			    P2ROUNDUP((uint64_t)drrwe->drr_psize, 8);
-			(void) sfread(buf, payload_size, ofp);
+			zstream_job_reserve(job, job->zj_payload_size);
+			(void) sfread(job->zj_buf, job->zj_payload_size, ofp);
 			break;
 		}
 
@@ -388,46 +684,32 @@ zfs_redup_stream(int infd, int outfd, boolean_t verbose)
 			exit(1);
 		}
 
-		/*
-		 * We need to recalculate the checksum, and it needs to be
-		 * initially zero to do that.  BEGIN records don't have
-		 * a checksum.
-		 */
-		if (drr->drr_type != DRR_BEGIN) {
-			memset(&drr->drr_u.drr_checksum.drr_checksum, 0,
-			    sizeof (drr->drr_u.drr_checksum.drr_checksum));
-		}
-		if (dump_record(drr, buf, payload_size,
-		    &stream_cksum, outfd) != 0)
-			break;
-		if (drr->drr_type == DRR_END) {
-			/*
-			 * Typically the END record is either the last
-			 * thing in the stream, or it is followed
-			 * by a BEGIN record (which also zeros the checksum).
-			 * However, a stream package ends with two END
-			 * records.  The last END record's checksum starts
-			 * from zero.
-			 */
-			ZIO_SET_CHECKSUM(&stream_cksum, 0, 0, 0, 0);
-		}
+		zstream_pipeline_submit(zp, job, work);
+		drr = &thedrr;
 		offset = ftell(ofp);
 	}
+	(void) zstream_pipeline_destroy(zp);
 
 	if (verbose) {
-		char mem_str[16];
+		char mem_str[16], disk_str[16];
 		zfs_nicenum(rdt.ddt_count * sizeof (redup_entry_t),
 		    mem_str, sizeof (mem_str));
+		zfs_nicenum(rdt.disk_count * sizeof (redup_disk_entry_t),
+		    disk_str, sizeof (disk_str));
 		fprintf(stderr, "converted stream with %llu total records, "
-		    "including %llu dedup records, using %sB memory.\n",
+		    "including %llu dedup records, using %sB memory "
+		    "and %sB of index file.\n",
 		    (long long)num_records,
 		    (long long)num_write_byref_records,
-		    mem_str);
+		    mem_str, disk_str);
 	}
 
+	if (rdt.disk_fd != -1)
+		(void) close(rdt.disk_fd);
+	VERIFY0(pthread_rwlock_destroy(&rdt.lock));
 	umem_cache_destroy(rdt.ddecache);
 	free(rdt.redup_hash_array);
-	free(buf);
+	free(rdt.pend_hash_array);
 	(void) fclose(ofp);
 }
 
@@ -435,10 +717,20 @@ int
 zstream_do_redup(int argc, char *argv[])
 {
 	boolean_t verbose = B_FALSE;
+	int nthreads = zstream_default_threads();
 	int c;
 
-	while ((c = getopt(argc, argv, "v")) != -1) {
+	while ((c = getopt(argc, argv, "j:v")) != -1) {
 		switch (c) {
+		case 'j':
+			if (sscanf(optarg, "%d", &nthreads) != 1 ||
+			    nthreads < 1) {
+				fprintf(stderr,
+				    "failed to parse thread count '%s'\n",
+				    optarg);
+				zstream_usage();
+			}
+			break;
 		case 'v':
 			verbose = B_TRUE;
 			break;
@@ -474,7 +766,7 @@ zstream_do_redup(int argc, char *argv[])
 	}
 
 	fletcher_4_init();
-	zfs_redup_stream(fd, STDOUT_FILENO, verbose);
+	zfs_redup_stream(fd, STDOUT_FILENO, verbose, nthreads);
 	fletcher_4_fini();
 
 	close(fd);
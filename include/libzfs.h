@@ -721,6 +721,7 @@ _LIBZFS_H int zprop_collect_property(const char *, zprop_get_cbdata_t *,
 #define	ZFS_ITER_RECVD_PROPS		(1 << 4)
 #define	ZFS_ITER_LITERAL_PROPS		(1 << 5)
 #define	ZFS_ITER_SIMPLE			(1 << 6)
+#define	ZFS_ITER_BATCH			(1 << 7)
 
 typedef int (*zfs_iter_f)(zfs_handle_t *, void *);
 _LIBZFS_H int zfs_iter_root(libzfs_handle_t *, zfs_iter_f, void *);
@@ -843,6 +844,9 @@ typedef struct sendflags {
 
 	/* stream represents a partially received dataset */
 	boolean_t saved;
+
+	/* compress uncompressed WRITE payloads in transit ("lz4" or "zstd") */
+	const char *stream_compress;
 } sendflags_t;
 
 typedef boolean_t (snapfilter_cb_t)(zfs_handle_t *, void *);
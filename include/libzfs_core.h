@@ -86,6 +86,8 @@ enum lzc_send_flags {
 	LZC_SEND_FLAG_COMPRESS = 1 << 2,
 	LZC_SEND_FLAG_RAW = 1 << 3,
 	LZC_SEND_FLAG_SAVED = 1 << 4,
+	LZC_SEND_FLAG_STREAM_LZ4 = 1 << 5,
+	LZC_SEND_FLAG_STREAM_ZSTD = 1 << 6,
 };
 
 _LIBZFS_CORE_H int lzc_send_wrapper(int (*)(int, void *), int, void *);
@@ -165,6 +167,13 @@ _LIBZFS_CORE_H int lzc_scrub(zfs_ioc_t, const char *, nvlist_t *, nvlist_t **);
 _LIBZFS_CORE_H int lzc_ddt_prune(const char *, zpool_ddt_prune_unit_t,
     uint64_t);
 
+_LIBZFS_CORE_H int lzc_clone_range_batch(int, zfs_clone_batch_ent_t *,
+    uint64_t);
+
+_LIBZFS_CORE_H int lzc_obj_to_stats_batch(const char *, const uint64_t *,
+    uint_t, nvlist_t **);
+_LIBZFS_CORE_H int lzc_list_batch(const char *, nvlist_t *, nvlist_t **);
+
 #ifdef	__cplusplus
 }
 #endif
@@ -85,6 +85,7 @@ struct zfsvfs {
 	boolean_t	z_xattr_sa;	/* allow xattrs to be stores as SA */
 	boolean_t	z_use_namecache; /* make use of FreeBSD name cache */
 	boolean_t	z_longname;	/* Dataset supports long names */
+	struct zfs_dedup_scan *z_dedup_scan; /* offline dedup scan state */
 	uint8_t		z_xattr;	/* xattr type in use */
 	uint64_t	z_version;	/* ZPL version */
 	uint64_t	z_shares_dir;	/* hidden shares dir */
@@ -102,7 +103,6 @@ struct zfsvfs {
 	uint64_t	z_defaultuserobjquota;
 	uint64_t	z_defaultgroupobjquota;
 	uint64_t	z_defaultprojectobjquota;
-	uint64_t	z_replay_eof;	/* New end of file - replay only */
 	sa_attr_type_t	*z_attr_table;	/* SA attr mapping->id */
 #define	ZFS_OBJ_MTX_SZ	64
 	kmutex_t	z_hold_mtx[ZFS_OBJ_MTX_SZ];	/* znode hold locks */
@@ -120,6 +120,7 @@ struct zfsvfs {
 	boolean_t	z_xattr_sa;	/* allow xattrs to be stores as SA */
 	boolean_t	z_draining;	/* is true when drain is active */
 	boolean_t	z_drain_cancel; /* signal the unlinked drain to stop */
+	struct zfs_dedup_scan *z_dedup_scan; /* offline dedup scan state */
 	boolean_t	z_longname;	/* Dataset supports long names */
 	uint64_t	z_version;	/* ZPL version */
 	uint64_t	z_shares_dir;	/* hidden shares dir */
@@ -137,7 +138,6 @@ struct zfsvfs {
 	uint64_t	z_defaultuserobjquota;
 	uint64_t	z_defaultgroupobjquota;
 	uint64_t	z_defaultprojectobjquota;
-	uint64_t	z_replay_eof;	/* New end of file - replay only */
 	sa_attr_type_t	*z_attr_table;	/* SA attr mapping->id */
 	uint64_t	z_hold_size;	/* znode hold array size */
 	avl_tree_t	*z_hold_trees;	/* znode hold trees */
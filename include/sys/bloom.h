@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or https://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_SYS_BLOOM_H
+#define	_SYS_BLOOM_H
+
+#include <sys/zfs_context.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * In-core bloom filter over keys of two 64-bit words, used in front of
+ * on-disk tables to skip lookups of keys they certainly do not contain.
+ */
+typedef struct bloom {
+	uint64_t	*bl_bits;	/* bit array */
+	uint64_t	bl_nbits;	/* size of bit array, power of 2 */
+	uint64_t	bl_capacity;	/* entries it was sized for */
+	uint_t		bl_nhash;	/* hash functions per key */
+	uint_t		bl_bpe;		/* bits per entry */
+} bloom_t;
+
+extern uint64_t bloom_size(uint64_t capacity, uint_t bits_per_entry);
+extern void bloom_create(bloom_t *bl, uint64_t capacity,
+    uint_t bits_per_entry);
+extern void bloom_resize(bloom_t *bl, uint64_t capacity,
+    uint_t bits_per_entry);
+extern void bloom_destroy(bloom_t *bl);
+extern void bloom_insert(bloom_t *bl, uint64_t k1, uint64_t k2);
+extern boolean_t bloom_contains(const bloom_t *bl, uint64_t k1, uint64_t k2);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_BLOOM_H */
@@ -167,6 +167,11 @@ struct brt_vdev {
 	 * Entries to sync.
 	 */
 	avl_tree_t	bv_tree;
+	/*
+	 * Bloom filter over the offsets of cloned blocks, letting
+	 * brt_maybe_exists() skip the ZAP for most frees.
+	 */
+	struct brt_filter *bv_filter;
 };
 
 /* Size of offset / sizeof (uint64_t). */
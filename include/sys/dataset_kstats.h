@@ -68,6 +68,7 @@ typedef struct dataset_kstats {
 	dataset_sum_stats_t dk_sums;
 	zil_sums_t dk_zil_sums;
 	kstat_t *dk_kstats;
+	kstat_t *dk_zil_latency;
 } dataset_kstats_t;
 
 int dataset_kstats_create(dataset_kstats_t *, objset_t *);
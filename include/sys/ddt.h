@@ -263,6 +263,8 @@ typedef struct {
  */
 typedef struct {
 	avl_tree_t	ddl_tree;	/* logged entries */
+	struct ddt_log_pack *ddl_pack;	/* packed entries (flushing only) */
+	uint64_t	ddl_npacked;	/* live entries in ddl_pack */
 	uint32_t	ddl_flags;	/* flags for this log */
 	uint64_t	ddl_object;	/* log object id */
 	uint64_t	ddl_length;	/* on-disk log size */
@@ -296,6 +298,8 @@ typedef struct {
 
 	kstat_t		*ddt_ksp;	/* kstats context */
 
+	struct ddt_filter *ddt_filter;	/* store lookup filter */
+
 	enum zio_checksum ddt_checksum;	/* checksum algorithm in use */
 	spa_t		*ddt_spa;	/* pool this ddt is on */
 	objset_t	*ddt_os;	/* ddt objset (always MOS) */
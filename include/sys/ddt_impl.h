@@ -182,6 +182,16 @@ typedef struct {
 
 extern const ddt_ops_t ddt_zap_ops;
 
+/* Store lookup filter */
+typedef struct ddt_filter ddt_filter_t;
+
+extern void ddt_filter_sync(ddt_t *ddt, dmu_tx_t *tx);
+extern void ddt_filter_add(ddt_t *ddt, const ddt_key_t *ddk);
+extern boolean_t ddt_filter_ready(ddt_t *ddt);
+extern boolean_t ddt_filter_contains(ddt_t *ddt, const ddt_key_t *ddk);
+extern uint64_t ddt_filter_size(ddt_t *ddt);
+extern void ddt_filter_free(ddt_t *ddt);
+
 /* Dedup log API */
 extern void ddt_log_begin(ddt_t *ddt, size_t nentries, dmu_tx_t *tx,
     ddt_log_update_t *dlu);
@@ -197,6 +207,12 @@ extern boolean_t ddt_log_find_key(ddt_t *ddt, const ddt_key_t *ddk,
 extern boolean_t ddt_log_remove_key(ddt_t *ddt, ddt_log_t *ddl,
     const ddt_key_t *ddk);
 
+extern uint64_t ddt_log_count(ddt_log_t *ddl);
+extern uint64_t ddt_log_mem_size(ddt_t *ddt, ddt_log_t *ddl);
+extern void ddt_log_foreach(ddt_t *ddt, ddt_log_t *ddl,
+    void (*func)(ddt_t *, const ddt_lightweight_entry_t *, void *),
+    void *arg);
+
 extern void ddt_log_checkpoint(ddt_t *ddt, ddt_lightweight_entry_t *ddlwe,
     dmu_tx_t *tx);
 extern void ddt_log_truncate(ddt_t *ddt, dmu_tx_t *tx);
@@ -271,6 +287,8 @@ extern void ddt_object_name(ddt_t *ddt, ddt_type_t type, ddt_class_t clazz,
     char *name);
 extern int ddt_object_walk(ddt_t *ddt, ddt_type_t type, ddt_class_t clazz,
     uint64_t *walk, ddt_lightweight_entry_t *ddlwe);
+extern void ddt_object_prefetch_all(ddt_t *ddt, ddt_type_t type,
+    ddt_class_t clazz);
 extern int ddt_object_count(ddt_t *ddt, ddt_type_t type, ddt_class_t clazz,
     uint64_t *count);
 extern int ddt_object_info(ddt_t *ddt, ddt_type_t type, ddt_class_t clazz,
@@ -66,6 +66,13 @@ typedef int (blkptr_cb_t)(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
  */
 #define	TRAVERSE_LOGICAL		(1<<6)
 
+/*
+ * For an incremental traversal of a snapshot, only descend into the parts
+ * of the meta-dnode holding objects that the dataset's change log says were
+ * modified after txg_start.  Has no effect if there is no such log.
+ */
+#define	TRAVERSE_CHANGE_LOG		(1<<7)
+
 /* Special traverse error return value to indicate skipping of children */
 #define	TRAVERSE_VISIT_NO_CHILDREN	-1
 
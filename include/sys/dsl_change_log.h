@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or https://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_SYS_DSL_CHANGE_LOG_H
+#define	_SYS_DSL_CHANGE_LOG_H
+
+#include <sys/types.h>
+#include <sys/range_tree.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+struct dsl_dataset;
+struct dmu_tx;
+
+/*
+ * The bonus buffer of a change log object.  The log itself is an array of
+ * uint64_t words: a txg marker (DCL_TXG_MARKER | txg) followed by the
+ * objects dirtied in that txg, in ascending order.
+ */
+typedef struct dsl_change_log_phys {
+	uint64_t dcl_start_txg;		/* first txg covered by the log */
+	uint64_t dcl_entries;		/* number of words in the log */
+} dsl_change_log_phys_t;
+
+#define	DCL_TXG_MARKER	(1ULL << 63)
+
+uint64_t dsl_change_log_object(struct dsl_dataset *ds);
+void dsl_change_log_sync(struct dsl_dataset *ds, struct dmu_tx *tx);
+void dsl_change_log_destroy(struct dsl_dataset *ds, struct dmu_tx *tx);
+zfs_range_tree_t *dsl_change_log_changed(struct dsl_dataset *ds,
+    uint64_t fromtxg);
+void dsl_change_log_changed_free(zfs_range_tree_t *rt);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* _SYS_DSL_CHANGE_LOG_H */
@@ -129,6 +129,13 @@ struct zfs_bookmark_phys;
  */
 #define	DS_FIELD_IVSET_GUID	"com.datto:ivset_guid"
 
+/*
+ * This field is set to the object number of the dataset's change log if it
+ * has one.  If it is present, then this dataset is counted in the refcount
+ * of the SPA_FEATURE_CHANGE_LOG feature.
+ */
+#define	DS_FIELD_CHANGE_LOG	"org.openzfs:change_log"
+
 /*
  * DS_FLAG_CI_DATASET is set if the dataset contains a file system whose
  * name lookups should be performed case-insensitively.
@@ -251,6 +258,13 @@ typedef struct dsl_dataset {
 	uint64_t ds_resume_offset[TXG_SIZE];
 	uint64_t ds_resume_bytes[TXG_SIZE];
 
+	/*
+	 * Bumped whenever the change log is restarted or destroyed, so that
+	 * readers can tell that what they read is stale.  Protected by
+	 * ds_lock.
+	 */
+	uint64_t ds_change_log_gen;
+
 	/* Protected by our dsl_dir's dd_lock */
 	list_t ds_prop_cbs;
 
@@ -115,9 +115,12 @@ void dsl_deadlist_space_range(dsl_deadlist_t *dl,
 void dsl_deadlist_merge(dsl_deadlist_t *dl, uint64_t obj, dmu_tx_t *tx);
 void dsl_deadlist_move_bpobj(dsl_deadlist_t *dl, bpobj_t *bpo, uint64_t mintxg,
     dmu_tx_t *tx);
+void dsl_deadlist_prefetch(dsl_deadlist_t *dl);
 boolean_t dsl_deadlist_is_open(dsl_deadlist_t *dl);
 int dsl_process_sub_livelist(bpobj_t *bpobj, struct bplist *to_free,
     zthr_t *t, uint64_t *size);
+int dsl_process_sub_livelist_cancel(bpobj_t *bpobj, struct bplist *to_free,
+    const boolean_t *cancelled);
 void dsl_deadlist_clear_entry(dsl_deadlist_entry_t *dle, dsl_deadlist_t *dl,
     dmu_tx_t *tx);
 void dsl_deadlist_discard_tree(dsl_deadlist_t *dl);
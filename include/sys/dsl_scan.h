@@ -33,6 +33,7 @@
 #include <sys/zap.h>
 #include <sys/ddt.h>
 #include <sys/bplist.h>
+#include <sys/bptree.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -95,6 +96,59 @@ typedef struct dsl_errorscrub_phys {
 #define	ERRORSCRUB_PHYS_NUMINTS (sizeof (dsl_errorscrub_phys_t) \
 	/ sizeof (uint64_t))
 
+/*
+ * The scan traverses several datasets from its queue at once, each in a
+ * lane of its own (see dsl_scan_visit_queue()). Lane 0 keeps its state in
+ * the dsl_scan_phys_t (scn_bookmark, scn_cur_{min,max}_txg and the
+ * DSF_VISIT_DS_AGAIN flag), which also covers the MOS and the DDT, so a scan
+ * using a single lane looks the same on disk as it always did. The state
+ * of the other lanes is written to the DMU_POOL_SCAN_LANES entry of the
+ * pool directory, as the scan queue object it belongs with followed by a
+ * dsl_scan_lane_phys_t for each lane that is traversing a dataset. The
+ * datasets of those lanes are also left in the on-disk scan queue, so
+ * software that does not know about lanes traverses them again from the
+ * start.
+ *
+ * All members of this structure must be uint64_t, for byteswap
+ * purposes.
+ */
+typedef struct dsl_scan_lane_phys {
+	zbookmark_phys_t slp_bookmark;	/* resume point, names the dataset */
+	uint64_t slp_cur_min_txg;
+	uint64_t slp_cur_max_txg;
+	uint64_t slp_queue_txg;		/* txg of the dataset's queue entry */
+	uint64_t slp_flags;		/* DSF_VISIT_DS_AGAIN */
+} dsl_scan_lane_phys_t;
+
+#define	SCAN_LANE_PHYS_NUMINTS (sizeof (dsl_scan_lane_phys_t) / \
+	sizeof (uint64_t))
+
+/* most datasets the scan traverses at once */
+#define	DSL_SCAN_LANES_MAX	16
+
+struct dsl_scan;
+
+/*
+ * In-core state of a lane. Each lane is traversed by a single thread, so
+ * apart from sl_prefetch_bookmark, which is also read by the prefetch
+ * callbacks, none of this needs locking.
+ */
+typedef struct dsl_scan_lane {
+	struct dsl_scan *sl_scn;
+	dmu_tx_t *sl_tx;		/* txg being synced */
+	dsl_scan_lane_phys_t sl_phys;
+	boolean_t sl_suspending;	/* lane stopped at sl_phys' bookmark */
+	zbookmark_phys_t sl_prefetch_bookmark;	/* prefetch start bookmark */
+
+	/* per txg statistics, added to the dsl_scan_t's after the visit */
+	uint64_t sl_visited;
+	uint64_t sl_holes;
+	uint64_t sl_lt_min;
+	uint64_t sl_gt_max;
+	uint64_t sl_ddt_contained;
+	uint64_t sl_objsets_visited;
+} dsl_scan_lane_t;
+
 /*
  * Every pool will have one dsl_scan_t and this structure will contain
  * in-memory information about the scan and a pointer to the on-disk
@@ -109,6 +163,7 @@ typedef struct dsl_errorscrub_phys {
  *			has exceeded its allotted time will need to suspend.
  *			When this flag is set the scanner will stop traversing
  *			the pool and write out the current state to disk.
+ *			Each lane stops at the next point it can resume from.
  *
  * scn_restart_txg -	directs the scanner to either restart or start a
  *			a scan at the specified txg value.
@@ -138,6 +193,15 @@ typedef struct dsl_scan {
 	boolean_t scn_async_stalled;
 	uint64_t  scn_async_block_min_time_ms;
 
+	/* for reading ahead of async destroys, protected by the lock below */
+	kmutex_t scn_destroy_pf_lock;
+	kcondvar_t scn_destroy_pf_cv;
+	boolean_t scn_destroy_pf_active;	/* read ahead task running */
+	boolean_t scn_destroy_pf_stop;		/* read ahead should stop */
+	bptree_entry_phys_t scn_destroy_pf_entry; /* where to read from */
+	uint64_t scn_destroy_pf_window;		/* metadata bytes to read */
+	uint64_t scn_destroy_pf_bytes;		/* metadata bytes read */
+
 	/* flags and stats for controlling scan state */
 	boolean_t scn_is_sorted;	/* doing sequential scan */
 	boolean_t scn_clearing;		/* scan is issuing sequential extents */
@@ -148,16 +212,26 @@ typedef struct dsl_scan {
 	/* members for thread synchronization */
 	zio_t *scn_zio_root;		/* root zio for waiting on IO */
 	taskq_t *scn_taskq;		/* task queue for issuing extents */
+	taskq_t *scn_visit_taskq;	/* task queue for traversing lanes */
+	kmutex_t scn_blkstats_lock;	/* serializes dp_blkstats updates */
 
 	/* for controlling scan prefetch, protected by spa_scrub_lock */
 	boolean_t scn_prefetch_stop;	/* prefetch should stop */
-	zbookmark_phys_t scn_prefetch_bookmark;	/* prefetch start bookmark */
 	avl_tree_t scn_prefetch_queue;	/* priority queue of prefetch IOs */
 	uint64_t scn_maxinflight_bytes; /* max bytes in flight for pool */
 
+	/* datasets being traversed, see dsl_scan_lane_phys_t */
+	dsl_scan_lane_t scn_lanes[DSL_SCAN_LANES_MAX];
+	dsl_scan_lane_phys_t scn_lanes_cached[DSL_SCAN_LANES_MAX];
+	uint_t scn_nlanes;		/* lanes taking new datasets this txg */
+	boolean_t scn_lanes_running;	/* lanes run on scn_visit_taskq */
+	boolean_t scn_lanes_on_disk;	/* DMU_POOL_SCAN_LANES exists */
+
 	/* per txg statistics */
 	uint64_t scn_visited_this_txg;	/* total bps visited this txg */
 	uint64_t scn_dedup_frees_this_txg;	/* dedup bps freed this txg */
+	uint64_t scn_freed_bytes_this_txg;	/* bytes freed this txg */
+	uint64_t scn_freed_meta_this_txg;	/* bptree metadata bytes */
 	uint64_t scn_holes_this_txg;
 	uint64_t scn_lt_min_this_txg;
 	uint64_t scn_gt_max_this_txg;
@@ -176,6 +250,10 @@ typedef struct dsl_scan {
 	avl_tree_t scn_queue;		/* queue of datasets to scan */
 	kmutex_t scn_queue_lock;	/* serializes scn_queue inserts */
 	uint64_t scn_queues_pending;	/* outstanding data to issue */
+	uint64_t scn_spill_obj;		/* MOS object holding spilled runs */
+	uint64_t scn_spill_end;		/* end of the last run written */
+	boolean_t scn_spilling;		/* queues being written out */
+	uint64_t scn_spill_vdev;	/* next top-level vdev to spill */
 	/* members needed for syncing error scrub status to disk */
 	dsl_errorscrub_phys_t errorscrub_phys;
 } dsl_scan_t;
@@ -203,6 +203,7 @@ typedef enum {
 	ZFS_PROP_DEFAULTUSEROBJQUOTA,
 	ZFS_PROP_DEFAULTGROUPOBJQUOTA,
 	ZFS_PROP_DEFAULTPROJECTOBJQUOTA,
+	ZFS_PROP_CHANGE_LOG,
 	ZFS_NUM_PROPS
 } zfs_prop_t;
 
@@ -751,6 +752,8 @@ typedef struct zpool_load_policy {
 #define	ZPOOL_CONFIG_REMOVAL_STATS	"removal_stats"	/* not stored on disk */
 #define	ZPOOL_CONFIG_CHECKPOINT_STATS	"checkpoint_stats" /* not on disk */
 #define	ZPOOL_CONFIG_RAIDZ_EXPAND_STATS	"raidz_expand_stats" /* not on disk */
+#define	ZPOOL_CONFIG_DEDUP_SCAN_STATS	"dedup_scan_stats" /* not on disk */
+#define	ZPOOL_CONFIG_DEDUP_SCAN_DATASET	"dedup_scan_dataset" /* not on disk */
 #define	ZPOOL_CONFIG_VDEV_STATS		"vdev_stats"	/* not stored on disk */
 #define	ZPOOL_CONFIG_INDIRECT_SIZE	"indirect_size"	/* not stored on disk */
 
@@ -1216,6 +1219,16 @@ typedef struct pool_raidz_expand_stat {
 	uint64_t pres_waiting_for_resilver;
 } pool_raidz_expand_stat_t;
 
+typedef struct pool_dedup_scan_stat {
+	uint64_t pdss_state; /* dsl_scan_state_t */
+	uint64_t pdss_start_time;
+	uint64_t pdss_end_time;
+	uint64_t pdss_to_examine; /* bytes referenced by the dataset */
+	uint64_t pdss_examined; /* bytes examined so far */
+	uint64_t pdss_deduped; /* bytes of duplicate blocks merged */
+	uint64_t pdss_deduped_blocks; /* number of duplicate blocks merged */
+} pool_dedup_scan_stat_t;
+
 typedef enum dsl_scan_state {
 	DSS_NONE,
 	DSS_SCANNING,
@@ -1562,6 +1575,8 @@ typedef enum zfs_ioc {
 	ZFS_IOC_POOL_SCRUB,			/* 0x5a57 */
 	ZFS_IOC_POOL_PREFETCH,			/* 0x5a58 */
 	ZFS_IOC_DDT_PRUNE,			/* 0x5a59 */
+	ZFS_IOC_OBJ_TO_STATS_BATCH,		/* 0x5a5a */
+	ZFS_IOC_LIST_BATCH,			/* 0x5a5b */
 
 	/*
 	 * Per-platform (Optional) - 8/128 numbers reserved.
@@ -1632,6 +1647,41 @@ typedef struct zfs_rewrite_args {
 
 #define	ZFS_IOC_REWRITE		_IOW(0x83, 3, zfs_rewrite_args_t)
 
+typedef struct zfs_dedup_scan_args {
+	uint64_t	flags;
+} zfs_dedup_scan_args_t;
+
+/* zfs_dedup_scan_args flags */
+#define	ZFS_DEDUP_SCAN_STOP	0x1	/* Stop the running scan. */
+
+#define	ZFS_IOC_DEDUP_SCAN	_IOW(0x83, 4, zfs_dedup_scan_args_t)
+
+/*
+ * One range of a batch clone. The file descriptors must refer to regular
+ * files in the same pool, open for reading (src_fd) and writing (dst_fd).
+ * On return, len is the number of bytes cloned and error is the errno for
+ * this range, or zero.
+ */
+typedef struct zfs_clone_batch_ent {
+	int64_t		src_fd;
+	uint64_t	src_off;
+	int64_t		dst_fd;
+	uint64_t	dst_off;
+	uint64_t	len;
+	int64_t		error;
+} zfs_clone_batch_ent_t;
+
+typedef struct zfs_clone_batch_args {
+	uint64_t	ents;	/* address of zfs_clone_batch_ent_t array */
+	uint64_t	count;
+	uint64_t	flags;
+} zfs_clone_batch_args_t;
+
+/* Max number of ranges in a single ZFS_IOC_CLONE_BATCH call. */
+#define	ZFS_CLONE_BATCH_MAX	4096
+
+#define	ZFS_IOC_CLONE_BATCH	_IOW(0x83, 5, zfs_clone_batch_args_t)
+
 /*
  * ZFS-specific error codes used for returning descriptive errors
  * to the userland through zfs ioctls.
@@ -1821,6 +1871,42 @@ typedef enum {
 #define	DDT_PRUNE_UNIT		"ddt_prune_unit"
 #define	DDT_PRUNE_AMOUNT	"ddt_prune_amount"
 
+/*
+ * The following are names used when invoking ZFS_IOC_OBJ_TO_STATS_BATCH.
+ */
+#define	ZFS_OBJ_STATS_OBJECTS	"objects"
+#define	ZFS_OBJ_STATS_ERROR	"error"
+#define	ZFS_OBJ_STATS_PATH	"path"
+#define	ZFS_OBJ_STATS_STAT	"stat"
+
+/*
+ * Most objects looked up by one ZFS_IOC_OBJ_TO_STATS_BATCH call.
+ */
+#define	ZFS_OBJ_STATS_BATCH_MAX	1024
+
+/*
+ * The following are names used when invoking ZFS_IOC_LIST_BATCH.
+ */
+#define	ZFS_LIST_BATCH_SNAPSHOTS	"snapshots"
+#define	ZFS_LIST_BATCH_CURSOR		"cursor"
+#define	ZFS_LIST_BATCH_COUNT		"count"
+#define	ZFS_LIST_BATCH_MAXBYTES		"maxbytes"
+#define	ZFS_LIST_BATCH_SIMPLE		"simple"
+#define	ZFS_LIST_BATCH_PROPS		"props"
+#define	ZFS_LIST_BATCH_ENTRIES		"entries"
+#define	ZFS_LIST_BATCH_STATS		"stats"
+
+/*
+ * Most datasets returned by one ZFS_IOC_LIST_BATCH call.
+ */
+#define	ZFS_LIST_BATCH_MAX		1024
+
+/*
+ * Default rough size limit on the reply to a ZFS_IOC_LIST_BATCH call, so
+ * that it fits the buffer lzc_ioctl() starts with.
+ */
+#define	ZFS_LIST_BATCH_BYTES		(96 * 1024)
+
 /*
  * Flags for ZFS_IOC_VDEV_SET_STATE
  */
@@ -796,6 +796,13 @@ extern spa_t *spa_inject_addref(char *pool);
 extern void spa_inject_delref(spa_t *spa);
 extern void spa_scan_stat_init(spa_t *spa);
 extern int spa_scan_get_stats(spa_t *spa, pool_scan_stat_t *ps);
+extern int spa_dedup_scan_begin(spa_t *spa, const char *dsname,
+    uint64_t to_examine);
+extern void spa_dedup_scan_update(spa_t *spa, uint64_t examined,
+    uint64_t deduped, uint64_t deduped_blocks);
+extern void spa_dedup_scan_end(spa_t *spa, boolean_t canceled);
+extern int spa_dedup_scan_get_stats(spa_t *spa, pool_dedup_scan_stat_t *pdss,
+    char *dsname, size_t dsnamelen);
 extern int bpobj_enqueue_alloc_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx);
 extern int bpobj_enqueue_free_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx);
 
@@ -937,9 +944,14 @@ typedef struct spa_stats {
 	spa_history_list_t	txg_history;
 	spa_history_kstat_t	tx_assign_histogram;
 	spa_history_list_t	mmp_history;
+	spa_history_list_t	recv_writers;	/* receive writer threads */
 	spa_history_kstat_t	state;		/* pool state */
 	spa_history_kstat_t	guid;		/* pool guid */
 	spa_history_kstat_t	iostats;
+	spa_history_kstat_t	zil;		/* pool zil rollup */
+	spa_history_kstat_t	zil_latency;
+	spa_history_kstat_t	livelist;	/* livelist deletion */
+	spa_history_kstat_t	async_destroy;	/* async destroy throughput */
 } spa_stats_t;
 
 typedef enum txg_state {
@@ -988,6 +1000,29 @@ typedef struct spa_iostats {
 	kstat_named_t	direct_write_bytes;
 } spa_iostats_t;
 
+/* Progress of the deletion of destroyed clones' livelists */
+typedef struct spa_livelist_stats {
+	kstat_named_t	livelists_pending;
+	kstat_named_t	sublists_pending;
+	kstat_named_t	sublists_deleted;
+	kstat_named_t	blocks_freed;
+	kstat_named_t	bytes_freed;
+	kstat_named_t	dedup_blocks_freed;
+} spa_livelist_stats_t;
+
+/* Throughput of the async destroy of destroyed datasets */
+typedef struct spa_async_destroy_stats {
+	kstat_named_t	blocks_freed;
+	kstat_named_t	bytes_freed;
+	kstat_named_t	txgs;
+	kstat_named_t	last_txg_blocks;
+	kstat_named_t	last_txg_bytes;
+	kstat_named_t	last_txg_ms;
+	kstat_named_t	last_bytes_per_sec;
+	kstat_named_t	prefetch_window;
+	kstat_named_t	prefetch_bytes;
+} spa_async_destroy_stats_t;
+
 extern void spa_stats_init(spa_t *spa);
 extern void spa_stats_destroy(spa_t *spa);
 extern void spa_read_history_add(spa_t *spa, const zbookmark_phys_t *zb,
@@ -999,12 +1034,24 @@ extern txg_stat_t *spa_txg_history_init_io(spa_t *, uint64_t,
     struct dsl_pool *);
 extern void spa_txg_history_fini_io(spa_t *, txg_stat_t *);
 extern void spa_tx_assign_add_nsecs(spa_t *spa, uint64_t nsecs);
+extern void spa_livelist_stats_pending(spa_t *spa, uint64_t livelists,
+    uint64_t sublists);
+extern void spa_livelist_stats_freed(spa_t *spa, uint64_t sublists,
+    uint64_t blocks, uint64_t bytes, uint64_t dedup_blocks);
+extern void spa_async_destroy_stats_txg(spa_t *spa, uint64_t blocks,
+    uint64_t bytes, hrtime_t elapsed);
+extern void spa_async_destroy_stats_prefetch(spa_t *spa, uint64_t window,
+    uint64_t bytes);
+extern struct zil_sums *spa_zil_sums(spa_t *spa);
 extern int spa_mmp_history_set_skip(spa_t *spa, uint64_t mmp_kstat_id);
 extern int spa_mmp_history_set(spa_t *spa, uint64_t mmp_kstat_id, int io_error,
     hrtime_t duration);
 extern void spa_mmp_history_add(spa_t *spa, uint64_t txg, uint64_t timestamp,
     uint64_t mmp_delay, vdev_t *vd, int label, uint64_t mmp_kstat_id,
     int error);
+extern void spa_recv_writer_history_add(spa_t *spa, const char *dsname,
+    uint_t writer, uint_t nwriters, uint64_t records, uint64_t bytes,
+    hrtime_t busy);
 extern void spa_iostats_trim_add(spa_t *spa, trim_type_t type,
     uint64_t extents_written, uint64_t bytes_written,
     uint64_t extents_skipped, uint64_t bytes_skipped,
@@ -1148,6 +1195,7 @@ extern uint64_t bp_get_dsize_sync(spa_t *spa, const blkptr_t *bp);
 extern uint64_t bp_get_dsize(spa_t *spa, const blkptr_t *bp);
 extern boolean_t spa_has_dedup(spa_t *spa);
 extern boolean_t spa_has_slogs(spa_t *spa);
+extern uint64_t spa_slog_count(spa_t *spa);
 extern boolean_t spa_has_special(spa_t *spa);
 extern boolean_t spa_is_root(spa_t *spa);
 extern boolean_t spa_writeable(spa_t *spa);
@@ -361,6 +361,7 @@ struct spa {
 	uint64_t	spa_log_flushall_txg;
 
 	zthr_t		*spa_livelist_delete_zthr; /* deleting livelists */
+	taskq_t		*spa_livelist_delete_taskq; /* livelist sublists */
 	zthr_t		*spa_livelist_condense_zthr; /* condensing livelists */
 	uint64_t	spa_livelists_to_delete; /* set of livelists to free */
 	livelist_condense_entry_t	spa_to_condense; /* next to condense */
@@ -474,6 +475,9 @@ struct spa {
 	uint64_t	spa_dedup_table_quota;	/* property DDT maximum size */
 	uint64_t	spa_dedup_dsize;	/* cached on-disk size of DDT */
 	uint64_t	spa_dedup_class_full_txg; /* txg dedup class was full */
+	kmutex_t	spa_dedup_scan_lock;	/* protects dedup scan stats */
+	pool_dedup_scan_stat_t spa_dedup_scan_stats; /* offline dedup scan */
+	char		spa_dedup_scan_dataset[ZFS_MAX_DATASET_NAME_LEN];
 
 	/*
 	 * spa_refcount & spa_config_lock must be the last elements
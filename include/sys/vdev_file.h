@@ -36,6 +36,7 @@ extern "C" {
 
 typedef struct vdev_file {
 	zfs_file_t	*vf_file;
+	uint64_t	vf_inline_writes;	/* see vdev_file_inline_log */
 } vdev_file_t;
 
 extern void vdev_file_init(void);
@@ -151,6 +151,8 @@ struct vdev_queue {
 	list_t		vq_active_list;	/* List of active I/Os. */
 	hrtime_t	vq_io_complete_ts; /* time last i/o completed */
 	hrtime_t	vq_io_delta_ts;
+	hrtime_t	vq_sync_lat;	/* moving avg of sync i/o latency */
+	hrtime_t	vq_sync_ts;	/* time last sync i/o completed */
 	zio_t		vq_io_search; /* used as local for stack reduction */
 	kmutex_t	vq_lock;
 };
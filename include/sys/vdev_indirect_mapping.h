@@ -89,6 +89,15 @@ typedef struct vdev_indirect_mapping {
 	 */
 	vdev_indirect_mapping_entry_phys_t *vim_entries;
 
+	/*
+	 * Search index over vim_entries: their source offsets laid out in
+	 * Eytzinger (breadth-first) order, slot 0 unused, and for each slot
+	 * the index of the corresponding entry in vim_entries. Rebuilt
+	 * whenever vim_entries is.
+	 */
+	uint64_t	*vim_eytz_offsets;
+	uint64_t	*vim_eytz_index;
+
 	objset_t	*vim_objset;
 
 	dmu_buf_t	*vim_dbuf;
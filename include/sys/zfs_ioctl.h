@@ -148,6 +148,13 @@ typedef enum drr_headertype {
 #define	DMU_BACKUP_FEATURE_SWITCH_TO_LARGE_BLOCKS (1 << 27)
 #define	DMU_BACKUP_FEATURE_LONGNAME		(1 << 28)
 #define	DMU_BACKUP_FEATURE_LARGE_MICROZAP	(1 << 29)
+/*
+ * The STREAM_COMPRESS feature indicates that WRITE records may carry
+ * DRR_WRITE_STREAM_COMPRESSED: the payload was compressed by the sender
+ * for transport only, and the receiver must decompress it before the
+ * record is applied as an ordinary uncompressed write.
+ */
+#define	DMU_BACKUP_FEATURE_STREAM_COMPRESS	(1 << 30)
 
 /*
  * Mask of all supported backup features
@@ -159,7 +166,7 @@ typedef enum drr_headertype {
     DMU_BACKUP_FEATURE_RAW | DMU_BACKUP_FEATURE_HOLDS | \
     DMU_BACKUP_FEATURE_REDACTED | DMU_BACKUP_FEATURE_SWITCH_TO_LARGE_BLOCKS | \
     DMU_BACKUP_FEATURE_ZSTD | DMU_BACKUP_FEATURE_LONGNAME | \
-    DMU_BACKUP_FEATURE_LARGE_MICROZAP)
+    DMU_BACKUP_FEATURE_LARGE_MICROZAP | DMU_BACKUP_FEATURE_STREAM_COMPRESS)
 
 /* Are all features in the given flag word currently supported? */
 #define	DMU_STREAM_SUPPORTED(x)	(!((x) & ~DMU_BACKUP_FEATURE_MASK))
@@ -213,11 +220,13 @@ typedef enum dmu_send_resume_token_version {
 #define	DRR_RAW_BYTESWAP	(1<<1)
 #define	DRR_OBJECT_SPILL	(1<<2) /* OBJECT record has a spill block */
 #define	DRR_SPILL_UNMODIFIED	(1<<2) /* SPILL record for unmodified block */
+#define	DRR_WRITE_STREAM_COMPRESSED (1<<3) /* payload compressed in transit */
 
 #define	DRR_IS_DEDUP_CAPABLE(flags)	((flags) & DRR_CHECKSUM_DEDUP)
 #define	DRR_IS_RAW_BYTESWAPPED(flags)	((flags) & DRR_RAW_BYTESWAP)
 #define	DRR_OBJECT_HAS_SPILL(flags)	((flags) & DRR_OBJECT_SPILL)
 #define	DRR_SPILL_IS_UNMODIFIED(flags)	((flags) & DRR_SPILL_UNMODIFIED)
+#define	DRR_IS_STREAM_COMPRESSED(flags)	((flags) & DRR_WRITE_STREAM_COMPRESSED)
 
 /* deal with compressed drr_write replay records */
 #define	DRR_WRITE_COMPRESSED(drrw)	((drrw)->drr_compressiontype != 0)
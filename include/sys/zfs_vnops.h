@@ -38,9 +38,24 @@ extern int zfs_holey(znode_t *, ulong_t, loff_t *);
 extern int zfs_access(znode_t *, int, int, cred_t *);
 extern int zfs_clone_range(znode_t *, uint64_t *, znode_t *, uint64_t *,
     uint64_t *, cred_t *);
+/*
+ * One range of a zfs_clone_range_batch() call.
+ */
+typedef struct zfs_clone_range {
+	znode_t		*zcr_inzp;
+	znode_t		*zcr_outzp;
+	uint64_t	zcr_inoff;
+	uint64_t	zcr_outoff;
+	uint64_t	zcr_len;	/* in: requested, out: cloned */
+	int		zcr_error;
+} zfs_clone_range_t;
+
+extern void zfs_clone_range_batch(zfs_clone_range_t *, uint_t, cred_t *);
 extern int zfs_clone_range_replay(znode_t *, uint64_t, uint64_t, uint64_t,
     const blkptr_t *, size_t);
 extern int zfs_rewrite(znode_t *, uint64_t, uint64_t, uint64_t, uint64_t);
+extern int zfs_dedup_scan(znode_t *, uint64_t);
+extern void zfs_dedup_scan_stop_wait(zfsvfs_t *);
 
 extern int zfs_getsecattr(znode_t *, vsecattr_t *, int, cred_t *);
 extern int zfs_setsecattr(znode_t *, vsecattr_t *, int, cred_t *);
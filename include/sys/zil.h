@@ -546,6 +546,23 @@ typedef struct zil_stats {
 	kstat_named_t zil_itx_metaslab_slog_alloc;
 } zil_kstat_values_t;
 
+/*
+ * Phases of zil_commit() tracked by the ZIL latency histograms.  Each
+ * histogram has power of two buckets in nanoseconds; bucket i counts the
+ * samples in (2^(i-1), 2^i] ns, and the last one also counts anything
+ * larger.
+ */
+typedef enum zil_lat_type {
+	ZIL_LAT_COMMIT,		/* zil_commit() end to end */
+	ZIL_LAT_LWB_FILL,	/* lwb opened until issued */
+	ZIL_LAT_LWB_WRITE,	/* lwb issued until written */
+	ZIL_LAT_LWB_FLUSH,	/* lwb written until vdevs flushed */
+	ZIL_LAT_WAITER_TIMEOUT,	/* commit waiter slept until its timeout */
+	ZIL_LAT_TYPES
+} zil_lat_type_t;
+
+#define	ZIL_LAT_BUCKETS	37	/* 1ns to 68s */
+
 typedef struct zil_sums {
 	wmsum_t zil_commit_count;
 	wmsum_t zil_commit_writer_count;
@@ -568,6 +585,7 @@ typedef struct zil_sums {
 	wmsum_t zil_itx_metaslab_slog_bytes;
 	wmsum_t zil_itx_metaslab_slog_write;
 	wmsum_t zil_itx_metaslab_slog_alloc;
+	uint64_t zil_latency[ZIL_LAT_BUCKETS][ZIL_LAT_TYPES];
 } zil_sums_t;
 
 #define	ZIL_STAT_INCR(zil, stat, val) \
@@ -576,6 +594,8 @@ typedef struct zil_sums {
 		wmsum_add(&(zil_sums_global.stat), tmpval); \
 		if ((zil)->zl_sums) \
 			wmsum_add(&((zil)->zl_sums->stat), tmpval); \
+		if ((zil)->zl_pool_sums) \
+			wmsum_add(&((zil)->zl_pool_sums->stat), tmpval); \
 	} while (0)
 
 #define	ZIL_STAT_BUMP(zil, stat) \
@@ -667,6 +687,11 @@ extern void zil_sums_init(zil_sums_t *zs);
 extern void zil_sums_fini(zil_sums_t *zs);
 extern void zil_kstat_values_update(zil_kstat_values_t *zs,
     zil_sums_t *zil_sums);
+extern kstat_t *zil_kstat_create(const char *module, const char *name,
+    zil_sums_t *zil_sums);
+extern void zil_kstat_destroy(kstat_t *ksp);
+extern kstat_t *zil_latency_kstat_create(const char *module, const char *name,
+    zil_sums_t *zil_sums);
 
 extern int zil_replay_disable;
 extern uint_t zfs_immediate_write_sz;
@@ -121,7 +121,9 @@ typedef struct lwb {
 	zio_t		*lwb_child_zio;	/* parent zio for children */
 	zio_t		*lwb_write_zio;	/* zio for the lwb buffer */
 	zio_t		*lwb_root_zio;	/* root zio for lwb write and flushes */
+	hrtime_t	lwb_opened_timestamp; /* when was the lwb opened? */
 	hrtime_t	lwb_issued_timestamp; /* when was the lwb issued? */
+	hrtime_t	lwb_written_timestamp; /* when was the lwb written? */
 	uint64_t	lwb_issued_txg;	/* the txg when the write is issued */
 	uint64_t	lwb_alloc_txg;	/* the txg when lwb_blk is allocated */
 	uint64_t	lwb_max_txg;	/* highest txg in this lwb */
@@ -212,6 +214,7 @@ struct zilog {
 	uint8_t		zl_suspending;	/* log is currently suspending */
 	uint8_t		zl_keep_first;	/* keep first log block in destroy */
 	uint8_t		zl_replay;	/* replaying records while set */
+	uint8_t		zl_replay_parallel; /* records replayed out of order */
 	uint8_t		zl_stop_sync;	/* for debugging */
 	kmutex_t	zl_issuer_lock;	/* single writer, per ZIL, at a time */
 	uint8_t		zl_logbias;	/* latency or throughput */
@@ -257,6 +260,9 @@ struct zilog {
 
 	/* Pointer for per dataset zil sums */
 	zil_sums_t *zl_sums;
+
+	/* Pointer for per pool zil sums */
+	zil_sums_t *zl_pool_sums;
 };
 
 typedef struct zil_bp_node {
@@ -90,6 +90,8 @@ typedef enum spa_feature {
 	SPA_FEATURE_DYNAMIC_GANG_HEADER,
 	SPA_FEATURE_BLOCK_CLONING_ENDIAN,
 	SPA_FEATURE_PHYSICAL_REWRITE,
+	SPA_FEATURE_CHANGE_LOG,
+	SPA_FEATURE_SCAN_SPILL,
 	SPA_FEATURES
 } spa_feature_t;
 
@@ -378,16 +378,17 @@ get_recvd_props_ioctl(zfs_handle_t *zhp)
 	return (0);
 }
 
+/*
+ * Store the given stats and properties in the handle, which takes ownership
+ * of allprops.
+ */
 static int
-put_stats_zhdl(zfs_handle_t *zhp, zfs_cmd_t *zc)
+put_stats_nvl(zfs_handle_t *zhp, const dmu_objset_stats_t *stats,
+    nvlist_t *allprops)
 {
-	nvlist_t *allprops, *userprops;
+	nvlist_t *userprops;
 
-	zhp->zfs_dmustats = zc->zc_objset_stats; /* structure assignment */
-
-	if (zcmd_read_dst_nvlist(zhp->zfs_hdl, zc, &allprops) != 0) {
-		return (-1);
-	}
+	zhp->zfs_dmustats = *stats; /* structure assignment */
 
 	/*
 	 * XXX Why do we store the user props separately, in addition to
@@ -407,6 +408,17 @@ put_stats_zhdl(zfs_handle_t *zhp, zfs_cmd_t *zc)
 	return (0);
 }
 
+static int
+put_stats_zhdl(zfs_handle_t *zhp, zfs_cmd_t *zc)
+{
+	nvlist_t *allprops;
+
+	if (zcmd_read_dst_nvlist(zhp->zfs_hdl, zc, &allprops) != 0)
+		return (-1);
+
+	return (put_stats_nvl(zhp, &zc->zc_objset_stats, allprops));
+}
+
 static int
 get_stats(zfs_handle_t *zhp)
 {
@@ -437,11 +449,8 @@ zfs_refresh_properties(zfs_handle_t *zhp)
  * zfs_iter_* to create child handles on the fly.
  */
 static int
-make_dataset_handle_common(zfs_handle_t *zhp, zfs_cmd_t *zc)
+make_dataset_handle_type(zfs_handle_t *zhp)
 {
-	if (put_stats_zhdl(zhp, zc) != 0)
-		return (-1);
-
 	/*
 	 * We've managed to open the dataset and gather statistics.  Determine
 	 * the high-level type.
@@ -475,6 +484,15 @@ make_dataset_handle_common(zfs_handle_t *zhp, zfs_cmd_t *zc)
 	return (0);
 }
 
+static int
+make_dataset_handle_common(zfs_handle_t *zhp, zfs_cmd_t *zc)
+{
+	if (put_stats_zhdl(zhp, zc) != 0)
+		return (-1);
+
+	return (make_dataset_handle_type(zhp));
+}
+
 zfs_handle_t *
 make_dataset_handle(libzfs_handle_t *hdl, const char *path)
 {
@@ -560,6 +578,51 @@ make_dataset_simple_handle_zc(zfs_handle_t *pzhp, zfs_cmd_t *zc)
 	return (zhp);
 }
 
+/*
+ * Makes a handle for a child of pzhp from an entry returned by
+ * ZFS_IOC_LIST_BATCH.  props is NULL if the listing was simple, in which
+ * case the handle is set up like make_dataset_simple_handle_zc() does.
+ * The handle keeps the props table of its parent, if it has one.
+ */
+zfs_handle_t *
+make_dataset_handle_batch(zfs_handle_t *pzhp, const char *name,
+    const dmu_objset_stats_t *stats, nvlist_t *props)
+{
+	zfs_handle_t *zhp = calloc(1, sizeof (zfs_handle_t));
+	nvlist_t *allprops;
+
+	if (zhp == NULL)
+		return (NULL);
+
+	zhp->zfs_hdl = pzhp->zfs_hdl;
+	(void) strlcpy(zhp->zfs_name, name, sizeof (zhp->zfs_name));
+
+	if (props == NULL) {
+		zhp->zfs_head_type = pzhp->zfs_type;
+		zhp->zpool_hdl = zpool_handle(zhp);
+		zhp->zfs_dmustats = *stats;	/* structure assignment */
+
+		if (stats->dds_is_snapshot || strchr(name, '@') != NULL)
+			zhp->zfs_type = ZFS_TYPE_SNAPSHOT;
+		else if (stats->dds_type == DMU_OST_ZVOL)
+			zhp->zfs_type = ZFS_TYPE_VOLUME;
+		else
+			zhp->zfs_type = ZFS_TYPE_FILESYSTEM;
+		return (zhp);
+	}
+
+	if (nvlist_dup(props, &allprops, 0) != 0 ||
+	    put_stats_nvl(zhp, stats, allprops) != 0 ||
+	    make_dataset_handle_type(zhp) != 0) {
+		nvlist_free(zhp->zfs_props);
+		nvlist_free(zhp->zfs_user_props);
+		free(zhp);
+		return (NULL);
+	}
+	zhp->zfs_props_table = pzhp->zfs_props_table;
+	return (zhp);
+}
+
 zfs_handle_t *
 zfs_handle_dup(zfs_handle_t *zhp_orig)
 {
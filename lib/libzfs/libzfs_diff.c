@@ -45,6 +45,7 @@
 #include <pthread.h>
 #include <sys/zfs_ioctl.h>
 #include <libzfs.h>
+#include <libzfs_core.h>
 #include <libzutil.h>
 #include "libzfs_impl.h"
 
@@ -62,27 +63,272 @@
 #define	ZDIFF_RENAMED_COLOR  ANSI_BOLD_BLUE
 
 /*
- * Given a {dsname, object id}, get the object path
+ * The objects reported by ZFS_IOC_DIFF are resolved to names in pages of up
+ * to ZDIFF_PAGE_OBJS objects.  A pool of resolver threads looks up each page
+ * in both snapshots with one ZFS_IOC_OBJ_TO_STATS_BATCH call per snapshot,
+ * while the differ thread keeps reading diff records and prints the pages
+ * in the order their objects were reported.  At most ZDIFF_PAGES_PER_THREAD
+ * pages per resolver are in flight, so memory use stays flat no matter how
+ * many objects changed.
  */
-static int
-get_stats_for_obj(differ_info_t *di, const char *dsname, uint64_t obj,
-    char *pn, int maxlen, zfs_stat_t *sb)
+#define	ZDIFF_PAGE_OBJS		256
+#define	ZDIFF_PAGES_PER_THREAD	2
+#define	ZDIFF_MAX_THREADS	16
+
+typedef struct diff_obj_stats {
+	int		dos_err;	/* errno from looking up the object */
+	char		*dos_path;
+	zfs_stat_t	dos_stat;
+} diff_obj_stats_t;
+
+typedef enum diff_page_state {
+	DP_FREE,	/* unused, or being filled by the differ thread */
+	DP_QUEUED,	/* submitted, waiting for a resolver */
+	DP_RUNNING,	/* being resolved */
+	DP_DONE		/* ready to be printed */
+} diff_page_state_t;
+
+typedef struct diff_page {
+	diff_page_state_t dp_state;
+	int		dp_count;
+	uint64_t	dp_obj[ZDIFF_PAGE_OBJS];
+	boolean_t	dp_free[ZDIFF_PAGE_OBJS];	/* from DDR_FREE */
+	diff_obj_stats_t dp_from[ZDIFF_PAGE_OBJS];
+	diff_obj_stats_t dp_to[ZDIFF_PAGE_OBJS];
+} diff_page_t;
+
+struct diff_pipeline {
+	pthread_mutex_t	dpl_lock;
+	pthread_cond_t	dpl_cv;
+	diff_page_t	*dpl_pages;
+	uint64_t	dpl_npages;
+	uint64_t	dpl_head;	/* next page to print */
+	uint64_t	dpl_tail;	/* next page to fill */
+	uint64_t	dpl_work;	/* next page for a resolver */
+	diff_page_t	*dpl_cur;	/* page being filled, if any */
+	boolean_t	dpl_exiting;
+	int		dpl_nthreads;
+	pthread_t	*dpl_threads;
+};
+
+static void
+set_obj_path(diff_obj_stats_t *dos, const char *path)
+{
+	if ((dos->dos_path = strdup(path)) == NULL)
+		dos->dos_err = ENOMEM;
+}
+
+/*
+ * Look up a single object with ZFS_IOC_OBJ_TO_STATS, for kernels that do
+ * not have ZFS_IOC_OBJ_TO_STATS_BATCH.
+ */
+static void
+lookup_obj(differ_info_t *di, const char *dsname, uint64_t obj,
+    diff_obj_stats_t *dos)
 {
 	zfs_cmd_t zc = {"\0"};
-	int error;
 
 	(void) strlcpy(zc.zc_name, dsname, sizeof (zc.zc_name));
 	zc.zc_obj = obj;
 
-	errno = 0;
-	error = zfs_ioctl(di->zhp->zfs_hdl, ZFS_IOC_OBJ_TO_STATS, &zc);
-	di->zerr = errno;
+	if (zfs_ioctl(di->zhp->zfs_hdl, ZFS_IOC_OBJ_TO_STATS, &zc) != 0)
+		dos->dos_err = errno;
 
 	/* we can get stats even if we failed to get a path */
-	(void) memcpy(sb, &zc.zc_stat, sizeof (zfs_stat_t));
-	if (error == 0) {
-		ASSERT0(di->zerr);
-		(void) strlcpy(pn, zc.zc_value, maxlen);
+	(void) memcpy(&dos->dos_stat, &zc.zc_stat, sizeof (zfs_stat_t));
+	if (dos->dos_err == 0)
+		set_obj_path(dos, zc.zc_value);
+}
+
+/*
+ * Look up the objects of a page in one snapshot.  Objects from DDR_FREE
+ * records are only looked for in the from snapshot, so skip_free leaves
+ * them out.  *no_batch is set once the kernel turns out not to support
+ * batched lookups.
+ */
+static void
+lookup_page(differ_info_t *di, const char *dsname, diff_page_t *dp,
+    diff_obj_stats_t *dos, boolean_t skip_free, boolean_t *no_batch)
+{
+	uint64_t objs[ZDIFF_PAGE_OBJS];
+	nvlist_t *result = NULL;
+	uint_t count = 0;
+	int err = ZFS_ERR_IOC_CMD_UNAVAIL;
+
+	for (int i = 0; i < dp->dp_count; i++) {
+		if (!skip_free || !dp->dp_free[i])
+			objs[count++] = dp->dp_obj[i];
+	}
+	if (count == 0)
+		return;
+
+	if (!*no_batch) {
+		err = lzc_obj_to_stats_batch(dsname, objs, count, &result);
+		if (err == ZFS_ERR_IOC_CMD_UNAVAIL)
+			*no_batch = B_TRUE;
+	}
+
+	for (int i = 0; i < dp->dp_count; i++) {
+		char key[32];
+		nvlist_t *nv;
+		const char *path;
+		uint64_t *stat;
+		uint_t nstat;
+
+		if (skip_free && dp->dp_free[i])
+			continue;
+
+		if (err == ZFS_ERR_IOC_CMD_UNAVAIL) {
+			lookup_obj(di, dsname, dp->dp_obj[i], &dos[i]);
+			continue;
+		} else if (err != 0) {
+			dos[i].dos_err = err;
+			continue;
+		}
+
+		(void) snprintf(key, sizeof (key), "%llu",
+		    (u_longlong_t)dp->dp_obj[i]);
+		if (nvlist_lookup_nvlist(result, key, &nv) != 0) {
+			dos[i].dos_err = EIO;
+			continue;
+		}
+		dos[i].dos_err = fnvlist_lookup_int32(nv, ZFS_OBJ_STATS_ERROR);
+		if (nvlist_lookup_uint64_array(nv, ZFS_OBJ_STATS_STAT, &stat,
+		    &nstat) == 0) {
+			(void) memcpy(&dos[i].dos_stat, stat, MIN(nstat *
+			    sizeof (uint64_t), sizeof (zfs_stat_t)));
+		}
+		if (dos[i].dos_err == 0) {
+			if (nvlist_lookup_string(nv, ZFS_OBJ_STATS_PATH,
+			    &path) == 0)
+				set_obj_path(&dos[i], path);
+			else
+				dos[i].dos_err = EIO;
+		}
+	}
+	nvlist_free(result);
+}
+
+static void *
+diff_resolver(void *arg)
+{
+	differ_info_t *di = arg;
+	diff_pipeline_t *dpl = di->pipeline;
+
+	pthread_mutex_lock(&dpl->dpl_lock);
+	for (;;) {
+		if (dpl->dpl_exiting)
+			break;
+		if (dpl->dpl_work == dpl->dpl_tail) {
+			pthread_cond_wait(&dpl->dpl_cv, &dpl->dpl_lock);
+			continue;
+		}
+
+		diff_page_t *dp =
+		    &dpl->dpl_pages[dpl->dpl_work++ % dpl->dpl_npages];
+		ASSERT3U(dp->dp_state, ==, DP_QUEUED);
+		dp->dp_state = DP_RUNNING;
+		boolean_t no_batch = di->no_batch;
+		pthread_mutex_unlock(&dpl->dpl_lock);
+
+		lookup_page(di, di->fromsnap, dp, dp->dp_from, B_FALSE,
+		    &no_batch);
+		lookup_page(di, di->tosnap, dp, dp->dp_to, B_TRUE, &no_batch);
+
+		pthread_mutex_lock(&dpl->dpl_lock);
+		if (no_batch)
+			di->no_batch = B_TRUE;
+		dp->dp_state = DP_DONE;
+		pthread_cond_broadcast(&dpl->dpl_cv);
+	}
+	pthread_mutex_unlock(&dpl->dpl_lock);
+	return (NULL);
+}
+
+static void
+diff_pipeline_destroy(differ_info_t *di)
+{
+	diff_pipeline_t *dpl = di->pipeline;
+
+	if (dpl == NULL)
+		return;
+
+	pthread_mutex_lock(&dpl->dpl_lock);
+	dpl->dpl_exiting = B_TRUE;
+	pthread_cond_broadcast(&dpl->dpl_cv);
+	pthread_mutex_unlock(&dpl->dpl_lock);
+
+	for (int i = 0; i < dpl->dpl_nthreads; i++)
+		(void) pthread_join(dpl->dpl_threads[i], NULL);
+
+	for (uint64_t p = 0; p < dpl->dpl_npages; p++) {
+		diff_page_t *dp = &dpl->dpl_pages[p];
+		for (int i = 0; i < ZDIFF_PAGE_OBJS; i++) {
+			free(dp->dp_from[i].dos_path);
+			free(dp->dp_to[i].dos_path);
+		}
+	}
+	free(dpl->dpl_pages);
+	free(dpl->dpl_threads);
+	pthread_cond_destroy(&dpl->dpl_cv);
+	pthread_mutex_destroy(&dpl->dpl_lock);
+	free(dpl);
+	di->pipeline = NULL;
+}
+
+/*
+ * Start the resolver threads, one per online CPU up to ZDIFF_MAX_THREADS.
+ */
+static int
+diff_pipeline_create(differ_info_t *di)
+{
+	libzfs_handle_t *hdl = di->zhp->zfs_hdl;
+	diff_pipeline_t *dpl;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int nthreads = ncpus > 0 ? MIN(ncpus, ZDIFF_MAX_THREADS) : 1;
+
+	if ((dpl = zfs_alloc(hdl, sizeof (*dpl))) == NULL)
+		return (ENOMEM);
+	dpl->dpl_npages = ZDIFF_PAGES_PER_THREAD * nthreads;
+	dpl->dpl_pages = zfs_alloc(hdl,
+	    dpl->dpl_npages * sizeof (diff_page_t));
+	dpl->dpl_threads = zfs_alloc(hdl, nthreads * sizeof (pthread_t));
+	if (dpl->dpl_pages == NULL || dpl->dpl_threads == NULL) {
+		free(dpl->dpl_pages);
+		free(dpl->dpl_threads);
+		free(dpl);
+		return (ENOMEM);
+	}
+	pthread_mutex_init(&dpl->dpl_lock, NULL);
+	pthread_cond_init(&dpl->dpl_cv, NULL);
+	di->pipeline = dpl;
+
+	for (int i = 0; i < nthreads; i++) {
+		int err = pthread_create(&dpl->dpl_threads[i], NULL,
+		    diff_resolver, di);
+		if (err != 0) {
+			diff_pipeline_destroy(di);
+			return (err);
+		}
+		dpl->dpl_nthreads++;
+	}
+	return (0);
+}
+
+/*
+ * Given a {dsname, object id} and the result of looking it up, get the
+ * object path
+ */
+static int
+get_stats_for_obj(differ_info_t *di, const char *dsname, uint64_t obj,
+    const diff_obj_stats_t *dos, char *pn, int maxlen, zfs_stat_t *sb)
+{
+	di->zerr = dos->dos_err;
+
+	/* we can get stats even if we failed to get a path */
+	(void) memcpy(sb, &dos->dos_stat, sizeof (zfs_stat_t));
+	if (di->zerr == 0) {
+		(void) strlcpy(pn, dos->dos_path, maxlen);
 		return (0);
 	}
 
@@ -260,18 +506,16 @@ print_file(FILE *fp, differ_info_t *di, char type, const char *file,
 }
 
 static int
-write_inuse_diffs_one(FILE *fp, differ_info_t *di, uint64_t dobj)
+write_inuse_diffs_one(FILE *fp, differ_info_t *di, diff_page_t *dp, int i)
 {
 	struct zfs_stat fsb, tsb;
 	mode_t fmode, tmode;
 	char fobjname[MAXPATHLEN], tobjname[MAXPATHLEN];
 	boolean_t already_logged = B_FALSE;
+	uint64_t dobj = dp->dp_obj[i];
 	int fobjerr, tobjerr;
 	int change;
 
-	if (dobj == di->shares)
-		return (0);
-
 	/*
 	 * Check the from and to snapshots for info on the object. If
 	 * we get ENOENT, then the object just didn't exist in that
@@ -281,8 +525,8 @@ write_inuse_diffs_one(FILE *fp, differ_info_t *di, uint64_t dobj)
 	 * errno and continue.
 	 */
 
-	fobjerr = get_stats_for_obj(di, di->fromsnap, dobj, fobjname,
-	    MAXPATHLEN, &fsb);
+	fobjerr = get_stats_for_obj(di, di->fromsnap, dobj, &dp->dp_from[i],
+	    fobjname, MAXPATHLEN, &fsb);
 	if (fobjerr && di->zerr != ENOTSUP && di->zerr != ENOENT) {
 		zfs_error_aux(di->zhp->zfs_hdl, "%s", zfs_strerror(di->zerr));
 		zfs_error(di->zhp->zfs_hdl, di->zerr, di->errbuf);
@@ -293,8 +537,8 @@ write_inuse_diffs_one(FILE *fp, differ_info_t *di, uint64_t dobj)
 		already_logged = B_TRUE;
 	}
 
-	tobjerr = get_stats_for_obj(di, di->tosnap, dobj, tobjname,
-	    MAXPATHLEN, &tsb);
+	tobjerr = get_stats_for_obj(di, di->tosnap, dobj, &dp->dp_to[i],
+	    tobjname, MAXPATHLEN, &tsb);
 
 	if (tobjerr && di->zerr != ENOTSUP && di->zerr != ENOENT) {
 		if (!already_logged) {
@@ -363,26 +607,13 @@ write_inuse_diffs_one(FILE *fp, differ_info_t *di, uint64_t dobj)
 }
 
 static int
-write_inuse_diffs(FILE *fp, differ_info_t *di, dmu_diff_record_t *dr)
-{
-	uint64_t o;
-	int err;
-
-	for (o = dr->ddr_first; o <= dr->ddr_last; o++) {
-		if ((err = write_inuse_diffs_one(fp, di, o)) != 0)
-			return (err);
-	}
-	return (0);
-}
-
-static int
-describe_free(FILE *fp, differ_info_t *di, uint64_t object, char *namebuf,
-    int maxlen)
+describe_free(FILE *fp, differ_info_t *di, diff_page_t *dp, int i)
 {
 	struct zfs_stat sb;
+	char namebuf[MAXPATHLEN];
 
-	(void) get_stats_for_obj(di, di->fromsnap, object, namebuf,
-	    maxlen, &sb);
+	(void) get_stats_for_obj(di, di->fromsnap, dp->dp_obj[i],
+	    &dp->dp_from[i], namebuf, MAXPATHLEN, &sb);
 
 	/* Don't print if in the delete queue on from side */
 	if (di->zerr == ESTALE || di->zerr == ENOENT) {
@@ -394,19 +625,121 @@ describe_free(FILE *fp, differ_info_t *di, uint64_t object, char *namebuf,
 	return (0);
 }
 
+/*
+ * Print the resolved pages in order and hand them back, until no more
+ * than inflight pages are outstanding.  Pages that are already resolved
+ * are printed even if that means going below inflight.
+ */
+static void
+print_pages(FILE *fp, differ_info_t *di, uint64_t inflight)
+{
+	diff_pipeline_t *dpl = di->pipeline;
+
+	pthread_mutex_lock(&dpl->dpl_lock);
+	while (dpl->dpl_head < dpl->dpl_tail) {
+		diff_page_t *dp =
+		    &dpl->dpl_pages[dpl->dpl_head % dpl->dpl_npages];
+		if (dp->dp_state != DP_DONE) {
+			if (dpl->dpl_tail - dpl->dpl_head <= inflight)
+				break;
+			pthread_cond_wait(&dpl->dpl_cv, &dpl->dpl_lock);
+			continue;
+		}
+		pthread_mutex_unlock(&dpl->dpl_lock);
+
+		for (int i = 0; i < dp->dp_count; i++) {
+			if (di->zerr != 0)
+				break;
+			if (dp->dp_free[i])
+				(void) describe_free(fp, di, dp, i);
+			else
+				(void) write_inuse_diffs_one(fp, di, dp, i);
+		}
+		for (int i = 0; i < dp->dp_count; i++) {
+			free(dp->dp_from[i].dos_path);
+			free(dp->dp_to[i].dos_path);
+			dp->dp_from[i].dos_path = NULL;
+			dp->dp_to[i].dos_path = NULL;
+		}
+
+		pthread_mutex_lock(&dpl->dpl_lock);
+		dp->dp_state = DP_FREE;
+		dpl->dpl_head++;
+	}
+	pthread_mutex_unlock(&dpl->dpl_lock);
+}
+
+static void
+submit_page(differ_info_t *di)
+{
+	diff_pipeline_t *dpl = di->pipeline;
+	diff_page_t *dp = dpl->dpl_cur;
+
+	if (dp == NULL)
+		return;
+
+	pthread_mutex_lock(&dpl->dpl_lock);
+	dp->dp_state = DP_QUEUED;
+	dpl->dpl_tail++;
+	pthread_cond_broadcast(&dpl->dpl_cv);
+	pthread_mutex_unlock(&dpl->dpl_lock);
+	dpl->dpl_cur = NULL;
+}
+
+/*
+ * Queue an object to be looked up and printed, waiting for earlier pages
+ * to be printed if every page is in flight.
+ */
+static void
+add_diff_obj(FILE *fp, differ_info_t *di, uint64_t obj, boolean_t isfree)
+{
+	diff_pipeline_t *dpl = di->pipeline;
+	diff_page_t *dp = dpl->dpl_cur;
+
+	if (dp == NULL) {
+		print_pages(fp, di, dpl->dpl_npages - 1);
+		dp = &dpl->dpl_pages[dpl->dpl_tail % dpl->dpl_npages];
+		ASSERT3U(dp->dp_state, ==, DP_FREE);
+		dp->dp_count = 0;
+		dpl->dpl_cur = dp;
+	}
+
+	int i = dp->dp_count++;
+	dp->dp_obj[i] = obj;
+	dp->dp_free[i] = isfree;
+	(void) memset(&dp->dp_from[i], 0, sizeof (diff_obj_stats_t));
+	(void) memset(&dp->dp_to[i], 0, sizeof (diff_obj_stats_t));
+
+	if (dp->dp_count == ZDIFF_PAGE_OBJS)
+		submit_page(di);
+}
+
+static int
+write_inuse_diffs(FILE *fp, differ_info_t *di, dmu_diff_record_t *dr)
+{
+	uint64_t o;
+
+	for (o = dr->ddr_first; o <= dr->ddr_last && di->zerr == 0; o++) {
+		if (o != di->shares)
+			add_diff_obj(fp, di, o, B_FALSE);
+	}
+	if (di->zerr)
+		return (-1);
+	return (0);
+}
+
 static int
 write_free_diffs(FILE *fp, differ_info_t *di, dmu_diff_record_t *dr)
 {
 	zfs_cmd_t zc = {"\0"};
 	libzfs_handle_t *lhdl = di->zhp->zfs_hdl;
-	char fobjname[MAXPATHLEN];
 
 	(void) strlcpy(zc.zc_name, di->fromsnap, sizeof (zc.zc_name));
 	zc.zc_obj = dr->ddr_first - 1;
 
 	ASSERT0(di->zerr);
 
-	while (zc.zc_obj < dr->ddr_last) {
+	while (zc.zc_obj < dr->ddr_last && di->zerr == 0) {
 		int err;
 
 		err = zfs_ioctl(lhdl, ZFS_IOC_NEXT_OBJ, &zc);
@@ -418,8 +751,7 @@ write_free_diffs(FILE *fp, differ_info_t *di, dmu_diff_record_t *dr)
 			if (zc.zc_obj > dr->ddr_last) {
 				break;
 			}
-			(void) describe_free(fp, di, zc.zc_obj, fobjname,
-			    MAXPATHLEN);
+			add_diff_obj(fp, di, zc.zc_obj, B_TRUE);
 		} else if (errno == ESRCH) {
 			break;
 		} else {
@@ -444,6 +776,13 @@ differ(void *arg)
 	FILE *ofp;
 	int err = 0;
 
+	/*
+	 * zfs_show_diffs() may cancel us while we wait for diff records.
+	 * Anywhere else we may be waiting on the resolver threads, so
+	 * don't allow it there.
+	 */
+	(void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
 	if ((ofp = fdopen(di->outputfd, "w")) == NULL) {
 		di->zerr = errno;
 		strlcpy(di->errbuf, zfs_strerror(errno), sizeof (di->errbuf));
@@ -456,11 +795,13 @@ differ(void *arg)
 		int len = sizeof (dr);
 		int rv;
 
+		(void) pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 		do {
 			rv = read(di->datafd, cp, len);
 			cp += rv;
 			len -= rv;
 		} while (len > 0 && rv > 0);
+		(void) pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
 		if (rv < 0 || (rv == 0 && len != sizeof (dr))) {
 			di->zerr = EPIPE;
@@ -486,6 +827,13 @@ differ(void *arg)
 			break;
 	}
 
+	if (err == 0 && di->zerr == 0) {
+		submit_page(di);
+		print_pages(ofp, di, 0);
+		if (di->zerr)
+			err = -1;
+	}
+
 	(void) fclose(ofp);
 	(void) close(di->datafd);
 	if (err)
@@ -752,7 +1100,7 @@ zfs_show_diffs(zfs_handle_t *zhp, int outfd, const char *fromsnap,
 	differ_info_t di = { 0 };
 	pthread_t tid;
 	int pipefd[2];
-	int iocerr;
+	int iocerr, err;
 
 	(void) snprintf(errbuf, sizeof (errbuf),
 	    dgettext(TEXT_DOMAIN, "zfs diff failed"));
@@ -776,10 +1124,20 @@ zfs_show_diffs(zfs_handle_t *zhp, int outfd, const char *fromsnap,
 	di.outputfd = outfd;
 	di.datafd = pipefd[0];
 
-	if (pthread_create(&tid, NULL, differ, &di)) {
-		zfs_error_aux(zhp->zfs_hdl, "%s", zfs_strerror(errno));
+	if ((err = diff_pipeline_create(&di)) != 0) {
+		zfs_error_aux(zhp->zfs_hdl, "%s", zfs_strerror(err));
+		(void) close(pipefd[0]);
+		(void) close(pipefd[1]);
+		teardown_differ_info(&di);
+		return (zfs_error(zhp->zfs_hdl,
+		    EZFS_THREADCREATEFAILED, errbuf));
+	}
+
+	if ((err = pthread_create(&tid, NULL, differ, &di)) != 0) {
+		zfs_error_aux(zhp->zfs_hdl, "%s", zfs_strerror(err));
 		(void) close(pipefd[0]);
 		(void) close(pipefd[1]);
+		diff_pipeline_destroy(&di);
 		teardown_differ_info(&di);
 		return (zfs_error(zhp->zfs_hdl,
 		    EZFS_THREADCREATEFAILED, errbuf));
@@ -808,6 +1166,7 @@ zfs_show_diffs(zfs_handle_t *zhp, int outfd, const char *fromsnap,
 		(void) close(pipefd[1]);
 		(void) pthread_cancel(tid);
 		(void) pthread_join(tid, NULL);
+		diff_pipeline_destroy(&di);
 		teardown_differ_info(&di);
 		if (di.zerr != 0 && di.zerr != EPIPE) {
 			zfs_error_aux(zhp->zfs_hdl, "%s",
@@ -820,6 +1179,7 @@ zfs_show_diffs(zfs_handle_t *zhp, int outfd, const char *fromsnap,
 
 	(void) close(pipefd[1]);
 	(void) pthread_join(tid, NULL);
+	diff_pipeline_destroy(&di);
 
 	if (di.zerr != 0) {
 		zfs_error_aux(zhp->zfs_hdl, "%s", zfs_strerror(di.zerr));
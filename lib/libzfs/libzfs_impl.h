@@ -142,6 +142,8 @@ extern int zpool_standard_error_fmt(libzfs_handle_t *, int, const char *, ...)
 
 extern zfs_handle_t *make_dataset_handle_zc(libzfs_handle_t *, zfs_cmd_t *);
 extern zfs_handle_t *make_dataset_simple_handle_zc(zfs_handle_t *, zfs_cmd_t *);
+extern zfs_handle_t *make_dataset_handle_batch(zfs_handle_t *, const char *,
+    const dmu_objset_stats_t *, nvlist_t *);
 
 extern int zprop_parse_value(libzfs_handle_t *, nvpair_t *, int, zfs_type_t,
     nvlist_t *, const char **, uint64_t *, const char *);
@@ -205,6 +207,8 @@ typedef struct {
 	int p_unshare_err;
 } proto_table_t;
 
+typedef struct diff_pipeline diff_pipeline_t;
+
 typedef struct differ_info {
 	zfs_handle_t *zhp;
 	char *fromsnap;
@@ -225,6 +229,8 @@ typedef struct differ_info {
 	int cleanupfd;
 	int outputfd;
 	int datafd;
+	boolean_t no_batch;	/* no ZFS_IOC_OBJ_TO_STATS_BATCH in kernel */
+	diff_pipeline_t *pipeline;
 } differ_info_t;
 
 extern int do_mount(zfs_handle_t *zhp, const char *mntpt, const char *opts,
@@ -34,6 +34,7 @@
 #include <stddef.h>
 #include <libintl.h>
 #include <libzfs.h>
+#include <libzfs_core.h>
 #include <libzutil.h>
 #include <sys/mntent.h>
 
@@ -100,6 +101,94 @@ top:
 	return (rc);
 }
 
+/*
+ * Iterate over the child filesystems or the snapshots of zhp with
+ * ZFS_IOC_LIST_BATCH, which returns many datasets per ioctl.  If zhp has a
+ * props table, only the properties in it are fetched.  Returns
+ * ZFS_ERR_IOC_CMD_UNAVAIL, before calling func, if the kernel does not have
+ * that ioctl.
+ */
+static int
+zfs_iter_batch(zfs_handle_t *zhp, boolean_t snapshots, int flags,
+    zfs_iter_f func, void *data, uint64_t min_txg, uint64_t max_txg)
+{
+	nvlist_t *args = fnvlist_alloc();
+	uint64_t cursor = 0;
+	int err, ret = 0;
+
+	if (snapshots)
+		fnvlist_add_boolean(args, ZFS_LIST_BATCH_SNAPSHOTS);
+	if ((flags & ZFS_ITER_SIMPLE) != 0)
+		fnvlist_add_boolean(args, ZFS_LIST_BATCH_SIMPLE);
+	else if (zhp->zfs_props_table != NULL)
+		fnvlist_add_uint8_array(args, ZFS_LIST_BATCH_PROPS,
+		    zhp->zfs_props_table, ZFS_NUM_PROPS);
+	if (min_txg != 0)
+		fnvlist_add_uint64(args, SNAP_ITER_MIN_TXG, min_txg);
+	if (max_txg != 0)
+		fnvlist_add_uint64(args, SNAP_ITER_MAX_TXG, max_txg);
+	fnvlist_add_uint64(args, ZFS_LIST_BATCH_MAXBYTES, ZFS_LIST_BATCH_BYTES);
+
+	do {
+		nvlist_t *result = NULL;
+		nvlist_t *entries;
+
+		fnvlist_add_uint64(args, ZFS_LIST_BATCH_CURSOR, cursor);
+		err = lzc_list_batch(zhp->zfs_name, args, &result);
+		/*
+		 * ESRCH or ENOENT mean that the dataset has been removed
+		 * since we obtained the handle.
+		 */
+		if (err == ESRCH || err == ENOENT) {
+			break;
+		} else if (err == ZFS_ERR_IOC_CMD_UNAVAIL && cursor == 0) {
+			ret = err;
+			break;
+		} else if (err != 0) {
+			ret = zfs_standard_error(zhp->zfs_hdl, err,
+			    dgettext(TEXT_DOMAIN,
+			    "cannot iterate filesystems"));
+			break;
+		}
+
+		entries = fnvlist_lookup_nvlist(result,
+		    ZFS_LIST_BATCH_ENTRIES);
+		for (nvpair_t *pair = nvlist_next_nvpair(entries, NULL);
+		    pair != NULL && ret == 0;
+		    pair = nvlist_next_nvpair(entries, pair)) {
+			nvlist_t *entry = fnvpair_value_nvlist(pair);
+			nvlist_t *props = NULL;
+			uchar_t *stats;
+			uint_t len;
+			zfs_handle_t *nzhp;
+
+			stats = fnvlist_lookup_uint8_array(entry,
+			    ZFS_LIST_BATCH_STATS, &len);
+			if (len != sizeof (dmu_objset_stats_t))
+				continue;
+			(void) nvlist_lookup_nvlist(entry, ZFS_LIST_BATCH_PROPS,
+			    &props);
+
+			/*
+			 * Silently ignore errors, as the only plausible
+			 * explanation is that the pool has since been removed.
+			 */
+			nzhp = make_dataset_handle_batch(zhp, nvpair_name(pair),
+			    (dmu_objset_stats_t *)stats, props);
+			if (nzhp != NULL)
+				ret = func(nzhp, data);
+		}
+
+		if (nvlist_lookup_uint64(result, ZFS_LIST_BATCH_CURSOR,
+		    &cursor) != 0)
+			cursor = 0;
+		fnvlist_free(result);
+	} while (ret == 0 && cursor != 0);
+
+	fnvlist_free(args);
+	return (ret);
+}
+
 /*
  * Iterate over all child filesystems
  */
@@ -120,6 +209,12 @@ zfs_iter_filesystems_v2(zfs_handle_t *zhp, int flags, zfs_iter_f func,
 	if (zhp->zfs_type != ZFS_TYPE_FILESYSTEM)
 		return (0);
 
+	if ((flags & ZFS_ITER_BATCH) != 0) {
+		ret = zfs_iter_batch(zhp, B_FALSE, flags, func, data, 0, 0);
+		if (ret != ZFS_ERR_IOC_CMD_UNAVAIL)
+			return (ret);
+	}
+
 	zcmd_alloc_dst_nvlist(zhp->zfs_hdl, &zc, 0);
 
 	if ((flags & ZFS_ITER_SIMPLE) == ZFS_ITER_SIMPLE)
@@ -171,6 +266,13 @@ zfs_iter_snapshots_v2(zfs_handle_t *zhp, int flags, zfs_iter_f func,
 	    zhp->zfs_type == ZFS_TYPE_BOOKMARK)
 		return (0);
 
+	if ((flags & ZFS_ITER_BATCH) != 0) {
+		ret = zfs_iter_batch(zhp, B_TRUE, flags, func, data, min_txg,
+		    max_txg);
+		if (ret != ZFS_ERR_IOC_CMD_UNAVAIL)
+			return (ret);
+	}
+
 	zc.zc_simple = (flags & ZFS_ITER_SIMPLE) != 0;
 
 	zcmd_alloc_dst_nvlist(zhp->zfs_hdl, &zc, 0);
@@ -739,6 +739,7 @@ typedef struct send_dump_data {
 	boolean_t dryrun, parsable, progress, embed_data, std_out;
 	boolean_t large_block, compress, raw, holds;
 	boolean_t progressastitle;
+	const char *stream_compress;
 	int outfd;
 	boolean_t err;
 	nvlist_t *fss;
@@ -753,6 +754,16 @@ typedef struct send_dump_data {
 	uint64_t size;
 } send_dump_data_t;
 
+static enum lzc_send_flags
+lzc_flags_from_stream_compress(const char *stream_compress)
+{
+	if (stream_compress == NULL)
+		return (0);
+	if (strcmp(stream_compress, "zstd") == 0)
+		return (LZC_SEND_FLAG_STREAM_ZSTD);
+	return (LZC_SEND_FLAG_STREAM_LZ4);
+}
+
 static int
 zfs_send_space(zfs_handle_t *zhp, const char *snapname, const char *from,
     enum lzc_send_flags flags, uint64_t *spacep)
@@ -1189,6 +1200,7 @@ dump_snapshot(zfs_handle_t *zhp, void *arg)
 		flags |= LZC_SEND_FLAG_COMPRESS;
 	if (sdd->raw)
 		flags |= LZC_SEND_FLAG_RAW;
+	flags |= lzc_flags_from_stream_compress(sdd->stream_compress);
 
 	if (!sdd->doall && !isfromsnap && !istosnap) {
 		if (sdd->replicate) {
@@ -1609,6 +1621,7 @@ lzc_flags_from_sendflags(const sendflags_t *flags)
 		lzc_flags |= LZC_SEND_FLAG_RAW;
 	if (flags->saved)
 		lzc_flags |= LZC_SEND_FLAG_SAVED;
+	lzc_flags |= lzc_flags_from_stream_compress(flags->stream_compress);
 
 	return (lzc_flags);
 }
@@ -2415,6 +2428,7 @@ zfs_send_cb_impl(zfs_handle_t *zhp, const char *fromsnap, const char *tosnap,
 	sdd.embed_data = flags->embed_data;
 	sdd.compress = flags->compress;
 	sdd.raw = flags->raw;
+	sdd.stream_compress = flags->stream_compress;
 	sdd.holds = flags->holds;
 	sdd.filter_cb = filter_func;
 	sdd.filter_cb_arg = cb_arg;
@@ -90,6 +90,7 @@
 #include <sys/nvpair.h>
 #include <sys/param.h>
 #include <sys/types.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/zfs_ioctl.h>
 #if __FreeBSD__
@@ -806,6 +807,12 @@ lzc_send_wrapper(int (*func)(int, void *), int orig_fd, void *data)
  * If "flags" contains LZC_SEND_FLAG_RAW, the stream is generated, for encrypted
  * datasets, by sending data exactly as it exists on disk.  This allows backups
  * to be taken even if encryption keys are not currently loaded.
+ *
+ * If "flags" contains LZC_SEND_FLAG_STREAM_LZ4 or LZC_SEND_FLAG_STREAM_ZSTD,
+ * DRR_WRITE records which would otherwise carry uncompressed data are
+ * compressed with that algorithm for transport, and decompressed again by the
+ * receiving system, which must support the stream compression feature.  This
+ * has no effect on raw streams.
  */
 int
 lzc_send(const char *snapname, const char *from, int fd,
@@ -867,6 +874,10 @@ lzc_send_resume_redacted_cb_impl(const char *snapname, const char *from, int fd,
 		fnvlist_add_boolean(args, "rawok");
 	if (flags & LZC_SEND_FLAG_SAVED)
 		fnvlist_add_boolean(args, "savedok");
+	if (flags & LZC_SEND_FLAG_STREAM_ZSTD)
+		fnvlist_add_string(args, "streamcompress", "zstd");
+	else if (flags & LZC_SEND_FLAG_STREAM_LZ4)
+		fnvlist_add_string(args, "streamcompress", "lz4");
 	if (resumeobj != 0 || resumeoff != 0) {
 		fnvlist_add_uint64(args, "resume_object", resumeobj);
 		fnvlist_add_uint64(args, "resume_offset", resumeoff);
@@ -951,6 +962,10 @@ lzc_send_space_resume_redacted_cb_impl(const char *snapname, const char *from,
 		fnvlist_add_boolean(args, "compressok");
 	if (flags & LZC_SEND_FLAG_RAW)
 		fnvlist_add_boolean(args, "rawok");
+	if (flags & LZC_SEND_FLAG_STREAM_ZSTD)
+		fnvlist_add_string(args, "streamcompress", "zstd");
+	else if (flags & LZC_SEND_FLAG_STREAM_LZ4)
+		fnvlist_add_string(args, "streamcompress", "lz4");
 	if (resumeobj != 0 || resumeoff != 0) {
 		fnvlist_add_uint64(args, "resume_object", resumeobj);
 		fnvlist_add_uint64(args, "resume_offset", resumeoff);
@@ -1994,3 +2009,59 @@ lzc_ddt_prune(const char *pool, zpool_ddt_prune_unit_t unit, uint64_t amount)
 
 	return (error);
 }
+
+/*
+ * Clone a batch of file ranges with block cloning.  fd is any open file on
+ * a ZFS file system in the pool; each entry names its own source and
+ * destination descriptors.  On success, the len and error fields of each
+ * entry report how many bytes were cloned and why a range failed, if it
+ * did.  Returns an error only if the batch as a whole was rejected.
+ */
+int
+lzc_clone_range_batch(int fd, zfs_clone_batch_ent_t *ents, uint64_t count)
+{
+	zfs_clone_batch_args_t args = {
+		.ents = (uint64_t)(uintptr_t)ents,
+		.count = count,
+		.flags = 0,
+	};
+
+	if (ioctl(fd, ZFS_IOC_CLONE_BATCH, &args) < 0)
+		return (errno);
+
+	return (0);
+}
+
+/*
+ * Look up the path and stats of each of the count objects in objs in the
+ * given filesystem or snapshot with a single ioctl.  On success, *resultp
+ * is an nvlist keyed by object number, where each entry holds the error
+ * from looking up that object and, when they are known, its path and
+ * stats.  At most ZFS_OBJ_STATS_BATCH_MAX objects may be passed at once.
+ */
+int
+lzc_obj_to_stats_batch(const char *fsname, const uint64_t *objs,
+    uint_t count, nvlist_t **resultp)
+{
+	nvlist_t *args = fnvlist_alloc();
+	int error;
+
+	fnvlist_add_uint64_array(args, ZFS_OBJ_STATS_OBJECTS, objs, count);
+	error = lzc_ioctl(ZFS_IOC_OBJ_TO_STATS_BATCH, fsname, args, resultp);
+	fnvlist_free(args);
+
+	return (error);
+}
+
+/*
+ * List the child filesystems, or with ZFS_LIST_BATCH_SNAPSHOTS the
+ * snapshots, of fsname, many datasets per call.  args holds the
+ * ZFS_IOC_LIST_BATCH options, including the cursor returned in *resultp by
+ * the previous call.  *resultp holds the datasets, in listing order, and
+ * the cursor to continue from if there are more.
+ */
+int
+lzc_list_batch(const char *fsname, nvlist_t *args, nvlist_t **resultp)
+{
+	return (lzc_ioctl(ZFS_IOC_LIST_BATCH, fsname, args, resultp));
+}
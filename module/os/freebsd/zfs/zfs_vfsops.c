@@ -1746,6 +1746,12 @@ zfs_umount(vfs_t *vfsp, int fflag)
 			return (ret);
 	}
 
+	/*
+	 * The offline dedup scan holds vnodes of its own; stop it before
+	 * flushing.
+	 */
+	zfs_dedup_scan_stop_wait(zfsvfs);
+
 	if (fflag & MS_FORCE) {
 		/*
 		 * Mark file system as unmounted before calling
@@ -93,6 +93,7 @@
 
 #include <vm/vm_object.h>
 
+#include <sys/capsicum.h>
 #include <sys/extattr.h>
 #include <sys/priv.h>
 
@@ -336,6 +337,107 @@ zfs_ioctl_setxattr(vnode_t *vp, zfsxattr_t *fsx, cred_t *cr)
 	return (err);
 }
 
+extern struct vop_vector zfs_vnodeops;
+
+/*
+ * ZFS_IOC_CLONE_BATCH.  All destination files must live on the same file
+ * system as vp, so that a single vn_start_write() covers the batch.
+ */
+static int
+zfs_ioctl_clone_batch(vnode_t *vp, zfs_clone_batch_args_t *args, cred_t *cr)
+{
+	kthread_t *td = curthread;
+	zfs_clone_batch_ent_t *ents;
+	zfs_clone_range_t *zcr;
+	struct file **files;
+	struct mount *mp;
+	size_t entsize;
+	uint64_t count;
+	int error;
+
+	if (args->flags != 0 || args->count > ZFS_CLONE_BATCH_MAX)
+		return (SET_ERROR(EINVAL));
+	if (args->count == 0)
+		return (0);
+	if (!zfs_bclone_enabled)
+		return (SET_ERROR(EOPNOTSUPP));
+
+	count = args->count;
+	entsize = count * sizeof (*ents);
+	ents = kmem_alloc(entsize, KM_SLEEP);
+	error = copyin((void *)(uintptr_t)args->ents, ents, entsize);
+	if (error != 0) {
+		kmem_free(ents, entsize);
+		return (error);
+	}
+
+	zcr = kmem_zalloc(count * sizeof (*zcr), KM_SLEEP);
+	files = kmem_zalloc(count * 2 * sizeof (*files), KM_SLEEP);
+
+	for (uint64_t i = 0; i < count; i++) {
+		vnode_t *invp, *outvp;
+
+		if (getvnode(td, ents[i].src_fd, &cap_read_rights,
+		    &files[2 * i]) != 0 ||
+		    getvnode(td, ents[i].dst_fd, &cap_write_rights,
+		    &files[2 * i + 1]) != 0 ||
+		    (files[2 * i]->f_flag & FREAD) == 0 ||
+		    (files[2 * i + 1]->f_flag & FWRITE) == 0 ||
+		    (files[2 * i + 1]->f_flag & O_APPEND) != 0) {
+			zcr[i].zcr_error = SET_ERROR(EBADF);
+			continue;
+		}
+		invp = files[2 * i]->f_vnode;
+		outvp = files[2 * i + 1]->f_vnode;
+		if (invp->v_op != &zfs_vnodeops || invp->v_type != VREG ||
+		    outvp->v_op != &zfs_vnodeops || outvp->v_type != VREG) {
+			zcr[i].zcr_error = SET_ERROR(EBADF);
+			continue;
+		}
+		if (outvp->v_mount != vp->v_mount) {
+			zcr[i].zcr_error = SET_ERROR(EXDEV);
+			continue;
+		}
+		if ((off_t)ents[i].src_off < 0 || (off_t)ents[i].dst_off < 0 ||
+		    (off_t)ents[i].len < 0 ||
+		    ents[i].len > OFF_MAX - ents[i].src_off ||
+		    ents[i].len > OFF_MAX - ents[i].dst_off) {
+			zcr[i].zcr_error = SET_ERROR(EINVAL);
+			continue;
+		}
+
+		zcr[i].zcr_inzp = VTOZ(invp);
+		zcr[i].zcr_outzp = VTOZ(outvp);
+		zcr[i].zcr_inoff = ents[i].src_off;
+		zcr[i].zcr_outoff = ents[i].dst_off;
+		zcr[i].zcr_len = ents[i].len;
+	}
+
+	error = vn_start_write(vp, &mp, V_WAIT);
+	if (error == 0) {
+		zfs_clone_range_batch(zcr, count, cr);
+		vn_finished_write(mp);
+	}
+
+	for (uint64_t i = 0; i < count; i++) {
+		ents[i].len = zcr[i].zcr_len;
+		ents[i].error = zcr[i].zcr_error;
+		if (files[2 * i] != NULL)
+			fdrop(files[2 * i], td);
+		if (files[2 * i + 1] != NULL)
+			fdrop(files[2 * i + 1], td);
+	}
+
+	if (error == 0)
+		error = copyout(ents, (void *)(uintptr_t)args->ents, entsize);
+
+	kmem_free(files, count * 2 * sizeof (*files));
+	kmem_free(zcr, count * sizeof (*zcr));
+	kmem_free(ents, entsize);
+
+	return (error);
+}
+
 static int
 zfs_ioctl(vnode_t *vp, ulong_t com, intptr_t data, int flag, cred_t *cred,
     int *rvalp)
@@ -405,6 +507,14 @@ zfs_ioctl(vnode_t *vp, ulong_t com, intptr_t data, int flag, cred_t *cred,
 		VOP_UNLOCK(vp);
 		return (error);
 	}
+	case ZFS_IOC_DEDUP_SCAN: {
+		zfs_dedup_scan_args_t *args = (zfs_dedup_scan_args_t *)data;
+		return (zfs_dedup_scan(VTOZ(vp), args->flags));
+	}
+	case ZFS_IOC_CLONE_BATCH: {
+		zfs_clone_batch_args_t *args = (zfs_clone_batch_args_t *)data;
+		return (zfs_ioctl_clone_batch(vp, args, cred));
+	}
 	}
 	return (SET_ERROR(ENOTTY));
 }
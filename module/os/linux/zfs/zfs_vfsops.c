@@ -1636,6 +1636,7 @@ zfs_preumount(struct super_block *sb)
 	/* zfsvfs is NULL when zfs_domount fails during mount */
 	if (zfsvfs) {
 		zfs_unlinked_drain_stop_wait(zfsvfs);
+		zfs_dedup_scan_stop_wait(zfsvfs);
 		zfsctl_destroy(sb->s_fs_info);
 		/*
 		 * Wait for zrele_async before entering evict_inodes in
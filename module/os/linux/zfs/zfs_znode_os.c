@@ -543,6 +543,7 @@ zfs_znode_alloc(zfsvfs_t *zfsvfs, dmu_buf_t *db, int blksz,
 	zp->z_blksz = blksz;
 	zp->z_seq = 0x7A4653;
 	zp->z_sync_cnt = 0;
+	zp->z_replay_eof = 0;
 
 	zfs_znode_sa_init(zfsvfs, zp, db, obj_type, hdl);
 
@@ -1017,6 +1017,24 @@ zpl_ioctl_rewrite(struct file *filp, void __user *arg)
 	return (err);
 }
 
+static int
+zpl_ioctl_dedup_scan(struct file *filp, void __user *arg)
+{
+	struct inode *ip = file_inode(filp);
+	zfs_dedup_scan_args_t args;
+	fstrans_cookie_t cookie;
+	int err;
+
+	if (copy_from_user(&args, arg, sizeof (args)))
+		return (-EFAULT);
+
+	cookie = spl_fstrans_mark();
+	err = -zfs_dedup_scan(ITOZ(ip), args.flags);
+	spl_fstrans_unmark(cookie);
+
+	return (err);
+}
+
 static long
 zpl_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
@@ -1037,6 +1055,10 @@ zpl_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		return (zpl_ioctl_setdosflags(filp, (void *)arg));
 	case ZFS_IOC_REWRITE:
 		return (zpl_ioctl_rewrite(filp, (void *)arg));
+	case ZFS_IOC_DEDUP_SCAN:
+		return (zpl_ioctl_dedup_scan(filp, (void *)arg));
+	case ZFS_IOC_CLONE_BATCH:
+		return (zpl_ioctl_clone_batch(filp, (void *)arg));
 	default:
 		return (-ENOTTY);
 	}
@@ -26,6 +26,7 @@
 #ifdef CONFIG_COMPAT
 #include <linux/compat.h>
 #endif
+#include <linux/file.h>
 #include <linux/fs.h>
 #ifdef HAVE_VFS_SPLICE_COPY_FILE_RANGE
 #include <linux/splice.h>
@@ -212,3 +213,143 @@ zpl_dedupe_file_range(struct file *src_file, loff_t src_off,
 	return (-EOPNOTSUPP);
 }
 #endif /* HAVE_VFS_DEDUPE_FILE_RANGE */
+
+/*
+ * The checks vfs_clone_file_range() and remap_verify_area() make before
+ * calling into FICLONERANGE, for an entry of a batch, which doesn't go
+ * through the VFS. The remaining checks are made by zfs_clone_range_batch()
+ * itself. All the destinations must be on the file system of the ioctl, so
+ * that the freeze protection taken for it covers the whole batch.
+ */
+static int
+zpl_clone_batch_verify(struct file *filp, struct file *src, struct file *dst,
+    const zfs_clone_batch_ent_t *ent)
+{
+	struct inode *src_i = file_inode(src);
+	struct inode *dst_i = file_inode(dst);
+
+	if (src->f_op != &zpl_file_operations ||
+	    dst->f_op != &zpl_file_operations ||
+	    !(src->f_mode & FMODE_READ) ||
+	    !(dst->f_mode & FMODE_WRITE) ||
+	    (dst->f_flags & O_APPEND))
+		return (EBADF);
+	if (dst_i->i_sb != file_inode(filp)->i_sb)
+		return (EXDEV);
+	if (S_ISDIR(src_i->i_mode) || S_ISDIR(dst_i->i_mode))
+		return (EISDIR);
+	if (!S_ISREG(src_i->i_mode) || !S_ISREG(dst_i->i_mode))
+		return (EINVAL);
+	if (IS_IMMUTABLE(dst_i))
+		return (EPERM);
+	if (IS_SWAPFILE(src_i) || IS_SWAPFILE(dst_i))
+		return (ETXTBSY);
+
+	/* Offsets and lengths are loff_t to the VFS; none may wrap. */
+	if ((loff_t)ent->src_off < 0 || (loff_t)ent->dst_off < 0 ||
+	    (loff_t)ent->len < 0 ||
+	    ent->len > LLONG_MAX - ent->src_off ||
+	    ent->len > LLONG_MAX - ent->dst_off)
+		return (EINVAL);
+	if ((loff_t)(ent->dst_off + ent->len) > dst_i->i_sb->s_maxbytes)
+		return (EFBIG);
+
+	return (0);
+}
+
+/*
+ * Entry point for ZFS_IOC_CLONE_BATCH. Clone a list of ranges, possibly
+ * between many different pairs of files, in as few transactions as
+ * zfs_clone_range_batch() can manage. The outcome of each range is written
+ * back to its entry; the ioctl itself only fails if the request as a whole
+ * is malformed.
+ *
+ * Unlike zpl_clone_file_range_impl() we don't take the inode locks, as a
+ * batch may name any number of files in any order; the range locks taken
+ * by zfs_clone_range_batch() are enough to keep the ranges stable. Freeze
+ * protection, which the VFS takes for FICLONERANGE, is taken here.
+ */
+int
+zpl_ioctl_clone_batch(struct file *filp, void __user *arg)
+{
+	zfs_clone_batch_args_t args;
+	zfs_clone_batch_ent_t *ents;
+	zfs_clone_range_t *zcr;
+	struct file **files;
+	cred_t *cr = CRED();
+	fstrans_cookie_t cookie;
+	size_t entsize;
+	uint64_t count;
+	int err = 0;
+
+	if (copy_from_user(&args, arg, sizeof (args)))
+		return (-EFAULT);
+
+	if (args.flags != 0 || args.count > ZFS_CLONE_BATCH_MAX)
+		return (-EINVAL);
+	if (args.count == 0)
+		return (0);
+
+	if (!zfs_bclone_enabled)
+		return (-EOPNOTSUPP);
+
+	count = args.count;
+	entsize = count * sizeof (*ents);
+	ents = vmem_alloc(entsize, KM_SLEEP);
+	if (copy_from_user(ents, (void __user *)(uintptr_t)args.ents,
+	    entsize)) {
+		vmem_free(ents, entsize);
+		return (-EFAULT);
+	}
+
+	zcr = vmem_zalloc(count * sizeof (*zcr), KM_SLEEP);
+	files = vmem_zalloc(count * 2 * sizeof (*files), KM_SLEEP);
+
+	for (uint64_t i = 0; i < count; i++) {
+		struct file *src, *dst;
+
+		src = files[2 * i] = fget(ents[i].src_fd);
+		dst = files[2 * i + 1] = fget(ents[i].dst_fd);
+
+		if (src == NULL || dst == NULL) {
+			zcr[i].zcr_error = EBADF;
+			continue;
+		}
+		zcr[i].zcr_error = zpl_clone_batch_verify(filp, src, dst,
+		    &ents[i]);
+		if (zcr[i].zcr_error != 0)
+			continue;
+
+		zcr[i].zcr_inzp = ITOZ(file_inode(src));
+		zcr[i].zcr_outzp = ITOZ(file_inode(dst));
+		zcr[i].zcr_inoff = ents[i].src_off;
+		zcr[i].zcr_outoff = ents[i].dst_off;
+		zcr[i].zcr_len = ents[i].len;
+	}
+
+	sb_start_write(file_inode(filp)->i_sb);
+	crhold(cr);
+	cookie = spl_fstrans_mark();
+	zfs_clone_range_batch(zcr, count, cr);
+	spl_fstrans_unmark(cookie);
+	crfree(cr);
+	sb_end_write(file_inode(filp)->i_sb);
+
+	for (uint64_t i = 0; i < count; i++) {
+		ents[i].len = zcr[i].zcr_len;
+		ents[i].error = zcr[i].zcr_error;
+		if (files[2 * i] != NULL)
+			fput(files[2 * i]);
+		if (files[2 * i + 1] != NULL)
+			fput(files[2 * i + 1]);
+	}
+
+	if (copy_to_user((void __user *)(uintptr_t)args.ents, ents, entsize))
+		err = -EFAULT;
+
+	vmem_free(files, count * 2 * sizeof (*files));
+	vmem_free(zcr, count * sizeof (*zcr));
+	vmem_free(ents, entsize);
+
+	return (err);
+}
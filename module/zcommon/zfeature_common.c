@@ -810,6 +810,24 @@ zpool_feature_init(void)
 		    ZFEATURE_TYPE_BOOLEAN, physical_rewrite_deps, sfeatures);
 	}
 
+	{
+		static const spa_feature_t change_log_deps[] = {
+			SPA_FEATURE_EXTENSIBLE_DATASET,
+			SPA_FEATURE_NONE
+		};
+		zfeature_register(SPA_FEATURE_CHANGE_LOG,
+		    "org.openzfs:change_log", "change_log",
+		    "Per-dataset log of changed objects.",
+		    ZFEATURE_FLAG_READONLY_COMPAT, ZFEATURE_TYPE_BOOLEAN,
+		    change_log_deps, sfeatures);
+	}
+
+	zfeature_register(SPA_FEATURE_SCAN_SPILL,
+	    "org.openzfs:scan_spill", "scan_spill",
+	    "Sorted scan queues spilled to disk.",
+	    ZFEATURE_FLAG_READONLY_COMPAT, ZFEATURE_TYPE_BOOLEAN, NULL,
+	    sfeatures);
+
 	zfs_mod_list_supported_free(sfeatures);
 }
 
@@ -0,0 +1,146 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or https://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/bloom.h>
+
+/*
+ * A plain bloom filter, shared by the DDT and BRT lookup filters.
+ *
+ * The bit array is a power of 2 in size, and each key sets bl_nhash bits
+ * chosen by double hashing of its two words. Keys can't be removed, so a
+ * filter only grows more permissive until it is rebuilt; the users size it
+ * for some headroom, and rebuild it with bloom_resize() once they outgrow
+ * it. Inserts may race with each other and with lookups, but not with
+ * bloom_resize() or bloom_destroy(), which the users serialize.
+ */
+
+static uint64_t
+bloom_mix(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return (x);
+}
+
+static uint64_t
+bloom_nbits(uint64_t capacity, uint_t bits_per_entry)
+{
+	return (1ULL << highbit64(capacity * bits_per_entry - 1));
+}
+
+/*
+ * Returns the size in bytes of the bit array of a filter for capacity
+ * entries.
+ */
+uint64_t
+bloom_size(uint64_t capacity, uint_t bits_per_entry)
+{
+	return (bloom_nbits(capacity, bits_per_entry) / NBBY);
+}
+
+static void
+bloom_setup(bloom_t *bl, uint64_t capacity, uint_t bits_per_entry)
+{
+	bl->bl_capacity = capacity;
+	bl->bl_bpe = bits_per_entry;
+	/* ln(2) * bits per entry is optimal */
+	bl->bl_nhash = MIN(MAX(bits_per_entry * 69 / 100, 1), 16);
+}
+
+void
+bloom_create(bloom_t *bl, uint64_t capacity, uint_t bits_per_entry)
+{
+	ASSERT3U(capacity, >, 0);
+	ASSERT3U(bits_per_entry, >, 0);
+
+	bloom_setup(bl, capacity, bits_per_entry);
+	bl->bl_nbits = bloom_nbits(capacity, bits_per_entry);
+	bl->bl_bits = vmem_zalloc(bl->bl_nbits / NBBY, KM_SLEEP);
+}
+
+/*
+ * Empty the filter and size it for a new capacity. The bit array is reused
+ * if it is already the right size, and otherwise freed before the new one is
+ * allocated.
+ */
+void
+bloom_resize(bloom_t *bl, uint64_t capacity, uint_t bits_per_entry)
+{
+	uint64_t nbits = bloom_nbits(capacity, bits_per_entry);
+
+	if (nbits == bl->bl_nbits) {
+		memset(bl->bl_bits, 0, nbits / NBBY);
+		bloom_setup(bl, capacity, bits_per_entry);
+	} else {
+		bloom_destroy(bl);
+		bloom_create(bl, capacity, bits_per_entry);
+	}
+}
+
+void
+bloom_destroy(bloom_t *bl)
+{
+	vmem_free(bl->bl_bits, bl->bl_nbits / NBBY);
+	bl->bl_bits = NULL;
+	bl->bl_nbits = 0;
+}
+
+void
+bloom_insert(bloom_t *bl, uint64_t k1, uint64_t k2)
+{
+	uint64_t mask = bl->bl_nbits - 1;
+	uint64_t h1 = bloom_mix(k1);
+	uint64_t h2 = bloom_mix(k2) | 1;
+
+	for (uint_t i = 0; i < bl->bl_nhash; i++) {
+		uint64_t bit = (h1 + i * h2) & mask;
+		uint64_t *word = &bl->bl_bits[bit >> 6];
+		uint64_t set = 1ULL << (bit & 63);
+
+		if ((*word & set) == 0)
+			atomic_or_64(word, set);
+	}
+}
+
+/*
+ * Returns false if the key was certainly never inserted.
+ */
+boolean_t
+bloom_contains(const bloom_t *bl, uint64_t k1, uint64_t k2)
+{
+	uint64_t mask = bl->bl_nbits - 1;
+	uint64_t h1 = bloom_mix(k1);
+	uint64_t h2 = bloom_mix(k2) | 1;
+
+	for (uint_t i = 0; i < bl->bl_nhash; i++) {
+		uint64_t bit = (h1 + i * h2) & mask;
+
+		if ((bl->bl_bits[bit >> 6] & (1ULL << (bit & 63))) == 0)
+			return (B_FALSE);
+	}
+
+	return (B_TRUE);
+}
@@ -148,6 +148,39 @@ bptree_add(objset_t *os, uint64_t obj, blkptr_t *bp, uint64_t birth_txg,
 	dmu_buf_rele(db, FTAG);
 }
 
+/*
+ * Copy out the first entry of the bptree that still has blocks to free,
+ * including the bookmark its traversal resumes from.  Returns ENOENT if
+ * there is none.
+ */
+int
+bptree_first(objset_t *os, uint64_t obj, bptree_entry_phys_t *btep)
+{
+	dmu_buf_t *db;
+	bptree_phys_t *bt;
+	int err;
+
+	err = dmu_bonus_hold(os, obj, FTAG, &db);
+	if (err != 0)
+		return (err);
+	bt = db->db_data;
+
+	err = SET_ERROR(ENOENT);
+	for (uint64_t i = bt->bt_begin; i < bt->bt_end; i++) {
+		err = dmu_read(os, obj, i * sizeof (*btep), sizeof (*btep),
+		    btep, DMU_READ_NO_PREFETCH);
+		if (err != 0)
+			break;
+		/* skip entries finished after an i/o error */
+		if (btep->be_birth_txg != UINT64_MAX)
+			break;
+		err = SET_ERROR(ENOENT);
+	}
+	dmu_buf_rele(db, FTAG);
+
+	return (err);
+}
+
 static int
 bptree_visit_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
     const zbookmark_phys_t *zb, const dnode_phys_t *dnp, void *arg)
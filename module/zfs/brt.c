@@ -40,6 +40,7 @@
 #include <sys/vdev_impl.h>
 #include <sys/kstat.h>
 #include <sys/wmsum.h>
+#include <sys/bloom.h>
 
 /*
  * Block Cloning design.
@@ -263,6 +264,26 @@ static int brt_zap_prefetch = 1;
 static int brt_zap_default_bs = 12;
 static int brt_zap_default_ibs = 12;
 
+/*
+ * Bits of per-vdev lookup filter per cloned block. 10 bits gives a false
+ * positive rate of about 1% when the filter is full. Zero disables the
+ * filter.
+ */
+static uint_t brt_filter_bits = 10;
+
+/*
+ * Maximum number of BRT entries to walk per vdev per txg while loading the
+ * lookup filter. The entries ZAP is prefetched a txg before the walk starts,
+ * so the walk mostly finds it cached.
+ */
+static uint_t brt_filter_load_per_txg = 100000;
+
+/*
+ * Maximum size of the lookup filter of a vdev, in bytes. If the vdev
+ * outgrows it, the filter is dropped.
+ */
+static uint64_t brt_filter_max_size = 16 << 20;
+
 static kstat_t	*brt_ksp;
 
 typedef struct brt_stats {
@@ -276,6 +297,9 @@ typedef struct brt_stats {
 	kstat_named_t brt_decref_free_data_later;
 	kstat_named_t brt_decref_free_data_now;
 	kstat_named_t brt_decref_no_entry;
+	kstat_named_t brt_filter_hit;
+	kstat_named_t brt_filter_miss;
+	kstat_named_t brt_filter_size;
 } brt_stats_t;
 
 static brt_stats_t brt_stats = {
@@ -288,7 +312,10 @@ static brt_stats_t brt_stats = {
 	{ "decref_entry_still_referenced",	KSTAT_DATA_UINT64 },
 	{ "decref_free_data_later",		KSTAT_DATA_UINT64 },
 	{ "decref_free_data_now",		KSTAT_DATA_UINT64 },
-	{ "decref_no_entry",			KSTAT_DATA_UINT64 }
+	{ "decref_no_entry",			KSTAT_DATA_UINT64 },
+	{ "filter_hit",				KSTAT_DATA_UINT64 },
+	{ "filter_miss",			KSTAT_DATA_UINT64 },
+	{ "filter_size",			KSTAT_DATA_UINT64 }
 };
 
 struct {
@@ -302,6 +329,9 @@ struct {
 	wmsum_t brt_decref_free_data_later;
 	wmsum_t brt_decref_free_data_now;
 	wmsum_t brt_decref_no_entry;
+	wmsum_t brt_filter_hit;
+	wmsum_t brt_filter_miss;
+	wmsum_t brt_filter_size;
 } brt_sums;
 
 #define	BRTSTAT_BUMP(stat)	wmsum_add(&brt_sums.stat, 1)
@@ -419,6 +449,230 @@ brt_vdev_dump(brt_vdev_t *brtvd)
 }
 #endif
 
+/*
+ * Lookup filter.
+ *
+ * The entcount array only tells us that some block in a BRT_RANGESIZE range
+ * of the vdev was cloned. On a pool with a lot of cloning most ranges have
+ * an entry, so most frees still end up looking up the BRT ZAP. To avoid most
+ * of these lookups, each BRT vdev keeps an in-core bloom filter over the
+ * offsets of its cloned blocks, consulted by brt_maybe_exists() after the
+ * entcount.
+ *
+ * Offsets are added in syncing context by brt_pending_apply_vdev(), before
+ * their references become visible to brt_maybe_exists(). Offsets are never
+ * removed; a block that leaves the BRT remains as a false positive until the
+ * filter is rebuilt. The filter is sized for twice the number of entries when
+ * it is created, and rebuilt at twice the size when the vdev outgrows it,
+ * reusing its bit array if it is already big enough. A filter that would be
+ * larger than brt_filter_max_size is not created, and lookups go to the ZAP.
+ * The bloom filter itself is shared with the DDT.
+ *
+ * A new filter knows nothing about the entries that were already in the ZAP,
+ * so it is not consulted until it has been loaded by walking the ZAP, a
+ * limited number of entries per txg so that pool import is not delayed. The
+ * ZAP is prefetched a txg before the walk starts.
+ *
+ * The filter is only replaced or freed in syncing context with bv_lock held
+ * as writer, and read by brt_maybe_exists() with bv_lock held as reader.
+ */
+
+/* Smallest filter, in entries. */
+#define	BRT_FILTER_MIN_ENTRIES	(1ULL << 14)
+
+typedef struct brt_filter {
+	bloom_t		bf_bloom;
+	boolean_t	bf_loaded;	/* all ZAP entries have been added */
+	boolean_t	bf_prefetched;	/* ZAP prefetch has been issued */
+	uint64_t	bf_cursor;	/* load walk position (serialized) */
+} brt_filter_t;
+
+/*
+ * Block offsets are sector aligned and clustered, but the filter mixes both
+ * words of its keys, so the second word only has to differ from the first.
+ */
+#define	BRT_FILTER_KEY2(offset)	((offset) ^ 0x9e3779b97f4a7c15ULL)
+
+static uint64_t
+brt_filter_capacity(uint64_t entries)
+{
+	return (MAX(entries * 2, BRT_FILTER_MIN_ENTRIES));
+}
+
+static void
+brt_filter_destroy(brt_filter_t *bf)
+{
+	bloom_destroy(&bf->bf_bloom);
+	kmem_free(bf, sizeof (brt_filter_t));
+}
+
+static void
+brt_filter_insert(brt_filter_t *bf, uint64_t offset)
+{
+	bloom_insert(&bf->bf_bloom, offset, BRT_FILTER_KEY2(offset));
+}
+
+static boolean_t
+brt_filter_contains(const brt_filter_t *bf, uint64_t offset)
+{
+	ASSERT(bf->bf_loaded);
+
+	return (bloom_contains(&bf->bf_bloom, offset,
+	    BRT_FILTER_KEY2(offset)));
+}
+
+/*
+ * Replace the filter of the BRT vdev, or remove it if bf is NULL. Returns
+ * the old filter.
+ */
+static brt_filter_t *
+brt_vdev_filter_swap(brt_vdev_t *brtvd, brt_filter_t *bf)
+{
+	brt_filter_t *old;
+
+	rw_enter(&brtvd->bv_lock, RW_WRITER);
+	old = brtvd->bv_filter;
+	brtvd->bv_filter = bf;
+	rw_exit(&brtvd->bv_lock);
+
+	if (old != NULL) {
+		wmsum_add(&brt_sums.brt_filter_size,
+		    -(int64_t)(old->bf_bloom.bl_nbits / NBBY));
+	}
+	if (bf != NULL) {
+		wmsum_add(&brt_sums.brt_filter_size,
+		    bf->bf_bloom.bl_nbits / NBBY);
+	}
+
+	return (old);
+}
+
+/*
+ * Walk up to brt_filter_load_per_txg ZAP entries into the filter.
+ */
+static void
+brt_vdev_filter_load(spa_t *spa, brt_vdev_t *brtvd, brt_filter_t *bf)
+{
+	zap_cursor_t zc;
+	zap_attribute_t *za;
+	uint_t n = 0;
+	int error = ENOENT;
+
+	/*
+	 * Start reading the ZAP in, and give it a txg to arrive, rather
+	 * than walking it one leaf read at a time.
+	 */
+	if (brtvd->bv_mos_entries != 0 && !bf->bf_prefetched) {
+		(void) zap_prefetch_object(spa->spa_meta_objset,
+		    brtvd->bv_mos_entries);
+		bf->bf_prefetched = B_TRUE;
+		return;
+	}
+
+	if (brtvd->bv_mos_entries != 0) {
+		za = zap_attribute_alloc();
+		zap_cursor_init_serialized(&zc, spa->spa_meta_objset,
+		    brtvd->bv_mos_entries, bf->bf_cursor);
+		while (n < brt_filter_load_per_txg &&
+		    (error = zap_cursor_retrieve(&zc, za)) == 0) {
+			brt_filter_insert(bf, *(const uint64_t *)za->za_name);
+			zap_cursor_advance(&zc);
+			n++;
+		}
+		bf->bf_cursor = zap_cursor_serialize(&zc);
+		zap_cursor_fini(&zc);
+		zap_attribute_free(za);
+	}
+
+	if (error == 0)
+		return;
+	if (error != ENOENT) {
+		/*
+		 * Leave the filter unloaded (and so unused) rather than risk
+		 * it missing an entry; the walk will be retried next txg.
+		 */
+		zfs_dbgmsg("brt filter load failed for %s vdev %llu: %d",
+		    spa_name(spa), (u_longlong_t)brtvd->bv_vdevid, error);
+		return;
+	}
+
+	membar_producer();
+	bf->bf_loaded = B_TRUE;
+}
+
+/*
+ * Called in syncing context from brt_pending_apply_vdev(), before any new
+ * references are applied. Creates, rebuilds, removes and loads the filter as
+ * needed.
+ */
+static void
+brt_vdev_filter_sync(spa_t *spa, brt_vdev_t *brtvd)
+{
+	brt_filter_t *bf = brtvd->bv_filter;
+	uint_t bits = brt_filter_bits;
+
+	/* Nothing to filter until the vdev has entries. */
+	if (!brtvd->bv_initiated)
+		return;
+
+	if (bits == 0) {
+		if (bf != NULL)
+			brt_filter_destroy(brt_vdev_filter_swap(brtvd, NULL));
+		return;
+	}
+
+	if (bf == NULL || brtvd->bv_totalcount > bf->bf_bloom.bl_capacity ||
+	    bits != bf->bf_bloom.bl_bpe) {
+		uint64_t capacity = brt_filter_capacity(brtvd->bv_totalcount);
+
+		/*
+		 * Detach the filter while it is rebuilt, so that the old and
+		 * new bit arrays never coexist. If the new one would be too
+		 * big, lookups go to the ZAP.
+		 */
+		if (bf != NULL)
+			(void) brt_vdev_filter_swap(brtvd, NULL);
+		if (bloom_size(capacity, bits) > brt_filter_max_size) {
+			if (bf != NULL) {
+				zfs_dbgmsg("brt filter for %s vdev %llu "
+				    "dropped, %llu entries exceed max size",
+				    spa_name(spa),
+				    (u_longlong_t)brtvd->bv_vdevid,
+				    (u_longlong_t)brtvd->bv_totalcount);
+				brt_filter_destroy(bf);
+			}
+			return;
+		}
+		if (bf == NULL) {
+			bf = kmem_zalloc(sizeof (brt_filter_t), KM_SLEEP);
+			bloom_create(&bf->bf_bloom, capacity, bits);
+		} else {
+			bloom_resize(&bf->bf_bloom, capacity, bits);
+			bf->bf_loaded = B_FALSE;
+			bf->bf_prefetched = B_FALSE;
+			bf->bf_cursor = 0;
+		}
+		(void) brt_vdev_filter_swap(brtvd, bf);
+	}
+
+	if (!bf->bf_loaded)
+		brt_vdev_filter_load(spa, brtvd, bf);
+}
+
+/*
+ * Returns false if the offset is certainly not in the BRT of this vdev.
+ * Only for use in syncing context, where the filter cannot change.
+ */
+static boolean_t
+brt_vdev_filter_maybe(brt_vdev_t *brtvd, uint64_t offset)
+{
+	brt_filter_t *bf = brtvd->bv_filter;
+
+	if (bf == NULL || !bf->bf_loaded)
+		return (B_TRUE);
+	return (brt_filter_contains(bf, offset));
+}
+
 static brt_vdev_t *
 brt_vdev(spa_t *spa, uint64_t vdevid, boolean_t alloc)
 {
@@ -613,6 +867,13 @@ brt_vdev_dealloc(brt_vdev_t *brtvd)
 	ASSERT(brtvd->bv_initiated);
 	ASSERT0(avl_numnodes(&brtvd->bv_tree));
 
+	if (brtvd->bv_filter != NULL) {
+		wmsum_add(&brt_sums.brt_filter_size,
+		    -(int64_t)(brtvd->bv_filter->bf_bloom.bl_nbits / NBBY));
+		brt_filter_destroy(brtvd->bv_filter);
+		brtvd->bv_filter = NULL;
+	}
+
 	vmem_free(brtvd->bv_entcount, sizeof (uint16_t) * brtvd->bv_size);
 	brtvd->bv_entcount = NULL;
 	uint64_t nblocks = BRT_RANGESIZE_TO_NBLOCKS(brtvd->bv_size);
@@ -918,7 +1179,30 @@ brt_maybe_exists(spa_t *spa, const blkptr_t *bp)
 	 * all brt_vdev_addref() have already completed by this point.
 	 */
 	uint64_t off = DVA_GET_OFFSET(&bp->blk_dva[0]);
-	return (brt_vdev_lookup(spa, brtvd, off));
+	if (!brt_vdev_lookup(spa, brtvd, off))
+		return (FALSE);
+
+	/*
+	 * The range has cloned blocks; ask the filter whether this is one of
+	 * them. The filter can be replaced in syncing context, so it is only
+	 * looked at under the lock.
+	 */
+	if (brtvd->bv_filter == NULL)
+		return (TRUE);
+
+	boolean_t maybe = TRUE;
+	rw_enter(&brtvd->bv_lock, RW_READER);
+	brt_filter_t *bf = brtvd->bv_filter;
+	if (bf != NULL && bf->bf_loaded) {
+		maybe = brt_filter_contains(bf, off);
+		if (maybe)
+			BRTSTAT_BUMP(brt_filter_hit);
+		else
+			BRTSTAT_BUMP(brt_filter_miss);
+	}
+	rw_exit(&brtvd->bv_lock);
+
+	return (maybe);
 }
 
 uint64_t
@@ -992,6 +1276,12 @@ brt_kstats_update(kstat_t *ksp, int rw)
 	    wmsum_value(&brt_sums.brt_decref_free_data_now);
 	bs->brt_decref_no_entry.value.ui64 =
 	    wmsum_value(&brt_sums.brt_decref_no_entry);
+	bs->brt_filter_hit.value.ui64 =
+	    wmsum_value(&brt_sums.brt_filter_hit);
+	bs->brt_filter_miss.value.ui64 =
+	    wmsum_value(&brt_sums.brt_filter_miss);
+	bs->brt_filter_size.value.ui64 =
+	    wmsum_value(&brt_sums.brt_filter_size);
 
 	return (0);
 }
@@ -1010,6 +1300,9 @@ brt_stat_init(void)
 	wmsum_init(&brt_sums.brt_decref_free_data_later, 0);
 	wmsum_init(&brt_sums.brt_decref_free_data_now, 0);
 	wmsum_init(&brt_sums.brt_decref_no_entry, 0);
+	wmsum_init(&brt_sums.brt_filter_hit, 0);
+	wmsum_init(&brt_sums.brt_filter_miss, 0);
+	wmsum_init(&brt_sums.brt_filter_size, 0);
 
 	brt_ksp = kstat_create("zfs", 0, "brtstats", "misc", KSTAT_TYPE_NAMED,
 	    sizeof (brt_stats) / sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
@@ -1038,6 +1331,9 @@ brt_stat_fini(void)
 	wmsum_fini(&brt_sums.brt_decref_free_data_later);
 	wmsum_fini(&brt_sums.brt_decref_free_data_now);
 	wmsum_fini(&brt_sums.brt_decref_no_entry);
+	wmsum_fini(&brt_sums.brt_filter_hit);
+	wmsum_fini(&brt_sums.brt_filter_miss);
+	wmsum_fini(&brt_sums.brt_filter_size);
 }
 
 void
@@ -1267,6 +1563,9 @@ brt_pending_apply_vdev(spa_t *spa, brt_vdev_t *brtvd, uint64_t txg)
 	 * are possible for the TXG.  So we don't need bv_pending_lock.
 	 */
 	ASSERT(avl_is_empty(&brtvd->bv_tree));
+
+	brt_vdev_filter_sync(spa, brtvd);
+
 	avl_swap(&brtvd->bv_tree, &brtvd->bv_pending_tree[txg & TXG_MASK]);
 
 	for (bre = avl_first(&brtvd->bv_tree); bre; bre = nbre) {
@@ -1296,7 +1595,8 @@ brt_pending_apply_vdev(spa_t *spa, brt_vdev_t *brtvd, uint64_t txg)
 		 */
 		uint64_t off = BRE_OFFSET(bre);
 		if (brtvd->bv_mos_entries != 0 &&
-		    brt_vdev_lookup(spa, brtvd, off)) {
+		    brt_vdev_lookup(spa, brtvd, off) &&
+		    brt_vdev_filter_maybe(brtvd, off)) {
 			int error;
 			if (brt_has_endian_fixed(spa)) {
 				error = zap_lookup_uint64_by_dnode(
@@ -1338,6 +1638,8 @@ brt_pending_apply_vdev(spa_t *spa, brt_vdev_t *brtvd, uint64_t txg)
 	 */
 	for (bre = avl_first(&brtvd->bv_tree); bre;
 	    bre = AVL_NEXT(&brtvd->bv_tree, bre)) {
+		if (brtvd->bv_filter != NULL)
+			brt_filter_insert(brtvd->bv_filter, BRE_OFFSET(bre));
 		brt_vdev_addref(spa, brtvd, bre,
 		    bp_get_dsize(spa, &bre->bre_bp), bre->bre_pcount);
 		bre->bre_count += bre->bre_pcount;
@@ -1525,3 +1827,9 @@ ZFS_MODULE_PARAM(zfs_brt, , brt_zap_default_bs, UINT, ZMOD_RW,
 	"BRT ZAP leaf blockshift");
 ZFS_MODULE_PARAM(zfs_brt, , brt_zap_default_ibs, UINT, ZMOD_RW,
 	"BRT ZAP indirect blockshift");
+ZFS_MODULE_PARAM(zfs_brt, , brt_filter_bits, UINT, ZMOD_RW,
+	"Bits of BRT lookup filter per cloned block, 0 to disable");
+ZFS_MODULE_PARAM(zfs_brt, , brt_filter_load_per_txg, UINT, ZMOD_RW,
+	"Max BRT entries per vdev to load into the lookup filter per txg");
+ZFS_MODULE_PARAM(zfs_brt, , brt_filter_max_size, U64, ZMOD_RW,
+	"Max size in bytes of the BRT lookup filter of a vdev");
@@ -178,6 +178,15 @@ dataset_kstats_create(dataset_kstats_t *dk, objset_t *objset)
 
 	dk->dk_kstats = kstat;
 	kstat_install(kstat);
+
+	/*
+	 * The ZIL latency histograms are too large for named kstats, so
+	 * they are exported as a separate table next to the dataset kstat.
+	 */
+	(void) snprintf(kstat_name, sizeof (kstat_name), "zil_latency-0x%llx",
+	    (unsigned long long)dmu_objset_id(objset));
+	dk->dk_zil_latency = zil_latency_kstat_create(kstat_module_name,
+	    kstat_name, &dk->dk_zil_sums);
 	return (0);
 }
 
@@ -187,6 +196,11 @@ dataset_kstats_destroy(dataset_kstats_t *dk)
 	if (dk->dk_kstats == NULL)
 		return;
 
+	if (dk->dk_zil_latency != NULL) {
+		kstat_delete(dk->dk_zil_latency);
+		dk->dk_zil_latency = NULL;
+	}
+
 	dataset_kstat_values_t *dkv = dk->dk_kstats->ks_data;
 	kstat_delete(dk->dk_kstats);
 	dk->dk_kstats = NULL;
@@ -290,6 +290,20 @@ boolean_t zfs_dedup_log_hard_cap = B_FALSE;
  */
 uint_t zfs_dedup_log_flush_flow_rate_txgs = 10;
 
+/*
+ * Number of key ranges each batch of entries being written to the DDT store
+ * objects is split into. The ranges, and the batches of different DDTs, are
+ * written concurrently on the pool's sync taskq. Zero writes them serially
+ * in the sync thread.
+ */
+static uint_t zfs_dedup_flush_tasks = 4;
+
+/*
+ * Maximum entries taken from a DDT for each batch written to the store
+ * objects. Log flush time limits are checked between batches.
+ */
+static uint_t zfs_dedup_flush_batch = 4096;
+
 static const ddt_ops_t *const ddt_ops[DDT_TYPES] = {
 	&ddt_zap_ops,
 };
@@ -331,10 +345,20 @@ typedef struct {
 	kstat_named_t dds_lookup_stored_hit;
 	kstat_named_t dds_lookup_stored_miss;
 
+	/* store lookup filter */
+	kstat_named_t dds_lookup_filter_hit;
+	kstat_named_t dds_lookup_filter_miss;
+	kstat_named_t dds_lookup_filter_false_positive;
+	kstat_named_t dds_filter_size;
+
 	/* number of entries on log trees */
 	kstat_named_t dds_log_active_entries;
 	kstat_named_t dds_log_flushing_entries;
 
+	/* in-core size of log trees, including packed entries */
+	kstat_named_t dds_log_active_mem;
+	kstat_named_t dds_log_flushing_mem;
+
 	/* avg updated/flushed entries per txg */
 	kstat_named_t dds_log_ingest_rate;
 	kstat_named_t dds_log_flush_rate;
@@ -354,8 +378,14 @@ static const ddt_kstats_t ddt_kstats_template = {
 	{ "lookup_log_miss",		KSTAT_DATA_UINT64 },
 	{ "lookup_stored_hit",		KSTAT_DATA_UINT64 },
 	{ "lookup_stored_miss",		KSTAT_DATA_UINT64 },
+	{ "lookup_filter_hit",		KSTAT_DATA_UINT64 },
+	{ "lookup_filter_miss",		KSTAT_DATA_UINT64 },
+	{ "lookup_filter_false_positive", KSTAT_DATA_UINT64 },
+	{ "filter_size",		KSTAT_DATA_UINT64 },
 	{ "log_active_entries",		KSTAT_DATA_UINT64 },
 	{ "log_flushing_entries",	KSTAT_DATA_UINT64 },
+	{ "log_active_mem",		KSTAT_DATA_UINT64 },
+	{ "log_flushing_mem",		KSTAT_DATA_UINT64 },
 	{ "log_ingest_rate",		KSTAT_DATA_UINT32 },
 	{ "log_flush_rate",		KSTAT_DATA_UINT32 },
 	{ "log_flush_time_rate",	KSTAT_DATA_UINT32 },
@@ -381,6 +411,19 @@ static const ddt_kstats_t ddt_kstats_template = {
 #define	DDT_KSTAT_ZERO(ddt, stat) do {} while (0)
 #endif /* _KERNEL */
 
+static void
+ddt_log_update_kstats(ddt_t *ddt)
+{
+	(void) ddt;
+	DDT_KSTAT_SET(ddt, dds_log_active_entries,
+	    ddt_log_count(ddt->ddt_log_active));
+	DDT_KSTAT_SET(ddt, dds_log_flushing_entries,
+	    ddt_log_count(ddt->ddt_log_flushing));
+	DDT_KSTAT_SET(ddt, dds_log_active_mem,
+	    ddt_log_mem_size(ddt, ddt->ddt_log_active));
+	DDT_KSTAT_SET(ddt, dds_log_flushing_mem,
+	    ddt_log_mem_size(ddt, ddt->ddt_log_flushing));
+}
 
 static void
 ddt_object_create(ddt_t *ddt, ddt_type_t type, ddt_class_t class,
@@ -552,7 +595,7 @@ ddt_object_prefetch(ddt_t *ddt, ddt_type_t type, ddt_class_t class,
 	    ddt->ddt_object[type][class], ddk);
 }
 
-static void
+void
 ddt_object_prefetch_all(ddt_t *ddt, ddt_type_t type, ddt_class_t class)
 {
 	if (!ddt_object_exists(ddt, type, class))
@@ -1276,6 +1319,21 @@ ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t verify)
 		DDT_KSTAT_BUMP(ddt, dds_lookup_log_miss);
 	}
 
+	/*
+	 * If the lookup filter is loaded and doesn't have the key, then the
+	 * entry is not in any store object, and we can skip searching them.
+	 */
+	boolean_t filtered = B_FALSE;
+	boolean_t stored = B_TRUE;
+	if (ddt_filter_ready(ddt)) {
+		filtered = B_TRUE;
+		stored = ddt_filter_contains(ddt, &search);
+		if (stored)
+			DDT_KSTAT_BUMP(ddt, dds_lookup_filter_hit);
+		else
+			DDT_KSTAT_BUMP(ddt, dds_lookup_filter_miss);
+	}
+
 	/*
 	 * ddt_tree is now stable, so unlock and let everyone else keep moving.
 	 * Anyone landing on this entry will find it without DDE_FLAG_LOADED,
@@ -1285,7 +1343,8 @@ ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t verify)
 
 	/* Search all store objects for the entry. */
 	error = ENOENT;
-	for (type = 0; type < DDT_TYPES; type++) {
+	class = DDT_CLASSES;
+	for (type = (stored ? 0 : DDT_TYPES); type < DDT_TYPES; type++) {
 		for (class = 0; class < DDT_CLASSES; class++) {
 			error = ddt_object_lookup(ddt, type, class, dde);
 			if (error != ENOENT) {
@@ -1299,6 +1358,9 @@ ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t verify)
 
 	ddt_enter(ddt);
 
+	if (filtered && stored && error == ENOENT)
+		DDT_KSTAT_BUMP(ddt, dds_lookup_filter_false_positive);
+
 	ASSERT(!(dde->dde_flags & DDE_FLAG_LOADED));
 
 	dde->dde_type = type;	/* will be DDT_TYPES if no entry found */
@@ -1648,6 +1710,7 @@ ddt_table_free(ddt_t *ddt)
 		kstat_delete(ddt->ddt_ksp);
 	}
 
+	ddt_filter_free(ddt);
 	ddt_log_free(ddt);
 	ASSERT0(avl_numnodes(&ddt->ddt_tree));
 	ASSERT0(avl_numnodes(&ddt->ddt_repair_tree));
@@ -1707,10 +1770,7 @@ ddt_load(spa_t *spa)
 				return (error);
 		}
 
-		DDT_KSTAT_SET(ddt, dds_log_active_entries,
-		    avl_numnodes(&ddt->ddt_log_active->ddl_tree));
-		DDT_KSTAT_SET(ddt, dds_log_flushing_entries,
-		    avl_numnodes(&ddt->ddt_log_flushing->ddl_tree));
+		ddt_log_update_kstats(ddt);
 
 		/*
 		 * Seed the cached histograms.
@@ -1914,8 +1974,8 @@ ddt_sync_update_stats(ddt_t *ddt, dmu_tx_t *tx)
 
 	if (ddt->ddt_flags & DDT_FLAG_LOG) {
 		/* Include logged entries in the total count */
-		count += avl_numnodes(&ddt->ddt_log_active->ddl_tree);
-		count += avl_numnodes(&ddt->ddt_log_flushing->ddl_tree);
+		count += ddt_log_count(ddt->ddt_log_active);
+		count += ddt_log_count(ddt->ddt_log_flushing);
 	}
 
 	if (count == 0) {
@@ -1970,11 +2030,98 @@ ddt_sync_scan_entry(ddt_t *ddt, ddt_lightweight_entry_t *ddlwe, dmu_tx_t *tx)
 		    ddlwe, tx);
 }
 
+/* Most ranges a store flush batch is split into */
+#define	DDT_FLUSH_TASKS_MAX	32
+
+/* Fewest entries worth dispatching as a separate range */
+#define	DDT_FLUSH_RANGE_MIN	64
+
+typedef struct ddt_flush ddt_flush_t;
+
+typedef struct {
+	ddt_flush_t	*dfr_flush;
+	uint_t		dfr_start;	/* first entry of range */
+	uint_t		dfr_end;	/* entry after last */
+} ddt_flush_range_t;
+
+/*
+ * Entries of one DDT being written to its store objects in syncing context.
+ * They are taken from the live or flushing tree in key order, a batch at a
+ * time, and each batch is split into contiguous key ranges that are written
+ * concurrently on the pool's sync taskq. The store ZAPs are hashed by the
+ * first word of the key, so a contiguous key range is also a contiguous run
+ * of ZAP leaves: each task dirties mostly its own leaves, and updates to the
+ * same leaf are made together.
+ *
+ * ZAP updates are safe to make concurrently; dfl_lock covers the rest of the
+ * DDT state changed by ddt_sync_flush_entry(). Frees go to zio_free(), which
+ * is also safe from any sync taskq thread.
+ */
+struct ddt_flush {
+	ddt_t		*dfl_ddt;
+	dmu_tx_t	*dfl_tx;
+	kmutex_t	dfl_lock;	/* histograms and object creation */
+	ddt_lightweight_entry_t *dfl_entries;	/* current batch */
+	uint_t		dfl_size;	/* batch capacity */
+	uint_t		dfl_count;	/* entries in current batch */
+	uint_t		dfl_ntasks;	/* ranges per batch, 0 for inline */
+	ddt_flush_range_t dfl_range[DDT_FLUSH_TASKS_MAX];
+
+	/* log flush progress this txg */
+	boolean_t	dfl_done;	/* no more batches this txg */
+	hrtime_t	dfl_start;	/* flush start time */
+	uint64_t	dfl_backlog;	/* log entries at start */
+	uint64_t	dfl_flushed;	/* entries flushed so far */
+	uint64_t	dfl_min;	/* entries to flush, time permitting */
+	uint64_t	dfl_max;	/* entries to flush at most */
+	uint64_t	dfl_target_time; /* time to spend flushing */
+};
+
+static ddt_flush_t *
+ddt_flush_alloc(ddt_t *ddt, dmu_tx_t *tx, uint_t size)
+{
+	ddt_flush_t *dfl = kmem_zalloc(sizeof (ddt_flush_t), KM_SLEEP);
+
+	dfl->dfl_ddt = ddt;
+	dfl->dfl_tx = tx;
+	mutex_init(&dfl->dfl_lock, NULL, MUTEX_DEFAULT, NULL);
+	dfl->dfl_ntasks = MIN(zfs_dedup_flush_tasks, DDT_FLUSH_TASKS_MAX);
+	dfl->dfl_size = size;
+	if (size > 0) {
+		dfl->dfl_entries = vmem_alloc(
+		    size * sizeof (ddt_lightweight_entry_t), KM_SLEEP);
+	}
+
+	return (dfl);
+}
+
+static void
+ddt_flush_free(ddt_flush_t *dfl)
+{
+	if (dfl->dfl_size > 0) {
+		vmem_free(dfl->dfl_entries,
+		    dfl->dfl_size * sizeof (ddt_lightweight_entry_t));
+	}
+	mutex_destroy(&dfl->dfl_lock);
+	kmem_free(dfl, sizeof (ddt_flush_t));
+}
+
+static taskq_t *
+ddt_flush_taskq(ddt_t *ddt)
+{
+	if (MIN(zfs_dedup_flush_tasks, DDT_FLUSH_TASKS_MAX) == 0)
+		return (NULL);
+	return (ddt->ddt_spa->spa_dsl_pool->dp_sync_taskq);
+}
+
 static void
-ddt_sync_flush_entry(ddt_t *ddt, ddt_lightweight_entry_t *ddlwe,
-    ddt_type_t otype, ddt_class_t oclass, dmu_tx_t *tx)
+ddt_sync_flush_entry(ddt_flush_t *dfl, ddt_lightweight_entry_t *ddlwe)
 {
+	ddt_t *ddt = dfl->dfl_ddt;
+	dmu_tx_t *tx = dfl->dfl_tx;
 	ddt_key_t *ddk = &ddlwe->ddlwe_key;
+	ddt_type_t otype = ddlwe->ddlwe_type;
+	ddt_class_t oclass = ddlwe->ddlwe_class;
 	ddt_type_t ntype = DDT_TYPE_DEFAULT;
 	uint64_t refcnt = 0;
 
@@ -2027,14 +2174,61 @@ ddt_sync_flush_entry(ddt_t *ddt, ddt_lightweight_entry_t *ddlwe,
 		ddt_histogram_t *ddh =
 		    &ddt->ddt_histogram[ntype][nclass];
 
+		mutex_enter(&dfl->dfl_lock);
 		ddt_histogram_add_entry(ddt, ddh, ddlwe);
-
 		if (!ddt_object_exists(ddt, ntype, nclass))
 			ddt_object_create(ddt, ntype, nclass, tx);
+		mutex_exit(&dfl->dfl_lock);
+
+		ddt_filter_add(ddt, &ddlwe->ddlwe_key);
 		VERIFY0(ddt_object_update(ddt, ntype, nclass, ddlwe, tx));
 	}
 }
 
+static void
+ddt_flush_range(void *arg)
+{
+	ddt_flush_range_t *dfr = arg;
+	ddt_flush_t *dfl = dfr->dfr_flush;
+
+	for (uint_t i = dfr->dfr_start; i < dfr->dfr_end; i++)
+		ddt_sync_flush_entry(dfl, &dfl->dfl_entries[i]);
+}
+
+/*
+ * Write the current batch to the store objects. If tq is NULL, the batch is
+ * written before returning; otherwise its ranges are dispatched to tq, and
+ * the caller must taskq_wait() for them.
+ */
+static void
+ddt_flush_dispatch(ddt_flush_t *dfl, taskq_t *tq)
+{
+	uint_t count = dfl->dfl_count;
+	uint_t ntasks = MIN(dfl->dfl_ntasks,
+	    howmany(count, DDT_FLUSH_RANGE_MIN));
+
+	if (count == 0)
+		return;
+
+	if (tq == NULL || ntasks == 0) {
+		ddt_flush_range_t *dfr = &dfl->dfl_range[0];
+		dfr->dfr_flush = dfl;
+		dfr->dfr_start = 0;
+		dfr->dfr_end = count;
+		ddt_flush_range(dfr);
+		return;
+	}
+
+	uint_t per = howmany(count, ntasks);
+	for (uint_t t = 0, start = 0; start < count; t++, start += per) {
+		ddt_flush_range_t *dfr = &dfl->dfl_range[t];
+		dfr->dfr_flush = dfl;
+		dfr->dfr_start = start;
+		dfr->dfr_end = MIN(start + per, count);
+		(void) taskq_dispatch(tq, ddt_flush_range, dfr, TQ_SLEEP);
+	}
+}
+
 /* Calculate an exponential weighted moving average, lower limited to zero */
 static inline int32_t
 _ewma(int32_t val, int32_t prev, uint32_t weight)
@@ -2066,9 +2260,9 @@ ddt_flush_force_update_txg(ddt_t *ddt, uint64_t txg)
 	 * the wanted txg, set the force txg, otherwise clear it.
 	 */
 
-	if ((!avl_is_empty(&ddt->ddt_log_active->ddl_tree) &&
+	if ((ddt_log_count(ddt->ddt_log_active) > 0 &&
 	    ddt->ddt_log_active->ddl_first_txg <= txg) ||
-	    (!avl_is_empty(&ddt->ddt_log_flushing->ddl_tree) &&
+	    (ddt_log_count(ddt->ddt_log_flushing) > 0 &&
 	    ddt->ddt_log_flushing->ddl_first_txg <= txg)) {
 		ddt->ddt_flush_force_txg = txg;
 		return;
@@ -2081,8 +2275,14 @@ ddt_flush_force_update_txg(ddt_t *ddt, uint64_t txg)
 	ddt->ddt_flush_force_txg = 0;
 }
 
-static void
-ddt_sync_flush_log(ddt_t *ddt, dmu_tx_t *tx)
+/*
+ * Start flushing the flushing log of the DDT to its store objects. Returns
+ * NULL if no flushing or housekeeping should be done this pass. Otherwise,
+ * the entries are flushed by calls to ddt_sync_flush_log_batch() until
+ * dfl_done is set, and then ddt_sync_flush_log_end() finishes up.
+ */
+static ddt_flush_t *
+ddt_sync_flush_log_begin(ddt_t *ddt, dmu_tx_t *tx)
 {
 	spa_t *spa = ddt->ddt_spa;
 	ASSERT(avl_is_empty(&ddt->ddt_tree));
@@ -2092,21 +2292,25 @@ ddt_sync_flush_log(ddt_t *ddt, dmu_tx_t *tx)
 	 * passes beyond the first.
 	 */
 	if (spa_sync_pass(spa) > 1 || tx->tx_txg > spa_final_dirty_txg(spa))
-		return;
+		return (NULL);
 
 	hrtime_t flush_start = gethrtime();
-	uint32_t count = 0;
 
 	/*
 	 * How many entries we need to flush. We need to at
 	 * least match the ingest rate, and also consider the
 	 * current backlog of entries.
 	 */
-	uint64_t backlog = avl_numnodes(&ddt->ddt_log_flushing->ddl_tree) +
-	    avl_numnodes(&ddt->ddt_log_active->ddl_tree);
-
-	if (avl_is_empty(&ddt->ddt_log_flushing->ddl_tree))
-		goto housekeeping;
+	uint64_t backlog = ddt_log_count(ddt->ddt_log_flushing) +
+	    ddt_log_count(ddt->ddt_log_active);
+
+	if (ddt_log_count(ddt->ddt_log_flushing) == 0) {
+		ddt_flush_t *dfl = ddt_flush_alloc(ddt, tx, 0);
+		dfl->dfl_start = flush_start;
+		dfl->dfl_backlog = backlog;
+		dfl->dfl_done = B_TRUE;
+		return (dfl);
+	}
 
 	uint64_t txgs = MAX(1, zfs_dedup_log_flush_txgs);
 	uint64_t cap = MAX(1, zfs_dedup_log_cap);
@@ -2152,7 +2356,7 @@ ddt_sync_flush_log(ddt_t *ddt, dmu_tx_t *tx)
 	 * times.
 	 */
 	if (ddt->ddt_flush_force_txg > 0)
-		flush_max = avl_numnodes(&ddt->ddt_log_flushing->ddl_tree);
+		flush_max = ddt_log_count(ddt->ddt_log_flushing);
 	else if (cap != UINT32_MAX && !zfs_dedup_log_hard_cap)
 		flush_max = MAX(flush_min * 5 / 4, MIN(backlog - cap,
 		    (flush_min * ddt->ddt_log_flush_pressure) / 10));
@@ -2175,61 +2379,113 @@ ddt_sync_flush_log(ddt_t *ddt, dmu_tx_t *tx)
 		target_time = SEC2NSEC(zfs_txg_timeout) / 2;
 	}
 
-	ddt_lightweight_entry_t ddlwe;
-	while (ddt_log_take_first(ddt, ddt->ddt_log_flushing, &ddlwe)) {
-		ddt_sync_flush_entry(ddt, &ddlwe,
-		    ddlwe.ddlwe_type, ddlwe.ddlwe_class, tx);
+	/* Always flush at least one entry. */
+	flush_max = MAX(flush_max, 1);
 
-		/* End if we've synced as much as we needed to. */
-		if (++count >= flush_max)
-			break;
+	ddt_flush_t *dfl = ddt_flush_alloc(ddt, tx, MIN(flush_max,
+	    MAX(zfs_dedup_flush_batch, 1)));
+	dfl->dfl_start = flush_start;
+	dfl->dfl_backlog = backlog;
+	dfl->dfl_min = flush_min;
+	dfl->dfl_max = flush_max;
+	dfl->dfl_target_time = target_time;
 
-		/*
-		 * As long as we've flushed the absolute minimum,
-		 * stop if we're way over our target time.
-		 */
-		uint64_t diff = gethrtime() - flush_start;
-		if (count > zfs_dedup_log_flush_entries_min &&
-		    diff >= target_time * 2)
-			break;
+	return (dfl);
+}
 
-		/*
-		 * End if we've passed the minimum flush and we're out of time.
-		 */
-		if (count > flush_min && diff >= target_time)
-			break;
+/*
+ * Take the next batch of entries off the flushing log and write them to the
+ * store objects, on tq if it is not NULL. Before the next batch, the caller
+ * must taskq_wait() for this one and call ddt_sync_flush_log_check().
+ */
+static void
+ddt_sync_flush_log_batch(ddt_flush_t *dfl, taskq_t *tq)
+{
+	ddt_t *ddt = dfl->dfl_ddt;
+	uint64_t n = MIN(dfl->dfl_size, dfl->dfl_max - dfl->dfl_flushed);
+
+	ASSERT(!dfl->dfl_done);
+
+	dfl->dfl_count = 0;
+	while (dfl->dfl_count < n && ddt_log_take_first(ddt,
+	    ddt->ddt_log_flushing, &dfl->dfl_entries[dfl->dfl_count]))
+		dfl->dfl_count++;
+
+	ddt_flush_dispatch(dfl, tq);
+}
+
+/*
+ * Account for the batch just written, and decide if another is wanted.
+ */
+static void
+ddt_sync_flush_log_check(ddt_flush_t *dfl)
+{
+	ddt_t *ddt = dfl->dfl_ddt;
+
+	dfl->dfl_flushed += dfl->dfl_count;
+
+	/* End if we've synced as much as we needed to. */
+	if (dfl->dfl_flushed >= dfl->dfl_max ||
+	    ddt_log_count(ddt->ddt_log_flushing) == 0) {
+		dfl->dfl_done = B_TRUE;
+		return;
 	}
 
-	if (avl_is_empty(&ddt->ddt_log_flushing->ddl_tree)) {
+	/*
+	 * As long as we've flushed the absolute minimum,
+	 * stop if we're way over our target time.
+	 */
+	uint64_t diff = gethrtime() - dfl->dfl_start;
+	if (dfl->dfl_flushed > zfs_dedup_log_flush_entries_min &&
+	    diff >= dfl->dfl_target_time * 2)
+		dfl->dfl_done = B_TRUE;
+
+	/*
+	 * End if we've passed the minimum flush and we're out of time.
+	 */
+	if (dfl->dfl_flushed > dfl->dfl_min && diff >= dfl->dfl_target_time)
+		dfl->dfl_done = B_TRUE;
+}
+
+static void
+ddt_sync_flush_log_end(ddt_flush_t *dfl)
+{
+	ddt_t *ddt = dfl->dfl_ddt;
+	dmu_tx_t *tx = dfl->dfl_tx;
+	uint32_t count = dfl->dfl_flushed;
+
+	ASSERT(dfl->dfl_done);
+
+	if (count == 0)
+		goto housekeeping;
+
+	if (ddt_log_count(ddt->ddt_log_flushing) == 0) {
 		/* We emptied it, so truncate on-disk */
-		DDT_KSTAT_ZERO(ddt, dds_log_flushing_entries);
 		ddt_log_truncate(ddt, tx);
 	} else {
 		/* More to do next time, save checkpoint */
-		DDT_KSTAT_SUB(ddt, dds_log_flushing_entries, count);
-		ddt_log_checkpoint(ddt, &ddlwe, tx);
+		ddt_log_checkpoint(ddt,
+		    &dfl->dfl_entries[dfl->dfl_count - 1], tx);
 	}
 
 	ddt_sync_update_stats(ddt, tx);
 
 housekeeping:
-	if (avl_is_empty(&ddt->ddt_log_flushing->ddl_tree) &&
-	    !avl_is_empty(&ddt->ddt_log_active->ddl_tree)) {
+	if (ddt_log_count(ddt->ddt_log_flushing) == 0 &&
+	    ddt_log_count(ddt->ddt_log_active) > 0) {
 		/*
 		 * No more to flush, and the active list has stuff, so
 		 * try to swap the logs for next time.
 		 */
-		if (ddt_log_swap(ddt, tx)) {
-			DDT_KSTAT_ZERO(ddt, dds_log_active_entries);
-			DDT_KSTAT_SET(ddt, dds_log_flushing_entries,
-			    avl_numnodes(&ddt->ddt_log_flushing->ddl_tree));
-		}
+		(void) ddt_log_swap(ddt, tx);
 	}
 
+	ddt_log_update_kstats(ddt);
+
 	/* If force flush is no longer necessary, turn it off. */
 	ddt_flush_force_update_txg(ddt, 0);
 
-	ddt->ddt_log_flush_prev_backlog = backlog;
+	ddt->ddt_log_flush_prev_backlog = dfl->dfl_backlog;
 
 	/*
 	 * Update flush rate. This is an exponential weighted moving
@@ -2244,22 +2500,70 @@ housekeeping:
 	 * average of the total time taken to flush over recent txgs.
 	 */
 	ddt->ddt_log_flush_time_rate = _ewma(ddt->ddt_log_flush_time_rate,
-	    (int32_t)NSEC2MSEC(gethrtime() - flush_start),
+	    (int32_t)NSEC2MSEC(gethrtime() - dfl->dfl_start),
 	    zfs_dedup_log_flush_flow_rate_txgs);
 	DDT_KSTAT_SET(ddt, dds_log_flush_time_rate,
 	    ddt->ddt_log_flush_time_rate);
-	if (avl_numnodes(&ddt->ddt_log_flushing->ddl_tree) > 0 &&
+	if (ddt_log_count(ddt->ddt_log_flushing) > 0 &&
 	    zfs_flags & ZFS_DEBUG_DDT) {
 		zfs_dbgmsg("%lu entries remain(%lu in active), flushed %u @ "
 		    "txg %llu, in %llu ms, flush rate %d, time rate %d",
-		    (ulong_t)avl_numnodes(&ddt->ddt_log_flushing->ddl_tree),
-		    (ulong_t)avl_numnodes(&ddt->ddt_log_active->ddl_tree),
+		    (ulong_t)ddt_log_count(ddt->ddt_log_flushing),
+		    (ulong_t)ddt_log_count(ddt->ddt_log_active),
 		    count, (u_longlong_t)tx->tx_txg,
-		    (u_longlong_t)NSEC2MSEC(gethrtime() - flush_start),
+		    (u_longlong_t)NSEC2MSEC(gethrtime() - dfl->dfl_start),
 		    ddt->ddt_log_flush_rate, ddt->ddt_log_flush_time_rate);
 	}
 }
 
+/*
+ * Flush the logs of all DDTs. Each round takes a batch from every DDT that
+ * still has flushing to do, and writes them all concurrently.
+ */
+static void
+ddt_sync_flush_logs(spa_t *spa, dmu_tx_t *tx)
+{
+	ddt_flush_t *dfls[ZIO_CHECKSUM_FUNCTIONS] = { NULL };
+	boolean_t more = B_FALSE;
+	taskq_t *tq = NULL;
+
+	for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		ddt_t *ddt = spa->spa_ddt[c];
+		if (ddt == NULL || !(ddt->ddt_flags & DDT_FLAG_LOG))
+			continue;
+		dfls[c] = ddt_sync_flush_log_begin(ddt, tx);
+		if (dfls[c] != NULL && !dfls[c]->dfl_done) {
+			tq = ddt_flush_taskq(ddt);
+			more = B_TRUE;
+		}
+	}
+
+	while (more) {
+		for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+			if (dfls[c] != NULL && !dfls[c]->dfl_done)
+				ddt_sync_flush_log_batch(dfls[c], tq);
+		}
+
+		if (tq != NULL)
+			taskq_wait(tq);
+
+		more = B_FALSE;
+		for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+			if (dfls[c] != NULL && !dfls[c]->dfl_done) {
+				ddt_sync_flush_log_check(dfls[c]);
+				more |= !dfls[c]->dfl_done;
+			}
+		}
+	}
+
+	for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		if (dfls[c] != NULL) {
+			ddt_sync_flush_log_end(dfls[c]);
+			ddt_flush_free(dfls[c]);
+		}
+	}
+}
+
 static void
 ddt_sync_table_log(ddt_t *ddt, dmu_tx_t *tx)
 {
@@ -2283,8 +2587,7 @@ ddt_sync_table_log(ddt_t *ddt, dmu_tx_t *tx)
 
 		ddt_log_commit(ddt, &dlu);
 
-		DDT_KSTAT_SET(ddt, dds_log_active_entries,
-		    avl_numnodes(&ddt->ddt_log_active->ddl_tree));
+		ddt_log_update_kstats(ddt);
 
 		/*
 		 * Sync the stats for the store objects. Even though we haven't
@@ -2328,20 +2631,34 @@ ddt_sync_table_flush(ddt_t *ddt, dmu_tx_t *tx)
 	if (avl_numnodes(&ddt->ddt_tree) == 0)
 		return;
 
+	ddt_flush_t *dfl = ddt_flush_alloc(ddt, tx,
+	    MIN(avl_numnodes(&ddt->ddt_tree), MAX(zfs_dedup_flush_batch, 1)));
+	taskq_t *tq = ddt_flush_taskq(ddt);
+
+	/* Take entries in key order, so that each range is contiguous. */
 	ddt_entry_t *dde;
-	void *cookie = NULL;
-	while ((dde = avl_destroy_nodes(
-	    &ddt->ddt_tree, &cookie)) != NULL) {
-		ASSERT(dde->dde_flags & DDE_FLAG_LOADED);
+	while (!avl_is_empty(&ddt->ddt_tree)) {
+		dfl->dfl_count = 0;
+		while (dfl->dfl_count < dfl->dfl_size &&
+		    (dde = avl_first(&ddt->ddt_tree)) != NULL) {
+			ASSERT(dde->dde_flags & DDE_FLAG_LOADED);
+			avl_remove(&ddt->ddt_tree, dde);
+			DDT_ENTRY_TO_LIGHTWEIGHT(ddt, dde,
+			    &dfl->dfl_entries[dfl->dfl_count]);
+			dfl->dfl_count++;
+			ddt_free(ddt, dde);
+		}
 
-		ddt_lightweight_entry_t ddlwe;
-		DDT_ENTRY_TO_LIGHTWEIGHT(ddt, dde, &ddlwe);
-		ddt_sync_flush_entry(ddt, &ddlwe,
-		    dde->dde_type, dde->dde_class, tx);
-		ddt_sync_scan_entry(ddt, &ddlwe, tx);
-		ddt_free(ddt, dde);
+		ddt_flush_dispatch(dfl, tq);
+		if (tq != NULL)
+			taskq_wait(tq);
+
+		for (uint_t i = 0; i < dfl->dfl_count; i++)
+			ddt_sync_scan_entry(ddt, &dfl->dfl_entries[i], tx);
 	}
 
+	ddt_flush_free(dfl);
+
 	memcpy(&ddt->ddt_histogram_cache, ddt->ddt_histogram,
 	    sizeof (ddt->ddt_histogram));
 	ddt->ddt_spa->spa_dedup_dspace = ~0ULL;
@@ -2371,6 +2688,9 @@ ddt_sync_table(ddt_t *ddt, dmu_tx_t *tx)
 	if (ddt->ddt_version == DDT_VERSION_FDT && ddt->ddt_dir_object == 0)
 		ddt_create_dir(ddt, tx);
 
+	ddt_filter_sync(ddt, tx);
+	DDT_KSTAT_SET(ddt, dds_filter_size, ddt_filter_size(ddt));
+
 	if (ddt->ddt_flags & DDT_FLAG_LOG)
 		ddt_sync_table_log(ddt, tx);
 	else
@@ -2405,8 +2725,14 @@ ddt_sync(spa_t *spa, uint64_t txg)
 		if (ddt == NULL)
 			continue;
 		ddt_sync_table(ddt, tx);
-		if (ddt->ddt_flags & DDT_FLAG_LOG)
-			ddt_sync_flush_log(ddt, tx);
+	}
+
+	ddt_sync_flush_logs(spa, tx);
+
+	for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		ddt_t *ddt = spa->spa_ddt[c];
+		if (ddt == NULL)
+			continue;
 		ddt_repair_table(ddt, rio);
 	}
 
@@ -2825,3 +3151,9 @@ ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, log_hard_cap, UINT, ZMOD_RW,
 
 ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, log_flush_flow_rate_txgs, UINT, ZMOD_RW,
 	"Number of txgs to average flow rates across");
+
+ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, flush_tasks, UINT, ZMOD_RW,
+	"Key ranges to write each DDT store batch in, 0 for serial");
+
+ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, flush_batch, UINT, ZMOD_RW,
+	"Max DDT entries to take for each store batch");
@@ -0,0 +1,351 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or https://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/ddt.h>
+#include <sys/ddt_impl.h>
+#include <sys/bloom.h>
+
+/*
+ * # DDT lookup filter
+ *
+ * Writing a unique block to a dedup dataset has to establish that its
+ * checksum is not already in the DDT. After the live and log trees, that
+ * means a lookup in every store object, each of which is likely a random
+ * read of a ZAP leaf that is not cached. To avoid most of these, each DDT
+ * keeps an in-core bloom filter over the keys of the entries in its store
+ * objects. If the filter does not contain a key, the key is certainly not
+ * stored, and ddt_lookup() skips the store objects entirely.
+ *
+ * Keys are added in syncing context, just before they are written to a store
+ * object. Keys are never removed; an entry that leaves the store remains as
+ * a false positive until the filter is rebuilt. The filter is sized for twice
+ * the number of stored entries when it is created, and rebuilt at twice the
+ * size when the store outgrows it. A filter that would be larger than
+ * zfs_dedup_filter_max_size is not created, and lookups go to the store
+ * objects as if the filter was disabled.
+ *
+ * A new filter knows nothing about the entries that were stored before it was
+ * created, so it is not consulted until it has been loaded by walking all the
+ * store objects. The walk is done in syncing context, a limited number of
+ * entries per txg, so that importing a pool with a large DDT is not delayed.
+ * The store objects are prefetched when the walk starts, so that it mostly
+ * finds them cached. The filter is created after import, and whenever it is
+ * enabled or rebuilt.
+ *
+ * The filter is only replaced or freed in syncing context with ddt_lock held,
+ * and only read by ddt_lookup() with ddt_lock held.
+ */
+
+/*
+ * Bits of filter per stored entry. 10 bits gives a false positive rate of
+ * about 1% when the filter is full. Zero disables the filter.
+ */
+static uint_t zfs_dedup_filter_bits = 10;
+
+/*
+ * Maximum number of stored entries to walk per txg while loading the filter.
+ */
+static uint_t zfs_dedup_filter_load_per_txg = 20000;
+
+/*
+ * Maximum size of the filter of a DDT, in bytes. If the store outgrows it,
+ * the filter is dropped.
+ */
+static uint64_t zfs_dedup_filter_max_size = 64 << 20;
+
+/* Smallest filter, in entries. */
+#define	DDT_FILTER_MIN_ENTRIES	(1ULL << 16)
+
+struct ddt_filter {
+	bloom_t		ddf_bloom;
+	boolean_t	ddf_loaded;	/* all stored entries have been added */
+	ddt_type_t	ddf_type;	/* load walk position */
+	ddt_class_t	ddf_class;
+	uint64_t	ddf_cursor;
+	uint64_t	ddf_load_txg;	/* last txg the walk made progress */
+};
+
+/*
+ * The key is a cryptographic checksum, but the filter mixes it anyway, so
+ * that the probe positions do not depend on which of its words happen to be
+ * well distributed.
+ */
+static void
+ddt_filter_insert(ddt_filter_t *ddf, const ddt_key_t *ddk)
+{
+	const uint64_t *w = ddk->ddk_cksum.zc_word;
+
+	bloom_insert(&ddf->ddf_bloom, w[0] ^ ddk->ddk_prop, w[1] ^ w[3]);
+}
+
+/*
+ * Returns the number of entries in the store objects, or -1 if there are
+ * no store objects at all.
+ */
+static int64_t
+ddt_filter_stored_entries(ddt_t *ddt)
+{
+	int64_t count = -1;
+
+	for (ddt_type_t type = 0; type < DDT_TYPES; type++) {
+		for (ddt_class_t class = 0; class < DDT_CLASSES; class++) {
+			if (ddt->ddt_object[type][class] == 0)
+				continue;
+			count = MAX(count, 0) +
+			    ddt->ddt_object_stats[type][class].ddo_count;
+		}
+	}
+
+	return (count);
+}
+
+static uint64_t
+ddt_filter_capacity(uint64_t entries)
+{
+	return (MAX(entries * 2, DDT_FILTER_MIN_ENTRIES));
+}
+
+static ddt_filter_t *
+ddt_filter_alloc(uint64_t entries, uint_t bits_per_entry)
+{
+	ddt_filter_t *ddf = kmem_zalloc(sizeof (ddt_filter_t), KM_SLEEP);
+
+	bloom_create(&ddf->ddf_bloom, ddt_filter_capacity(entries),
+	    bits_per_entry);
+
+	return (ddf);
+}
+
+static void
+ddt_filter_destroy(ddt_filter_t *ddf)
+{
+	bloom_destroy(&ddf->ddf_bloom);
+	kmem_free(ddf, sizeof (ddt_filter_t));
+}
+
+/*
+ * Replace the filter of the DDT, or remove it if ddf is NULL. Returns the
+ * old filter.
+ */
+static ddt_filter_t *
+ddt_filter_swap(ddt_t *ddt, ddt_filter_t *ddf)
+{
+	ddt_filter_t *old;
+
+	ddt_enter(ddt);
+	old = ddt->ddt_filter;
+	ddt->ddt_filter = ddf;
+	ddt_exit(ddt);
+
+	return (old);
+}
+
+/*
+ * Walk up to zfs_dedup_filter_load_per_txg stored entries into the filter.
+ * ddt_sync_table() runs in every sync pass, but the walk only makes progress
+ * once per txg.
+ */
+static void
+ddt_filter_load(ddt_t *ddt, ddt_filter_t *ddf, uint64_t txg)
+{
+	ddt_lightweight_entry_t ddlwe;
+	uint_t n = 0;
+
+	if (ddf->ddf_load_txg == txg)
+		return;
+	if (ddf->ddf_load_txg == 0) {
+		for (ddt_type_t type = 0; type < DDT_TYPES; type++) {
+			for (ddt_class_t class = 0; class < DDT_CLASSES;
+			    class++)
+				ddt_object_prefetch_all(ddt, type, class);
+		}
+	}
+	ddf->ddf_load_txg = txg;
+
+	while (ddf->ddf_type < DDT_TYPES &&
+	    n < zfs_dedup_filter_load_per_txg) {
+		int error = ENOENT;
+
+		if (ddt->ddt_object[ddf->ddf_type][ddf->ddf_class] != 0) {
+			error = ddt_object_walk(ddt, ddf->ddf_type,
+			    ddf->ddf_class, &ddf->ddf_cursor, &ddlwe);
+		}
+		if (error == 0) {
+			ddt_filter_insert(ddf, &ddlwe.ddlwe_key);
+			n++;
+			continue;
+		}
+		if (error != ENOENT) {
+			/*
+			 * Leave the filter unloaded (and so unused) rather
+			 * than risk it missing an entry; the walk will be
+			 * retried from here next txg.
+			 */
+			zfs_dbgmsg("ddt filter load failed for %s: %d",
+			    spa_name(ddt->ddt_spa), error);
+			return;
+		}
+
+		ddf->ddf_cursor = 0;
+		if (++ddf->ddf_class == DDT_CLASSES) {
+			ddf->ddf_class = 0;
+			ddf->ddf_type++;
+		}
+	}
+
+	if (ddf->ddf_type == DDT_TYPES) {
+		membar_producer();
+		ddf->ddf_loaded = B_TRUE;
+	}
+}
+
+/*
+ * Called in syncing context at the start of ddt_sync_table(), before any
+ * entries are written to the store objects. Creates, rebuilds, removes and
+ * loads the filter as needed.
+ */
+void
+ddt_filter_sync(ddt_t *ddt, dmu_tx_t *tx)
+{
+	ddt_filter_t *ddf = ddt->ddt_filter;
+	uint_t bits = zfs_dedup_filter_bits;
+
+	if (bits == 0) {
+		if (ddf != NULL)
+			ddt_filter_destroy(ddt_filter_swap(ddt, NULL));
+		return;
+	}
+
+	/*
+	 * Don't bother until the first store object exists. Anything
+	 * written to it before the filter is created will be found by the
+	 * load walk.
+	 */
+	int64_t entries = ddt_filter_stored_entries(ddt);
+	if (entries < 0)
+		return;
+
+	if (ddf == NULL || entries > ddf->ddf_bloom.bl_capacity ||
+	    bits != ddf->ddf_bloom.bl_bpe) {
+		uint64_t capacity = ddt_filter_capacity(entries);
+
+		/*
+		 * Detach the filter while it is rebuilt, so that the old and
+		 * new bit arrays never coexist. If the new one would be too
+		 * big, lookups go to the store objects.
+		 */
+		if (ddf != NULL)
+			(void) ddt_filter_swap(ddt, NULL);
+		if (bloom_size(capacity, bits) > zfs_dedup_filter_max_size) {
+			if (ddf != NULL) {
+				zfs_dbgmsg("ddt filter for %s dropped, "
+				    "%lld entries exceed max size",
+				    spa_name(ddt->ddt_spa),
+				    (longlong_t)entries);
+				ddt_filter_destroy(ddf);
+			}
+			return;
+		}
+		if (ddf == NULL) {
+			ddf = ddt_filter_alloc(entries, bits);
+		} else {
+			bloom_resize(&ddf->ddf_bloom, capacity, bits);
+			ddf->ddf_loaded = B_FALSE;
+			ddf->ddf_type = 0;
+			ddf->ddf_class = 0;
+			ddf->ddf_cursor = 0;
+			ddf->ddf_load_txg = 0;
+		}
+		(void) ddt_filter_swap(ddt, ddf);
+	}
+
+	if (!ddf->ddf_loaded)
+		ddt_filter_load(ddt, ddf, dmu_tx_get_txg(tx));
+}
+
+/*
+ * Called in syncing context before the entry is written to a store object.
+ */
+void
+ddt_filter_add(ddt_t *ddt, const ddt_key_t *ddk)
+{
+	if (ddt->ddt_filter != NULL)
+		ddt_filter_insert(ddt->ddt_filter, ddk);
+}
+
+/*
+ * Returns true if the filter is loaded and can answer lookups.
+ */
+boolean_t
+ddt_filter_ready(ddt_t *ddt)
+{
+	ASSERT(MUTEX_HELD(&ddt->ddt_lock));
+
+	return (ddt->ddt_filter != NULL && ddt->ddt_filter->ddf_loaded);
+}
+
+/*
+ * Returns false if the key is certainly not in any store object. Only
+ * meaningful if ddt_filter_ready() is true.
+ */
+boolean_t
+ddt_filter_contains(ddt_t *ddt, const ddt_key_t *ddk)
+{
+	const uint64_t *w = ddk->ddk_cksum.zc_word;
+
+	ASSERT(MUTEX_HELD(&ddt->ddt_lock));
+	ASSERT(ddt->ddt_filter->ddf_loaded);
+
+	return (bloom_contains(&ddt->ddt_filter->ddf_bloom,
+	    w[0] ^ ddk->ddk_prop, w[1] ^ w[3]));
+}
+
+/*
+ * Returns the memory used by the filter, in bytes.
+ */
+uint64_t
+ddt_filter_size(ddt_t *ddt)
+{
+	ddt_filter_t *ddf = ddt->ddt_filter;
+
+	return (ddf == NULL ? 0 : ddf->ddf_bloom.bl_nbits / NBBY);
+}
+
+void
+ddt_filter_free(ddt_t *ddt)
+{
+	if (ddt->ddt_filter != NULL) {
+		ddt_filter_destroy(ddt->ddt_filter);
+		ddt->ddt_filter = NULL;
+	}
+}
+
+ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, filter_bits, UINT, ZMOD_RW,
+	"Bits of DDT lookup filter per stored entry, 0 to disable");
+
+ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, filter_load_per_txg, UINT, ZMOD_RW,
+	"Max stored DDT entries to load into the lookup filter per txg");
+
+ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, filter_max_size, U64, ZMOD_RW,
+	"Max size in bytes of the DDT lookup filter");
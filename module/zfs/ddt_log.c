@@ -59,6 +59,494 @@ static kmem_cache_t *ddt_log_entry_trad_cache;
 #define	DDT_LOG_ENTRY_SIZE(ddt)	\
 	_DDT_PHYS_SWITCH(ddt, DDT_LOG_ENTRY_FLAT_SIZE, DDT_LOG_ENTRY_TRAD_SIZE)
 
+/*
+ * Once the logs are swapped, the flushing log is only ever drained from the
+ * front or has entries pulled out of it by ddt_lookup(); nothing modifies an
+ * entry in place. Rather than keeping a full AVL node and phys array for each
+ * entry, we pack it into an array of pages sorted by key. Each page records
+ * its first key in full; the entries within it are stored with their key
+ * prefix-compressed against the previous entry and with unused trad phys
+ * variants omitted. Entries are expanded back to lightweight entries as they
+ * are taken. Set to 0 to keep the flushing log as an AVL tree.
+ */
+int zfs_dedup_log_pack = 1;
+
+/*
+ * Number of entries in a packed page. Lookups binary search the page headers
+ * and then decode linearly within a page.
+ */
+#define	DDT_LOG_PACK_PAGE_ENTRIES	(32)
+
+/*
+ * Each packed record is:
+ *
+ *   flags (1), type (1), class (1), shared prefix length (1),
+ *   key suffix (DDT_LOG_PACK_KEY_SIZE - prefix),
+ *   phys variants present in the flags mask
+ *
+ * The key is serialised as big-endian words, so that its byte order matches
+ * ddt_key_compare() and the shared prefix is as long as possible.
+ */
+#define	DDT_LOG_PACK_KEY_SIZE		(sizeof (ddt_key_t))
+#define	DDT_LOG_PACK_KEY_WORDS		(sizeof (ddt_key_t) / sizeof (uint64_t))
+#define	DDT_LOG_PACK_REC_HDR_SIZE	(4)
+#define	DDT_LOG_PACK_REC_MAX_SIZE	\
+	(DDT_LOG_PACK_REC_HDR_SIZE + DDT_LOG_PACK_KEY_SIZE + DDT_TRAD_PHYS_SIZE)
+
+#define	DDT_LOG_PACK_REMOVED		(0x80)
+#define	DDT_LOG_PACK_PHYS_MASK		((1 << DDT_PHYS_MAX) - 1)
+
+#define	DDT_LOG_PACK_VARIANT_SIZE	\
+	sizeof (((ddt_univ_phys_t *)0)->ddp_trad[0])
+
+typedef struct {
+	ddt_key_t	dlpp_first;	/* key of first record */
+	uint8_t		*dlpp_data;	/* packed records; NULL once drained */
+	uint32_t	dlpp_size;	/* size of dlpp_data */
+	uint16_t	dlpp_nentries;	/* records in page */
+	uint16_t	dlpp_live;	/* records not yet taken or removed */
+} ddt_log_pack_page_t;
+
+typedef struct ddt_log_pack {
+	ddt_log_pack_page_t	*dlp_pages;
+	uint64_t		dlp_npages;
+	uint64_t		dlp_first;	/* first page with live data */
+	uint64_t		dlp_size;	/* total page data size */
+} ddt_log_pack_t;
+
+/* Cursor for decoding records within a page */
+typedef struct {
+	uint8_t		*dlpc_rec;	/* current record */
+	uint8_t		*dlpc_next;	/* next record */
+	uint8_t		*dlpc_end;
+	uint8_t		dlpc_key[DDT_LOG_PACK_KEY_SIZE];
+} ddt_log_pack_cursor_t;
+
+static void
+ddt_log_pack_key_encode(const ddt_key_t *ddk, uint8_t *buf)
+{
+	const uint64_t *w = (const uint64_t *)ddk;
+	for (int i = 0; i < DDT_LOG_PACK_KEY_WORDS; i++) {
+		for (int b = 0; b < sizeof (uint64_t); b++)
+			*buf++ = (uint8_t)(w[i] >> (56 - (b << 3)));
+	}
+}
+
+static void
+ddt_log_pack_key_decode(const uint8_t *buf, ddt_key_t *ddk)
+{
+	uint64_t *w = (uint64_t *)ddk;
+	for (int i = 0; i < DDT_LOG_PACK_KEY_WORDS; i++) {
+		uint64_t v = 0;
+		for (int b = 0; b < sizeof (uint64_t); b++)
+			v = (v << 8) | *buf++;
+		w[i] = v;
+	}
+}
+
+static boolean_t
+ddt_log_pack_variant_empty(const void *p)
+{
+	const uint64_t *w = p;
+	for (int i = 0; i < DDT_LOG_PACK_VARIANT_SIZE / sizeof (uint64_t); i++)
+		if (w[i] != 0)
+			return (B_FALSE);
+	return (B_TRUE);
+}
+
+/*
+ * Encode a single log entry into buf, prefix-compressing its key against
+ * prev (the encoded key of the previous record, or NULL for the first record
+ * of a page). Returns the encoded size.
+ */
+static size_t
+ddt_log_pack_encode(ddt_t *ddt, const ddt_log_entry_t *ddle,
+    const uint8_t *prev, uint8_t *key, uint8_t *buf)
+{
+	const ddt_univ_phys_t *ddp = (const ddt_univ_phys_t *)ddle->ddle_phys;
+	uint8_t *p = buf + DDT_LOG_PACK_REC_HDR_SIZE;
+	uint8_t mask = 0;
+
+	ddt_log_pack_key_encode(&ddle->ddle_key, key);
+
+	uint8_t shared = 0;
+	if (prev != NULL) {
+		while (shared < DDT_LOG_PACK_KEY_SIZE &&
+		    prev[shared] == key[shared])
+			shared++;
+	}
+	memcpy(p, key + shared, DDT_LOG_PACK_KEY_SIZE - shared);
+	p += DDT_LOG_PACK_KEY_SIZE - shared;
+
+	if (ddt->ddt_flags & DDT_FLAG_FLAT) {
+		mask = 1;
+		memcpy(p, &ddp->ddp_flat, DDT_FLAT_PHYS_SIZE);
+		p += DDT_FLAT_PHYS_SIZE;
+	} else {
+		for (int v = 0; v < DDT_PHYS_MAX; v++) {
+			if (ddt_log_pack_variant_empty(&ddp->ddp_trad[v]))
+				continue;
+			mask |= 1 << v;
+			memcpy(p, &ddp->ddp_trad[v], DDT_LOG_PACK_VARIANT_SIZE);
+			p += DDT_LOG_PACK_VARIANT_SIZE;
+		}
+	}
+
+	buf[0] = mask;
+	buf[1] = ddle->ddle_type;
+	buf[2] = ddle->ddle_class;
+	buf[3] = shared;
+
+	return (p - buf);
+}
+
+static void
+ddt_log_pack_cursor_init(ddt_log_pack_cursor_t *dlpc,
+    ddt_log_pack_page_t *dlpp)
+{
+	dlpc->dlpc_rec = NULL;
+	dlpc->dlpc_next = dlpp->dlpp_data;
+	dlpc->dlpc_end = dlpp->dlpp_data + dlpp->dlpp_size;
+}
+
+/*
+ * Advance the cursor to the next record, updating the cursor key. If ddlwe
+ * is not NULL, the phys is expanded into it too. Returns B_FALSE at the end
+ * of the page.
+ */
+static boolean_t
+ddt_log_pack_cursor_next(ddt_t *ddt, ddt_log_pack_cursor_t *dlpc,
+    ddt_lightweight_entry_t *ddlwe)
+{
+	if (dlpc->dlpc_next >= dlpc->dlpc_end)
+		return (B_FALSE);
+
+	uint8_t *rec = dlpc->dlpc_next;
+	uint8_t *p = rec + DDT_LOG_PACK_REC_HDR_SIZE;
+	uint8_t mask = rec[0] & DDT_LOG_PACK_PHYS_MASK;
+	uint8_t shared = rec[3];
+
+	ASSERT3U(shared, <=, DDT_LOG_PACK_KEY_SIZE);
+	memcpy(dlpc->dlpc_key + shared, p, DDT_LOG_PACK_KEY_SIZE - shared);
+	p += DDT_LOG_PACK_KEY_SIZE - shared;
+
+	if (ddlwe != NULL) {
+		memset(ddlwe, 0, sizeof (*ddlwe));
+		ddt_log_pack_key_decode(dlpc->dlpc_key, &ddlwe->ddlwe_key);
+		ddlwe->ddlwe_type = rec[1];
+		ddlwe->ddlwe_class = rec[2];
+	}
+
+	if (ddt->ddt_flags & DDT_FLAG_FLAT) {
+		ASSERT3U(mask, ==, 1);
+		if (ddlwe != NULL)
+			memcpy(&ddlwe->ddlwe_phys.ddp_flat, p,
+			    DDT_FLAT_PHYS_SIZE);
+		p += DDT_FLAT_PHYS_SIZE;
+	} else {
+		for (int v = 0; v < DDT_PHYS_MAX; v++) {
+			if (!(mask & (1 << v)))
+				continue;
+			if (ddlwe != NULL)
+				memcpy(&ddlwe->ddlwe_phys.ddp_trad[v], p,
+				    DDT_LOG_PACK_VARIANT_SIZE);
+			p += DDT_LOG_PACK_VARIANT_SIZE;
+		}
+	}
+
+	ASSERT3P(p, <=, dlpc->dlpc_end);
+	dlpc->dlpc_rec = rec;
+	dlpc->dlpc_next = p;
+	return (B_TRUE);
+}
+
+static void
+ddt_log_pack_page_drop(ddt_log_pack_t *dlp, ddt_log_pack_page_t *dlpp)
+{
+	ASSERT0(dlpp->dlpp_live);
+	if (dlpp->dlpp_data == NULL)
+		return;
+	kmem_free(dlpp->dlpp_data, dlpp->dlpp_size);
+	dlp->dlp_size -= dlpp->dlpp_size;
+	dlpp->dlpp_data = NULL;
+	dlpp->dlpp_size = 0;
+}
+
+static void
+ddt_log_pack_destroy(ddt_log_t *ddl)
+{
+	ddt_log_pack_t *dlp = ddl->ddl_pack;
+	if (dlp == NULL)
+		return;
+
+	for (uint64_t i = 0; i < dlp->dlp_npages; i++) {
+		ddt_log_pack_page_t *dlpp = &dlp->dlp_pages[i];
+		dlpp->dlpp_live = 0;
+		ddt_log_pack_page_drop(dlp, dlpp);
+	}
+	ASSERT0(dlp->dlp_size);
+
+	vmem_free(dlp->dlp_pages,
+	    dlp->dlp_npages * sizeof (ddt_log_pack_page_t));
+	kmem_free(dlp, sizeof (ddt_log_pack_t));
+
+	ddl->ddl_pack = NULL;
+	ddl->ddl_npacked = 0;
+}
+
+static boolean_t ddt_log_pack_find(ddt_t *ddt, ddt_log_t *ddl,
+    const ddt_key_t *ddk, ddt_lightweight_entry_t *ddlwe, boolean_t take);
+
+#ifdef ZFS_DEBUG
+/*
+ * Check that the packed records decode to exactly the entries of the log
+ * tree, in the same order, and that each can be looked up by its key.
+ */
+static void
+ddt_log_pack_verify(ddt_t *ddt, ddt_log_t *ddl)
+{
+	ddt_log_pack_t *dlp = ddl->ddl_pack;
+	ddt_lightweight_entry_t tree, packed;
+	ddt_log_pack_cursor_t dlpc;
+	uint64_t page = 0;
+
+	ddt_log_pack_cursor_init(&dlpc, &dlp->dlp_pages[0]);
+	for (ddt_log_entry_t *ddle = avl_first(&ddl->ddl_tree);
+	    ddle != NULL; ddle = AVL_NEXT(&ddl->ddl_tree, ddle)) {
+		DDT_LOG_ENTRY_TO_LIGHTWEIGHT(ddt, ddle, &tree);
+
+		while (!ddt_log_pack_cursor_next(ddt, &dlpc, &packed)) {
+			VERIFY3U(++page, <, dlp->dlp_npages);
+			ddt_log_pack_cursor_init(&dlpc, &dlp->dlp_pages[page]);
+		}
+		VERIFY0(memcmp(&tree, &packed, sizeof (tree)));
+
+		VERIFY(ddt_log_pack_find(ddt, ddl, &ddle->ddle_key, &packed,
+		    B_FALSE));
+		VERIFY0(memcmp(&tree, &packed, sizeof (tree)));
+	}
+	VERIFY3U(page, ==, dlp->dlp_npages - 1);
+	VERIFY(!ddt_log_pack_cursor_next(ddt, &dlpc, NULL));
+}
+#endif
+
+/*
+ * Convert the log tree into the packed form, freeing the tree entries.
+ */
+static void
+ddt_log_pack(ddt_t *ddt, ddt_log_t *ddl)
+{
+	ASSERT(ddl->ddl_flags & DDL_FLAG_FLUSHING);
+	ASSERT0P(ddl->ddl_pack);
+
+	uint64_t nentries = avl_numnodes(&ddl->ddl_tree);
+	if (!zfs_dedup_log_pack || nentries == 0)
+		return;
+
+	ddt_log_pack_t *dlp = kmem_zalloc(sizeof (ddt_log_pack_t), KM_SLEEP);
+	dlp->dlp_npages = howmany(nentries, DDT_LOG_PACK_PAGE_ENTRIES);
+	dlp->dlp_pages = vmem_zalloc(
+	    dlp->dlp_npages * sizeof (ddt_log_pack_page_t), KM_SLEEP);
+
+	size_t bufsize = DDT_LOG_PACK_PAGE_ENTRIES * DDT_LOG_PACK_REC_MAX_SIZE;
+	uint8_t *buf = vmem_alloc(bufsize, KM_SLEEP);
+	uint8_t keys[2][DDT_LOG_PACK_KEY_SIZE];
+
+	ddt_log_entry_t *ddle = avl_first(&ddl->ddl_tree);
+	for (uint64_t i = 0; i < dlp->dlp_npages; i++) {
+		ddt_log_pack_page_t *dlpp = &dlp->dlp_pages[i];
+		size_t off = 0;
+
+		dlpp->dlpp_first = ddle->ddle_key;
+		while (ddle != NULL &&
+		    dlpp->dlpp_nentries < DDT_LOG_PACK_PAGE_ENTRIES) {
+			uint_t n = dlpp->dlpp_nentries;
+			off += ddt_log_pack_encode(ddt, ddle,
+			    n == 0 ? NULL : keys[(n - 1) & 1], keys[n & 1],
+			    buf + off);
+			dlpp->dlpp_nentries++;
+			ddle = AVL_NEXT(&ddl->ddl_tree, ddle);
+		}
+		ASSERT3U(off, <=, bufsize);
+
+		dlpp->dlpp_live = dlpp->dlpp_nentries;
+		dlpp->dlpp_size = off;
+		dlpp->dlpp_data = kmem_alloc(off, KM_SLEEP);
+		memcpy(dlpp->dlpp_data, buf, off);
+		dlp->dlp_size += off;
+	}
+	ASSERT0P(ddle);
+
+	vmem_free(buf, bufsize);
+
+	ddl->ddl_pack = dlp;
+	ddl->ddl_npacked = nentries;
+#ifdef ZFS_DEBUG
+	ddt_log_pack_verify(ddt, ddl);
+#endif
+
+	void *cookie = NULL;
+	while ((ddle = avl_destroy_nodes(&ddl->ddl_tree, &cookie)) != NULL) {
+		kmem_cache_free(ddt->ddt_flags & DDT_FLAG_FLAT ?
+		    ddt_log_entry_flat_cache : ddt_log_entry_trad_cache, ddle);
+	}
+}
+
+/*
+ * Find the first live packed record, optionally marking it removed.
+ */
+static boolean_t
+ddt_log_pack_first(ddt_t *ddt, ddt_log_t *ddl,
+    ddt_lightweight_entry_t *ddlwe, boolean_t take)
+{
+	ddt_log_pack_t *dlp = ddl->ddl_pack;
+	if (dlp == NULL || ddl->ddl_npacked == 0)
+		return (B_FALSE);
+
+	while (dlp->dlp_first < dlp->dlp_npages) {
+		ddt_log_pack_page_t *dlpp = &dlp->dlp_pages[dlp->dlp_first];
+		if (dlpp->dlpp_live == 0) {
+			ddt_log_pack_page_drop(dlp, dlpp);
+			dlp->dlp_first++;
+			continue;
+		}
+
+		ddt_log_pack_cursor_t dlpc;
+		ddt_log_pack_cursor_init(&dlpc, dlpp);
+		while (ddt_log_pack_cursor_next(ddt, &dlpc, ddlwe)) {
+			if (dlpc.dlpc_rec[0] & DDT_LOG_PACK_REMOVED)
+				continue;
+			if (take) {
+				dlpc.dlpc_rec[0] |= DDT_LOG_PACK_REMOVED;
+				dlpp->dlpp_live--;
+				ddl->ddl_npacked--;
+				if (dlpp->dlpp_live == 0) {
+					ddt_log_pack_page_drop(dlp, dlpp);
+					dlp->dlp_first++;
+				}
+			}
+			return (B_TRUE);
+		}
+
+		/* the live count said there was something here */
+		VERIFY0(dlpp->dlpp_live);
+	}
+
+	return (B_FALSE);
+}
+
+/*
+ * Look up a key in the packed records, optionally marking it removed.
+ */
+static boolean_t
+ddt_log_pack_find(ddt_t *ddt, ddt_log_t *ddl, const ddt_key_t *ddk,
+    ddt_lightweight_entry_t *ddlwe, boolean_t take)
+{
+	ddt_log_pack_t *dlp = ddl->ddl_pack;
+	if (dlp == NULL || ddl->ddl_npacked == 0)
+		return (B_FALSE);
+
+	/* Find the last page whose first key is <= ddk */
+	uint64_t lo = dlp->dlp_first, hi = dlp->dlp_npages;
+	if (lo >= hi ||
+	    ddt_key_compare(&dlp->dlp_pages[lo].dlpp_first, ddk) > 0)
+		return (B_FALSE);
+	while (hi - lo > 1) {
+		uint64_t mid = lo + ((hi - lo) >> 1);
+		if (ddt_key_compare(&dlp->dlp_pages[mid].dlpp_first, ddk) > 0)
+			hi = mid;
+		else
+			lo = mid;
+	}
+
+	ddt_log_pack_page_t *dlpp = &dlp->dlp_pages[lo];
+	if (dlpp->dlpp_live == 0)
+		return (B_FALSE);
+
+	uint8_t key[DDT_LOG_PACK_KEY_SIZE];
+	ddt_log_pack_key_encode(ddk, key);
+
+	ddt_log_pack_cursor_t dlpc;
+	ddt_log_pack_cursor_init(&dlpc, dlpp);
+	while (ddt_log_pack_cursor_next(ddt, &dlpc, NULL)) {
+		int c = memcmp(dlpc.dlpc_key, key, DDT_LOG_PACK_KEY_SIZE);
+		if (c < 0)
+			continue;
+		if (c > 0 || (dlpc.dlpc_rec[0] & DDT_LOG_PACK_REMOVED))
+			return (B_FALSE);
+
+		if (ddlwe != NULL) {
+			/* rewind and decode this record in full */
+			dlpc.dlpc_next = dlpc.dlpc_rec;
+			VERIFY(ddt_log_pack_cursor_next(ddt, &dlpc, ddlwe));
+		}
+		if (take) {
+			dlpc.dlpc_rec[0] |= DDT_LOG_PACK_REMOVED;
+			dlpp->dlpp_live--;
+			ddl->ddl_npacked--;
+			if (dlpp->dlpp_live == 0)
+				ddt_log_pack_page_drop(dlp, dlpp);
+		}
+		return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
+uint64_t
+ddt_log_count(ddt_log_t *ddl)
+{
+	return (avl_numnodes(&ddl->ddl_tree) + ddl->ddl_npacked);
+}
+
+/*
+ * In-core footprint of a log, including the packed pages.
+ */
+uint64_t
+ddt_log_mem_size(ddt_t *ddt, ddt_log_t *ddl)
+{
+	uint64_t size = avl_numnodes(&ddl->ddl_tree) * DDT_LOG_ENTRY_SIZE(ddt);
+	if (ddl->ddl_pack != NULL) {
+		size += sizeof (ddt_log_pack_t) + ddl->ddl_pack->dlp_size +
+		    ddl->ddl_pack->dlp_npages * sizeof (ddt_log_pack_page_t);
+	}
+	return (size);
+}
+
+/*
+ * Call func for every live entry on the log, in key order.
+ */
+void
+ddt_log_foreach(ddt_t *ddt, ddt_log_t *ddl,
+    void (*func)(ddt_t *, const ddt_lightweight_entry_t *, void *),
+    void *arg)
+{
+	ddt_lightweight_entry_t ddlwe;
+
+	for (ddt_log_entry_t *ddle = avl_first(&ddl->ddl_tree);
+	    ddle != NULL; ddle = AVL_NEXT(&ddl->ddl_tree, ddle)) {
+		DDT_LOG_ENTRY_TO_LIGHTWEIGHT(ddt, ddle, &ddlwe);
+		func(ddt, &ddlwe, arg);
+	}
+
+	ddt_log_pack_t *dlp = ddl->ddl_pack;
+	if (dlp == NULL)
+		return;
+
+	for (uint64_t i = dlp->dlp_first; i < dlp->dlp_npages; i++) {
+		ddt_log_pack_page_t *dlpp = &dlp->dlp_pages[i];
+		if (dlpp->dlpp_live == 0)
+			continue;
+
+		ddt_log_pack_cursor_t dlpc;
+		ddt_log_pack_cursor_init(&dlpc, dlpp);
+		while (ddt_log_pack_cursor_next(ddt, &dlpc, &ddlwe)) {
+			if (!(dlpc.dlpc_rec[0] & DDT_LOG_PACK_REMOVED))
+				func(ddt, &ddlwe, arg);
+		}
+	}
+}
+
 void
 ddt_log_init(void)
 {
@@ -186,9 +674,11 @@ ddt_log_update_stats(ddt_t *ddt)
 
 	ddt_object_t *ddo = &ddt->ddt_log_stats;
 	ddo->ddo_count =
-	    avl_numnodes(&ddt->ddt_log_active->ddl_tree) +
-	    avl_numnodes(&ddt->ddt_log_flushing->ddl_tree);
-	ddo->ddo_mspace = ddo->ddo_count * DDT_LOG_ENTRY_SIZE(ddt);
+	    ddt_log_count(ddt->ddt_log_active) +
+	    ddt_log_count(ddt->ddt_log_flushing);
+	ddo->ddo_mspace =
+	    ddt_log_mem_size(ddt, ddt->ddt_log_active) +
+	    ddt_log_mem_size(ddt, ddt->ddt_log_flushing);
 	ddo->ddo_dspace = nblocks << 9;
 }
 
@@ -341,8 +831,12 @@ boolean_t
 ddt_log_take_first(ddt_t *ddt, ddt_log_t *ddl, ddt_lightweight_entry_t *ddlwe)
 {
 	ddt_log_entry_t *ddle = avl_first(&ddl->ddl_tree);
-	if (ddle == NULL)
-		return (B_FALSE);
+	if (ddle == NULL) {
+		if (!ddt_log_pack_first(ddt, ddl, ddlwe, B_TRUE))
+			return (B_FALSE);
+		ddt_histogram_sub_entry(ddt, &ddt->ddt_log_histogram, ddlwe);
+		return (B_TRUE);
+	}
 
 	DDT_LOG_ENTRY_TO_LIGHTWEIGHT(ddt, ddle, ddlwe);
 
@@ -358,11 +852,15 @@ ddt_log_take_first(ddt_t *ddt, ddt_log_t *ddl, ddt_lightweight_entry_t *ddlwe)
 boolean_t
 ddt_log_remove_key(ddt_t *ddt, ddt_log_t *ddl, const ddt_key_t *ddk)
 {
+	ddt_lightweight_entry_t ddlwe;
 	ddt_log_entry_t *ddle = avl_find(&ddl->ddl_tree, ddk, NULL);
-	if (ddle == NULL)
-		return (B_FALSE);
+	if (ddle == NULL) {
+		if (!ddt_log_pack_find(ddt, ddl, ddk, &ddlwe, B_TRUE))
+			return (B_FALSE);
+		ddt_histogram_sub_entry(ddt, &ddt->ddt_log_histogram, &ddlwe);
+		return (B_TRUE);
+	}
 
-	ddt_lightweight_entry_t ddlwe;
 	DDT_LOG_ENTRY_TO_LIGHTWEIGHT(ddt, ddle, &ddlwe);
 	ddt_histogram_sub_entry(ddt, &ddt->ddt_log_histogram, &ddlwe);
 
@@ -381,8 +879,10 @@ ddt_log_find_key(ddt_t *ddt, const ddt_key_t *ddk,
 	    avl_find(&ddt->ddt_log_active->ddl_tree, ddk, NULL);
 	if (!ddle)
 		ddle = avl_find(&ddt->ddt_log_flushing->ddl_tree, ddk, NULL);
-	if (!ddle)
-		return (B_FALSE);
+	if (!ddle) {
+		return (ddt_log_pack_find(ddt, ddt->ddt_log_flushing, ddk,
+		    ddlwe, B_FALSE));
+	}
 	if (ddlwe)
 		DDT_LOG_ENTRY_TO_LIGHTWEIGHT(ddt, ddle, ddlwe);
 	return (B_TRUE);
@@ -404,6 +904,10 @@ ddt_log_checkpoint(ddt_t *ddt, ddt_lightweight_entry_t *ddlwe, dmu_tx_t *tx)
 	if (ddle != NULL)
 		VERIFY3U(ddt_key_compare(&ddle->ddle_key, &ddlwe->ddlwe_key),
 		    >, 0);
+	ddt_lightweight_entry_t first;
+	if (ddt_log_pack_first(ddt, ddl, &first, B_FALSE))
+		VERIFY3U(ddt_key_compare(&first.ddlwe_key, &ddlwe->ddlwe_key),
+		    >, 0);
 #endif
 
 	ddl->ddl_flags |= DDL_FLAG_CHECKPOINT;
@@ -421,7 +925,8 @@ ddt_log_truncate(ddt_t *ddt, dmu_tx_t *tx)
 	if (ddl->ddl_object == 0)
 		return;
 
-	ASSERT(avl_is_empty(&ddl->ddl_tree));
+	ASSERT0(ddt_log_count(ddl));
+	ddt_log_pack_destroy(ddl);
 
 	/* Eject the entire object */
 	dmu_free_range(ddt->ddt_os, ddl->ddl_object, 0, DMU_OBJECT_END, tx);
@@ -438,7 +943,8 @@ boolean_t
 ddt_log_swap(ddt_t *ddt, dmu_tx_t *tx)
 {
 	/* Swap the logs. The old flushing one must be empty */
-	VERIFY(avl_is_empty(&ddt->ddt_log_flushing->ddl_tree));
+	VERIFY0(ddt_log_count(ddt->ddt_log_flushing));
+	ddt_log_pack_destroy(ddt->ddt_log_flushing);
 
 	/*
 	 * If there are still blocks on the flushing log, truncate it first.
@@ -492,6 +998,8 @@ ddt_log_swap(ddt_t *ddt, dmu_tx_t *tx)
 	ddt_log_update_header(ddt, ddt->ddt_log_active, tx);
 	ddt_log_update_header(ddt, ddt->ddt_log_flushing, tx);
 
+	ddt_log_pack(ddt, ddt->ddt_log_flushing);
+
 	ddt_log_update_stats(ddt);
 
 	return (B_TRUE);
@@ -526,7 +1034,8 @@ ddt_log_empty(ddt_t *ddt, ddt_log_t *ddl)
 {
 	void *cookie = NULL;
 	ddt_log_entry_t *ddle;
-	IMPLY(ddt->ddt_version == UINT64_MAX, avl_is_empty(&ddl->ddl_tree));
+	IMPLY(ddt->ddt_version == UINT64_MAX, ddt_log_count(ddl) == 0);
+	ddt_log_pack_destroy(ddl);
 	while ((ddle =
 	    avl_destroy_nodes(&ddl->ddl_tree, &cookie)) != NULL) {
 		kmem_cache_free(ddt->ddt_flags & DDT_FLAG_FLAT ?
@@ -742,6 +1251,8 @@ ddt_log_load(ddt_t *ddt)
 
 	spa_config_exit(ddt->ddt_spa, SCL_STATE, FTAG);
 
+	ddt_log_pack(ddt, ddt->ddt_log_flushing);
+
 	ddt_log_update_stats(ddt);
 
 	return (0);
@@ -779,3 +1290,6 @@ ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, log_mem_max, U64, ZMOD_RD,
 
 ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, log_mem_max_percent, UINT, ZMOD_RD,
 	"Max memory for dedup logs, as % of total memory");
+
+ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, log_pack, INT, ZMOD_RW,
+	"Pack flushing dedup log entries in memory");
@@ -225,7 +225,7 @@ dmu_diff(const char *tosnap_name, const char *fromsnap_name,
 	 */
 	error = traverse_dataset(tosnap, fromtxg,
 	    TRAVERSE_PRE | TRAVERSE_PREFETCH_METADATA | TRAVERSE_NO_DECRYPT |
-	    TRAVERSE_LOGICAL, diff_cb, &da);
+	    TRAVERSE_LOGICAL | TRAVERSE_CHANGE_LOG, diff_cb, &da);
 
 	if (error != 0) {
 		da.da_err = error;
@@ -67,6 +67,7 @@
 #include <sys/objlist.h>
 #ifdef _KERNEL
 #include <sys/zfs_vfsops.h>
+#include <sys/zfs_vnops.h>
 #endif
 #include <sys/zfs_file.h>
 #include <sys/cred.h>
@@ -75,6 +76,14 @@ static uint_t zfs_recv_queue_length = SPA_MAXBLOCKSIZE;
 static uint_t zfs_recv_queue_ff = 20;
 static uint_t zfs_recv_write_batch_size = 1024 * 1024;
 static int zfs_recv_best_effort_corrective = 0;
+static uint_t zfs_recv_writer_threads = 1;
+
+/*
+ * Number of recently received blocks remembered by their dedup-capable
+ * stream checksum, so that later WRITE records with the same contents are
+ * cloned from the earlier block instead of being written again (0 disables).
+ */
+static uint_t zfs_recv_clone_index_size = 0;
 
 static const void *const dmu_recv_tag = "dmu_recv_tag";
 const char *const recv_clone_name = "%recv";
@@ -99,9 +108,33 @@ struct receive_record_arg {
 	int payload_size;
 	uint64_t bytes_read; /* bytes read from stream when record created */
 	boolean_t eos_marker; /* Marks the end of the stream */
+	boolean_t barrier; /* see receive_writers_barrier() */
 	bqueue_node_t node;
 };
 
+/*
+ * Index of the blocks written by one receive, keyed by the WRITE records'
+ * dedup key.  It is shared by all writer threads of the receive; the oldest
+ * entries are evicted once zfs_recv_clone_index_size is reached.
+ */
+typedef struct recv_clone_entry {
+	ddt_key_t	rce_key;	/* must be first for ddt_key_compare */
+	uint64_t	rce_object;
+	uint64_t	rce_offset;
+	uint64_t	rce_txg;	/* txg the block was written in */
+	avl_node_t	rce_node;
+	list_node_t	rce_lnode;
+} recv_clone_entry_t;
+
+typedef struct recv_clone_index {
+	kmutex_t	rci_lock;
+	avl_tree_t	rci_tree;
+	list_t		rci_list;	/* oldest first */
+	uint64_t	rci_count;
+	uint64_t	rci_cloned;
+	uint64_t	rci_cloned_bytes;
+} recv_clone_index_t;
+
 struct receive_writer_arg {
 	objset_t *os;
 	boolean_t byteswap;
@@ -141,6 +174,24 @@ struct receive_writer_arg {
 
 	/* Keep track of DRR_FREEOBJECTS right after DRR_OBJECT_RANGE */
 	or_need_sync_t or_need_sync;
+
+	/*
+	 * Parallel writers, see receive_writers_start(). The records are
+	 * then routed to the writers' own queues instead of q, and barriers
+	 * are counted down under mutex.
+	 */
+	struct receive_writer_arg *writers;
+	uint_t nwriters;
+	uint_t barrier_waiting;
+	struct receive_writer_arg *parent;
+
+	/* Blocks to clone from, see receive_clone_block() */
+	recv_clone_index_t *clone_index;
+
+	/* statistics, see spa_recv_writer_history_add() */
+	uint64_t records;
+	uint64_t bytes;
+	hrtime_t busy;
 };
 
 typedef struct dmu_recv_begin_arg {
@@ -2212,6 +2263,138 @@ receive_freeobjects(struct receive_writer_arg *rwa,
 	return (0);
 }
 
+static recv_clone_index_t *
+recv_clone_index_create(void)
+{
+	recv_clone_index_t *rci = kmem_zalloc(sizeof (*rci), KM_SLEEP);
+
+	mutex_init(&rci->rci_lock, NULL, MUTEX_DEFAULT, NULL);
+	avl_create(&rci->rci_tree, ddt_key_compare, sizeof (recv_clone_entry_t),
+	    offsetof(recv_clone_entry_t, rce_node));
+	list_create(&rci->rci_list, sizeof (recv_clone_entry_t),
+	    offsetof(recv_clone_entry_t, rce_lnode));
+	return (rci);
+}
+
+static void
+recv_clone_index_destroy(recv_clone_index_t *rci, const char *tofs)
+{
+	recv_clone_entry_t *rce;
+
+	if (rci->rci_cloned != 0) {
+		zfs_dbgmsg("receive of %s cloned %llu blocks (%llu bytes)",
+		    tofs, (u_longlong_t)rci->rci_cloned,
+		    (u_longlong_t)rci->rci_cloned_bytes);
+	}
+
+	while ((rce = list_remove_head(&rci->rci_list)) != NULL) {
+		avl_remove(&rci->rci_tree, rce);
+		kmem_free(rce, sizeof (*rce));
+	}
+	avl_destroy(&rci->rci_tree);
+	list_destroy(&rci->rci_list);
+	mutex_destroy(&rci->rci_lock);
+	kmem_free(rci, sizeof (*rci));
+}
+
+/*
+ * Remember where the block described by drrw was written.
+ */
+static void
+recv_clone_index_add(recv_clone_index_t *rci, struct drr_write *drrw,
+    uint64_t txg)
+{
+	recv_clone_entry_t *rce;
+	avl_index_t where;
+
+	if (!DRR_IS_DEDUP_CAPABLE(drrw->drr_flags))
+		return;
+
+	mutex_enter(&rci->rci_lock);
+	rce = avl_find(&rci->rci_tree, &drrw->drr_key, &where);
+	if (rce != NULL) {
+		/* Prefer the newer copy, it is less likely to be cold. */
+		list_remove(&rci->rci_list, rce);
+	} else {
+		boolean_t evicted = B_FALSE;
+		while (rci->rci_count != 0 &&
+		    rci->rci_count >= zfs_recv_clone_index_size) {
+			recv_clone_entry_t *old =
+			    list_remove_head(&rci->rci_list);
+			avl_remove(&rci->rci_tree, old);
+			kmem_free(old, sizeof (*old));
+			rci->rci_count--;
+			evicted = B_TRUE;
+		}
+		if (evicted) {
+			(void) avl_find(&rci->rci_tree, &drrw->drr_key,
+			    &where);
+		}
+		rce = kmem_alloc(sizeof (*rce), KM_SLEEP);
+		rce->rce_key = drrw->drr_key;
+		avl_insert(&rci->rci_tree, rce, where);
+		rci->rci_count++;
+	}
+	rce->rce_object = drrw->drr_object;
+	rce->rce_offset = drrw->drr_offset;
+	rce->rce_txg = txg;
+	list_insert_tail(&rci->rci_list, rce);
+	mutex_exit(&rci->rci_lock);
+}
+
+/*
+ * If this receive already wrote a block with the same dedup key as drrw,
+ * and that block has been synced and not rewritten since, clone it into
+ * place instead of writing the payload again.  Returns B_TRUE if the block
+ * was cloned.
+ */
+static boolean_t
+receive_clone_block(struct receive_writer_arg *rwa, struct drr_write *drrw,
+    dmu_tx_t *tx)
+{
+	recv_clone_index_t *rci = rwa->clone_index;
+	uint64_t object, offset, txg;
+	blkptr_t bp;
+	size_t nbps = 1;
+
+	if (!DRR_IS_DEDUP_CAPABLE(drrw->drr_flags))
+		return (B_FALSE);
+
+	mutex_enter(&rci->rci_lock);
+	recv_clone_entry_t *rce = avl_find(&rci->rci_tree, &drrw->drr_key,
+	    NULL);
+	if (rce == NULL) {
+		mutex_exit(&rci->rci_lock);
+		return (B_FALSE);
+	}
+	object = rce->rce_object;
+	offset = rce->rce_offset;
+	txg = rce->rce_txg;
+	mutex_exit(&rci->rci_lock);
+
+	if (txg > spa_last_synced_txg(dmu_objset_spa(rwa->os)))
+		return (B_FALSE);
+	if (dmu_read_l0_bps(rwa->os, object, offset, drrw->drr_logical_size,
+	    &bp, &nbps) != 0 || nbps != 1)
+		return (B_FALSE);
+	/*
+	 * The birth txg tells us the block still holds what we wrote; it
+	 * differs if the write was turned into a nop or has been replaced.
+	 */
+	if (BP_IS_HOLE(&bp) || BP_IS_EMBEDDED(&bp) ||
+	    BP_GET_LOGICAL_BIRTH(&bp) != txg ||
+	    BP_GET_LSIZE(&bp) != drrw->drr_logical_size)
+		return (B_FALSE);
+	if (dmu_brt_clone(rwa->os, drrw->drr_object, drrw->drr_offset,
+	    drrw->drr_logical_size, tx, &bp, 1) != 0)
+		return (B_FALSE);
+
+	atomic_inc_64(&rci->rci_cloned);
+	atomic_add_64(&rci->rci_cloned_bytes, drrw->drr_logical_size);
+	return (B_TRUE);
+}
+
+
 /*
  * Note: if this fails, the caller will clean up any records left on the
  * rwa->write_batch list.
@@ -2292,6 +2475,9 @@ flush_write_batch_impl(struct receive_writer_arg *rwa)
 			}
 			if (err == 0)
 				abd_free(abd);
+		} else if (rwa->clone_index != NULL &&
+		    receive_clone_block(rwa, drrw, tx)) {
+			abd_free(abd);
 		} else {
 			zio_prop_t zp = {0};
 			dmu_write_policy(rwa->os, dn, 0, 0, &zp);
@@ -2349,6 +2535,10 @@ flush_write_batch_impl(struct receive_writer_arg *rwa)
 			 */
 			err = dmu_lightweight_write_by_dnode(dn,
 			    drrw->drr_offset, abd, &zp, zio_flags, tx);
+			if (err == 0 && rwa->clone_index != NULL) {
+				recv_clone_index_add(rwa->clone_index, drrw,
+				    dmu_tx_get_txg(tx));
+			}
 		}
 
 		if (err != 0) {
@@ -2870,6 +3060,45 @@ receive_read_prefetch(dmu_recv_cookie_t *drc, uint64_t object, uint64_t offset,
 	}
 }
 
+/*
+ * Undo the transport-only compression of a WRITE payload (see
+ * DMU_BACKUP_FEATURE_STREAM_COMPRESS) and turn the record back into an
+ * ordinary uncompressed write.  On success *abdp is replaced by the logical
+ * block.
+ */
+static int
+receive_stream_decompress(dmu_recv_cookie_t *drc, struct drr_write *drrw,
+    abd_t **abdp)
+{
+	if (!(drc->drc_featureflags & DMU_BACKUP_FEATURE_STREAM_COMPRESS) ||
+	    (drc->drc_featureflags & DMU_BACKUP_FEATURE_RAW))
+		return (SET_ERROR(EINVAL));
+
+	if (drrw->drr_compressiontype != ZIO_COMPRESS_OFF) {
+		if (drrw->drr_compressiontype >= ZIO_COMPRESS_FUNCTIONS ||
+		    drrw->drr_logical_size > SPA_MAXBLOCKSIZE ||
+		    drrw->drr_compressed_size > drrw->drr_logical_size)
+			return (SET_ERROR(EINVAL));
+
+		abd_t *dabd = abd_alloc_linear(drrw->drr_logical_size,
+		    B_FALSE);
+		int err = zio_decompress_data(drrw->drr_compressiontype,
+		    *abdp, dabd, drrw->drr_compressed_size,
+		    drrw->drr_logical_size, NULL);
+		if (err != 0) {
+			abd_free(dabd);
+			return (SET_ERROR(EINVAL));
+		}
+		abd_free(*abdp);
+		*abdp = dabd;
+	}
+
+	drrw->drr_flags &= ~DRR_WRITE_STREAM_COMPRESSED;
+	drrw->drr_compressiontype = ZIO_COMPRESS_OFF;
+	drrw->drr_compressed_size = 0;
+	return (0);
+}
+
 /*
  * Read records off the stream, issuing any necessary prefetches.
  */
@@ -2924,6 +3153,13 @@ receive_read_record(dmu_recv_cookie_t *drc)
 			abd_free(abd);
 			return (err);
 		}
+		if (DRR_IS_STREAM_COMPRESSED(drrw->drr_flags)) {
+			err = receive_stream_decompress(drc, drrw, &abd);
+			if (err != 0) {
+				abd_free(abd);
+				return (err);
+			}
+		}
 		drc->drc_rrd->abd = abd;
 		receive_read_prefetch(drc, drrw->drr_object, drrw->drr_offset,
 		    drrw->drr_logical_size);
@@ -3226,6 +3462,32 @@ receive_process_record(struct receive_writer_arg *rwa,
 	return (err);
 }
 
+/*
+ * Called by a parallel writer when it dequeues a barrier: everything queued
+ * to it before the barrier has been processed, so write out its batch and
+ * let receive_writers_barrier() know.
+ */
+static void
+receive_writer_barrier_reached(struct receive_writer_arg *rwa,
+    struct receive_record_arg *rrd)
+{
+	struct receive_writer_arg *prwa = rwa->parent;
+	int err;
+
+	ASSERT3P(prwa, !=, NULL);
+	kmem_free(rrd, sizeof (*rrd));
+
+	err = flush_write_batch(rwa);
+	if (rwa->err == 0)
+		rwa->err = err;
+
+	mutex_enter(&prwa->mutex);
+	ASSERT3U(prwa->barrier_waiting, >, 0);
+	if (--prwa->barrier_waiting == 0)
+		cv_broadcast(&prwa->cv);
+	mutex_exit(&prwa->mutex);
+}
+
 /*
  * dmu_recv_stream's worker thread; pull records off the queue, and then call
  * receive_process_record  When we're done, signal the main thread and exit.
@@ -3239,6 +3501,11 @@ receive_writer_thread(void *arg)
 
 	for (rrd = bqueue_dequeue(&rwa->q); !rrd->eos_marker;
 	    rrd = bqueue_dequeue(&rwa->q)) {
+		if (rrd->barrier) {
+			receive_writer_barrier_reached(rwa, rrd);
+			continue;
+		}
+
 		/*
 		 * If there's an error, the main thread will stop putting things
 		 * on the queue, but we need to clear everything in it before we
@@ -3246,7 +3513,12 @@ receive_writer_thread(void *arg)
 		 */
 		int err = 0;
 		if (rwa->err == 0) {
+			hrtime_t start = gethrtime();
+
+			rwa->records++;
+			rwa->bytes += rrd->payload_size;
 			err = receive_process_record(rwa, rrd);
+			rwa->busy += gethrtime() - start;
 		} else if (rrd->abd != NULL) {
 			abd_free(rrd->abd);
 			rrd->abd = NULL;
@@ -3284,6 +3556,182 @@ receive_writer_thread(void *arg)
 	thread_exit();
 }
 
+/*
+ * A single writer thread applying every record is limited to one CPU's
+ * worth of dmu_tx and dbuf work, which a fast stream easily outruns. For
+ * full streams, zfs_recv_writer_threads > 1 spreads the records over
+ * several writers instead, each running receive_writer_thread() with its
+ * own queue, write batch and state. Records that belong to a single
+ * object go to the writer owning that object's dnode block, so each
+ * object's records are still applied in stream order by one thread and
+ * no two writers share a dnode block. Records that may touch several
+ * objects (FREEOBJECTS and anything we don't know about) are applied
+ * alone, between two barriers.
+ *
+ * Incremental, raw, resumable and corrective receives always use a
+ * single writer: they depend on state carried from one record to the next
+ * (the resume point, the DRR_OBJECT_RANGE crypt parameters, objects
+ * freed and reallocated within the stream) that can't be partitioned.
+ */
+static void
+receive_writers_start(struct receive_writer_arg *rwa, uint_t nwriters)
+{
+	rwa->nwriters = nwriters;
+	rwa->writers = kmem_zalloc(nwriters * sizeof (*rwa), KM_SLEEP);
+
+	for (uint_t i = 0; i < nwriters; i++) {
+		struct receive_writer_arg *w = &rwa->writers[i];
+
+		(void) bqueue_init(&w->q, zfs_recv_queue_ff,
+		    MAX(zfs_recv_queue_length, 2 * zfs_max_recordsize),
+		    offsetof(struct receive_record_arg, node));
+		cv_init(&w->cv, NULL, CV_DEFAULT, NULL);
+		mutex_init(&w->mutex, NULL, MUTEX_DEFAULT, NULL);
+		w->os = rwa->os;
+		w->byteswap = rwa->byteswap;
+		w->tofs = rwa->tofs;
+		w->spill = rwa->spill;
+		w->full = rwa->full;
+		w->parent = rwa;
+		w->clone_index = rwa->clone_index;
+		list_create(&w->write_batch, sizeof (struct receive_record_arg),
+		    offsetof(struct receive_record_arg, node.bqn_node));
+
+		(void) thread_create(NULL, 0, receive_writer_thread, w, 0,
+		    curproc, TS_RUN, minclsyspri);
+	}
+}
+
+/*
+ * Wait until every writer has processed and written out everything queued
+ * to it so far.
+ */
+static void
+receive_writers_barrier(struct receive_writer_arg *rwa)
+{
+	mutex_enter(&rwa->mutex);
+	ASSERT0(rwa->barrier_waiting);
+	rwa->barrier_waiting = rwa->nwriters;
+	mutex_exit(&rwa->mutex);
+
+	for (uint_t i = 0; i < rwa->nwriters; i++) {
+		struct receive_record_arg *rrd =
+		    kmem_zalloc(sizeof (*rrd), KM_SLEEP);
+		rrd->barrier = B_TRUE;
+		bqueue_enqueue_flush(&rwa->writers[i].q, rrd, 1);
+	}
+
+	mutex_enter(&rwa->mutex);
+	while (rwa->barrier_waiting != 0)
+		(void) cv_wait_sig(&rwa->cv, &rwa->mutex);
+	mutex_exit(&rwa->mutex);
+}
+
+/*
+ * Returns B_TRUE and the object if all the record modifies is that one
+ * object, so it can be applied by that object's writer.
+ */
+static boolean_t
+receive_record_object(const struct receive_record_arg *rrd, uint64_t *objp)
+{
+	const dmu_replay_record_t *drr = &rrd->header;
+
+	switch (drr->drr_type) {
+	case DRR_OBJECT:
+		*objp = drr->drr_u.drr_object.drr_object;
+		return (B_TRUE);
+	case DRR_WRITE:
+		*objp = drr->drr_u.drr_write.drr_object;
+		return (B_TRUE);
+	case DRR_WRITE_EMBEDDED:
+		*objp = drr->drr_u.drr_write_embedded.drr_object;
+		return (B_TRUE);
+	case DRR_FREE:
+		*objp = drr->drr_u.drr_free.drr_object;
+		return (B_TRUE);
+	case DRR_SPILL:
+		*objp = drr->drr_u.drr_spill.drr_object;
+		return (B_TRUE);
+	default:
+		return (B_FALSE);
+	}
+}
+
+/* Hand a record to the writer thread that must apply it. */
+static void
+receive_enqueue(struct receive_writer_arg *rwa, struct receive_record_arg *rrd)
+{
+	uint64_t size = sizeof (*rrd) + rrd->payload_size;
+	uint64_t object;
+
+	if (rwa->nwriters == 0) {
+		bqueue_enqueue(&rwa->q, rrd, size);
+		return;
+	}
+
+	if (receive_record_object(rrd, &object)) {
+		uint_t i = (object / DNODES_PER_BLOCK) % rwa->nwriters;
+		bqueue_enqueue(&rwa->writers[i].q, rrd, size);
+	} else {
+		receive_writers_barrier(rwa);
+		bqueue_enqueue(&rwa->writers[0].q, rrd, size);
+		receive_writers_barrier(rwa);
+	}
+}
+
+/* The first error hit by any writer */
+static int
+receive_writer_err(const struct receive_writer_arg *rwa)
+{
+	for (uint_t i = 0; i < rwa->nwriters; i++) {
+		if (rwa->writers[i].err != 0)
+			return (rwa->writers[i].err);
+	}
+	return (rwa->err);
+}
+
+/*
+ * Send the end of stream to each writer, wait for them to exit, and fold
+ * their results back into rwa.
+ */
+static void
+receive_writers_finish(struct receive_writer_arg *rwa)
+{
+	for (uint_t i = 0; i < rwa->nwriters; i++) {
+		struct receive_record_arg *rrd =
+		    kmem_zalloc(sizeof (*rrd), KM_SLEEP);
+		rrd->eos_marker = B_TRUE;
+		bqueue_enqueue_flush(&rwa->writers[i].q, rrd, 1);
+	}
+
+	for (uint_t i = 0; i < rwa->nwriters; i++) {
+		struct receive_writer_arg *w = &rwa->writers[i];
+
+		mutex_enter(&w->mutex);
+		while (!w->done)
+			(void) cv_wait_sig(&w->cv, &w->mutex);
+		mutex_exit(&w->mutex);
+
+		if (rwa->err == 0)
+			rwa->err = w->err;
+		rwa->max_object = MAX(rwa->max_object, w->max_object);
+		rwa->records += w->records;
+		rwa->bytes += w->bytes;
+		spa_recv_writer_history_add(dmu_objset_spa(rwa->os),
+		    rwa->tofs, i, rwa->nwriters, w->records, w->bytes,
+		    w->busy);
+
+		cv_destroy(&w->cv);
+		mutex_destroy(&w->mutex);
+		bqueue_destroy(&w->q);
+		list_destroy(&w->write_batch);
+	}
+
+	kmem_free(rwa->writers, rwa->nwriters * sizeof (*rwa));
+	rwa->writers = NULL;
+	rwa->nwriters = 0;
+}
+
 static int
 resume_check(dmu_recv_cookie_t *drc, nvlist_t *begin_nvl)
 {
@@ -3427,8 +3875,25 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, offset_t *voffp)
 	list_create(&rwa->write_batch, sizeof (struct receive_record_arg),
 	    offsetof(struct receive_record_arg, node.bqn_node));
 
-	(void) thread_create(NULL, 0, receive_writer_thread, rwa, 0, curproc,
-	    TS_RUN, minclsyspri);
+	boolean_t bclone_enabled = B_TRUE;
+#ifdef _KERNEL
+	bclone_enabled = !!zfs_bclone_enabled;
+#endif
+	if (zfs_recv_clone_index_size != 0 && bclone_enabled &&
+	    !rwa->heal && !rwa->raw &&
+	    spa_feature_is_enabled(dmu_objset_spa(rwa->os),
+	    SPA_FEATURE_BLOCK_CLONING)) {
+		rwa->clone_index = recv_clone_index_create();
+	}
+
+	uint_t nwriters = MIN(zfs_recv_writer_threads, max_ncpus);
+	if (nwriters > 1 && rwa->full && !rwa->heal && !rwa->raw &&
+	    !rwa->resumable) {
+		receive_writers_start(rwa, nwriters);
+	} else {
+		(void) thread_create(NULL, 0, receive_writer_thread, rwa, 0,
+		    curproc, TS_RUN, minclsyspri);
+	}
 	/*
 	 * We're reading rwa->err without locks, which is safe since we are the
 	 * only reader, and the worker thread is the only writer.  It's ok if we
@@ -3444,7 +3909,7 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, offset_t *voffp)
 	 * it.  Finally, if receive_read_record fails or we're at the end of the
 	 * stream, then we free drc->drc_rrd and exit.
 	 */
-	while (rwa->err == 0) {
+	while (receive_writer_err(rwa) == 0) {
 		if (issig()) {
 			err = SET_ERROR(EINTR);
 			break;
@@ -3462,26 +3927,30 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, offset_t *voffp)
 			break;
 		}
 
-		bqueue_enqueue(&rwa->q, drc->drc_rrd,
-		    sizeof (struct receive_record_arg) +
-		    drc->drc_rrd->payload_size);
+		receive_enqueue(rwa, drc->drc_rrd);
 		drc->drc_rrd = NULL;
 	}
 
 	ASSERT0P(drc->drc_rrd);
-	drc->drc_rrd = kmem_zalloc(sizeof (*drc->drc_rrd), KM_SLEEP);
-	drc->drc_rrd->eos_marker = B_TRUE;
-	bqueue_enqueue_flush(&rwa->q, drc->drc_rrd, 1);
+	if (rwa->nwriters != 0) {
+		receive_writers_finish(rwa);
+	} else {
+		drc->drc_rrd = kmem_zalloc(sizeof (*drc->drc_rrd), KM_SLEEP);
+		drc->drc_rrd->eos_marker = B_TRUE;
+		bqueue_enqueue_flush(&rwa->q, drc->drc_rrd, 1);
 
-	mutex_enter(&rwa->mutex);
-	while (!rwa->done) {
-		/*
-		 * We need to use cv_wait_sig() so that any process that may
-		 * be sleeping here can still fork.
-		 */
-		(void) cv_wait_sig(&rwa->cv, &rwa->mutex);
+		mutex_enter(&rwa->mutex);
+		while (!rwa->done) {
+			/*
+			 * We need to use cv_wait_sig() so that any process
+			 * that may be sleeping here can still fork.
+			 */
+			(void) cv_wait_sig(&rwa->cv, &rwa->mutex);
+		}
+		mutex_exit(&rwa->mutex);
+		spa_recv_writer_history_add(dmu_objset_spa(rwa->os),
+		    rwa->tofs, 0, 1, rwa->records, rwa->bytes, rwa->busy);
 	}
-	mutex_exit(&rwa->mutex);
 
 	/*
 	 * If we are receiving a full stream as a clone, all object IDs which
@@ -3509,6 +3978,8 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, offset_t *voffp)
 		}
 	}
 
+	if (rwa->clone_index != NULL)
+		recv_clone_index_destroy(rwa->clone_index, rwa->tofs);
 	cv_destroy(&rwa->cv);
 	mutex_destroy(&rwa->mutex);
 	bqueue_destroy(&rwa->q);
@@ -3866,3 +4337,9 @@ ZFS_MODULE_PARAM(zfs_recv, zfs_recv_, write_batch_size, UINT, ZMOD_RW,
 
 ZFS_MODULE_PARAM(zfs_recv, zfs_recv_, best_effort_corrective, INT, ZMOD_RW,
 	"Ignore errors during corrective receive");
+
+ZFS_MODULE_PARAM(zfs_recv, zfs_recv_, writer_threads, UINT, ZMOD_RW,
+	"Number of threads applying the records of a full receive stream");
+
+ZFS_MODULE_PARAM(zfs_recv, zfs_recv_, clone_index_size, UINT, ZMOD_RW,
+	"Number of received blocks remembered for cloning duplicates");
@@ -106,6 +106,9 @@ static const boolean_t zfs_send_set_freerecords_bit = B_TRUE;
 /* Set this tunable to FALSE is disable sending unmodified spill blocks. */
 static int zfs_send_unmodified_spill_blocks = B_TRUE;
 
+/* Number of threads compressing WRITE payloads for each send. */
+static uint_t zfs_send_compress_threads = 4;
+
 static inline boolean_t
 overflow_multiply(uint64_t a, uint64_t b, uint64_t *c)
 {
@@ -168,6 +171,11 @@ struct send_range {
 			boolean_t		io_outstanding;
 			boolean_t		io_compressed;
 			int			io_err;
+			/* stream compression, see send_compress_range() */
+			boolean_t		sc_outstanding;
+			enum zio_compress	sc_compress;
+			uint32_t		sc_size;
+			abd_t			*sc_abd;
 		} data;
 		struct srh {
 			uint32_t		datablksz;
@@ -238,10 +246,13 @@ range_free(struct send_range *range)
 			range_free(range->sru.object.spill_range);
 	} else if (range->type == DATA) {
 		mutex_enter(&range->sru.data.lock);
-		while (range->sru.data.io_outstanding)
+		while (range->sru.data.io_outstanding ||
+		    range->sru.data.sc_outstanding)
 			cv_wait(&range->sru.data.cv, &range->sru.data.lock);
 		if (range->sru.data.abd != NULL)
 			abd_free(range->sru.data.abd);
+		if (range->sru.data.sc_abd != NULL)
+			abd_free(range->sru.data.sc_abd);
 		if (range->sru.data.abuf != NULL) {
 			arc_buf_destroy(range->sru.data.abuf,
 			    &range->sru.data.abuf);
@@ -457,7 +468,7 @@ dump_redact(dmu_send_cookie_t *dscp, uint64_t object, uint64_t offset,
 static int
 dmu_dump_write(dmu_send_cookie_t *dscp, dmu_object_type_t type, uint64_t object,
     uint64_t offset, int lsize, int psize, const blkptr_t *bp,
-    boolean_t io_compressed, void *data)
+    boolean_t io_compressed, enum zio_compress stream_compress, void *data)
 {
 	uint64_t payload_size;
 	boolean_t raw = (dscp->dsc_featureflags & DMU_BACKUP_FEATURE_RAW);
@@ -532,6 +543,18 @@ dmu_dump_write(dmu_send_cookie_t *dscp, dmu_object_type_t type, uint64_t object,
 		drrw->drr_compressiontype = BP_GET_COMPRESS(bp);
 		drrw->drr_compressed_size = psize;
 		payload_size = drrw->drr_compressed_size;
+	} else if (stream_compress != ZIO_COMPRESS_OFF) {
+		/*
+		 * The payload was compressed for transport only; the
+		 * receiver restores the logical block before writing it.
+		 */
+		ASSERT(dscp->dsc_featureflags &
+		    DMU_BACKUP_FEATURE_STREAM_COMPRESS);
+		ASSERT3S(lsize, >, psize);
+		drrw->drr_flags |= DRR_WRITE_STREAM_COMPRESSED;
+		drrw->drr_compressiontype = stream_compress;
+		drrw->drr_compressed_size = psize;
+		payload_size = drrw->drr_compressed_size;
 	} else {
 		payload_size = drrw->drr_logical_size;
 	}
@@ -933,7 +956,7 @@ do_dump(dmu_send_cookie_t *dscp, struct send_range *range)
 		/* it's a level-0 block of a regular object */
 
 		mutex_enter(&srdp->lock);
-		while (srdp->io_outstanding)
+		while (srdp->io_outstanding || srdp->sc_outstanding)
 			cv_wait(&srdp->cv, &srdp->lock);
 		err = srdp->io_err;
 		mutex_exit(&srdp->lock);
@@ -988,7 +1011,7 @@ do_dump(dmu_send_cookie_t *dscp, struct send_range *range)
 				    SPA_OLD_MAXBLOCKSIZE);
 				err = dmu_dump_write(dscp, srdp->obj_type,
 				    range->object, offset, n, n, NULL, B_FALSE,
-				    data);
+				    ZIO_COMPRESS_OFF, data);
 				offset += n;
 				/*
 				 * When doing dry run, data==NULL is used as a
@@ -999,11 +1022,20 @@ do_dump(dmu_send_cookie_t *dscp, struct send_range *range)
 					data += n;
 				srdp->datablksz -= n;
 			}
+		} else if (srdp->sc_compress != ZIO_COMPRESS_OFF) {
+			ASSERT(dscp->dsc_dso->dso_dryrun ||
+			    srdp->sc_abd != NULL);
+			err = dmu_dump_write(dscp, srdp->obj_type,
+			    range->object, offset,
+			    srdp->datablksz, srdp->sc_size, bp,
+			    srdp->io_compressed, srdp->sc_compress,
+			    srdp->sc_abd != NULL ? abd_to_buf(srdp->sc_abd) :
+			    NULL);
 		} else {
 			err = dmu_dump_write(dscp, srdp->obj_type,
 			    range->object, offset,
 			    srdp->datablksz, srdp->datasz, bp,
-			    srdp->io_compressed, data);
+			    srdp->io_compressed, ZIO_COMPRESS_OFF, data);
 		}
 		return (err);
 	}
@@ -1057,6 +1089,10 @@ range_alloc(enum type type, uint64_t object, uint64_t start_blkid,
 		range->sru.data.io_outstanding = 0;
 		range->sru.data.io_err = 0;
 		range->sru.data.io_compressed = B_FALSE;
+		range->sru.data.sc_outstanding = B_FALSE;
+		range->sru.data.sc_compress = ZIO_COMPRESS_OFF;
+		range->sru.data.sc_size = 0;
+		range->sru.data.sc_abd = NULL;
 	} else if (type == OBJECT) {
 		range->sru.object.spill_range = NULL;
 	}
@@ -1210,7 +1246,8 @@ send_traverse_thread(void *arg)
 
 	err = traverse_dataset_resume(st_arg->os->os_dsl_dataset,
 	    st_arg->fromtxg, &st_arg->resume,
-	    st_arg->flags | TRAVERSE_LOGICAL, send_cb, st_arg);
+	    st_arg->flags | TRAVERSE_LOGICAL | TRAVERSE_CHANGE_LOG, send_cb,
+	    st_arg);
 
 	if (err != EINTR)
 		st_arg->error_code = err;
@@ -1564,6 +1601,8 @@ struct send_reader_thread_arg {
 	boolean_t cancel;
 	boolean_t issue_reads;
 	uint64_t featureflags;
+	taskq_t *compress_tq;
+	enum zio_compress compress;
 	int error;
 };
 
@@ -1585,6 +1624,116 @@ dmu_send_read_done(zio_t *zio)
 	mutex_exit(&range->sru.data.lock);
 }
 
+/*
+ * Taskq callback compressing the payload of a DATA range for transport.  It
+ * waits for the read issued by issue_data_read() and publishes the result in
+ * sc_abd; do_dump() waits for sc_outstanding to clear, so records still leave
+ * in stream order no matter which worker finishes first.
+ */
+static void
+send_compress_range(void *arg)
+{
+	struct send_range *range = arg;
+	struct srd *srdp = &range->sru.data;
+	abd_t *src = NULL;
+
+	mutex_enter(&srdp->lock);
+	while (srdp->io_outstanding)
+		cv_wait(&srdp->cv, &srdp->lock);
+	if (srdp->io_err == 0) {
+		if (srdp->abd != NULL) {
+			src = abd_get_offset(srdp->abd, 0);
+		} else if (srdp->abuf != NULL) {
+			src = abd_get_from_buf(srdp->abuf->b_data,
+			    srdp->datablksz);
+		}
+	}
+	mutex_exit(&srdp->lock);
+
+	abd_t *dst = NULL;
+	size_t csize = srdp->datablksz;
+	if (src != NULL) {
+		/* Only keep the result if it saves at least 1/8th. */
+		csize = zio_compress_data(srdp->sc_compress, src, &dst,
+		    srdp->datablksz, srdp->datablksz - (srdp->datablksz >> 3),
+		    ZIO_COMPLEVEL_DEFAULT);
+		abd_free(src);
+	}
+
+	mutex_enter(&srdp->lock);
+	if (dst != NULL && csize < srdp->datablksz) {
+		/*
+		 * Payloads must be a multiple of 8 bytes.  Both lz4 and zstd
+		 * record the compressed length in a header of their own, so
+		 * the receiver can decompress the zero padded buffer as is.
+		 */
+		size_t padded = P2ROUNDUP(csize, 8);
+		ASSERT3U(padded, <, srdp->datablksz);
+		abd_zero_off(dst, csize, padded - csize);
+		srdp->sc_abd = dst;
+		srdp->sc_size = padded;
+	} else {
+		if (dst != NULL)
+			abd_free(dst);
+		srdp->sc_compress = ZIO_COMPRESS_OFF;
+	}
+	srdp->sc_outstanding = B_FALSE;
+	cv_broadcast(&srdp->cv);
+	mutex_exit(&srdp->lock);
+}
+
+/*
+ * Returns B_TRUE if stream compression was requested and the payload of a
+ * DATA range will be sent as a single uncompressed WRITE record.
+ */
+static boolean_t
+send_compress_eligible(struct send_reader_thread_arg *srta,
+    struct send_range *range)
+{
+	struct srd *srdp = &range->sru.data;
+	blkptr_t *bp = &srdp->bp;
+
+	if (srta->compress == ZIO_COMPRESS_OFF)
+		return (B_FALSE);
+	if (BP_IS_REDACTED(bp) || send_do_embed(bp, srta->featureflags))
+		return (B_FALSE);
+	if (range->start_blkid == DMU_SPILL_BLKID ||
+	    BP_GET_TYPE(bp) == DMU_OT_SA)
+		return (B_FALSE);
+	if (srdp->io_compressed && BP_GET_COMPRESS(bp) != ZIO_COMPRESS_OFF)
+		return (B_FALSE);
+	if (srdp->datablksz > SPA_OLD_MAXBLOCKSIZE &&
+	    !(srta->featureflags & DMU_BACKUP_FEATURE_LARGE_BLOCKS))
+		return (B_FALSE);
+	return (B_TRUE);
+}
+
+/*
+ * Hand a DATA range to the stream compression taskq if its payload can be
+ * compressed for transport.
+ */
+static void
+send_compress_dispatch(struct send_reader_thread_arg *srta,
+    struct send_range *range)
+{
+	struct srd *srdp = &range->sru.data;
+
+	if (srta->compress_tq == NULL || !send_compress_eligible(srta, range))
+		return;
+
+	mutex_enter(&srdp->lock);
+	if (!srdp->io_outstanding && srdp->abd == NULL && srdp->abuf == NULL) {
+		mutex_exit(&srdp->lock);
+		return;
+	}
+	srdp->sc_compress = srta->compress;
+	srdp->sc_outstanding = B_TRUE;
+	mutex_exit(&srdp->lock);
+
+	VERIFY3U(taskq_dispatch(srta->compress_tq, send_compress_range,
+	    range, TQ_SLEEP), !=, TASKQID_INVALID);
+}
+
 static void
 issue_data_read(struct send_reader_thread_arg *srta, struct send_range *range)
 {
@@ -1631,8 +1780,19 @@ issue_data_read(struct send_reader_thread_arg *srta, struct send_range *range)
 	srdp->datasz = (zioflags & ZIO_FLAG_RAW_COMPRESS) ?
 	    BP_GET_PSIZE(bp) : BP_GET_LSIZE(bp);
 
-	if (!srta->issue_reads)
+	if (!srta->issue_reads) {
+		/*
+		 * A dry run can't compress anything, so it counts a block that
+		 * would be compressed for transport at its size on disk.
+		 */
+		if (send_compress_eligible(srta, range) &&
+		    !BP_IS_EMBEDDED(bp) &&
+		    BP_GET_COMPRESS(bp) != ZIO_COMPRESS_OFF) {
+			srdp->sc_compress = srta->compress;
+			srdp->sc_size = BP_GET_PSIZE(bp);
+		}
 		return;
+	}
 	if (BP_IS_REDACTED(bp))
 		return;
 	if (send_do_embed(bp, srta->featureflags))
@@ -1663,6 +1823,7 @@ issue_data_read(struct send_reader_thread_arg *srta, struct send_range *range)
 		    srdp->datasz, dmu_send_read_done, range,
 		    ZIO_PRIORITY_ASYNC_READ, zioflags, &zb));
 	}
+	send_compress_dispatch(srta, range);
 }
 
 /*
@@ -1937,6 +2098,7 @@ struct dmu_send_params {
 	boolean_t compressok;
 	boolean_t rawok;
 	boolean_t savedok;
+	enum zio_compress stream_compress;
 	uint64_t resumeobj;
 	uint64_t resumeoff;
 	uint64_t saved_guid;
@@ -2019,6 +2181,11 @@ setup_featureflags(struct dmu_send_params *dspp, objset_t *os,
 		*featureflags |= DMU_BACKUP_FEATURE_LONGNAME;
 	}
 
+	if (dspp->stream_compress != ZIO_COMPRESS_OFF &&
+	    !(*featureflags & DMU_BACKUP_FEATURE_RAW)) {
+		*featureflags |= DMU_BACKUP_FEATURE_STREAM_COMPRESS;
+	}
+
 	if (dsl_dataset_feature_is_active(to_ds, SPA_FEATURE_LARGE_MICROZAP)) {
 		/*
 		 * We must never split a large microzap block, so we can only
@@ -2167,6 +2334,14 @@ setup_reader_thread(struct send_reader_thread_arg *srt_arg,
 	srt_arg->smta = smt_arg;
 	srt_arg->issue_reads = !dspp->dso->dso_dryrun;
 	srt_arg->featureflags = featureflags;
+	srt_arg->compress = ZIO_COMPRESS_OFF;
+	if (featureflags & DMU_BACKUP_FEATURE_STREAM_COMPRESS)
+		srt_arg->compress = dspp->stream_compress;
+	if (srt_arg->compress != ZIO_COMPRESS_OFF && srt_arg->issue_reads) {
+		int nthreads = MAX(zfs_send_compress_threads, 1);
+		srt_arg->compress_tq = taskq_create("send_compress", nthreads,
+		    minclsyspri, nthreads, INT_MAX, TASKQ_PREPOPULATE);
+	}
 	(void) thread_create(NULL, 0, send_reader_thread, srt_arg, 0,
 	    curproc, TS_RUN, minclsyspri);
 }
@@ -2588,6 +2763,10 @@ dmu_send_impl(struct dmu_send_params *dspp)
 	}
 	range_free(range);
 
+	/* Every range has been freed, so no compression task is pending. */
+	if (srt_arg->compress_tq != NULL)
+		taskq_destroy(srt_arg->compress_tq);
+
 	bqueue_destroy(&srt_arg->q);
 	bqueue_destroy(&smt_arg->q);
 	if (dspp->redactbook != NULL)
@@ -2657,8 +2836,8 @@ out:
 int
 dmu_send_obj(const char *pool, uint64_t tosnap, uint64_t fromsnap,
     boolean_t embedok, boolean_t large_block_ok, boolean_t compressok,
-    boolean_t rawok, boolean_t savedok, int outfd, offset_t *off,
-    dmu_send_outparams_t *dsop)
+    boolean_t rawok, boolean_t savedok, enum zio_compress stream_compress,
+    int outfd, offset_t *off, dmu_send_outparams_t *dsop)
 {
 	int err;
 	dsl_dataset_t *fromds;
@@ -2673,6 +2852,7 @@ dmu_send_obj(const char *pool, uint64_t tosnap, uint64_t fromsnap,
 	dspp.tag = FTAG;
 	dspp.rawok = rawok;
 	dspp.savedok = savedok;
+	dspp.stream_compress = stream_compress;
 
 	dsflags = (rawok) ? DS_HOLD_FLAG_NONE : DS_HOLD_FLAG_DECRYPT;
 	err = dsl_pool_hold(pool, FTAG, &dspp.dp);
@@ -2747,8 +2927,8 @@ dmu_send_obj(const char *pool, uint64_t tosnap, uint64_t fromsnap,
 int
 dmu_send(const char *tosnap, const char *fromsnap, boolean_t embedok,
     boolean_t large_block_ok, boolean_t compressok, boolean_t rawok,
-    boolean_t savedok, uint64_t resumeobj, uint64_t resumeoff,
-    const char *redactbook, int outfd, offset_t *off,
+    boolean_t savedok, enum zio_compress stream_compress, uint64_t resumeobj,
+    uint64_t resumeoff, const char *redactbook, int outfd, offset_t *off,
     dmu_send_outparams_t *dsop)
 {
 	int err = 0;
@@ -2771,6 +2951,7 @@ dmu_send(const char *tosnap, const char *fromsnap, boolean_t embedok,
 	dspp.resumeoff = resumeoff;
 	dspp.rawok = rawok;
 	dspp.savedok = savedok;
+	dspp.stream_compress = stream_compress;
 
 	if (fromsnap != NULL && strpbrk(fromsnap, "@#") == NULL)
 		return (SET_ERROR(EINVAL));
@@ -3130,6 +3311,9 @@ ZFS_MODULE_PARAM(zfs_send, zfs_send_, unmodified_spill_blocks, INT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_send, zfs_send_, no_prefetch_queue_length, UINT, ZMOD_RW,
 	"Maximum send queue length for non-prefetch queues");
 
+ZFS_MODULE_PARAM(zfs_send, zfs_send_, compress_threads, UINT, ZMOD_RW,
+	"Threads compressing WRITE payloads for each send");
+
 ZFS_MODULE_PARAM(zfs_send, zfs_send_, queue_ff, UINT, ZMOD_RW,
 	"Send queue fill fraction");
 
@@ -30,6 +30,7 @@
 #include <sys/dsl_dataset.h>
 #include <sys/dsl_dir.h>
 #include <sys/dsl_pool.h>
+#include <sys/dsl_change_log.h>
 #include <sys/dnode.h>
 #include <sys/spa.h>
 #include <sys/spa_impl.h>
@@ -67,6 +68,7 @@ typedef struct traverse_data {
 	blkptr_cb_t *td_func;
 	void *td_arg;
 	boolean_t td_realloc_possible;
+	zfs_range_tree_t *td_changed;
 } traverse_data_t;
 
 static int traverse_dnode(traverse_data_t *td, const blkptr_t *bp,
@@ -184,6 +186,34 @@ resume_skip_check(const traverse_data_t *td, const dnode_phys_t *dnp,
 	return (RESUME_SKIP_NONE);
 }
 
+/*
+ * Returns B_FALSE if td has a list of changed objects and the meta-dnode
+ * block indicated by zb holds none of them, in which case nothing below
+ * the block can have changed either.  Otherwise returns B_TRUE.
+ */
+static boolean_t
+traverse_holds_changed(const traverse_data_t *td, const dnode_phys_t *dnp,
+    const zbookmark_phys_t *zb)
+{
+	uint64_t start, size;
+
+	if (td->td_changed == NULL || zb->zb_object != DMU_META_DNODE_OBJECT ||
+	    zb->zb_level < 0)
+		return (B_TRUE);
+
+	/* log2 of the number of dnodes covered by this block */
+	uint64_t shift = highbit64(((uint64_t)dnp->dn_datablkszsec <<
+	    SPA_MINBLOCKSHIFT) >> DNODE_SHIFT) - 1 +
+	    zb->zb_level * (dnp->dn_indblkshift - SPA_BLKPTRSHIFT);
+	if (shift >= DN_MAX_OBJECT_SHIFT)
+		return (B_TRUE);
+	if (zb->zb_blkid >= (DN_MAX_OBJECT >> shift))
+		return (B_FALSE);
+
+	return (zfs_range_tree_find_in(td->td_changed, zb->zb_blkid << shift,
+	    1ULL << shift, &start, &size));
+}
+
 /*
  * Returns B_TRUE, if prefetch read is issued, otherwise B_FALSE.
  */
@@ -207,6 +237,8 @@ traverse_prefetch_metadata(traverse_data_t *td, const dnode_phys_t *dnp,
 		return (B_FALSE);
 	if (BP_GET_LEVEL(bp) == 0 && BP_GET_TYPE(bp) != DMU_OT_DNODE)
 		return (B_FALSE);
+	if (!traverse_holds_changed(td, dnp, zb))
+		return (B_FALSE);
 	ASSERT(!BP_IS_REDACTED(bp));
 
 	if ((td->td_flags & TRAVERSE_NO_DECRYPT) && BP_IS_PROTECTED(bp))
@@ -278,6 +310,9 @@ traverse_visitbp(traverse_data_t *td, const dnode_phys_t *dnp,
 		return (0);
 	}
 
+	if (!traverse_holds_changed(td, dnp, zb))
+		return (0);
+
 	if (pd != NULL && !pd->pd_exited && prefetch_needed(pd, bp)) {
 		uint64_t size = BP_GET_LSIZE(bp);
 		mutex_enter(&pd->pd_mtx);
@@ -658,6 +693,9 @@ traverse_impl(spa_t *spa, dsl_dataset_t *ds, uint64_t objset, blkptr_t *rootbp,
 	td->td_flags = flags;
 	td->td_paused = B_FALSE;
 	td->td_realloc_possible = (txg_start == 0 ? B_FALSE : B_TRUE);
+	td->td_changed = NULL;
+	if ((flags & TRAVERSE_CHANGE_LOG) && ds != NULL)
+		td->td_changed = dsl_change_log_changed(ds, txg_start);
 
 	if (spa_feature_is_active(spa, SPA_FEATURE_HOLE_BIRTH)) {
 		VERIFY(spa_feature_enabled_txg(spa,
@@ -722,6 +760,8 @@ out:
 	mutex_destroy(&pd->pd_mtx);
 	cv_destroy(&pd->pd_cv);
 
+	if (td->td_changed != NULL)
+		dsl_change_log_changed_free(td->td_changed);
 	kmem_free(czb, sizeof (zbookmark_phys_t));
 	kmem_free(pd, sizeof (struct prefetch_data));
 	kmem_free(td, sizeof (struct traverse_data));
@@ -0,0 +1,364 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or https://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Per-dataset change log.
+ *
+ * When the change_log feature is enabled, every head filesystem and volume
+ * with the changelog property set keeps a MOS object recording which of its
+ * objects were dirtied in each txg.  dsl_dataset_sync() appends to the log
+ * before the dirty dnodes are written out; the format is described in
+ * dsl_change_log.h.
+ *
+ * A block born after some txg always belongs to an object that was dirtied
+ * after that txg, so an incremental traversal from a snapshot taken after
+ * the log started only has to descend into the parts of the meta-dnode
+ * that hold logged objects.  traverse_dataset() does this for callers that
+ * pass TRAVERSE_CHANGE_LOG (incremental send and zfs diff); everything
+ * below the meta-dnode is still pruned by birth time as before.
+ *
+ * The log describes the history of the head dataset, so it is thrown away
+ * when the head's contents are replaced by another dataset's (rollback and
+ * receive both go through dsl_dataset_clone_swap_sync_impl()), restarted
+ * when it grows past zfs_change_log_max_entries, and destroyed when a
+ * dataset is synced with the property turned off.  A traversal that starts
+ * before the log does simply visits the whole meta-dnode.
+ *
+ * Readers run in open context while the log may be appended to, reset or
+ * destroyed in syncing context.  The log is only ever appended to between
+ * resets, and every reset or destroy bumps ds_change_log_gen, so a reader
+ * that sees the same generation before and after reading knows that what
+ * it read was a consistent prefix of the log.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/dsl_change_log.h>
+#include <sys/dsl_dataset.h>
+#include <sys/dsl_dir.h>
+#include <sys/dsl_pool.h>
+#include <sys/dmu_objset.h>
+#include <sys/dmu_tx.h>
+#include <sys/dnode.h>
+#include <sys/multilist.h>
+#include <sys/zap.h>
+#include <sys/zfeature.h>
+
+/*
+ * Restart a change log once it holds this many words (8 bytes each).
+ */
+static uint64_t zfs_change_log_max_entries = 1ULL << 22;
+
+/* Words read from the log at a time */
+#define	DCL_READ_WORDS	(SPA_OLD_MAXBLOCKSIZE / sizeof (uint64_t))
+
+uint64_t
+dsl_change_log_object(dsl_dataset_t *ds)
+{
+	uint64_t obj;
+	int err;
+
+	if (!spa_feature_is_active(ds->ds_dir->dd_pool->dp_spa,
+	    SPA_FEATURE_CHANGE_LOG) || !dsl_dataset_is_zapified(ds))
+		return (0);
+
+	err = zap_lookup(ds->ds_dir->dd_pool->dp_meta_objset, ds->ds_object,
+	    DS_FIELD_CHANGE_LOG, sizeof (obj), 1, &obj);
+	if (err != 0) {
+		VERIFY3S(err, ==, ENOENT);
+		return (0);
+	}
+
+	ASSERT(obj != 0);
+	return (obj);
+}
+
+static uint64_t
+dsl_change_log_create(dsl_dataset_t *ds, dmu_tx_t *tx)
+{
+	objset_t *mos = ds->ds_dir->dd_pool->dp_meta_objset;
+	dmu_buf_t *db;
+
+	uint64_t obj = dmu_object_alloc(mos, DMU_OTN_UINT64_METADATA,
+	    SPA_OLD_MAXBLOCKSIZE, DMU_OTN_UINT64_METADATA,
+	    sizeof (dsl_change_log_phys_t), tx);
+	VERIFY0(dmu_bonus_hold(mos, obj, FTAG, &db));
+	dmu_buf_will_dirty(db, tx);
+	dsl_change_log_phys_t *dcl = db->db_data;
+	dcl->dcl_start_txg = dmu_tx_get_txg(tx);
+	dcl->dcl_entries = 0;
+	dmu_buf_rele(db, FTAG);
+
+	dsl_dataset_zapify(ds, tx);
+	VERIFY0(zap_add(mos, ds->ds_object, DS_FIELD_CHANGE_LOG,
+	    sizeof (obj), 1, &obj, tx));
+	spa_feature_incr(ds->ds_dir->dd_pool->dp_spa, SPA_FEATURE_CHANGE_LOG,
+	    tx);
+	return (obj);
+}
+
+void
+dsl_change_log_destroy(dsl_dataset_t *ds, dmu_tx_t *tx)
+{
+	objset_t *mos = ds->ds_dir->dd_pool->dp_meta_objset;
+
+	ASSERT(dmu_tx_is_syncing(tx));
+
+	uint64_t obj = dsl_change_log_object(ds);
+	if (obj == 0)
+		return;
+
+	mutex_enter(&ds->ds_lock);
+	ds->ds_change_log_gen++;
+	mutex_exit(&ds->ds_lock);
+
+	VERIFY0(dmu_object_free(mos, obj, tx));
+	VERIFY0(zap_remove(mos, ds->ds_object, DS_FIELD_CHANGE_LOG, tx));
+	spa_feature_decr(ds->ds_dir->dd_pool->dp_spa, SPA_FEATURE_CHANGE_LOG,
+	    tx);
+}
+
+typedef struct dcl_fill_arg {
+	uint64_t *dfa_buf;
+	uint64_t dfa_count;
+} dcl_fill_arg_t;
+
+static void
+dsl_change_log_fill(void *arg, uint64_t start, uint64_t size)
+{
+	dcl_fill_arg_t *dfa = arg;
+
+	for (uint64_t obj = start; obj < start + size; obj++)
+		dfa->dfa_buf[dfa->dfa_count++] = obj;
+}
+
+/*
+ * Append the objects dirtied in this txg to the dataset's change log,
+ * creating the log if needed.  Called from dsl_dataset_sync() before the
+ * dirty dnodes are synced.
+ */
+void
+dsl_change_log_sync(dsl_dataset_t *ds, dmu_tx_t *tx)
+{
+	dsl_pool_t *dp = ds->ds_dir->dd_pool;
+	objset_t *mos = dp->dp_meta_objset;
+	objset_t *os = ds->ds_objset;
+	uint64_t txg = dmu_tx_get_txg(tx);
+
+	ASSERT(dmu_tx_is_syncing(tx));
+
+	if (!spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_CHANGE_LOG))
+		return;
+
+	uint64_t obj = dsl_change_log_object(ds);
+	if (!os->os_change_log || DS_IS_INCONSISTENT(ds) ||
+	    ds->ds_dir->dd_myname[0] == '$') {
+		dsl_change_log_destroy(ds, tx);
+		return;
+	}
+
+	zfs_range_tree_t *rt = zfs_range_tree_create(NULL, ZFS_RANGE_SEG64,
+	    NULL, 0, 0);
+	multilist_t *ml = &os->os_dirty_dnodes[txg & TXG_MASK];
+	for (int i = 0; i < multilist_get_num_sublists(ml); i++) {
+		multilist_sublist_t *mls = multilist_sublist_lock_idx(ml, i);
+		for (dnode_t *dn = multilist_sublist_head(mls); dn != NULL;
+		    dn = multilist_sublist_next(mls, dn)) {
+			if (!zfs_range_tree_contains(rt, dn->dn_object, 1))
+				zfs_range_tree_add(rt, dn->dn_object, 1);
+		}
+		multilist_sublist_unlock(mls);
+	}
+
+	uint64_t count = zfs_range_tree_space(rt);
+	if (count == 0 && obj != 0) {
+		zfs_range_tree_destroy(rt);
+		return;
+	}
+
+	dcl_fill_arg_t dfa;
+	size_t size = (count + 1) * sizeof (uint64_t);
+	dfa.dfa_buf = vmem_alloc(size, KM_SLEEP);
+	dfa.dfa_buf[0] = DCL_TXG_MARKER | txg;
+	dfa.dfa_count = 1;
+	zfs_range_tree_vacate(rt, dsl_change_log_fill, &dfa);
+	zfs_range_tree_destroy(rt);
+	ASSERT3U(dfa.dfa_count, ==, count + 1);
+
+	if (obj == 0)
+		obj = dsl_change_log_create(ds, tx);
+
+	dmu_buf_t *db;
+	VERIFY0(dmu_bonus_hold(mos, obj, FTAG, &db));
+	dmu_buf_will_dirty(db, tx);
+	dsl_change_log_phys_t *dcl = db->db_data;
+
+	if (dcl->dcl_entries + dfa.dfa_count > zfs_change_log_max_entries &&
+	    dcl->dcl_entries != 0) {
+		zfs_dbgmsg("restarting change log of ds %llu at txg %llu "
+		    "after %llu entries", (u_longlong_t)ds->ds_object,
+		    (u_longlong_t)txg, (u_longlong_t)dcl->dcl_entries);
+		mutex_enter(&ds->ds_lock);
+		ds->ds_change_log_gen++;
+		dcl->dcl_start_txg = txg;
+		dcl->dcl_entries = 0;
+		mutex_exit(&ds->ds_lock);
+		VERIFY0(dmu_free_range(mos, obj, 0, DMU_OBJECT_END, tx));
+	}
+
+	if (count != 0) {
+		dmu_write(mos, obj, dcl->dcl_entries * sizeof (uint64_t),
+		    size, dfa.dfa_buf, tx);
+		mutex_enter(&ds->ds_lock);
+		dcl->dcl_entries += dfa.dfa_count;
+		mutex_exit(&ds->ds_lock);
+	}
+	dmu_buf_rele(db, FTAG);
+	vmem_free(dfa.dfa_buf, size);
+}
+
+/*
+ * Read the change log of the head of ds's dsl_dir into rt, adding every
+ * object dirtied in a txg in (fromtxg, totxg].
+ */
+static int
+dsl_change_log_read(dsl_dataset_t *head, uint64_t fromtxg, uint64_t totxg,
+    zfs_range_tree_t *rt)
+{
+	objset_t *mos = head->ds_dir->dd_pool->dp_meta_objset;
+	uint64_t start_txg, entries, gen;
+	dmu_buf_t *db;
+	int err;
+
+	mutex_enter(&head->ds_lock);
+	gen = head->ds_change_log_gen;
+	mutex_exit(&head->ds_lock);
+
+	uint64_t obj = dsl_change_log_object(head);
+	if (obj == 0)
+		return (SET_ERROR(ENOENT));
+
+	err = dmu_bonus_hold(mos, obj, FTAG, &db);
+	if (err != 0)
+		return (err);
+	dsl_change_log_phys_t *dcl = db->db_data;
+	mutex_enter(&head->ds_lock);
+	start_txg = dcl->dcl_start_txg;
+	entries = dcl->dcl_entries;
+	mutex_exit(&head->ds_lock);
+	dmu_buf_rele(db, FTAG);
+
+	/*
+	 * Everything after fromtxg must have been logged, so the log has to
+	 * start no later than the txg after fromtxg.
+	 */
+	if (start_txg > fromtxg + 1)
+		return (SET_ERROR(ENOENT));
+
+	uint64_t *buf = vmem_alloc(DCL_READ_WORDS * sizeof (uint64_t),
+	    KM_SLEEP);
+	uint64_t txg = 0;
+	for (uint64_t off = 0; off < entries && txg <= totxg; ) {
+		uint64_t n = MIN(entries - off, DCL_READ_WORDS);
+
+		err = dmu_read(mos, obj, off * sizeof (uint64_t),
+		    n * sizeof (uint64_t), buf, DMU_READ_PREFETCH);
+		if (err != 0)
+			break;
+
+		for (uint64_t i = 0; i < n; i++) {
+			if (buf[i] & DCL_TXG_MARKER) {
+				txg = buf[i] & ~DCL_TXG_MARKER;
+				if (txg > totxg)
+					break;
+			} else if (txg > fromtxg &&
+			    !zfs_range_tree_contains(rt, buf[i], 1)) {
+				zfs_range_tree_add(rt, buf[i], 1);
+			}
+		}
+		off += n;
+	}
+	vmem_free(buf, DCL_READ_WORDS * sizeof (uint64_t));
+
+	mutex_enter(&head->ds_lock);
+	if (err == 0 && head->ds_change_log_gen != gen)
+		err = SET_ERROR(ESTALE);
+	mutex_exit(&head->ds_lock);
+	return (err);
+}
+
+/*
+ * Return the objects of snapshot ds that changed after fromtxg, or NULL if
+ * the change log of its dataset doesn't cover all of those changes.  The
+ * caller frees the tree with dsl_change_log_changed_free().
+ */
+zfs_range_tree_t *
+dsl_change_log_changed(dsl_dataset_t *ds, uint64_t fromtxg)
+{
+	dsl_pool_t *dp = ds->ds_dir->dd_pool;
+	dsl_dataset_t *head;
+	int err;
+
+	if (!ds->ds_is_snapshot || fromtxg == 0 ||
+	    !spa_feature_is_active(dp->dp_spa, SPA_FEATURE_CHANGE_LOG))
+		return (NULL);
+
+	dsl_pool_config_enter(dp, FTAG);
+	err = dsl_dataset_hold_obj(dp,
+	    dsl_dir_phys(ds->ds_dir)->dd_head_dataset_obj, FTAG, &head);
+	if (err != 0) {
+		dsl_pool_config_exit(dp, FTAG);
+		return (NULL);
+	}
+	dsl_dataset_long_hold(head, FTAG);
+	dsl_pool_config_exit(dp, FTAG);
+
+	zfs_range_tree_t *rt = zfs_range_tree_create(NULL, ZFS_RANGE_SEG64,
+	    NULL, 0, 0);
+	err = dsl_change_log_read(head, fromtxg,
+	    dsl_dataset_phys(ds)->ds_creation_txg, rt);
+	if (err == 0) {
+		zfs_dbgmsg("using change log of ds %llu from txg %llu: "
+		    "%llu objects", (u_longlong_t)head->ds_object,
+		    (u_longlong_t)fromtxg,
+		    (u_longlong_t)zfs_range_tree_space(rt));
+	} else {
+		dsl_change_log_changed_free(rt);
+		rt = NULL;
+	}
+
+	dsl_pool_config_enter(dp, FTAG);
+	dsl_dataset_long_rele(head, FTAG);
+	dsl_dataset_rele(head, FTAG);
+	dsl_pool_config_exit(dp, FTAG);
+
+	return (rt);
+}
+
+void
+dsl_change_log_changed_free(zfs_range_tree_t *rt)
+{
+	zfs_range_tree_vacate(rt, NULL, NULL);
+	zfs_range_tree_destroy(rt);
+}
+
+ZFS_MODULE_PARAM(zfs, zfs_, change_log_max_entries, U64, ZMOD_RW,
+	"Number of entries after which a change log is restarted");
@@ -64,6 +64,7 @@
 #include <sys/dsl_destroy.h>
 #include <sys/dsl_userhold.h>
 #include <sys/dsl_bookmark.h>
+#include <sys/dsl_change_log.h>
 #include <sys/policy.h>
 #include <sys/dmu_send.h>
 #include <sys/dmu_recv.h>
@@ -2136,6 +2137,8 @@ dsl_dataset_sync(dsl_dataset_t *ds, zio_t *rio, dmu_tx_t *tx)
 		ds->ds_resume_bytes[tx->tx_txg & TXG_MASK] = 0;
 	}
 
+	dsl_change_log_sync(ds, tx);
+
 	dmu_objset_sync(ds->ds_objset, rio, tx);
 }
 
@@ -4192,6 +4195,12 @@ dsl_dataset_clone_swap_sync_impl(dsl_dataset_t *clone,
 
 	dsl_dir_cancel_waiters(origin_head->ds_dir);
 
+	/*
+	 * Neither change log describes how the swapped contents came to be.
+	 */
+	dsl_change_log_destroy(clone, tx);
+	dsl_change_log_destroy(origin_head, tx);
+
 	/*
 	 * Swap per-dataset feature flags.
 	 */
@@ -927,6 +927,64 @@ dsl_deadlist_merge(dsl_deadlist_t *dl, uint64_t obj, dmu_tx_t *tx)
 	zap_attribute_free(pza);
 }
 
+/*
+ * Read in the non-empty bpobjs of dl and prefetch the tails of their
+ * blkptr and subobj arrays, so that a later dsl_deadlist_merge() or
+ * dsl_deadlist_move_bpobj() involving dl finds them cached.  Unlike the
+ * prefetching done by those functions, this is called from open context
+ * (with the dp_config_rwlock held as reader), so the reads are not charged
+ * to the syncing txg.  It does not modify dl, and errors are ignored.
+ */
+void
+dsl_deadlist_prefetch(dsl_deadlist_t *dl)
+{
+	zap_cursor_t zc;
+	zap_attribute_t *za;
+	uint64_t empty_bpobj, count, n = 0;
+	uint64_t *objs;
+
+	if (dl->dl_oldfmt)
+		return;
+	if (zap_count(dl->dl_os, dl->dl_object, &count) != 0 || count == 0)
+		return;
+
+	/*
+	 * Prefetch all the bpobj's so that we do that i/o in parallel, as
+	 * dsl_deadlist_load_tree() does.  Then open them in a second pass.
+	 */
+	empty_bpobj = dmu_objset_pool(dl->dl_os)->dp_empty_bpobj;
+	objs = kmem_alloc(count * sizeof (uint64_t), KM_SLEEP);
+	za = zap_attribute_alloc();
+	for (zap_cursor_init(&zc, dl->dl_os, dl->dl_object);
+	    n < count && zap_cursor_retrieve(&zc, za) == 0;
+	    zap_cursor_advance(&zc)) {
+		if (za->za_first_integer == empty_bpobj)
+			continue;
+		objs[n++] = za->za_first_integer;
+		dmu_prefetch_dnode(dl->dl_os, za->za_first_integer,
+		    ZIO_PRIORITY_ASYNC_READ);
+	}
+	zap_cursor_fini(&zc);
+	zap_attribute_free(za);
+
+	for (uint64_t i = 0; i < n; i++) {
+		bpobj_t bpo;
+
+		if (bpobj_open(&bpo, dl->dl_os, objs[i]) != 0)
+			continue;
+		dmu_prefetch(dl->dl_os, bpo.bpo_object, 0,
+		    bpo.bpo_phys->bpo_num_blkptrs * sizeof (blkptr_t), 1,
+		    ZIO_PRIORITY_ASYNC_READ);
+		if (bpo.bpo_havesubobj && bpo.bpo_phys->bpo_subobjs != 0) {
+			dmu_prefetch(dl->dl_os, bpo.bpo_phys->bpo_subobjs, 0,
+			    bpo.bpo_phys->bpo_num_subobjs * sizeof (uint64_t),
+			    1, ZIO_PRIORITY_ASYNC_READ);
+		}
+		bpobj_close(&bpo);
+	}
+	kmem_free(objs, count * sizeof (uint64_t));
+}
+
 /*
  * Remove entries on dl that are born > mintxg, and put them on the bpobj.
  */
@@ -1017,6 +1075,7 @@ struct livelist_iter_arg {
 	avl_tree_t *avl;
 	bplist_t *to_free;
 	zthr_t *t;
+	const boolean_t *cancelled;
 };
 
 /*
@@ -1041,6 +1100,8 @@ dsl_livelist_iterate(void *arg, const blkptr_t *bp, boolean_t bp_freed,
 
 	if ((t != NULL) && (zthr_has_waiters(t) || zthr_iscancelled(t)))
 		return (SET_ERROR(EINTR));
+	if (lia->cancelled != NULL && *lia->cancelled)
+		return (SET_ERROR(EINTR));
 
 	livelist_entry_t node;
 	node.le_bp = *bp;
@@ -1086,13 +1147,9 @@ dsl_livelist_iterate(void *arg, const blkptr_t *bp, boolean_t bp_freed,
 	return (0);
 }
 
-/*
- * Accepts a bpobj and a bplist. Will insert into the bplist the blkptrs
- * which have an ALLOC entry but no matching FREE
- */
-int
-dsl_process_sub_livelist(bpobj_t *bpobj, bplist_t *to_free, zthr_t *t,
-    uint64_t *size)
+static int
+dsl_process_sub_livelist_impl(bpobj_t *bpobj, bplist_t *to_free, zthr_t *t,
+    const boolean_t *cancelled, uint64_t *size)
 {
 	avl_tree_t avl;
 	avl_create(&avl, livelist_compare, sizeof (livelist_entry_t),
@@ -1102,7 +1159,8 @@ dsl_process_sub_livelist(bpobj_t *bpobj, bplist_t *to_free, zthr_t *t,
 	struct livelist_iter_arg arg = {
 	    .avl = &avl,
 	    .to_free = to_free,
-	    .t = t
+	    .t = t,
+	    .cancelled = cancelled
 	};
 	int err = bpobj_iterate_nofree(bpobj, dsl_livelist_iterate, &arg, size);
 	VERIFY(err != 0 || avl_numnodes(&avl) == 0);
@@ -1116,6 +1174,30 @@ dsl_process_sub_livelist(bpobj_t *bpobj, bplist_t *to_free, zthr_t *t,
 	return (err);
 }
 
+/*
+ * Accepts a bpobj and a bplist. Will insert into the bplist the blkptrs
+ * which have an ALLOC entry but no matching FREE
+ */
+int
+dsl_process_sub_livelist(bpobj_t *bpobj, bplist_t *to_free, zthr_t *t,
+    uint64_t *size)
+{
+	return (dsl_process_sub_livelist_impl(bpobj, to_free, t, NULL, size));
+}
+
+/*
+ * Like dsl_process_sub_livelist(), for callers that are not running in the
+ * zthr itself: the processing is interrupted with EINTR once *cancelled is
+ * set.
+ */
+int
+dsl_process_sub_livelist_cancel(bpobj_t *bpobj, bplist_t *to_free,
+    const boolean_t *cancelled)
+{
+	return (dsl_process_sub_livelist_impl(bpobj, to_free, NULL,
+	    cancelled, NULL));
+}
+
 ZFS_MODULE_PARAM(zfs_livelist, zfs_livelist_, max_entries, U64, ZMOD_RW,
 	"Size to start the next sub-livelist in a livelist");
 
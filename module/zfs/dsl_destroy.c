@@ -47,11 +47,25 @@
 #include <sys/zvol.h>
 #include <sys/zcp.h>
 #include <sys/dsl_deadlist.h>
+#include <sys/dsl_change_log.h>
 #include <sys/zthr.h>
 #include <sys/spa_impl.h>
 
 extern int zfs_snapshot_history_enabled;
 
+/*
+ * Number of threads used to read in the deadlists of the snapshots being
+ * destroyed by dsl_destroy_snapshots_nvl() before the destroy is synced.
+ * Zero disables the prefetch.
+ */
+static uint_t zfs_destroy_prefetch_threads = 8;
+
+/*
+ * Destroys of fewer snapshots than this sync without prefetching, as
+ * starting the threads would cost more than it saves.
+ */
+#define	DSL_DESTROY_PREFETCH_MIN	4
+
 int
 dsl_destroy_snapshot_check_impl(dsl_dataset_t *ds, boolean_t defer)
 {
@@ -586,6 +600,71 @@ dsl_destroy_snapshot_sync(void *arg, dmu_tx_t *tx)
 	dsl_dataset_rele(ds, FTAG);
 }
 
+/*
+ * Read in the deadlists that destroying the named snapshot will merge, from
+ * open context, so that dsl_destroy_snapshot_sync_impl() finds them cached.
+ * This is best effort: a snapshot that can't be held is simply skipped, and
+ * the sync task will report the error.
+ */
+static void
+dsl_destroy_snapshot_prefetch(void *arg)
+{
+	const char *name = arg;
+	dsl_pool_t *dp;
+	dsl_dataset_t *ds, *ds_next;
+	uint64_t used, comp, uncomp;
+
+	if (dsl_pool_hold(name, FTAG, &dp) != 0)
+		return;
+	if (dsl_dataset_hold(dp, name, FTAG, &ds) != 0) {
+		dsl_pool_rele(dp, FTAG);
+		return;
+	}
+	if (ds->ds_is_snapshot && dsl_dataset_phys(ds)->ds_next_snap_obj != 0 &&
+	    dsl_dataset_hold_obj(dp, dsl_dataset_phys(ds)->ds_next_snap_obj,
+	    FTAG, &ds_next) == 0) {
+		if (!ds_next->ds_deadlist.dl_oldfmt) {
+			/* Load next's space cache for the snapused update. */
+			dsl_deadlist_space_range(&ds_next->ds_deadlist,
+			    dsl_dataset_phys(ds)->ds_prev_snap_txg, UINT64_MAX,
+			    &used, &comp, &uncomp);
+			dsl_deadlist_prefetch(&ds_next->ds_deadlist);
+			dsl_deadlist_prefetch(&ds->ds_deadlist);
+		}
+		dsl_dataset_rele(ds_next, FTAG);
+	}
+	dsl_dataset_rele(ds, FTAG);
+	dsl_pool_rele(dp, FTAG);
+}
+
+/*
+ * Read in the deadlists of all the snapshots in snaps on a taskq, and wait
+ * for it.  Destroys of only a few snapshots don't bother.
+ */
+static void
+dsl_destroy_snapshots_prefetch(nvlist_t *snaps)
+{
+	uint_t nthreads = zfs_destroy_prefetch_threads;
+	uint_t count = 0;
+
+	for (nvpair_t *pair = nvlist_next_nvpair(snaps, NULL);
+	    pair != NULL && count < DSL_DESTROY_PREFETCH_MIN;
+	    pair = nvlist_next_nvpair(snaps, pair))
+		count++;
+	if (nthreads == 0 || count < DSL_DESTROY_PREFETCH_MIN)
+		return;
+
+	taskq_t *tq = taskq_create("dsl_destroy_prefetch", nthreads,
+	    defclsyspri, 1, INT_MAX, TASKQ_DYNAMIC);
+	for (nvpair_t *pair = nvlist_next_nvpair(snaps, NULL);
+	    pair != NULL; pair = nvlist_next_nvpair(snaps, pair)) {
+		(void) taskq_dispatch(tq, dsl_destroy_snapshot_prefetch,
+		    (void *)nvpair_name(pair), TQ_SLEEP);
+	}
+	taskq_wait(tq);
+	taskq_destroy(tq);
+}
+
 /*
  * The semantics of this function are described in the comment above
  * lzc_destroy_snaps().  To summarize:
@@ -598,6 +677,12 @@ dsl_destroy_snapshot_sync(void *arg, dmu_tx_t *tx)
  * On success, all snaps will be destroyed and this will return 0.
  * On failure, no snaps will be destroyed, the errlist will be filled in,
  * and this will return an errno.
+ *
+ * Destroying a snapshot merges its deadlist into the next snapshot's, and
+ * when many snapshots are destroyed at once reading those deadlists in can
+ * dominate the sync.  So they are first read in from open context.
+ * Callers that want to bound the length of the sync should destroy fewer
+ * snapshots per call, as "zfs destroy -b" does.
  */
 int
 dsl_destroy_snapshots_nvl(nvlist_t *snaps, boolean_t defer,
@@ -606,6 +691,8 @@ dsl_destroy_snapshots_nvl(nvlist_t *snaps, boolean_t defer,
 	if (nvlist_next_nvpair(snaps, NULL) == NULL)
 		return (0);
 
+	dsl_destroy_snapshots_prefetch(snaps);
+
 	/*
 	 * lzc_destroy_snaps() is documented to take an nvlist whose
 	 * values "don't matter".  We need to convert that nvlist to
@@ -1078,6 +1165,8 @@ dsl_destroy_head_sync_impl(dsl_dataset_t *ds, dmu_tx_t *tx)
 	if (dsl_dataset_remap_deadlist_exists(ds))
 		dsl_dataset_destroy_remap_deadlist(ds, tx);
 
+	dsl_change_log_destroy(ds, tx);
+
 	/*
 	 * Each destroy is responsible for both destroying (enqueuing
 	 * to be destroyed) the blkptrs comprising the dataset as well as
@@ -1292,6 +1381,9 @@ dsl_destroy_inconsistent(const char *dsname, void *arg)
 }
 
 
+ZFS_MODULE_PARAM(zfs, zfs_, destroy_prefetch_threads, UINT, ZMOD_RW,
+	"Threads reading in deadlists before a bulk snapshot destroy");
+
 #if defined(_KERNEL)
 EXPORT_SYMBOL(dsl_destroy_head);
 EXPORT_SYMBOL(dsl_destroy_head_sync_impl);
@@ -56,6 +56,7 @@
 #include <sys/abd.h>
 #include <sys/range_tree.h>
 #include <sys/dbuf.h>
+#include <sys/dmu_traverse.h>
 #ifdef _KERNEL
 #include <sys/zfs_vfsops.h>
 #endif
@@ -82,7 +83,9 @@
  * limit, we clear out a few of the largest extents at the head of the queues
  * to make room for more scanning. Hopefully, these extents will be fairly
  * large and contiguous, allowing us to approach sequential I/O throughput
- * even without a fully sorted tree.
+ * even without a fully sorted tree. Alternatively (zfs_scan_spill), the
+ * queues are written out to disk as sorted runs instead, which are merged
+ * back in LBA order at the next checkpoint; see dsl_scan_spill().
  *
  * Metadata scanning takes place in dsl_scan_visit(), which is called from
  * dsl_scan_sync() every spa_sync(). If we have either fully scanned all
@@ -114,6 +117,9 @@
  * bookmark, indicating that we have scanned everything logically before it.
  * If the pool is imported on a machine without the new sorting algorithm,
  * the scan simply resumes from the last checkpoint using the legacy algorithm.
+ * The same goes for the datasets that were being traversed concurrently
+ * (see dsl_scan_visit_queue()): software that does not know about them
+ * finds them in the dataset queue and traverses them again from the start.
  */
 
 typedef int (scan_cb_t)(dsl_pool_t *, const blkptr_t *,
@@ -130,6 +136,9 @@ static boolean_t scan_ds_queue_contains(dsl_scan_t *scn, uint64_t dsobj,
 static void scan_ds_queue_insert(dsl_scan_t *scn, uint64_t dsobj, uint64_t txg);
 static void scan_ds_queue_remove(dsl_scan_t *scn, uint64_t dsobj);
 static void scan_ds_queue_sync(dsl_scan_t *scn, dmu_tx_t *tx);
+static boolean_t dsl_scan_lane_busy(const dsl_scan_lane_phys_t *slp);
+static void dsl_scan_lanes_sync(dsl_scan_t *scn, const dsl_scan_phys_t *phys,
+    const dsl_scan_lane_phys_t *lanes, dmu_tx_t *tx);
 static uint64_t dsl_scan_count_data_disks(spa_t *spa);
 static void read_by_block_level(dsl_scan_t *scn, zbookmark_phys_t zb);
 
@@ -163,6 +172,18 @@ static int zfs_scan_strict_mem_lim = B_FALSE;
  */
 static uint64_t zfs_scan_vdev_limit = 16 << 20;
 
+/*
+ * When non-zero, the issuing phase of a sorted scan adapts to foreground
+ * load: whenever the moving average of sync read and write latency on any
+ * leaf of a top-level vdev exceeds zfs_scan_latency_target_us, the in-flight
+ * limit of that vdev's queue is halved, down to zfs_scan_latency_min_pct
+ * percent of zfs_scan_vdev_limit. It grows back in steps while latency is
+ * under target, and immediately to the full limit once the vdev has seen no
+ * sync I/O for a second. See scan_io_queue_throttle().
+ */
+static uint_t zfs_scan_latency_target_us = 0;
+static uint_t zfs_scan_latency_min_pct = 5;
+
 static uint_t zfs_scan_issue_strategy = 0;
 
 /* don't queue & sort zios, go direct */
@@ -188,6 +209,19 @@ static uint_t zfs_scan_mem_lim_fact = 20;
 /* fraction of mem lim above */
 static uint_t zfs_scan_mem_lim_soft_fact = 20;
 
+/*
+ * Spill the sorting queues to disk rather than issuing them early when
+ * they hit the memory limit; see dsl_scan_spill(). zfs_scan_spill_max_runs
+ * caps the number of runs per top-level vdev before we fall back to
+ * clearing, zfs_scan_spill_load_mem is how much of the runs of a vdev
+ * is merged back into memory at a time, and zfs_scan_spill_txg_max is how
+ * much is written out per txg.
+ */
+static int zfs_scan_spill = B_FALSE;
+static uint_t zfs_scan_spill_max_runs = 32;
+static uint64_t zfs_scan_spill_load_mem = 16 << 20;
+static uint64_t zfs_scan_spill_txg_max = 64 << 20;
+
 /* minimum milliseconds to scrub per txg */
 static uint_t zfs_scrub_min_time_ms = 1000;
 
@@ -204,11 +238,15 @@ static uint_t zfs_scan_checkpoint_intval = 7200; /* in seconds */
 int zfs_scan_suspend_progress = 0; /* set to prevent scans from progressing */
 static int zfs_no_scrub_io = B_FALSE; /* set to disable scrub i/o */
 static int zfs_no_scrub_prefetch = B_FALSE; /* set to disable scrub prefetch */
+/* max number of datasets to traverse at once, see dsl_scan_visit_queue() */
+static uint_t zfs_scan_ds_concurrent = 4;
 static const ddt_class_t zfs_scrub_ddt_class_max = DDT_CLASS_DUPLICATE;
 /* max number of blocks to free in a single TXG */
 static uint64_t zfs_async_block_max_blocks = UINT64_MAX;
 /* max number of dedup blocks to free in a single TXG */
 static uint64_t zfs_max_async_dedup_frees = 100000;
+/* max bytes of metadata to read ahead of an async destroy between TXGs */
+static uint64_t zfs_async_destroy_prefetch_max = 128 << 20;
 
 /* set to disable resilver deferring */
 static int zfs_resilver_disable_defer = B_FALSE;
@@ -319,6 +357,33 @@ typedef struct scan_io {
 #define	SIO_GET_MUSED(sio)		\
 	(sizeof (scan_io_t) + ((sio)->sio_nr_dvas * sizeof (dva_t)))
 
+/*
+ * On-disk form of a scan_io_t in a run spilled by dsl_scan_spill(). Runs
+ * are only read back by the same import of the pool, so this is kept in
+ * native byte order.
+ */
+typedef struct scan_spill_rec {
+	uint64_t		ssr_blk_prop;
+	uint64_t		ssr_phys_birth;
+	uint64_t		ssr_birth;
+	zio_cksum_t		ssr_cksum;
+	uint64_t		ssr_nr_dvas;
+	uint64_t		ssr_flags;
+	zbookmark_phys_t	ssr_zb;
+	dva_t			ssr_dva[SPA_DVAS_PER_BP];
+} scan_spill_rec_t;
+
+/* A run of scan_spill_rec_t's in scn_spill_obj, sorted by offset */
+typedef struct scan_spill_run {
+	uint64_t	spr_off;	/* next record to load back */
+	uint64_t	spr_end;	/* end of the run */
+	uint64_t	spr_head;	/* DVA offset of record at spr_off */
+} scan_spill_run_t;
+
+/* size of the buffers used for writing and reading back spilled runs */
+#define	SCAN_SPILL_WRITE_SIZE	(1 << 20)
+#define	SCAN_SPILL_READ_SIZE	(32 << 10)
+
 struct dsl_scan_io_queue {
 	dsl_scan_t	*q_scn; /* associated dsl_scan_t */
 	vdev_t		*q_vd; /* top-level vdev that this queue represents */
@@ -331,9 +396,19 @@ struct dsl_scan_io_queue {
 	uint64_t	q_sio_memused;
 	uint64_t	q_last_ext_addr;
 
+	/* runs spilled to disk, see dsl_scan_spill() */
+	scan_spill_run_t *q_spill_runs;
+	uint_t		q_spill_nruns;
+	uint64_t	q_spill_pending; /* spilled sios not loaded back yet */
+	uint64_t	q_spill_next;	/* lowest offset not loaded back yet */
+	zfs_range_tree_t *q_spill_freed; /* freed since they were spilled */
+	boolean_t	q_spill_open;	/* last run is still being written */
+
 	/* members for zio rate limiting */
 	uint64_t	q_maxinflight_bytes;
 	uint64_t	q_inflight_bytes;
+	uint_t		q_throttle_pct; /* % of limit allowed by latency */
+	hrtime_t	q_throttle_ts;	/* last scan_io_queue_throttle() */
 	kcondvar_t	q_zio_cv; /* used under vd->vdev_scan_io_queue_lock */
 
 	/* per txg statistics */
@@ -347,6 +422,7 @@ struct dsl_scan_io_queue {
 typedef struct scan_prefetch_ctx {
 	zfs_refcount_t spc_refcnt;	/* refcount for memory management */
 	dsl_scan_t *spc_scn;		/* dsl_scan_t for the pool */
+	dsl_scan_lane_t *spc_lane;	/* lane traversing the objset */
 	boolean_t spc_root;		/* is this prefetch for an objset? */
 	uint8_t spc_indblkshift;	/* dn_indblkshift of current dnode */
 	uint16_t spc_datablkszsec;	/* dn_idatablkszsec of current dnode */
@@ -364,6 +440,8 @@ static void scan_exec_io(dsl_pool_t *dp, const blkptr_t *bp, int zio_flags,
     const zbookmark_phys_t *zb, dsl_scan_io_queue_t *queue);
 static void scan_io_queue_insert_impl(dsl_scan_io_queue_t *queue,
     scan_io_t *sio);
+static void count_block_skipped(dsl_scan_t *scn, const blkptr_t *bp,
+    boolean_t all);
 
 static dsl_scan_io_queue_t *scan_io_queue_create(vdev_t *vd);
 static void scan_io_queues_destroy(dsl_scan_t *scn);
@@ -470,6 +548,98 @@ bp2sio(const blkptr_t *bp, scan_io_t *sio, int dva_i)
 	}
 }
 
+static inline void
+sio2rec(const scan_io_t *sio, scan_spill_rec_t *rec)
+{
+	memset(rec, 0, sizeof (*rec));
+	rec->ssr_blk_prop = sio->sio_blk_prop;
+	rec->ssr_phys_birth = sio->sio_phys_birth;
+	rec->ssr_birth = sio->sio_birth;
+	rec->ssr_cksum = sio->sio_cksum;
+	rec->ssr_nr_dvas = sio->sio_nr_dvas;
+	rec->ssr_flags = sio->sio_flags;
+	rec->ssr_zb = sio->sio_zb;
+	memcpy(rec->ssr_dva, sio->sio_dva, sio->sio_nr_dvas * sizeof (dva_t));
+}
+
+static inline scan_io_t *
+rec2sio(const scan_spill_rec_t *rec)
+{
+	scan_io_t *sio;
+
+	ASSERT3U(rec->ssr_nr_dvas, >, 0);
+	ASSERT3U(rec->ssr_nr_dvas, <=, SPA_DVAS_PER_BP);
+
+	sio = sio_alloc(rec->ssr_nr_dvas);
+	sio->sio_blk_prop = rec->ssr_blk_prop;
+	sio->sio_phys_birth = rec->ssr_phys_birth;
+	sio->sio_birth = rec->ssr_birth;
+	sio->sio_cksum = rec->ssr_cksum;
+	sio->sio_nr_dvas = rec->ssr_nr_dvas;
+	sio->sio_flags = rec->ssr_flags;
+	sio->sio_zb = rec->ssr_zb;
+	memcpy(sio->sio_dva, rec->ssr_dva, sio->sio_nr_dvas * sizeof (dva_t));
+	return (sio);
+}
+
+/*
+ * Loads the state of the lanes written by dsl_scan_lanes_sync(). It is
+ * ignored if it does not belong with the scan queue, e.g. because software
+ * that does not know about lanes synced the scan since, or if the dataset
+ * of a lane has left the queue.
+ */
+static int
+dsl_scan_lanes_load(dsl_scan_t *scn)
+{
+	objset_t *mos = scn->scn_dp->dp_meta_objset;
+	uint64_t *buf;
+	uint64_t isize, nints, txg;
+	uint_t n = 0;
+	int err;
+
+	err = zap_length(mos, DMU_POOL_DIRECTORY_OBJECT, DMU_POOL_SCAN_LANES,
+	    &isize, &nints);
+	if (err == ENOENT)
+		return (0);
+	else if (err != 0)
+		return (err);
+	scn->scn_lanes_on_disk = B_TRUE;
+
+	if (isize != sizeof (uint64_t) || nints == 0 ||
+	    (nints - 1) % SCAN_LANE_PHYS_NUMINTS != 0 ||
+	    (nints - 1) / SCAN_LANE_PHYS_NUMINTS >= DSL_SCAN_LANES_MAX) {
+		zfs_dbgmsg("ignoring malformed scan lanes on %s",
+		    spa_name(scn->scn_dp->dp_spa));
+		return (0);
+	}
+
+	buf = kmem_alloc(nints * sizeof (uint64_t), KM_SLEEP);
+	err = zap_lookup(mos, DMU_POOL_DIRECTORY_OBJECT, DMU_POOL_SCAN_LANES,
+	    sizeof (uint64_t), nints, buf);
+	if (err == 0 && buf[0] == scn->scn_phys.scn_queue_obj &&
+	    buf[0] != 0 && dsl_scan_is_running(scn)) {
+		dsl_scan_lane_phys_t *lanes = (dsl_scan_lane_phys_t *)&buf[1];
+
+		for (uint64_t i = 0; i < (nints - 1) / SCAN_LANE_PHYS_NUMINTS;
+		    i++) {
+			if (!dsl_scan_lane_busy(&lanes[i]) ||
+			    zap_lookup_int_key(mos, scn->scn_phys.scn_queue_obj,
+			    lanes[i].slp_bookmark.zb_objset, &txg) != 0)
+				continue;
+			n++;
+			scn->scn_lanes[n].sl_phys = lanes[i];
+			scn->scn_lanes_cached[n] = lanes[i];
+		}
+	}
+	kmem_free(buf, nints * sizeof (uint64_t));
+	if (err == 0 && n != 0) {
+		zfs_dbgmsg("resuming %u scan lanes on %s", n,
+		    spa_name(scn->scn_dp->dp_spa));
+	}
+
+	return (err);
+}
+
 int
 dsl_scan_init(dsl_pool_t *dp, uint64_t txg)
 {
@@ -502,9 +672,23 @@ dsl_scan_init(dsl_pool_t *dp, uint64_t txg)
 	avl_create(&scn->scn_queue, scan_ds_queue_compare, sizeof (scan_ds_t),
 	    offsetof(scan_ds_t, sds_node));
 	mutex_init(&scn->scn_queue_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&scn->scn_blkstats_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&scn->scn_destroy_pf_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&scn->scn_destroy_pf_cv, NULL, CV_DEFAULT, NULL);
 	avl_create(&scn->scn_prefetch_queue, scan_prefetch_queue_compare,
 	    sizeof (scan_prefetch_issue_ctx_t),
 	    offsetof(scan_prefetch_issue_ctx_t, spic_avl_node));
+	for (int i = 0; i < DSL_SCAN_LANES_MAX; i++)
+		scn->scn_lanes[i].sl_scn = scn;
+
+	/*
+	 * Runs spilled before an export are of no use, the scan resumes
+	 * from its last checkpoint. dsl_scan_sync() frees the object.
+	 */
+	err = zap_lookup(dp->dp_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_SCAN_SPILL, sizeof (uint64_t), 1, &scn->scn_spill_obj);
+	if (err != 0 && err != ENOENT)
+		return (err);
 
 	err = zap_lookup(dp->dp_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
 	    "scrub_func", sizeof (uint64_t), 1, &f);
@@ -624,6 +808,10 @@ dsl_scan_init(dsl_pool_t *dp, uint64_t txg)
 
 	memcpy(&scn->scn_phys_cached, &scn->scn_phys, sizeof (scn->scn_phys));
 
+	err = dsl_scan_lanes_load(scn);
+	if (err != 0)
+		return (err);
+
 	/* reload the queue into the in-core state */
 	if (scn->scn_phys.scn_queue_obj != 0) {
 		zap_cursor_t zc;
@@ -633,9 +821,21 @@ dsl_scan_init(dsl_pool_t *dp, uint64_t txg)
 		    scn->scn_phys.scn_queue_obj);
 		    zap_cursor_retrieve(&zc, za) == 0;
 		    (void) zap_cursor_advance(&zc)) {
-			scan_ds_queue_insert(scn,
-			    zfs_strtonum(za->za_name, NULL),
-			    za->za_first_integer);
+			uint64_t dsobj = zfs_strtonum(za->za_name, NULL);
+			boolean_t in_lane = B_FALSE;
+
+			/* the lanes traverse these, see scan_ds_queue_sync() */
+			for (int i = 1; i < DSL_SCAN_LANES_MAX; i++) {
+				if (dsl_scan_lane_busy(
+				    &scn->scn_lanes[i].sl_phys) &&
+				    scn->scn_lanes[i].sl_phys.slp_bookmark.
+				    zb_objset == dsobj)
+					in_lane = B_TRUE;
+			}
+			if (!in_lane) {
+				scan_ds_queue_insert(scn, dsobj,
+				    za->za_first_integer);
+			}
 		}
 		zap_cursor_fini(&zc);
 		zap_attribute_free(za);
@@ -649,20 +849,134 @@ dsl_scan_init(dsl_pool_t *dp, uint64_t txg)
 	return (0);
 }
 
+/*
+ * An async destroy frees the blocks of a destroyed dataset by traversing
+ * its block tree from syncing context, so it spends most of each txg
+ * waiting for indirect block reads, and between txgs nothing is read at
+ * all.  Once a txg has paused the traversal, we keep reading the indirect
+ * blocks ahead of where it stopped from open context, so that the next txg
+ * finds them cached.  The read ahead is stopped before the traversal
+ * resumes, so it never touches blocks that are being freed.
+ *
+ * The depth of the read ahead adapts to the rate at which the destroy
+ * consumes metadata: it is twice what the last txg freed, between
+ * DSL_SCAN_DESTROY_PREFETCH_MIN and zfs_async_destroy_prefetch_max bytes.
+ */
+#define	DSL_SCAN_DESTROY_PREFETCH_MIN	(8ULL << 20)
+
+/* the blocks which the bptree traversal has to read */
+static boolean_t
+dsl_scan_destroy_bp_is_meta(const blkptr_t *bp)
+{
+	return (BP_GET_LEVEL(bp) > 0 || BP_GET_TYPE(bp) == DMU_OT_DNODE ||
+	    BP_GET_TYPE(bp) == DMU_OT_OBJSET);
+}
+
+static int
+dsl_scan_destroy_prefetch_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
+    const zbookmark_phys_t *zb, const dnode_phys_t *dnp, void *arg)
+{
+	(void) spa, (void) zilog, (void) dnp;
+	dsl_scan_t *scn = arg;
+
+	if (zb->zb_level == ZB_DNODE_LEVEL || BP_IS_HOLE(bp) ||
+	    BP_IS_REDACTED(bp) || BP_IS_EMBEDDED(bp))
+		return (0);
+
+	if (!dsl_scan_destroy_bp_is_meta(bp))
+		return (0);
+
+	if (scn->scn_destroy_pf_stop ||
+	    scn->scn_destroy_pf_bytes >= scn->scn_destroy_pf_window)
+		return (SET_ERROR(EINTR));
+	scn->scn_destroy_pf_bytes += BP_GET_PSIZE(bp);
+	return (0);
+}
+
+static void
+dsl_scan_destroy_prefetch_thread(void *arg)
+{
+	dsl_scan_t *scn = arg;
+	spa_t *spa = scn->scn_dp->dp_spa;
+	bptree_entry_phys_t *bte = &scn->scn_destroy_pf_entry;
+	zbookmark_phys_t zb = bte->be_zb;
+
+	(void) traverse_dataset_destroyed(spa, &bte->be_bp,
+	    bte->be_birth_txg, &zb, TRAVERSE_PRE | TRAVERSE_PREFETCH_METADATA |
+	    TRAVERSE_NO_DECRYPT | TRAVERSE_HARD,
+	    dsl_scan_destroy_prefetch_cb, scn);
+	spa_async_destroy_stats_prefetch(spa, scn->scn_destroy_pf_window,
+	    scn->scn_destroy_pf_bytes);
+
+	mutex_enter(&scn->scn_destroy_pf_lock);
+	scn->scn_destroy_pf_active = B_FALSE;
+	cv_broadcast(&scn->scn_destroy_pf_cv);
+	mutex_exit(&scn->scn_destroy_pf_lock);
+}
+
+/*
+ * Start reading ahead of the bptree traversal, which the current txg has
+ * paused.  Called from syncing context.
+ */
+static void
+dsl_scan_destroy_prefetch_start(dsl_scan_t *scn)
+{
+	dsl_pool_t *dp = scn->scn_dp;
+	uint64_t max = zfs_async_destroy_prefetch_max;
+
+	ASSERT(!scn->scn_destroy_pf_active);
+
+	if (max == 0 || spa_shutting_down(dp->dp_spa))
+		return;
+	if (bptree_first(dp->dp_meta_objset, dp->dp_bptree_obj,
+	    &scn->scn_destroy_pf_entry) != 0)
+		return;
+
+	scn->scn_destroy_pf_window = MIN(MAX(2 * scn->scn_freed_meta_this_txg,
+	    DSL_SCAN_DESTROY_PREFETCH_MIN), max);
+	scn->scn_destroy_pf_bytes = 0;
+	scn->scn_destroy_pf_active = B_TRUE;
+	if (taskq_dispatch(dp->dp_spa->spa_prefetch_taskq,
+	    dsl_scan_destroy_prefetch_thread, scn, TQ_NOSLEEP) ==
+	    TASKQID_INVALID)
+		scn->scn_destroy_pf_active = B_FALSE;
+}
+
+/*
+ * Stop reading ahead of the bptree traversal and wait for the read ahead
+ * task to finish, before the traversal resumes.
+ */
+static void
+dsl_scan_destroy_prefetch_stop(dsl_scan_t *scn)
+{
+	mutex_enter(&scn->scn_destroy_pf_lock);
+	scn->scn_destroy_pf_stop = B_TRUE;
+	while (scn->scn_destroy_pf_active)
+		cv_wait(&scn->scn_destroy_pf_cv, &scn->scn_destroy_pf_lock);
+	scn->scn_destroy_pf_stop = B_FALSE;
+	mutex_exit(&scn->scn_destroy_pf_lock);
+}
+
 void
 dsl_scan_fini(dsl_pool_t *dp)
 {
 	if (dp->dp_scan != NULL) {
 		dsl_scan_t *scn = dp->dp_scan;
 
+		dsl_scan_destroy_prefetch_stop(scn);
 		if (scn->scn_taskq != NULL)
 			taskq_destroy(scn->scn_taskq);
+		if (scn->scn_visit_taskq != NULL)
+			taskq_destroy(scn->scn_visit_taskq);
 
 		scan_ds_queue_clear(scn);
 		avl_destroy(&scn->scn_queue);
 		mutex_destroy(&scn->scn_queue_lock);
+		mutex_destroy(&scn->scn_blkstats_lock);
 		scan_ds_prefetch_queue_clear(scn);
 		avl_destroy(&scn->scn_prefetch_queue);
+		cv_destroy(&scn->scn_destroy_pf_cv);
+		mutex_destroy(&scn->scn_destroy_pf_lock);
 
 		kmem_free(dp->dp_scan, sizeof (dsl_scan_t));
 		dp->dp_scan = NULL;
@@ -831,6 +1145,10 @@ dsl_scan_sync_state(dsl_scan_t *scn, dmu_tx_t *tx, state_sync_type_t sync_type)
 		    &scn->scn_phys, tx));
 		memcpy(&scn->scn_phys_cached, &scn->scn_phys,
 		    sizeof (scn->scn_phys));
+		for (i = 1; i < DSL_SCAN_LANES_MAX; i++)
+			scn->scn_lanes_cached[i] = scn->scn_lanes[i].sl_phys;
+		dsl_scan_lanes_sync(scn, &scn->scn_phys,
+		    scn->scn_lanes_cached, tx);
 
 		if (scn->scn_checkpointing)
 			zfs_dbgmsg("finish scan checkpoint for %s",
@@ -843,6 +1161,8 @@ dsl_scan_sync_state(dsl_scan_t *scn, dmu_tx_t *tx, state_sync_type_t sync_type)
 		    DMU_POOL_DIRECTORY_OBJECT,
 		    DMU_POOL_SCAN, sizeof (uint64_t), SCAN_PHYS_NUMINTS,
 		    &scn->scn_phys_cached, tx));
+		dsl_scan_lanes_sync(scn, &scn->scn_phys_cached,
+		    scn->scn_lanes_cached, tx);
 	}
 }
 
@@ -1114,6 +1434,18 @@ dsl_scan_done(dsl_scan_t *scn, boolean_t complete, dmu_tx_t *tx)
 	scan_ds_queue_clear(scn);
 	scan_ds_prefetch_queue_clear(scn);
 
+	if (scn->scn_lanes_on_disk) {
+		VERIFY0(zap_remove(dp->dp_meta_objset,
+		    DMU_POOL_DIRECTORY_OBJECT, DMU_POOL_SCAN_LANES, tx));
+		scn->scn_lanes_on_disk = B_FALSE;
+	}
+	for (i = 0; i < DSL_SCAN_LANES_MAX; i++) {
+		memset(&scn->scn_lanes[i].sl_phys, 0,
+		    sizeof (dsl_scan_lane_phys_t));
+		memset(&scn->scn_lanes_cached[i], 0,
+		    sizeof (dsl_scan_lane_phys_t));
+	}
+
 	scn->scn_phys.scn_flags &= ~DSF_SCRUB_PAUSED;
 
 	/*
@@ -1547,6 +1879,63 @@ scan_ds_queue_sync(dsl_scan_t *scn, dmu_tx_t *tx)
 		    scn->scn_phys.scn_queue_obj, sds->sds_dsobj,
 		    sds->sds_txg, tx));
 	}
+
+	/*
+	 * The datasets of lanes other than lane 0 stay in the queue, see
+	 * dsl_scan_lane_phys_t. dsl_scan_init() leaves them out again.
+	 */
+	for (int i = 1; i < DSL_SCAN_LANES_MAX; i++) {
+		dsl_scan_lane_phys_t *slp = &scn->scn_lanes[i].sl_phys;
+
+		if (!dsl_scan_lane_busy(slp))
+			continue;
+		VERIFY0(zap_add_int_key(dp->dp_meta_objset,
+		    scn->scn_phys.scn_queue_obj, slp->slp_bookmark.zb_objset,
+		    slp->slp_queue_txg, tx));
+	}
+}
+
+/*
+ * Writes out the state of the lanes other than lane 0 that are traversing
+ * a dataset, tagged with the queue object of the dsl_scan_phys_t written
+ * with it.
+ */
+static void
+dsl_scan_lanes_sync(dsl_scan_t *scn, const dsl_scan_phys_t *phys,
+    const dsl_scan_lane_phys_t *lanes, dmu_tx_t *tx)
+{
+	objset_t *mos = scn->scn_dp->dp_meta_objset;
+	dsl_scan_lane_phys_t *slp;
+	uint64_t *buf;
+	uint64_t nints = 1;
+	size_t size;
+
+	for (int i = 1; i < DSL_SCAN_LANES_MAX; i++) {
+		if (dsl_scan_lane_busy(&lanes[i]))
+			nints += SCAN_LANE_PHYS_NUMINTS;
+	}
+
+	if (nints == 1) {
+		if (scn->scn_lanes_on_disk) {
+			VERIFY0(zap_remove(mos, DMU_POOL_DIRECTORY_OBJECT,
+			    DMU_POOL_SCAN_LANES, tx));
+			scn->scn_lanes_on_disk = B_FALSE;
+		}
+		return;
+	}
+
+	size = nints * sizeof (uint64_t);
+	buf = kmem_alloc(size, KM_SLEEP);
+	buf[0] = phys->scn_queue_obj;
+	slp = (dsl_scan_lane_phys_t *)&buf[1];
+	for (int i = 1; i < DSL_SCAN_LANES_MAX; i++) {
+		if (dsl_scan_lane_busy(&lanes[i]))
+			*slp++ = lanes[i];
+	}
+	VERIFY0(zap_update(mos, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_SCAN_LANES, sizeof (uint64_t), nints, buf, tx));
+	scn->scn_lanes_on_disk = B_TRUE;
+	kmem_free(buf, size);
 }
 
 /*
@@ -1586,7 +1975,7 @@ dsl_scan_should_clear(dsl_scan_t *scn)
 {
 	spa_t *spa = scn->scn_dp->dp_spa;
 	vdev_t *rvd = scn->scn_dp->dp_spa->spa_root_vdev;
-	uint64_t alloc, mlim_hard, mlim_soft, mused;
+	uint64_t alloc, mlim_hard, mlim_soft, mused, spilled;
 
 	alloc = metaslab_class_get_alloc(spa_normal_class(spa));
 	alloc += metaslab_class_get_alloc(spa_special_class(spa));
@@ -1597,7 +1986,7 @@ dsl_scan_should_clear(dsl_scan_t *scn)
 	mlim_hard = MIN(mlim_hard, alloc / 20);
 	mlim_soft = mlim_hard - MIN(mlim_hard / zfs_scan_mem_lim_soft_fact,
 	    zfs_scan_mem_lim_soft_max);
-	mused = 0;
+	mused = spilled = 0;
 	for (uint64_t i = 0; i < rvd->vdev_children; i++) {
 		vdev_t *tvd = rvd->vdev_child[i];
 		dsl_scan_io_queue_t *queue;
@@ -1612,13 +2001,18 @@ dsl_scan_should_clear(dsl_scan_t *scn)
 			mused += zfs_btree_numnodes(&queue->q_exts_by_size) * ((
 			    sizeof (zfs_range_seg_gap_t) + sizeof (uint64_t)) *
 			    3 / 2) + queue->q_sio_memused;
+			spilled += queue->q_spill_pending;
 		}
 		mutex_exit(&tvd->vdev_scan_io_queue_lock);
 	}
 
 	dprintf("current scan memory usage: %llu bytes\n", (longlong_t)mused);
 
-	if (mused == 0)
+	/*
+	 * Other lanes of the traversal may be queueing I/O while we look,
+	 * so the totals can only be cross-checked from a single lane.
+	 */
+	if (mused == 0 && spilled == 0 && !scn->scn_lanes_running)
 		ASSERT0(scn->scn_queues_pending);
 
 	/*
@@ -1635,16 +2029,18 @@ dsl_scan_should_clear(dsl_scan_t *scn)
 }
 
 static boolean_t
-dsl_scan_check_suspend(dsl_scan_t *scn, const zbookmark_phys_t *zb)
+dsl_scan_check_suspend(dsl_scan_lane_t *sl, const zbookmark_phys_t *zb)
 {
+	dsl_scan_t *scn = sl->sl_scn;
+
 	/* we never skip user/group accounting objects */
 	if (zb && (int64_t)zb->zb_object < 0)
 		return (B_FALSE);
 
-	if (scn->scn_suspending)
+	if (sl->sl_suspending)
 		return (B_TRUE); /* we're already suspending */
 
-	if (!ZB_IS_ZERO(&scn->scn_phys.scn_bookmark))
+	if (!ZB_IS_ZERO(&sl->sl_phys.slp_bookmark))
 		return (B_FALSE); /* we're resuming */
 
 	/* We only know how to resume from level-0 and objset blocks. */
@@ -1664,6 +2060,8 @@ dsl_scan_check_suspend(dsl_scan_t *scn, const zbookmark_phys_t *zb)
 	 *    or the machine is rebooting.
 	 *  or
 	 *  - the scan queue has reached its memory use limit
+	 *  or
+	 *  - another lane is suspending.
 	 */
 	uint64_t curr_time_ns = gethrtime();
 	uint64_t scan_time_ns = curr_time_ns - scn->scn_sync_start_time;
@@ -1674,7 +2072,7 @@ dsl_scan_check_suspend(dsl_scan_t *scn, const zbookmark_phys_t *zb)
 	uint_t mintime = (scn->scn_phys.scn_func == POOL_SCAN_RESILVER) ?
 	    zfs_resilver_min_time_ms : zfs_scrub_min_time_ms;
 
-	if ((NSEC2MSEC(scan_time_ns) > mintime &&
+	if (scn->scn_suspending || (NSEC2MSEC(scan_time_ns) > mintime &&
 	    (scn->scn_dp->dp_dirty_total >= dirty_min_bytes ||
 	    txg_sync_waiting(scn->scn_dp) ||
 	    NSEC2SEC(sync_time_ns) >= zfs_txg_timeout)) ||
@@ -1688,7 +2086,7 @@ dsl_scan_check_suspend(dsl_scan_t *scn, const zbookmark_phys_t *zb)
 			    (longlong_t)zb->zb_object,
 			    (longlong_t)zb->zb_level,
 			    (longlong_t)zb->zb_blkid);
-			SET_BOOKMARK(&scn->scn_phys.scn_bookmark,
+			SET_BOOKMARK(&sl->sl_phys.slp_bookmark,
 			    zb->zb_objset, 0, 0, 0);
 		} else if (zb != NULL) {
 			dprintf("suspending at bookmark %llx/%llx/%llx/%llx\n",
@@ -1696,7 +2094,7 @@ dsl_scan_check_suspend(dsl_scan_t *scn, const zbookmark_phys_t *zb)
 			    (longlong_t)zb->zb_object,
 			    (longlong_t)zb->zb_level,
 			    (longlong_t)zb->zb_blkid);
-			scn->scn_phys.scn_bookmark = *zb;
+			sl->sl_phys.slp_bookmark = *zb;
 		} else {
 #ifdef ZFS_DEBUG
 			dsl_scan_phys_t *scnp = &scn->scn_phys;
@@ -1708,6 +2106,7 @@ dsl_scan_check_suspend(dsl_scan_t *scn, const zbookmark_phys_t *zb)
 			    (longlong_t)scnp->scn_ddt_bookmark.ddb_cursor);
 #endif
 		}
+		sl->sl_suspending = B_TRUE;
 		scn->scn_suspending = B_TRUE;
 		return (B_TRUE);
 	}
@@ -1753,6 +2152,7 @@ dsl_error_scrub_check_suspend(dsl_scan_t *scn, const zbookmark_phys_t *zb)
 typedef struct zil_scan_arg {
 	dsl_pool_t	*zsa_dp;
 	zil_header_t	*zsa_zh;
+	uint64_t	zsa_min_txg;
 } zil_scan_arg_t;
 
 static int
@@ -1767,8 +2167,7 @@ dsl_scan_zil_block(zilog_t *zilog, const blkptr_t *bp, void *arg,
 	zbookmark_phys_t zb;
 
 	ASSERT(!BP_IS_REDACTED(bp));
-	if (BP_IS_HOLE(bp) ||
-	    BP_GET_BIRTH(bp) <= scn->scn_phys.scn_cur_min_txg)
+	if (BP_IS_HOLE(bp) || BP_GET_BIRTH(bp) <= zsa->zsa_min_txg)
 		return (0);
 
 	/*
@@ -1803,8 +2202,7 @@ dsl_scan_zil_record(zilog_t *zilog, const lr_t *lrc, void *arg,
 		zbookmark_phys_t zb;
 
 		ASSERT(!BP_IS_REDACTED(bp));
-		if (BP_IS_HOLE(bp) ||
-		    BP_GET_BIRTH(bp) <= scn->scn_phys.scn_cur_min_txg)
+		if (BP_IS_HOLE(bp) || BP_GET_BIRTH(bp) <= zsa->zsa_min_txg)
 			return (0);
 
 		/*
@@ -1826,10 +2224,10 @@ dsl_scan_zil_record(zilog_t *zilog, const lr_t *lrc, void *arg,
 }
 
 static void
-dsl_scan_zil(dsl_pool_t *dp, zil_header_t *zh)
+dsl_scan_zil(dsl_pool_t *dp, zil_header_t *zh, uint64_t min_txg)
 {
 	uint64_t claim_txg = zh->zh_claim_txg;
-	zil_scan_arg_t zsa = { dp, zh };
+	zil_scan_arg_t zsa = { dp, zh, min_txg };
 	zilog_t *zilog;
 
 	ASSERT(spa_writeable(dp->dp_spa));
@@ -1875,14 +2273,16 @@ scan_prefetch_ctx_rele(scan_prefetch_ctx_t *spc, const void *tag)
 }
 
 static scan_prefetch_ctx_t *
-scan_prefetch_ctx_create(dsl_scan_t *scn, dnode_phys_t *dnp, const void *tag)
+scan_prefetch_ctx_create(dsl_scan_lane_t *sl, dnode_phys_t *dnp,
+    const void *tag)
 {
 	scan_prefetch_ctx_t *spc;
 
 	spc = kmem_alloc(sizeof (scan_prefetch_ctx_t), KM_SLEEP);
 	zfs_refcount_create(&spc->spc_refcnt);
 	zfs_refcount_add(&spc->spc_refcnt, tag);
-	spc->spc_scn = scn;
+	spc->spc_scn = sl->sl_scn;
+	spc->spc_lane = sl;
 	if (dnp != NULL) {
 		spc->spc_datablkszsec = dnp->dn_datablkszsec;
 		spc->spc_indblkshift = dnp->dn_indblkshift;
@@ -1922,7 +2322,7 @@ static boolean_t
 dsl_scan_check_prefetch_resume(scan_prefetch_ctx_t *spc,
     const zbookmark_phys_t *zb)
 {
-	zbookmark_phys_t *last_zb = &spc->spc_scn->scn_prefetch_bookmark;
+	zbookmark_phys_t *last_zb = &spc->spc_lane->sl_prefetch_bookmark;
 	dnode_phys_t tmp_dnp;
 	dnode_phys_t *dnp = (spc->spc_root) ? NULL : &tmp_dnp;
 
@@ -1952,7 +2352,7 @@ dsl_scan_prefetch(scan_prefetch_ctx_t *spc, blkptr_t *bp, zbookmark_phys_t *zb)
 		return;
 
 	if (BP_IS_HOLE(bp) ||
-	    BP_GET_BIRTH(bp) <= scn->scn_phys.scn_cur_min_txg ||
+	    BP_GET_BIRTH(bp) <= spc->spc_lane->sl_phys.slp_cur_min_txg ||
 	    (BP_GET_LEVEL(bp) == 0 && BP_GET_TYPE(bp) != DMU_OT_DNODE &&
 	    BP_GET_TYPE(bp) != DMU_OT_OBJSET))
 		return;
@@ -1986,7 +2386,7 @@ dsl_scan_prefetch(scan_prefetch_ctx_t *spc, blkptr_t *bp, zbookmark_phys_t *zb)
 }
 
 static void
-dsl_scan_prefetch_dnode(dsl_scan_t *scn, dnode_phys_t *dnp,
+dsl_scan_prefetch_dnode(scan_prefetch_ctx_t *pspc, dnode_phys_t *dnp,
     uint64_t objset, uint64_t object)
 {
 	int i;
@@ -1998,7 +2398,7 @@ dsl_scan_prefetch_dnode(dsl_scan_t *scn, dnode_phys_t *dnp,
 
 	SET_BOOKMARK(&zb, objset, object, 0, 0);
 
-	spc = scan_prefetch_ctx_create(scn, dnp, FTAG);
+	spc = scan_prefetch_ctx_create(pspc->spc_lane, dnp, FTAG);
 
 	for (i = 0; i < dnp->dn_nblkptr; i++) {
 		zb.zb_level = BP_GET_LEVEL(&dnp->dn_blkptr[i]);
@@ -2054,25 +2454,25 @@ dsl_scan_prefetch_cb(zio_t *zio, const zbookmark_phys_t *zb, const blkptr_t *bp,
 		for (i = 0, cdnp = buf->b_data; i < epb;
 		    i += cdnp->dn_extra_slots + 1,
 		    cdnp += cdnp->dn_extra_slots + 1) {
-			dsl_scan_prefetch_dnode(scn, cdnp,
+			dsl_scan_prefetch_dnode(spc, cdnp,
 			    zb->zb_objset, zb->zb_blkid * epb + i);
 		}
 	} else if (BP_GET_TYPE(bp) == DMU_OT_OBJSET) {
 		objset_phys_t *osp = buf->b_data;
 
-		dsl_scan_prefetch_dnode(scn, &osp->os_meta_dnode,
+		dsl_scan_prefetch_dnode(spc, &osp->os_meta_dnode,
 		    zb->zb_objset, DMU_META_DNODE_OBJECT);
 
 		if (OBJSET_BUF_HAS_USERUSED(buf)) {
 			if (OBJSET_BUF_HAS_PROJECTUSED(buf)) {
-				dsl_scan_prefetch_dnode(scn,
+				dsl_scan_prefetch_dnode(spc,
 				    &osp->os_projectused_dnode, zb->zb_objset,
 				    DMU_PROJECTUSED_OBJECT);
 			}
-			dsl_scan_prefetch_dnode(scn,
+			dsl_scan_prefetch_dnode(spc,
 			    &osp->os_groupused_dnode, zb->zb_objset,
 			    DMU_GROUPUSED_OBJECT);
-			dsl_scan_prefetch_dnode(scn,
+			dsl_scan_prefetch_dnode(spc,
 			    &osp->os_userused_dnode, zb->zb_objset,
 			    DMU_USERUSED_OBJECT);
 		}
@@ -2157,20 +2557,20 @@ dsl_scan_prefetch_thread(void *arg)
 }
 
 static boolean_t
-dsl_scan_check_resume(dsl_scan_t *scn, const dnode_phys_t *dnp,
+dsl_scan_check_resume(dsl_scan_lane_t *sl, const dnode_phys_t *dnp,
     const zbookmark_phys_t *zb)
 {
+	zbookmark_phys_t *bookmark = &sl->sl_phys.slp_bookmark;
+
 	/*
 	 * We never skip over user/group accounting objects (obj<0)
 	 */
-	if (!ZB_IS_ZERO(&scn->scn_phys.scn_bookmark) &&
-	    (int64_t)zb->zb_object >= 0) {
+	if (!ZB_IS_ZERO(bookmark) && (int64_t)zb->zb_object >= 0) {
 		/*
 		 * If we already visited this bp & everything below (in
 		 * a prior txg sync), don't bother doing it again.
 		 */
-		if (zbookmark_subtree_completed(dnp, zb,
-		    &scn->scn_phys.scn_bookmark))
+		if (zbookmark_subtree_completed(dnp, zb, bookmark))
 			return (B_TRUE);
 
 		/*
@@ -2178,24 +2578,23 @@ dsl_scan_check_resume(dsl_scan_t *scn, const dnode_phys_t *dnp,
 		 * we went past it, zero it out to indicate that it's OK
 		 * to start checking for suspending again.
 		 */
-		if (zbookmark_subtree_tbd(dnp, zb,
-		    &scn->scn_phys.scn_bookmark)) {
+		if (zbookmark_subtree_tbd(dnp, zb, bookmark)) {
 			dprintf("resuming at %llx/%llx/%llx/%llx\n",
 			    (longlong_t)zb->zb_objset,
 			    (longlong_t)zb->zb_object,
 			    (longlong_t)zb->zb_level,
 			    (longlong_t)zb->zb_blkid);
-			memset(&scn->scn_phys.scn_bookmark, 0, sizeof (*zb));
+			memset(bookmark, 0, sizeof (*zb));
 		}
 	}
 	return (B_FALSE);
 }
 
 static void dsl_scan_visitbp(const blkptr_t *bp, const zbookmark_phys_t *zb,
-    dnode_phys_t *dnp, dsl_dataset_t *ds, dsl_scan_t *scn,
+    dnode_phys_t *dnp, dsl_dataset_t *ds, dsl_scan_lane_t *sl,
     dmu_objset_type_t ostype, dmu_tx_t *tx);
 inline __attribute__((always_inline)) static void dsl_scan_visitdnode(
-    dsl_scan_t *, dsl_dataset_t *ds, dmu_objset_type_t ostype,
+    dsl_scan_lane_t *, dsl_dataset_t *ds, dmu_objset_type_t ostype,
     dnode_phys_t *dnp, uint64_t object, dmu_tx_t *tx);
 
 /*
@@ -2203,10 +2602,11 @@ inline __attribute__((always_inline)) static void dsl_scan_visitdnode(
  * Return new buf to write out in *bufp.
  */
 inline __attribute__((always_inline)) static int
-dsl_scan_recurse(dsl_scan_t *scn, dsl_dataset_t *ds, dmu_objset_type_t ostype,
-    dnode_phys_t *dnp, const blkptr_t *bp,
+dsl_scan_recurse(dsl_scan_lane_t *sl, dsl_dataset_t *ds,
+    dmu_objset_type_t ostype, dnode_phys_t *dnp, const blkptr_t *bp,
     const zbookmark_phys_t *zb, dmu_tx_t *tx)
 {
+	dsl_scan_t *scn = sl->sl_scn;
 	dsl_pool_t *dp = scn->scn_dp;
 	spa_t *spa = dp->dp_spa;
 	int zio_flags = ZIO_FLAG_CANFAIL | ZIO_FLAG_SCAN_THREAD;
@@ -2222,7 +2622,7 @@ dsl_scan_recurse(dsl_scan_t *scn, dsl_dataset_t *ds, dmu_objset_type_t ostype,
 	 */
 	if (dnp != NULL &&
 	    dnp->dn_bonuslen > DN_MAX_BONUS_LEN(dnp)) {
-		scn->scn_phys.scn_errors++;
+		atomic_inc_64(&scn->scn_phys.scn_errors);
 		spa_log_error(spa, zb, BP_GET_PHYSICAL_BIRTH(bp));
 		return (SET_ERROR(EINVAL));
 	}
@@ -2237,7 +2637,7 @@ dsl_scan_recurse(dsl_scan_t *scn, dsl_dataset_t *ds, dmu_objset_type_t ostype,
 		err = arc_read(NULL, spa, bp, arc_getbuf_func, &buf,
 		    ZIO_PRIORITY_SCRUB, zio_flags, &flags, zb);
 		if (err) {
-			scn->scn_phys.scn_errors++;
+			atomic_inc_64(&scn->scn_phys.scn_errors);
 			return (err);
 		}
 		for (i = 0, cbp = buf->b_data; i < epb; i++, cbp++) {
@@ -2247,7 +2647,7 @@ dsl_scan_recurse(dsl_scan_t *scn, dsl_dataset_t *ds, dmu_objset_type_t ostype,
 			    zb->zb_level - 1,
 			    zb->zb_blkid * epb + i);
 			dsl_scan_visitbp(cbp, &czb, dnp,
-			    ds, scn, ostype, tx);
+			    ds, sl, ostype, tx);
 		}
 		arc_buf_destroy(buf, &buf);
 	} else if (BP_GET_TYPE(bp) == DMU_OT_DNODE) {
@@ -2265,13 +2665,13 @@ dsl_scan_recurse(dsl_scan_t *scn, dsl_dataset_t *ds, dmu_objset_type_t ostype,
 		err = arc_read(NULL, spa, bp, arc_getbuf_func, &buf,
 		    ZIO_PRIORITY_SCRUB, zio_flags, &flags, zb);
 		if (err) {
-			scn->scn_phys.scn_errors++;
+			atomic_inc_64(&scn->scn_phys.scn_errors);
 			return (err);
 		}
 		for (i = 0, cdnp = buf->b_data; i < epb;
 		    i += cdnp->dn_extra_slots + 1,
 		    cdnp += cdnp->dn_extra_slots + 1) {
-			dsl_scan_visitdnode(scn, ds, ostype,
+			dsl_scan_visitdnode(sl, ds, ostype,
 			    cdnp, zb->zb_blkid * epb + i, tx);
 		}
 
@@ -2284,13 +2684,13 @@ dsl_scan_recurse(dsl_scan_t *scn, dsl_dataset_t *ds, dmu_objset_type_t ostype,
 		err = arc_read(NULL, spa, bp, arc_getbuf_func, &buf,
 		    ZIO_PRIORITY_SCRUB, zio_flags, &flags, zb);
 		if (err) {
-			scn->scn_phys.scn_errors++;
+			atomic_inc_64(&scn->scn_phys.scn_errors);
 			return (err);
 		}
 
 		osp = buf->b_data;
 
-		dsl_scan_visitdnode(scn, ds, osp->os_type,
+		dsl_scan_visitdnode(sl, ds, osp->os_type,
 		    &osp->os_meta_dnode, DMU_META_DNODE_OBJECT, tx);
 
 		if (OBJSET_BUF_HAS_USERUSED(buf)) {
@@ -2301,13 +2701,13 @@ dsl_scan_recurse(dsl_scan_t *scn, dsl_dataset_t *ds, dmu_objset_type_t ostype,
 			 * space deltas from this txg get integrated.
 			 */
 			if (OBJSET_BUF_HAS_PROJECTUSED(buf))
-				dsl_scan_visitdnode(scn, ds, osp->os_type,
+				dsl_scan_visitdnode(sl, ds, osp->os_type,
 				    &osp->os_projectused_dnode,
 				    DMU_PROJECTUSED_OBJECT, tx);
-			dsl_scan_visitdnode(scn, ds, osp->os_type,
+			dsl_scan_visitdnode(sl, ds, osp->os_type,
 			    &osp->os_groupused_dnode,
 			    DMU_GROUPUSED_OBJECT, tx);
-			dsl_scan_visitdnode(scn, ds, osp->os_type,
+			dsl_scan_visitdnode(sl, ds, osp->os_type,
 			    &osp->os_userused_dnode,
 			    DMU_USERUSED_OBJECT, tx);
 		}
@@ -2318,7 +2718,7 @@ dsl_scan_recurse(dsl_scan_t *scn, dsl_dataset_t *ds, dmu_objset_type_t ostype,
 		 * Sanity check the block pointer contents, this is handled
 		 * by arc_read() for the cases above.
 		 */
-		scn->scn_phys.scn_errors++;
+		atomic_inc_64(&scn->scn_phys.scn_errors);
 		spa_log_error(spa, zb, BP_GET_PHYSICAL_BIRTH(bp));
 		return (SET_ERROR(EINVAL));
 	}
@@ -2327,7 +2727,7 @@ dsl_scan_recurse(dsl_scan_t *scn, dsl_dataset_t *ds, dmu_objset_type_t ostype,
 }
 
 inline __attribute__((always_inline)) static void
-dsl_scan_visitdnode(dsl_scan_t *scn, dsl_dataset_t *ds,
+dsl_scan_visitdnode(dsl_scan_lane_t *sl, dsl_dataset_t *ds,
     dmu_objset_type_t ostype, dnode_phys_t *dnp,
     uint64_t object, dmu_tx_t *tx)
 {
@@ -2339,7 +2739,7 @@ dsl_scan_visitdnode(dsl_scan_t *scn, dsl_dataset_t *ds,
 		SET_BOOKMARK(&czb, ds ? ds->ds_object : 0, object,
 		    dnp->dn_nlevels - 1, j);
 		dsl_scan_visitbp(&dnp->dn_blkptr[j],
-		    &czb, dnp, ds, scn, ostype, tx);
+		    &czb, dnp, ds, sl, ostype, tx);
 	}
 
 	if (dnp->dn_flags & DNODE_FLAG_SPILL_BLKPTR) {
@@ -2347,7 +2747,7 @@ dsl_scan_visitdnode(dsl_scan_t *scn, dsl_dataset_t *ds,
 		SET_BOOKMARK(&czb, ds ? ds->ds_object : 0, object,
 		    0, DMU_SPILL_BLKID);
 		dsl_scan_visitbp(DN_SPILL_BLKPTR(dnp),
-		    &czb, dnp, ds, scn, ostype, tx);
+		    &czb, dnp, ds, sl, ostype, tx);
 	}
 }
 
@@ -2357,21 +2757,22 @@ dsl_scan_visitdnode(dsl_scan_t *scn, dsl_dataset_t *ds,
  */
 static void
 dsl_scan_visitbp(const blkptr_t *bp, const zbookmark_phys_t *zb,
-    dnode_phys_t *dnp, dsl_dataset_t *ds, dsl_scan_t *scn,
+    dnode_phys_t *dnp, dsl_dataset_t *ds, dsl_scan_lane_t *sl,
     dmu_objset_type_t ostype, dmu_tx_t *tx)
 {
+	dsl_scan_t *scn = sl->sl_scn;
 	dsl_pool_t *dp = scn->scn_dp;
 
-	if (dsl_scan_check_suspend(scn, zb))
+	if (dsl_scan_check_suspend(sl, zb))
 		return;
 
-	if (dsl_scan_check_resume(scn, dnp, zb))
+	if (dsl_scan_check_resume(sl, dnp, zb))
 		return;
 
-	scn->scn_visited_this_txg++;
+	sl->sl_visited++;
 
 	if (BP_IS_HOLE(bp)) {
-		scn->scn_holes_this_txg++;
+		sl->sl_holes++;
 		return;
 	}
 
@@ -2401,12 +2802,12 @@ dsl_scan_visitbp(const blkptr_t *bp, const zbookmark_phys_t *zb,
 	 * at or after cur_min_txg.  About logical birth we care for traversal,
 	 * looking for any changes, while about physical for the actual scan.
 	 */
-	if (BP_GET_BIRTH(bp) <= scn->scn_phys.scn_cur_min_txg) {
-		scn->scn_lt_min_this_txg++;
+	if (BP_GET_BIRTH(bp) <= sl->sl_phys.slp_cur_min_txg) {
+		sl->sl_lt_min++;
 		return;
 	}
 
-	if (dsl_scan_recurse(scn, ds, ostype, dnp, bp, zb, tx) != 0)
+	if (dsl_scan_recurse(sl, ds, ostype, dnp, bp, zb, tx) != 0)
 		return;
 
 	/*
@@ -2416,7 +2817,7 @@ dsl_scan_visitbp(const blkptr_t *bp, const zbookmark_phys_t *zb,
 	 */
 	if (ddt_class_contains(dp->dp_spa,
 	    scn->scn_phys.scn_ddt_class_max, bp)) {
-		scn->scn_ddt_contained_this_txg++;
+		sl->sl_ddt_contained++;
 		return;
 	}
 
@@ -2427,8 +2828,8 @@ dsl_scan_visitbp(const blkptr_t *bp, const zbookmark_phys_t *zb,
 	 * Don't scan it now unless we need to because something
 	 * under it was modified.
 	 */
-	if (BP_GET_PHYSICAL_BIRTH(bp) > scn->scn_phys.scn_cur_max_txg) {
-		scn->scn_gt_max_this_txg++;
+	if (BP_GET_PHYSICAL_BIRTH(bp) > sl->sl_phys.slp_cur_max_txg) {
+		sl->sl_gt_max++;
 		return;
 	}
 
@@ -2436,7 +2837,7 @@ dsl_scan_visitbp(const blkptr_t *bp, const zbookmark_phys_t *zb,
 }
 
 static void
-dsl_scan_visit_rootbp(dsl_scan_t *scn, dsl_dataset_t *ds, blkptr_t *bp,
+dsl_scan_visit_rootbp(dsl_scan_lane_t *sl, dsl_dataset_t *ds, blkptr_t *bp,
     dmu_tx_t *tx)
 {
 	zbookmark_phys_t zb;
@@ -2445,28 +2846,29 @@ dsl_scan_visit_rootbp(dsl_scan_t *scn, dsl_dataset_t *ds, blkptr_t *bp,
 	SET_BOOKMARK(&zb, ds ? ds->ds_object : DMU_META_OBJSET,
 	    ZB_ROOT_OBJECT, ZB_ROOT_LEVEL, ZB_ROOT_BLKID);
 
-	if (ZB_IS_ZERO(&scn->scn_phys.scn_bookmark)) {
-		SET_BOOKMARK(&scn->scn_prefetch_bookmark,
+	if (ZB_IS_ZERO(&sl->sl_phys.slp_bookmark)) {
+		SET_BOOKMARK(&sl->sl_prefetch_bookmark,
 		    zb.zb_objset, 0, 0, 0);
 	} else {
-		scn->scn_prefetch_bookmark = scn->scn_phys.scn_bookmark;
+		sl->sl_prefetch_bookmark = sl->sl_phys.slp_bookmark;
 	}
 
-	scn->scn_objsets_visited_this_txg++;
+	sl->sl_objsets_visited++;
 
-	spc = scan_prefetch_ctx_create(scn, NULL, FTAG);
+	spc = scan_prefetch_ctx_create(sl, NULL, FTAG);
 	dsl_scan_prefetch(spc, bp, &zb);
 	scan_prefetch_ctx_rele(spc, FTAG);
 
-	dsl_scan_visitbp(bp, &zb, NULL, ds, scn, DMU_OST_NONE, tx);
+	dsl_scan_visitbp(bp, &zb, NULL, ds, sl, DMU_OST_NONE, tx);
 
 	dprintf_ds(ds, "finished scan%s", "");
 }
 
 static void
-ds_destroyed_scn_phys(dsl_dataset_t *ds, dsl_scan_phys_t *scn_phys)
+ds_destroyed_bookmark(dsl_dataset_t *ds, zbookmark_phys_t *scn_bookmark,
+    uint64_t *scn_flags)
 {
-	if (scn_phys->scn_bookmark.zb_objset == ds->ds_object) {
+	if (scn_bookmark->zb_objset == ds->ds_object) {
 		if (ds->ds_is_snapshot) {
 			/*
 			 * Note:
@@ -2478,7 +2880,7 @@ ds_destroyed_scn_phys(dsl_dataset_t *ds, dsl_scan_phys_t *scn_phys)
 			 *    ignore it when we retraverse it in
 			 *    dsl_scan_visitds().
 			 */
-			scn_phys->scn_bookmark.zb_objset =
+			scn_bookmark->zb_objset =
 			    dsl_dataset_phys(ds)->ds_next_snap_obj;
 			zfs_dbgmsg("destroying ds %llu on %s; currently "
 			    "traversing; reset zb_objset to %llu",
@@ -2486,9 +2888,9 @@ ds_destroyed_scn_phys(dsl_dataset_t *ds, dsl_scan_phys_t *scn_phys)
 			    ds->ds_dir->dd_pool->dp_spa->spa_name,
 			    (u_longlong_t)dsl_dataset_phys(ds)->
 			    ds_next_snap_obj);
-			scn_phys->scn_flags |= DSF_VISIT_DS_AGAIN;
+			*scn_flags |= DSF_VISIT_DS_AGAIN;
 		} else {
-			SET_BOOKMARK(&scn_phys->scn_bookmark,
+			SET_BOOKMARK(scn_bookmark,
 			    ZB_DESTROYED_OBJSET, 0, 0, 0);
 			zfs_dbgmsg("destroying ds %llu on %s; currently "
 			    "traversing; reset bookmark to -1,0,0,0",
@@ -2519,8 +2921,19 @@ dsl_scan_ds_destroyed(dsl_dataset_t *ds, dmu_tx_t *tx)
 	if (!dsl_scan_is_running(scn))
 		return;
 
-	ds_destroyed_scn_phys(ds, &scn->scn_phys);
-	ds_destroyed_scn_phys(ds, &scn->scn_phys_cached);
+	ds_destroyed_bookmark(ds, &scn->scn_phys.scn_bookmark,
+	    &scn->scn_phys.scn_flags);
+	ds_destroyed_bookmark(ds, &scn->scn_phys_cached.scn_bookmark,
+	    &scn->scn_phys_cached.scn_flags);
+	for (int i = 1; i < DSL_SCAN_LANES_MAX; i++) {
+		dsl_scan_lane_phys_t *slp = &scn->scn_lanes[i].sl_phys;
+		dsl_scan_lane_phys_t *cslp = &scn->scn_lanes_cached[i];
+
+		ds_destroyed_bookmark(ds, &slp->slp_bookmark,
+		    &slp->slp_flags);
+		ds_destroyed_bookmark(ds, &cslp->slp_bookmark,
+		    &cslp->slp_flags);
+	}
 
 	if (scan_ds_queue_contains(scn, ds->ds_object, &mintxg)) {
 		scan_ds_queue_remove(scn, ds->ds_object);
@@ -2599,6 +3012,12 @@ dsl_scan_ds_snapshotted(dsl_dataset_t *ds, dmu_tx_t *tx)
 
 	ds_snapshotted_bookmark(ds, &scn->scn_phys.scn_bookmark);
 	ds_snapshotted_bookmark(ds, &scn->scn_phys_cached.scn_bookmark);
+	for (int i = 1; i < DSL_SCAN_LANES_MAX; i++) {
+		ds_snapshotted_bookmark(ds,
+		    &scn->scn_lanes[i].sl_phys.slp_bookmark);
+		ds_snapshotted_bookmark(ds,
+		    &scn->scn_lanes_cached[i].slp_bookmark);
+	}
 
 	if (scan_ds_queue_contains(scn, ds->ds_object, &mintxg)) {
 		scan_ds_queue_remove(scn, ds->ds_object);
@@ -2662,6 +3081,12 @@ dsl_scan_ds_clone_swapped(dsl_dataset_t *ds1, dsl_dataset_t *ds2, dmu_tx_t *tx)
 
 	ds_clone_swapped_bookmark(ds1, ds2, &scn->scn_phys.scn_bookmark);
 	ds_clone_swapped_bookmark(ds1, ds2, &scn->scn_phys_cached.scn_bookmark);
+	for (int i = 1; i < DSL_SCAN_LANES_MAX; i++) {
+		ds_clone_swapped_bookmark(ds1, ds2,
+		    &scn->scn_lanes[i].sl_phys.slp_bookmark);
+		ds_clone_swapped_bookmark(ds1, ds2,
+		    &scn->scn_lanes_cached[i].slp_bookmark);
+	}
 
 	/*
 	 * Handle the in-memory scan queue.
@@ -2783,15 +3208,16 @@ enqueue_clones_cb(dsl_pool_t *dp, dsl_dataset_t *hds, void *arg)
 }
 
 static void
-dsl_scan_visitds(dsl_scan_t *scn, uint64_t dsobj, dmu_tx_t *tx)
+dsl_scan_visitds(dsl_scan_lane_t *sl, uint64_t dsobj, dmu_tx_t *tx)
 {
+	dsl_scan_t *scn = sl->sl_scn;
+	dsl_scan_lane_phys_t *slp = &sl->sl_phys;
 	dsl_pool_t *dp = scn->scn_dp;
 	dsl_dataset_t *ds;
 
 	VERIFY3U(0, ==, dsl_dataset_hold_obj(dp, dsobj, FTAG, &ds));
 
-	if (scn->scn_phys.scn_cur_min_txg >=
-	    scn->scn_phys.scn_max_txg) {
+	if (slp->slp_cur_min_txg >= scn->scn_phys.scn_max_txg) {
 		/*
 		 * This can happen if this snapshot was created after the
 		 * scan started, and we already completed a previous snapshot
@@ -2823,7 +3249,7 @@ dsl_scan_visitds(dsl_scan_t *scn, uint64_t dsobj, dmu_tx_t *tx)
 		zfs_dbgmsg("scanning dataset %llu (%s) is unnecessary because "
 		    "cur_min_txg (%llu) >= max_txg (%llu)",
 		    (longlong_t)dsobj, dsname,
-		    (longlong_t)scn->scn_phys.scn_cur_min_txg,
+		    (longlong_t)slp->slp_cur_min_txg,
 		    (longlong_t)scn->scn_phys.scn_max_txg);
 		kmem_free(dsname, MAXNAMELEN);
 
@@ -2846,7 +3272,7 @@ dsl_scan_visitds(dsl_scan_t *scn, uint64_t dsobj, dmu_tx_t *tx)
 		if (dmu_objset_from_ds(ds, &os) != 0) {
 			goto out;
 		}
-		dsl_scan_zil(dp, &os->os_zil_header);
+		dsl_scan_zil(dp, &os->os_zil_header, slp->slp_cur_min_txg);
 	}
 
 	/*
@@ -2854,7 +3280,7 @@ dsl_scan_visitds(dsl_scan_t *scn, uint64_t dsobj, dmu_tx_t *tx)
 	 */
 	dmu_buf_will_dirty(ds->ds_dbuf, tx);
 	rrw_enter(&ds->ds_bp_rwlock, RW_READER, FTAG);
-	dsl_scan_visit_rootbp(scn, ds, &dsl_dataset_phys(ds)->ds_bp, tx);
+	dsl_scan_visit_rootbp(sl, ds, &dsl_dataset_phys(ds)->ds_bp, tx);
 	rrw_exit(&ds->ds_bp_rwlock, FTAG);
 
 	char *dsname = kmem_alloc(ZFS_MAX_DATASET_NAME_LEN, KM_SLEEP);
@@ -2862,12 +3288,12 @@ dsl_scan_visitds(dsl_scan_t *scn, uint64_t dsobj, dmu_tx_t *tx)
 	zfs_dbgmsg("scanned dataset %llu (%s) with min=%llu max=%llu; "
 	    "suspending=%u",
 	    (longlong_t)dsobj, dsname,
-	    (longlong_t)scn->scn_phys.scn_cur_min_txg,
-	    (longlong_t)scn->scn_phys.scn_cur_max_txg,
-	    (int)scn->scn_suspending);
+	    (longlong_t)slp->slp_cur_min_txg,
+	    (longlong_t)slp->slp_cur_max_txg,
+	    (int)sl->sl_suspending);
 	kmem_free(dsname, ZFS_MAX_DATASET_NAME_LEN);
 
-	if (scn->scn_suspending)
+	if (sl->sl_suspending)
 		goto out;
 
 	/*
@@ -2877,12 +3303,14 @@ dsl_scan_visitds(dsl_scan_t *scn, uint64_t dsobj, dmu_tx_t *tx)
 	/*
 	 * If we did not completely visit this dataset, do another pass.
 	 */
-	if (scn->scn_phys.scn_flags & DSF_VISIT_DS_AGAIN) {
+	if (slp->slp_flags & DSF_VISIT_DS_AGAIN) {
 		zfs_dbgmsg("incomplete pass on %s; visiting again",
 		    dp->dp_spa->spa_name);
-		scn->scn_phys.scn_flags &= ~DSF_VISIT_DS_AGAIN;
+		slp->slp_flags &= ~DSF_VISIT_DS_AGAIN;
+		mutex_enter(&scn->scn_queue_lock);
 		scan_ds_queue_insert(scn, ds->ds_object,
-		    scn->scn_phys.scn_cur_max_txg);
+		    slp->slp_cur_max_txg);
+		mutex_exit(&scn->scn_queue_lock);
 		goto out;
 	}
 
@@ -2890,9 +3318,11 @@ dsl_scan_visitds(dsl_scan_t *scn, uint64_t dsobj, dmu_tx_t *tx)
 	 * Add descendant datasets to work queue.
 	 */
 	if (dsl_dataset_phys(ds)->ds_next_snap_obj != 0) {
+		mutex_enter(&scn->scn_queue_lock);
 		scan_ds_queue_insert(scn,
 		    dsl_dataset_phys(ds)->ds_next_snap_obj,
 		    dsl_dataset_phys(ds)->ds_creation_txg);
+		mutex_exit(&scn->scn_queue_lock);
 	}
 	if (dsl_dataset_phys(ds)->ds_num_children > 1) {
 		boolean_t usenext = B_FALSE;
@@ -2919,9 +3349,11 @@ dsl_scan_visitds(dsl_scan_t *scn, uint64_t dsobj, dmu_tx_t *tx)
 			    dsl_dataset_phys(ds)->ds_next_clones_obj);
 			    zap_cursor_retrieve(&zc, za) == 0;
 			    (void) zap_cursor_advance(&zc)) {
+				mutex_enter(&scn->scn_queue_lock);
 				scan_ds_queue_insert(scn,
 				    zfs_strtonum(za->za_name, NULL),
 				    dsl_dataset_phys(ds)->ds_creation_txg);
+				mutex_exit(&scn->scn_queue_lock);
 			}
 			zap_cursor_fini(&zc);
 			zap_attribute_free(za);
@@ -3050,8 +3482,9 @@ dsl_scan_ddt_entry(dsl_scan_t *scn, enum zio_checksum checksum,
  * while a scrub is in progress, it scrubs the block right then.
  */
 static void
-dsl_scan_ddt(dsl_scan_t *scn, dmu_tx_t *tx)
+dsl_scan_ddt(dsl_scan_lane_t *sl, dmu_tx_t *tx)
 {
+	dsl_scan_t *scn = sl->sl_scn;
 	ddt_bookmark_t *ddb = &scn->scn_phys.scn_ddt_bookmark;
 	ddt_lightweight_entry_t ddlwe = {0};
 	int error;
@@ -3075,25 +3508,25 @@ dsl_scan_ddt(dsl_scan_t *scn, dmu_tx_t *tx)
 		dsl_scan_ddt_entry(scn, ddb->ddb_checksum, ddt, &ddlwe, tx);
 		n++;
 
-		if (dsl_scan_check_suspend(scn, NULL))
+		if (dsl_scan_check_suspend(sl, NULL))
 			break;
 	}
 
 	if (error == EAGAIN) {
-		dsl_scan_check_suspend(scn, NULL);
+		dsl_scan_check_suspend(sl, NULL);
 		error = 0;
 
 		zfs_dbgmsg("waiting for ddt to become ready for scan "
 		    "on %s with class_max = %u; suspending=%u",
 		    scn->scn_dp->dp_spa->spa_name,
 		    (int)scn->scn_phys.scn_ddt_class_max,
-		    (int)scn->scn_suspending);
+		    (int)sl->sl_suspending);
 	} else
 		zfs_dbgmsg("scanned %llu ddt entries on %s with "
 		    "class_max = %u; suspending=%u", (longlong_t)n,
 		    scn->scn_dp->dp_spa->spa_name,
 		    (int)scn->scn_phys.scn_ddt_class_max,
-		    (int)scn->scn_suspending);
+		    (int)sl->sl_suspending);
 
 	ASSERT(error == 0 || error == ENOENT);
 	ASSERT(error != ENOENT ||
@@ -3109,50 +3542,46 @@ dsl_scan_ds_maxtxg(dsl_dataset_t *ds)
 	return (smt);
 }
 
-static void
-dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
+/* min txg to traverse a dataset from, given its scan queue entry's txg */
+static uint64_t
+dsl_scan_ds_mintxg(dsl_scan_t *scn, dsl_dataset_t *ds, uint64_t txg)
 {
-	scan_ds_t *sds;
-	dsl_pool_t *dp = scn->scn_dp;
-
-	if (scn->scn_phys.scn_ddt_bookmark.ddb_class <=
-	    scn->scn_phys.scn_ddt_class_max) {
-		scn->scn_phys.scn_cur_min_txg = scn->scn_phys.scn_min_txg;
-		scn->scn_phys.scn_cur_max_txg = scn->scn_phys.scn_max_txg;
-		dsl_scan_ddt(scn, tx);
-		if (scn->scn_suspending)
-			return;
-	}
+	if (txg != 0)
+		return (MAX(scn->scn_phys.scn_min_txg, txg));
+	return (MAX(scn->scn_phys.scn_min_txg,
+	    dsl_dataset_phys(ds)->ds_prev_snap_txg));
+}
 
-	if (scn->scn_phys.scn_bookmark.zb_objset == DMU_META_OBJSET) {
-		/* First do the MOS & ORIGIN */
+/* a lane with a dataset to resume, see dsl_scan_lane_phys_t */
+static boolean_t
+dsl_scan_lane_busy(const dsl_scan_lane_phys_t *slp)
+{
+	return (slp->slp_bookmark.zb_objset != 0 &&
+	    slp->slp_bookmark.zb_objset != ZB_DESTROYED_OBJSET);
+}
 
-		scn->scn_phys.scn_cur_min_txg = scn->scn_phys.scn_min_txg;
-		scn->scn_phys.scn_cur_max_txg = scn->scn_phys.scn_max_txg;
-		dsl_scan_visit_rootbp(scn, NULL,
-		    &dp->dp_meta_rootbp, tx);
-		if (scn->scn_suspending)
-			return;
+/*
+ * Traverses the dataset the lane was suspended on, if any, and then takes
+ * datasets from the queue until it is empty or the scan suspends.
+ */
+static void
+dsl_scan_lane_visit(dsl_scan_lane_t *sl, dmu_tx_t *tx)
+{
+	dsl_scan_t *scn = sl->sl_scn;
+	dsl_scan_lane_phys_t *slp = &sl->sl_phys;
+	dsl_pool_t *dp = scn->scn_dp;
+	uint_t lane = sl - scn->scn_lanes;
+	scan_ds_t *sds;
 
-		if (spa_version(dp->dp_spa) < SPA_VERSION_DSL_SCRUB) {
-			VERIFY0(dmu_objset_find_dp(dp, dp->dp_root_dir_obj,
-			    enqueue_cb, NULL, DS_FIND_CHILDREN));
-		} else {
-			dsl_scan_visitds(scn,
-			    dp->dp_origin_snap->ds_object, tx);
-		}
-		ASSERT(!scn->scn_suspending);
-	} else if (scn->scn_phys.scn_bookmark.zb_objset !=
-	    ZB_DESTROYED_OBJSET) {
-		uint64_t dsobj = scn->scn_phys.scn_bookmark.zb_objset;
+	if (dsl_scan_lane_busy(slp)) {
 		/*
 		 * If we were suspended, continue from here. Note if the
 		 * ds we were suspended on was deleted, the zb_objset may
 		 * be -1, so we will skip this and find a new objset
 		 * below.
 		 */
-		dsl_scan_visitds(scn, dsobj, tx);
-		if (scn->scn_suspending)
+		dsl_scan_visitds(sl, slp->slp_bookmark.zb_objset, tx);
+		if (sl->sl_suspending)
 			return;
 	}
 
@@ -3160,42 +3589,177 @@ dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
 	 * In case we suspended right at the end of the ds, zero the
 	 * bookmark so we don't think that we're still trying to resume.
 	 */
-	memset(&scn->scn_phys.scn_bookmark, 0, sizeof (zbookmark_phys_t));
+	memset(&slp->slp_bookmark, 0, sizeof (zbookmark_phys_t));
 
 	/*
 	 * Keep pulling things out of the dataset avl queue. Updates to the
-	 * persistent zap-object-as-queue happen only at checkpoints.
+	 * persistent zap-object-as-queue happen only at checkpoints. Lanes
+	 * beyond zfs_scan_ds_concurrent only finish what they had.
 	 */
-	while ((sds = avl_first(&scn->scn_queue)) != NULL) {
+	while (lane < scn->scn_nlanes && !scn->scn_suspending) {
 		dsl_dataset_t *ds;
-		uint64_t dsobj = sds->sds_dsobj;
-		uint64_t txg = sds->sds_txg;
+		uint64_t dsobj, txg;
+
+		mutex_enter(&scn->scn_queue_lock);
+		if ((sds = avl_first(&scn->scn_queue)) == NULL) {
+			mutex_exit(&scn->scn_queue_lock);
+			break;
+		}
+		dsobj = sds->sds_dsobj;
+		txg = sds->sds_txg;
 
 		/* dequeue and free the ds from the queue */
 		scan_ds_queue_remove(scn, dsobj);
+		mutex_exit(&scn->scn_queue_lock);
 		sds = NULL;
 
 		/* set up min / max txg */
 		VERIFY3U(0, ==, dsl_dataset_hold_obj(dp, dsobj, FTAG, &ds));
-		if (txg != 0) {
-			scn->scn_phys.scn_cur_min_txg =
-			    MAX(scn->scn_phys.scn_min_txg, txg);
-		} else {
-			scn->scn_phys.scn_cur_min_txg =
-			    MAX(scn->scn_phys.scn_min_txg,
-			    dsl_dataset_phys(ds)->ds_prev_snap_txg);
-		}
-		scn->scn_phys.scn_cur_max_txg = dsl_scan_ds_maxtxg(ds);
+		slp->slp_cur_min_txg = dsl_scan_ds_mintxg(scn, ds, txg);
+		slp->slp_cur_max_txg = dsl_scan_ds_maxtxg(ds);
+		slp->slp_queue_txg = txg;
 		dsl_dataset_rele(ds, FTAG);
 
-		dsl_scan_visitds(scn, dsobj, tx);
-		if (scn->scn_suspending)
+		dsl_scan_visitds(sl, dsobj, tx);
+		if (sl->sl_suspending)
 			return;
 	}
 
 	/* No more objsets to fetch, we're done */
-	scn->scn_phys.scn_bookmark.zb_objset = ZB_DESTROYED_OBJSET;
-	ASSERT0(scn->scn_suspending);
+	slp->slp_bookmark.zb_objset = ZB_DESTROYED_OBJSET;
+}
+
+static void
+dsl_scan_lane_run(void *arg)
+{
+	dsl_scan_lane_t *sl = arg;
+	dsl_pool_t *dp = sl->sl_scn->scn_dp;
+
+	/* the sync thread's hold of the config lock does not cover us */
+	dsl_pool_config_enter_prio(dp, FTAG);
+	dsl_scan_lane_visit(sl, sl->sl_tx);
+	dsl_pool_config_exit(dp, FTAG);
+}
+
+/*
+ * Datasets are traversed in syncing context, and most of that time goes
+ * to waiting for metadata reads. On pools with many small datasets or
+ * snapshots a single traversal leaves the prefetcher little to work on,
+ * so we traverse up to zfs_scan_ds_concurrent datasets from the queue at
+ * once, each in a lane of its own: lane 0 in the sync thread, the others
+ * on scn_visit_taskq. Every lane has its own bookmark and min/max txg and
+ * suspends at the next point it can resume from once any of them has to
+ * (see dsl_scan_check_suspend()), so the scan can be resumed lane by lane.
+ * A lane that runs out of queued datasets stops; the round is repeated
+ * until the queue stays empty, since finished datasets add their
+ * snapshots and clones to it.
+ */
+static void
+dsl_scan_visit_queue(dsl_scan_t *scn, dmu_tx_t *tx)
+{
+	do {
+		boolean_t dispatched = B_FALSE;
+
+		for (int i = 1; i < DSL_SCAN_LANES_MAX; i++) {
+			dsl_scan_lane_t *sl = &scn->scn_lanes[i];
+
+			if (!dsl_scan_lane_busy(&sl->sl_phys) &&
+			    (i >= scn->scn_nlanes ||
+			    avl_numnodes(&scn->scn_queue) <= i))
+				continue;
+
+			if (scn->scn_visit_taskq == NULL) {
+				scn->scn_visit_taskq = taskq_create(
+				    "dsl_scan_visit", DSL_SCAN_LANES_MAX - 1,
+				    minclsyspri, 1, INT_MAX, TASKQ_DYNAMIC);
+			}
+			sl->sl_tx = tx;
+			scn->scn_lanes_running = B_TRUE;
+			VERIFY3U(taskq_dispatch(scn->scn_visit_taskq,
+			    dsl_scan_lane_run, sl, TQ_SLEEP), !=,
+			    TASKQID_INVALID);
+			dispatched = B_TRUE;
+		}
+
+		dsl_scan_lane_visit(&scn->scn_lanes[0], tx);
+		if (dispatched)
+			taskq_wait(scn->scn_visit_taskq);
+		scn->scn_lanes_running = B_FALSE;
+	} while (!scn->scn_suspending && avl_numnodes(&scn->scn_queue) != 0);
+}
+
+static void
+dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
+{
+	dsl_pool_t *dp = scn->scn_dp;
+	dsl_scan_lane_t *sl = &scn->scn_lanes[0];
+	dsl_scan_lane_phys_t *slp = &sl->sl_phys;
+
+	/* lane 0 works on the dsl_scan_phys_t, see dsl_scan_lane_phys_t */
+	slp->slp_bookmark = scn->scn_phys.scn_bookmark;
+	slp->slp_cur_min_txg = scn->scn_phys.scn_cur_min_txg;
+	slp->slp_cur_max_txg = scn->scn_phys.scn_cur_max_txg;
+	slp->slp_flags = scn->scn_phys.scn_flags;
+
+	/* the other lanes can only be written out along with the queue */
+	scn->scn_nlanes = MIN(MAX(zfs_scan_ds_concurrent, 1),
+	    DSL_SCAN_LANES_MAX);
+	if (scn->scn_phys.scn_queue_obj == 0)
+		scn->scn_nlanes = 1;
+	for (int i = 0; i < DSL_SCAN_LANES_MAX; i++)
+		scn->scn_lanes[i].sl_suspending = B_FALSE;
+
+	if (scn->scn_phys.scn_ddt_bookmark.ddb_class <=
+	    scn->scn_phys.scn_ddt_class_max) {
+		slp->slp_cur_min_txg = scn->scn_phys.scn_min_txg;
+		slp->slp_cur_max_txg = scn->scn_phys.scn_max_txg;
+		dsl_scan_ddt(sl, tx);
+		if (scn->scn_suspending)
+			goto out;
+	}
+
+	if (slp->slp_bookmark.zb_objset == DMU_META_OBJSET) {
+		/* First do the MOS & ORIGIN */
+
+		slp->slp_cur_min_txg = scn->scn_phys.scn_min_txg;
+		slp->slp_cur_max_txg = scn->scn_phys.scn_max_txg;
+		dsl_scan_visit_rootbp(sl, NULL,
+		    &dp->dp_meta_rootbp, tx);
+		if (scn->scn_suspending)
+			goto out;
+
+		if (spa_version(dp->dp_spa) < SPA_VERSION_DSL_SCRUB) {
+			VERIFY0(dmu_objset_find_dp(dp, dp->dp_root_dir_obj,
+			    enqueue_cb, NULL, DS_FIND_CHILDREN));
+		} else {
+			dsl_scan_visitds(sl,
+			    dp->dp_origin_snap->ds_object, tx);
+		}
+		ASSERT(!scn->scn_suspending);
+	}
+
+	dsl_scan_visit_queue(scn, tx);
+	ASSERT(scn->scn_suspending ||
+	    slp->slp_bookmark.zb_objset == ZB_DESTROYED_OBJSET);
+
+out:
+	scn->scn_phys.scn_bookmark = slp->slp_bookmark;
+	scn->scn_phys.scn_cur_min_txg = slp->slp_cur_min_txg;
+	scn->scn_phys.scn_cur_max_txg = slp->slp_cur_max_txg;
+	scn->scn_phys.scn_flags = slp->slp_flags;
+
+	for (int i = 0; i < DSL_SCAN_LANES_MAX; i++) {
+		sl = &scn->scn_lanes[i];
+		scn->scn_visited_this_txg += sl->sl_visited;
+		scn->scn_holes_this_txg += sl->sl_holes;
+		scn->scn_lt_min_this_txg += sl->sl_lt_min;
+		scn->scn_gt_max_this_txg += sl->sl_gt_max;
+		scn->scn_ddt_contained_this_txg += sl->sl_ddt_contained;
+		scn->scn_objsets_visited_this_txg += sl->sl_objsets_visited;
+		sl->sl_visited = sl->sl_holes = sl->sl_lt_min = 0;
+		sl->sl_gt_max = sl->sl_ddt_contained = 0;
+		sl->sl_objsets_visited = 0;
+	}
 }
 
 static uint64_t
@@ -3330,7 +3894,8 @@ scan_io_queue_gather(dsl_scan_io_queue_t *queue, zfs_range_seg_t *rs,
 
 		next_sio = AVL_NEXT(&queue->q_sios_by_addr, sio);
 		avl_remove(&queue->q_sios_by_addr, sio);
-		if (avl_is_empty(&queue->q_sios_by_addr))
+		if (avl_is_empty(&queue->q_sios_by_addr) &&
+		    queue->q_spill_pending == 0)
 			atomic_add_64(&queue->q_scn->scn_queues_pending, -1);
 		queue->q_sio_memused -= SIO_GET_MUSED(sio);
 
@@ -3365,6 +3930,473 @@ scan_io_queue_gather(dsl_scan_io_queue_t *queue, zfs_range_seg_t *rs,
 	}
 }
 
+/*
+ * External sort for the scan queues.
+ *
+ * When the queues reach the hard memory limit during the metadata scan we
+ * normally issue their largest extents to make room (see
+ * dsl_scan_should_clear()), which on big pools means most of the scrub is
+ * issued far from LBA order. With zfs_scan_spill set we instead write each
+ * queue out as a sorted run appended to a MOS object, empty it, and keep
+ * scanning. Once the scan checkpoints, scan_io_queues_run_one() merges the
+ * runs of each queue back into memory zfs_scan_spill_load_mem at a time,
+ * lowest offset first, and only issues below the lowest offset still on
+ * disk, so the whole queue is issued in LBA order with bounded memory.
+ *
+ * Runs never outlive a checkpoint: the checkpoint waits for them to drain
+ * like any other queued I/O. If the pool is exported before that, the scan
+ * resumes from the previous checkpoint and the object is simply freed.
+ * Blocks freed while they sit in a run can't be taken out of it, so their
+ * ranges are kept in q_spill_freed and dropped when the run is loaded.
+ *
+ * The object is only created with the scan_spill feature enabled, and keeps
+ * it active while it exists, so that software which does not know to free
+ * it never imports the pool read-write.
+ */
+static void
+dsl_scan_spill_create(dsl_scan_t *scn, dmu_tx_t *tx)
+{
+	objset_t *mos = scn->scn_dp->dp_meta_objset;
+
+	scn->scn_spill_obj = dmu_object_alloc(mos, DMU_OTN_UINT64_METADATA,
+	    SPA_OLD_MAXBLOCKSIZE, DMU_OT_NONE, 0, tx);
+	scn->scn_spill_end = 0;
+	VERIFY0(zap_add(mos, DMU_POOL_DIRECTORY_OBJECT, DMU_POOL_SCAN_SPILL,
+	    sizeof (uint64_t), 1, &scn->scn_spill_obj, tx));
+	spa_feature_incr(scn->scn_dp->dp_spa, SPA_FEATURE_SCAN_SPILL, tx);
+}
+
+static void
+dsl_scan_spill_destroy(dsl_scan_t *scn, dmu_tx_t *tx)
+{
+	objset_t *mos = scn->scn_dp->dp_meta_objset;
+
+	ASSERT0(scn->scn_queues_pending);
+
+	VERIFY0(dmu_object_free(mos, scn->scn_spill_obj, tx));
+	VERIFY0(zap_remove(mos, DMU_POOL_DIRECTORY_OBJECT, DMU_POOL_SCAN_SPILL,
+	    tx));
+	spa_feature_decr(scn->scn_dp->dp_spa, SPA_FEATURE_SCAN_SPILL, tx);
+	scn->scn_spill_obj = 0;
+	scn->scn_spill_end = 0;
+}
+
+static void
+scan_io_queue_spill_free(dsl_scan_io_queue_t *queue)
+{
+	if (queue->q_spill_runs != NULL) {
+		kmem_free(queue->q_spill_runs,
+		    queue->q_spill_nruns * sizeof (scan_spill_run_t));
+	}
+	if (queue->q_spill_freed != NULL) {
+		zfs_range_tree_vacate(queue->q_spill_freed, NULL, NULL);
+		zfs_range_tree_destroy(queue->q_spill_freed);
+	}
+	queue->q_spill_runs = NULL;
+	queue->q_spill_nruns = 0;
+	queue->q_spill_pending = 0;
+	queue->q_spill_next = UINT64_MAX;
+	queue->q_spill_freed = NULL;
+	queue->q_spill_open = B_FALSE;
+}
+
+/*
+ * Write up to limit bytes of the lowest sios in the queue out to the spill
+ * object and free them, starting a new run unless the queue's last one is
+ * still open. The run is closed once the queue is empty. The queue stays
+ * pending in scn_queues_pending through q_spill_pending. Returns the number
+ * of bytes written.
+ */
+static uint64_t
+scan_io_queue_spill(dsl_scan_io_queue_t *queue, uint64_t limit, dmu_tx_t *tx)
+{
+	dsl_scan_t *scn = queue->q_scn;
+	objset_t *mos = scn->scn_dp->dp_meta_objset;
+	uint64_t maxrecs = SCAN_SPILL_WRITE_SIZE / sizeof (scan_spill_rec_t);
+	uint64_t maxtotal = MAX(limit / sizeof (scan_spill_rec_t), 1);
+	uint64_t nrecs = 0, n = 0;
+	scan_spill_rec_t *buf;
+	scan_spill_run_t *runs;
+	scan_io_t *sio;
+
+	ASSERT(MUTEX_HELD(&queue->q_vd->vdev_scan_io_queue_lock));
+
+	if (avl_is_empty(&queue->q_sios_by_addr)) {
+		queue->q_spill_open = B_FALSE;
+		return (0);
+	}
+
+	if (!queue->q_spill_open) {
+		uint64_t head = SIO_GET_OFFSET(
+		    (scan_io_t *)avl_first(&queue->q_sios_by_addr));
+
+		runs = kmem_alloc((queue->q_spill_nruns + 1) * sizeof (*runs),
+		    KM_SLEEP);
+		if (queue->q_spill_runs != NULL) {
+			memcpy(runs, queue->q_spill_runs,
+			    queue->q_spill_nruns * sizeof (*runs));
+			kmem_free(queue->q_spill_runs,
+			    queue->q_spill_nruns * sizeof (*runs));
+		}
+		runs[queue->q_spill_nruns].spr_off = scn->scn_spill_end;
+		runs[queue->q_spill_nruns].spr_end = scn->scn_spill_end;
+		runs[queue->q_spill_nruns].spr_head = head;
+		queue->q_spill_runs = runs;
+		queue->q_spill_nruns++;
+		queue->q_spill_open = B_TRUE;
+
+		queue->q_spill_next = MIN(queue->q_spill_next, head);
+		if (queue->q_spill_freed == NULL) {
+			queue->q_spill_freed = zfs_range_tree_create(NULL,
+			    ZFS_RANGE_SEG64, NULL, 0, 0);
+		}
+	}
+	runs = &queue->q_spill_runs[queue->q_spill_nruns - 1];
+	ASSERT3U(runs->spr_end, ==, scn->scn_spill_end);
+
+	maxrecs = MIN(maxrecs, maxtotal);
+	buf = vmem_alloc(maxrecs * sizeof (*buf), KM_SLEEP);
+	while (nrecs + n < maxtotal &&
+	    (sio = avl_first(&queue->q_sios_by_addr)) != NULL) {
+		sio2rec(sio, &buf[n++]);
+		avl_remove(&queue->q_sios_by_addr, sio);
+		queue->q_sio_memused -= SIO_GET_MUSED(sio);
+		zfs_range_tree_remove_fill(queue->q_exts_by_addr,
+		    SIO_GET_OFFSET(sio), SIO_GET_ASIZE(sio));
+		sio_free(sio);
+
+		if (n == maxrecs || nrecs + n == maxtotal ||
+		    avl_is_empty(&queue->q_sios_by_addr)) {
+			dmu_write(mos, scn->scn_spill_obj, scn->scn_spill_end,
+			    n * sizeof (*buf), buf, tx);
+			scn->scn_spill_end += n * sizeof (*buf);
+			nrecs += n;
+			n = 0;
+		}
+	}
+	vmem_free(buf, maxrecs * sizeof (*buf));
+
+	runs->spr_end = scn->scn_spill_end;
+	queue->q_spill_pending += nrecs;
+	queue->q_last_ext_addr = -1;
+	if (avl_is_empty(&queue->q_sios_by_addr)) {
+		ASSERT0(queue->q_sio_memused);
+		ASSERT(zfs_range_tree_is_empty(queue->q_exts_by_addr));
+		queue->q_spill_open = B_FALSE;
+	}
+
+	return (nrecs * sizeof (*buf));
+}
+
+/*
+ * Start spilling all scan queues to disk. Returns B_FALSE without doing
+ * anything if spilling is disabled or some queue already has the maximum
+ * number of runs, in which case the caller falls back to clearing. The
+ * writes are done by dsl_scan_spill_sync(), zfs_scan_spill_txg_max per txg.
+ */
+static boolean_t
+dsl_scan_spill(dsl_scan_t *scn, dmu_tx_t *tx)
+{
+	spa_t *spa = scn->scn_dp->dp_spa;
+	vdev_t *rvd = spa->spa_root_vdev;
+
+	if (scn->scn_spilling)
+		return (B_TRUE);
+
+	if (!zfs_scan_spill || scn->scn_checkpointing ||
+	    !spa_feature_is_enabled(spa, SPA_FEATURE_SCAN_SPILL))
+		return (B_FALSE);
+
+	for (uint64_t i = 0; i < rvd->vdev_children; i++) {
+		vdev_t *tvd = rvd->vdev_child[i];
+		dsl_scan_io_queue_t *queue;
+		boolean_t full;
+
+		mutex_enter(&tvd->vdev_scan_io_queue_lock);
+		queue = tvd->vdev_scan_io_queue;
+		full = (queue != NULL &&
+		    queue->q_spill_nruns >= zfs_scan_spill_max_runs);
+		mutex_exit(&tvd->vdev_scan_io_queue_lock);
+		if (full)
+			return (B_FALSE);
+	}
+
+	if (scn->scn_spill_obj == 0)
+		dsl_scan_spill_create(scn, tx);
+
+	scn->scn_spilling = B_TRUE;
+	scn->scn_spill_vdev = 0;
+
+	return (B_TRUE);
+}
+
+/*
+ * Write out the next zfs_scan_spill_txg_max bytes of the queues being
+ * spilled. The queues are done one after the other, so that each run is
+ * contiguous in the spill object. dsl_scan_sync() doesn't scan metadata
+ * until all of them are written out, so no sio can be queued below the end
+ * of an open run.
+ */
+static void
+dsl_scan_spill_sync(dsl_scan_t *scn, dmu_tx_t *tx)
+{
+	vdev_t *rvd = scn->scn_dp->dp_spa->spa_root_vdev;
+	uint64_t limit = zfs_scan_spill_txg_max;
+	uint64_t written = 0;
+
+	ASSERT(scn->scn_spilling);
+
+	for (; scn->scn_spill_vdev < rvd->vdev_children;
+	    scn->scn_spill_vdev++) {
+		vdev_t *tvd = rvd->vdev_child[scn->scn_spill_vdev];
+		dsl_scan_io_queue_t *queue;
+		boolean_t open = B_FALSE;
+
+		if (written != 0 && written >= limit)
+			return;
+
+		mutex_enter(&tvd->vdev_scan_io_queue_lock);
+		queue = tvd->vdev_scan_io_queue;
+		if (queue != NULL) {
+			written += scan_io_queue_spill(queue,
+			    limit - MIN(written, limit), tx);
+			open = queue->q_spill_open;
+		}
+		mutex_exit(&tvd->vdev_scan_io_queue_lock);
+		if (open)
+			return;
+	}
+
+	scn->scn_spilling = B_FALSE;
+	zfs_dbgmsg("spilled scan queues for %s, spill size %llu",
+	    scn->scn_dp->dp_spa->spa_name, (u_longlong_t)scn->scn_spill_end);
+}
+
+/*
+ * Stop spilling before all queues are written out. The open run is closed
+ * where it is, and what is left of its queue stays in memory.
+ */
+static void
+dsl_scan_spill_stop(dsl_scan_t *scn)
+{
+	vdev_t *rvd = scn->scn_dp->dp_spa->spa_root_vdev;
+
+	for (uint64_t i = 0; i < rvd->vdev_children; i++) {
+		vdev_t *tvd = rvd->vdev_child[i];
+
+		mutex_enter(&tvd->vdev_scan_io_queue_lock);
+		if (tvd->vdev_scan_io_queue != NULL)
+			tvd->vdev_scan_io_queue->q_spill_open = B_FALSE;
+		mutex_exit(&tvd->vdev_scan_io_queue_lock);
+	}
+	scn->scn_spilling = B_FALSE;
+}
+
+/*
+ * Read the next records of a run into buf, returning how many were read.
+ * A run that can't be read is given up on; its blocks go unscanned.
+ */
+static uint64_t
+scan_spill_run_read(dsl_scan_t *scn, scan_spill_run_t *run,
+    scan_spill_rec_t *buf, uint64_t maxrecs, uint64_t *lost)
+{
+	uint64_t n = MIN(maxrecs, (run->spr_end - run->spr_off) /
+	    sizeof (*buf));
+	int err;
+
+	if (n == 0)
+		return (0);
+
+	err = dmu_read(scn->scn_dp->dp_meta_objset, scn->scn_spill_obj,
+	    run->spr_off, n * sizeof (*buf), buf, DMU_READ_PREFETCH);
+	if (err != 0) {
+		zfs_dbgmsg("failed to read spilled scan run on %s: %d",
+		    scn->scn_dp->dp_spa->spa_name, err);
+		*lost += (run->spr_end - run->spr_off) / sizeof (*buf);
+		run->spr_off = run->spr_end;
+		return (0);
+	}
+	return (n);
+}
+
+/*
+ * Merge the next batch of spilled sios back into the queue, lowest offset
+ * first across all of its runs. Called by the issuing thread with the
+ * queue lock held; the lock is dropped while reading. Only this thread
+ * touches the runs, everyone else only looks at q_spill_next and
+ * q_spill_freed under the lock.
+ */
+static void
+scan_io_queue_spill_load(dsl_scan_io_queue_t *queue)
+{
+	dsl_scan_t *scn = queue->q_scn;
+	kmutex_t *q_lock = &queue->q_vd->vdev_scan_io_queue_lock;
+	uint_t nruns = queue->q_spill_nruns;
+	scan_spill_run_t *runs = queue->q_spill_runs;
+	uint64_t chunk = SCAN_SPILL_READ_SIZE / sizeof (scan_spill_rec_t);
+	uint64_t maxout, nout = 0, lost = 0, next = UINT64_MAX;
+	scan_spill_rec_t *bufs, *out;
+	uint64_t *bufn, *bufi;
+
+	ASSERT(MUTEX_HELD(q_lock));
+	ASSERT3U(queue->q_spill_pending, >, 0);
+
+	maxout = MAX(zfs_scan_spill_load_mem / sizeof (*out), 1);
+	maxout = MIN(maxout, queue->q_spill_pending);
+
+	mutex_exit(q_lock);
+
+	bufs = vmem_alloc(nruns * chunk * sizeof (*bufs), KM_SLEEP);
+	bufn = kmem_zalloc(nruns * sizeof (uint64_t), KM_SLEEP);
+	bufi = kmem_zalloc(nruns * sizeof (uint64_t), KM_SLEEP);
+	out = vmem_alloc(maxout * sizeof (*out), KM_SLEEP);
+
+	for (uint_t r = 0; r < nruns; r++) {
+		bufn[r] = scan_spill_run_read(scn, &runs[r], &bufs[r * chunk],
+		    chunk, &lost);
+	}
+
+	while (nout < maxout) {
+		uint64_t best_off = UINT64_MAX;
+		int best = -1;
+
+		for (uint_t r = 0; r < nruns; r++) {
+			scan_spill_rec_t *rec = &bufs[r * chunk + bufi[r]];
+
+			if (bufi[r] < bufn[r] &&
+			    DVA_GET_OFFSET(&rec->ssr_dva[0]) < best_off) {
+				best_off = DVA_GET_OFFSET(&rec->ssr_dva[0]);
+				best = r;
+			}
+		}
+		if (best == -1)
+			break;
+
+		out[nout++] = bufs[best * chunk + bufi[best]++];
+		runs[best].spr_off += sizeof (*out);
+		if (bufi[best] == bufn[best]) {
+			bufn[best] = scan_spill_run_read(scn, &runs[best],
+			    &bufs[best * chunk], chunk, &lost);
+			bufi[best] = 0;
+		}
+	}
+
+	for (uint_t r = 0; r < nruns; r++) {
+		if (bufi[r] < bufn[r]) {
+			runs[r].spr_head = DVA_GET_OFFSET(
+			    &bufs[r * chunk + bufi[r]].ssr_dva[0]);
+		} else {
+			ASSERT3U(runs[r].spr_off, ==, runs[r].spr_end);
+			runs[r].spr_head = UINT64_MAX;
+		}
+		next = MIN(next, runs[r].spr_head);
+	}
+
+	vmem_free(bufs, nruns * chunk * sizeof (*bufs));
+	kmem_free(bufn, nruns * sizeof (uint64_t));
+	kmem_free(bufi, nruns * sizeof (uint64_t));
+
+	mutex_enter(q_lock);
+
+	for (uint64_t i = 0; i < nout; i++) {
+		scan_io_t *sio = rec2sio(&out[i]);
+		uint64_t fstart, fsize;
+
+		if (zfs_range_tree_find_in(queue->q_spill_freed,
+		    SIO_GET_OFFSET(sio), SIO_GET_ASIZE(sio), &fstart,
+		    &fsize)) {
+			blkptr_t tmpbp;
+
+			/* freed since it was spilled, see dsl_scan_freed() */
+			sio2bp(sio, &tmpbp);
+			count_block_skipped(scn, &tmpbp, B_FALSE);
+			sio_free(sio);
+			continue;
+		}
+		scan_io_queue_insert_impl(queue, sio);
+	}
+	vmem_free(out, maxout * sizeof (*out));
+
+	ASSERT3U(queue->q_spill_pending, >=, nout + lost);
+	queue->q_spill_pending -= nout + lost;
+	queue->q_spill_next = next;
+	queue->q_last_ext_addr = -1;
+
+	if (queue->q_spill_pending == 0) {
+		ASSERT3U(next, ==, UINT64_MAX);
+		scan_io_queue_spill_free(queue);
+		if (avl_is_empty(&queue->q_sios_by_addr))
+			atomic_add_64(&scn->scn_queues_pending, -1);
+	} else {
+		zfs_range_tree_clear(queue->q_spill_freed, 0, next);
+	}
+}
+
+/* highest sync I/O latency currently seen by any leaf under vd */
+static hrtime_t
+scan_vdev_sync_latency(vdev_t *vd)
+{
+	hrtime_t lat = 0;
+
+	if (vd->vdev_ops->vdev_op_leaf)
+		return (vdev_queue_sync_latency(vd));
+
+	for (uint64_t i = 0; i < vd->vdev_children; i++)
+		lat = MAX(lat, scan_vdev_sync_latency(vd->vdev_child[i]));
+
+	return (lat);
+}
+
+/* how often the issuing thread re-evaluates foreground latency */
+#define	SCAN_THROTTLE_INTERVAL	MSEC2NSEC(100)
+
+/*
+ * Set the in-flight limit of a queue from zfs_scan_vdev_limit, scaled down
+ * while foreground sync I/O on the vdev is slower than
+ * zfs_scan_latency_target_us. This is a simple AIMD controller: the limit
+ * is halved when latency is over target and grows by a tenth of the full
+ * limit per interval when it is under, so scrubs back off quickly when
+ * applications notice and use the whole vdev when it is idle.
+ */
+static void
+scan_io_queue_throttle(dsl_scan_io_queue_t *queue)
+{
+	uint64_t limit = zfs_scan_vdev_limit *
+	    (vdev_get_ndisks(queue->q_vd) - vdev_get_nparity(queue->q_vd));
+	hrtime_t now = gethrtime();
+
+	ASSERT(MUTEX_HELD(&queue->q_vd->vdev_scan_io_queue_lock));
+
+	if (zfs_scan_latency_target_us == 0) {
+		queue->q_throttle_pct = 100;
+	} else if (now - queue->q_throttle_ts >= SCAN_THROTTLE_INTERVAL) {
+		hrtime_t target = USEC2NSEC(zfs_scan_latency_target_us);
+		hrtime_t lat = scan_vdev_sync_latency(queue->q_vd);
+		uint_t min_pct = MIN(MAX(zfs_scan_latency_min_pct, 1), 100);
+		uint_t pct = queue->q_throttle_pct;
+
+		if (lat == 0)
+			pct = 100;
+		else if (lat > target)
+			pct = MAX(pct / 2, min_pct);
+		else
+			pct = MIN(pct + 10, 100);
+
+		if (pct != queue->q_throttle_pct) {
+			zfs_dbgmsg("scan throttle for vdev %llu on %s: %u%% "
+			    "(sync latency %lluus)",
+			    (u_longlong_t)queue->q_vd->vdev_id,
+			    queue->q_vd->vdev_spa->spa_name, pct,
+			    (u_longlong_t)NSEC2USEC(lat));
+		}
+		queue->q_throttle_pct = pct;
+		queue->q_throttle_ts = now;
+	}
+
+	queue->q_maxinflight_bytes = MAX(1,
+	    limit * queue->q_throttle_pct / 100);
+}
+
 /*
  * This is called from the queue emptying thread and selects the next
  * extent from which we are to issue I/Os. The behavior of this function
@@ -3388,6 +4420,21 @@ scan_io_queue_fetch_ext(dsl_scan_io_queue_t *queue)
 	if (!scn->scn_checkpointing && !scn->scn_clearing)
 		return (NULL);
 
+	/*
+	 * While some of the queue is spilled to disk, only issue in LBA
+	 * order below the lowest offset still on disk, so that merging the
+	 * runs back keeps the order. scan_io_queues_run_one() loads more of
+	 * the runs once we are through.
+	 */
+	if (queue->q_spill_pending != 0 && scn->scn_checkpointing) {
+		zfs_range_seg_t *rs = zfs_range_tree_first(rt);
+
+		if (rs == NULL ||
+		    zfs_rs_get_start(rs, rt) >= queue->q_spill_next)
+			return (NULL);
+		return (rs);
+	}
+
 	/*
 	 * During normal clearing, we want to issue our largest segments
 	 * first, keeping IO as sequential as possible, and leaving the
@@ -3456,8 +4503,7 @@ scan_io_queues_run_one(void *arg)
 	queue->q_zio = zio;
 
 	/* Calculate maximum in-flight bytes for this vdev. */
-	queue->q_maxinflight_bytes = MAX(1, zfs_scan_vdev_limit *
-	    (vdev_get_ndisks(queue->q_vd) - vdev_get_nparity(queue->q_vd)));
+	scan_io_queue_throttle(queue);
 
 	/* reset per-queue scan statistics for this txg */
 	queue->q_total_seg_size_this_txg = 0;
@@ -3466,10 +4512,21 @@ scan_io_queues_run_one(void *arg)
 	queue->q_zios_this_txg = 0;
 
 	/* loop until we run out of time or sios */
-	while ((rs = scan_io_queue_fetch_ext(queue)) != NULL) {
+	for (;;) {
 		uint64_t seg_start = 0, seg_end = 0;
 		boolean_t more_left;
 
+		rs = scan_io_queue_fetch_ext(queue);
+		if (rs == NULL) {
+			/* merge more of the spilled runs back, if any */
+			if (queue->q_spill_pending == 0 ||
+			    !queue->q_scn->scn_checkpointing ||
+			    scan_io_queue_check_suspend(queue->q_scn))
+				break;
+			scan_io_queue_spill_load(queue);
+			continue;
+		}
+
 		ASSERT(list_is_empty(&sio_list));
 
 		/* loop while we still have sios left to process in this rs */
@@ -3496,6 +4553,7 @@ scan_io_queues_run_one(void *arg)
 			 * we can be sure that our trees will remain exactly
 			 * as we left them.
 			 */
+			scan_io_queue_throttle(queue);
 			mutex_exit(q_lock);
 			suspended = scan_io_queue_issue(queue, &sio_list);
 			mutex_enter(q_lock);
@@ -3614,14 +4672,18 @@ dsl_scan_free_block_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
 			return (SET_ERROR(ERESTART));
 	}
 
+	uint64_t dsize = bp_get_dsize_sync(scn->scn_dp->dp_spa, bp);
+
 	zio_nowait(zio_free_sync(scn->scn_zio_root, scn->scn_dp->dp_spa,
 	    dmu_tx_get_txg(tx), bp, 0));
 	dsl_dir_diduse_space(tx->tx_pool->dp_free_dir, DD_USED_HEAD,
-	    -bp_get_dsize_sync(scn->scn_dp->dp_spa, bp),
-	    -BP_GET_PSIZE(bp), -BP_GET_UCSIZE(bp), tx);
+	    -dsize, -BP_GET_PSIZE(bp), -BP_GET_UCSIZE(bp), tx);
 	scn->scn_visited_this_txg++;
+	scn->scn_freed_bytes_this_txg += dsize;
 	if (BP_GET_DEDUP(bp))
 		scn->scn_dedup_frees_this_txg++;
+	if (scn->scn_is_bptree && dsl_scan_destroy_bp_is_meta(bp))
+		scn->scn_freed_meta_this_txg += BP_GET_PSIZE(bp);
 	return (0);
 }
 
@@ -3819,6 +4881,7 @@ dsl_process_async_destroys(dsl_pool_t *dp, dmu_tx_t *tx)
 
 	if (err == 0 && spa_feature_is_active(spa, SPA_FEATURE_ASYNC_DESTROY)) {
 		ASSERT(scn->scn_async_destroying);
+		dsl_scan_destroy_prefetch_stop(scn);
 		scn->scn_is_bptree = B_TRUE;
 		scn->scn_zio_root = zio_root(spa, NULL,
 		    NULL, ZIO_FLAG_MUSTSUCCEED);
@@ -3858,17 +4921,24 @@ dsl_process_async_destroys(dsl_pool_t *dp, dmu_tx_t *tx)
 			 */
 			scn->scn_async_stalled =
 			    (scn->scn_visited_this_txg == 0);
+			if (err == ERESTART)
+				dsl_scan_destroy_prefetch_start(scn);
 		}
 	}
 	if (scn->scn_visited_this_txg) {
+		hrtime_t elapsed = gethrtime() - scn->scn_sync_start_time;
+
 		zfs_dbgmsg("freed %llu blocks in %llums from "
 		    "free_bpobj/bptree on %s in txg %llu; err=%u",
 		    (longlong_t)scn->scn_visited_this_txg,
-		    (longlong_t)
-		    NSEC2MSEC(gethrtime() - scn->scn_sync_start_time),
+		    (longlong_t)NSEC2MSEC(elapsed),
 		    spa->spa_name, (longlong_t)tx->tx_txg, err);
+		spa_async_destroy_stats_txg(spa, scn->scn_visited_this_txg,
+		    scn->scn_freed_bytes_this_txg, elapsed);
 		scn->scn_visited_this_txg = 0;
 		scn->scn_dedup_frees_this_txg = 0;
+		scn->scn_freed_bytes_this_txg = 0;
+		scn->scn_freed_meta_this_txg = 0;
 
 		/*
 		 * Write out changes to the DDT and the BRT that may be required
@@ -4394,6 +5464,10 @@ dsl_scan_sync(dsl_pool_t *dp, dmu_tx_t *tx)
 	if (spa_shutting_down(spa))
 		return;
 
+	/* Free the spill object once nothing in it is needed anymore. */
+	if (scn->scn_spill_obj != 0 && scn->scn_queues_pending == 0)
+		dsl_scan_spill_destroy(scn, tx);
+
 	/*
 	 * If the scan is inactive due to a stalled async destroy, try again.
 	 */
@@ -4403,6 +5477,8 @@ dsl_scan_sync(dsl_pool_t *dp, dmu_tx_t *tx)
 	/* reset scan statistics */
 	scn->scn_visited_this_txg = 0;
 	scn->scn_dedup_frees_this_txg = 0;
+	scn->scn_freed_bytes_this_txg = 0;
+	scn->scn_freed_meta_this_txg = 0;
 	scn->scn_holes_this_txg = 0;
 	scn->scn_lt_min_this_txg = 0;
 	scn->scn_gt_max_this_txg = 0;
@@ -4502,11 +5578,16 @@ dsl_scan_sync(dsl_pool_t *dp, dmu_tx_t *tx)
 			if (!scn->scn_checkpointing)
 				zfs_dbgmsg("begin scan checkpoint for %s",
 				    spa->spa_name);
+			if (scn->scn_spilling)
+				dsl_scan_spill_stop(scn);
 
 			scn->scn_checkpointing = B_TRUE;
 			scn->scn_clearing = B_TRUE;
 		} else {
 			boolean_t should_clear = dsl_scan_should_clear(scn);
+			if (should_clear && !scn->scn_clearing &&
+			    dsl_scan_spill(scn, tx))
+				should_clear = B_FALSE;
 			if (should_clear && !scn->scn_clearing) {
 				zfs_dbgmsg("begin scan clearing for %s",
 				    spa->spa_name);
@@ -4522,7 +5603,10 @@ dsl_scan_sync(dsl_pool_t *dp, dmu_tx_t *tx)
 		ASSERT0(scn->scn_clearing);
 	}
 
-	if (!scn->scn_clearing && scn->scn_done_txg == 0) {
+	if (scn->scn_spilling) {
+		/* Need to write more of the queues out before scanning on */
+		dsl_scan_spill_sync(scn, tx);
+	} else if (!scn->scn_clearing && scn->scn_done_txg == 0) {
 		/* Need to scan metadata for more blocks to scrub */
 		dsl_scan_phys_t *scnp = &scn->scn_phys;
 		taskqid_t prefetch_tqid;
@@ -4729,7 +5813,8 @@ scan_io_queue_insert_impl(dsl_scan_io_queue_t *queue, scan_io_t *sio)
 
 	ASSERT(MUTEX_HELD(&queue->q_vd->vdev_scan_io_queue_lock));
 
-	if (unlikely(avl_is_empty(&queue->q_sios_by_addr)))
+	if (unlikely(avl_is_empty(&queue->q_sios_by_addr)) &&
+	    queue->q_spill_pending == 0)
 		atomic_add_64(&scn->scn_queues_pending, 1);
 	if (avl_find(&queue->q_sios_by_addr, sio, &idx) != NULL) {
 		/* block is already scheduled for reading */
@@ -4816,7 +5901,11 @@ dsl_scan_scrub_cb(dsl_pool_t *dp,
 	boolean_t needs_io = B_FALSE;
 	int zio_flags = ZIO_FLAG_SCAN_THREAD | ZIO_FLAG_RAW | ZIO_FLAG_CANFAIL;
 
-	count_block(dp->dp_blkstats, bp);
+	if (dp->dp_blkstats != NULL) {
+		mutex_enter(&scn->scn_blkstats_lock);
+		count_block(dp->dp_blkstats, bp);
+		mutex_exit(&scn->scn_blkstats_lock);
+	}
 	if (phys_birth <= scn->scn_phys.scn_min_txg ||
 	    phys_birth >= scn->scn_phys.scn_max_txg) {
 		count_block_skipped(scn, bp, B_TRUE);
@@ -4848,8 +5937,8 @@ dsl_scan_scrub_cb(dsl_pool_t *dp,
 		 * zpool(8) status can make useful progress reports.
 		 */
 		uint64_t asize = DVA_GET_ASIZE(dva);
-		scn->scn_phys.scn_examined += asize;
-		spa->spa_scan_pass_exam += asize;
+		atomic_add_64(&scn->scn_phys.scn_examined, asize);
+		atomic_add_64(&spa->spa_scan_pass_exam, asize);
 
 		/* if it's a resilver, this may not be in the target range */
 		if (!needs_io)
@@ -5087,6 +6176,8 @@ scan_io_queue_create(vdev_t *vd)
 	q->q_vd = vd;
 	q->q_sio_memused = 0;
 	q->q_last_ext_addr = -1;
+	q->q_spill_next = UINT64_MAX;
+	q->q_throttle_pct = 100;
 	cv_init(&q->q_zio_cv, NULL, CV_DEFAULT, NULL);
 	q->q_exts_by_addr = zfs_range_tree_create_gap(&ext_size_ops,
 	    ZFS_RANGE_SEG_GAP, &q->q_exts_by_size, 0, vd->vdev_ashift,
@@ -5111,8 +6202,10 @@ dsl_scan_io_queue_destroy(dsl_scan_io_queue_t *queue)
 
 	ASSERT(MUTEX_HELD(&queue->q_vd->vdev_scan_io_queue_lock));
 
-	if (!avl_is_empty(&queue->q_sios_by_addr))
+	if (!avl_is_empty(&queue->q_sios_by_addr) ||
+	    queue->q_spill_pending != 0)
 		atomic_add_64(&scn->scn_queues_pending, -1);
+	scan_io_queue_spill_free(queue);
 	while ((sio = avl_destroy_nodes(&queue->q_sios_by_addr, &cookie)) !=
 	    NULL) {
 		ASSERT(zfs_range_tree_contains(queue->q_exts_by_addr,
@@ -5165,6 +6258,7 @@ scan_io_queues_destroy(dsl_scan_t *scn)
 		tvd->vdev_scan_io_queue = NULL;
 		mutex_exit(&tvd->vdev_scan_io_queue_lock);
 	}
+	scn->scn_spilling = B_FALSE;
 }
 
 static void
@@ -5223,7 +6317,8 @@ dsl_scan_freed_dva(spa_t *spa, const blkptr_t *bp, int dva_i)
 		ASSERT3U(start, ==, SIO_GET_OFFSET(sio));
 		ASSERT3U(size, ==, SIO_GET_ASIZE(sio));
 		avl_remove(&queue->q_sios_by_addr, sio);
-		if (avl_is_empty(&queue->q_sios_by_addr))
+		if (avl_is_empty(&queue->q_sios_by_addr) &&
+		    queue->q_spill_pending == 0)
 			atomic_add_64(&scn->scn_queues_pending, -1);
 		queue->q_sio_memused -= SIO_GET_MUSED(sio);
 
@@ -5237,6 +6332,16 @@ dsl_scan_freed_dva(spa_t *spa, const blkptr_t *bp, int dva_i)
 
 		sio_free(sio);
 	}
+
+	/*
+	 * 3) Spilled to disk. The block may sit in one of the runs, maybe
+	 *	more than once, so remember the range and drop whatever
+	 *	overlaps it when the runs are loaded back.
+	 */
+	if (queue->q_spill_pending != 0 && start + size > queue->q_spill_next) {
+		zfs_range_tree_clear(queue->q_spill_freed, start, size);
+		zfs_range_tree_add(queue->q_spill_freed, start, size);
+	}
 	mutex_exit(q_lock);
 }
 
@@ -5315,12 +6420,18 @@ ZFS_MODULE_PARAM(zfs, zfs_, no_scrub_io, INT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs, zfs_, no_scrub_prefetch, INT, ZMOD_RW,
 	"Set to disable scrub prefetching");
 
+ZFS_MODULE_PARAM(zfs, zfs_, scan_ds_concurrent, UINT, ZMOD_RW,
+	"Max number of datasets the scan traverses at once");
+
 ZFS_MODULE_PARAM(zfs, zfs_, async_block_max_blocks, U64, ZMOD_RW,
 	"Max number of blocks freed in one txg");
 
 ZFS_MODULE_PARAM(zfs, zfs_, max_async_dedup_frees, U64, ZMOD_RW,
 	"Max number of dedup blocks freed in one txg");
 
+ZFS_MODULE_PARAM(zfs, zfs_, async_destroy_prefetch_max, U64, ZMOD_RW,
+	"Max metadata bytes read ahead of an async destroy between txgs");
+
 ZFS_MODULE_PARAM(zfs, zfs_, free_bpobj_enabled, INT, ZMOD_RW,
 	"Enable processing of the free_bpobj");
 
@@ -5333,6 +6444,12 @@ ZFS_MODULE_PARAM(zfs, zfs_, scan_mem_lim_fact, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs, zfs_, scan_issue_strategy, UINT, ZMOD_RW,
 	"IO issuing strategy during scrubbing. 0 = default, 1 = LBA, 2 = size");
 
+ZFS_MODULE_PARAM(zfs, zfs_, scan_latency_target_us, UINT, ZMOD_RW,
+	"Sync I/O latency above which sorted scans reduce their I/O depth");
+
+ZFS_MODULE_PARAM(zfs, zfs_, scan_latency_min_pct, UINT, ZMOD_RW,
+	"Minimum percentage of scan_vdev_limit kept by the latency throttle");
+
 ZFS_MODULE_PARAM(zfs, zfs_, scan_legacy, INT, ZMOD_RW,
 	"Scrub using legacy non-sequential method");
 
@@ -5348,6 +6465,18 @@ ZFS_MODULE_PARAM(zfs, zfs_, scan_mem_lim_soft_fact, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs, zfs_, scan_strict_mem_lim, INT, ZMOD_RW,
 	"Tunable to attempt to reduce lock contention");
 
+ZFS_MODULE_PARAM(zfs, zfs_, scan_spill, INT, ZMOD_RW,
+	"Spill sorted scan queues to disk instead of issuing them early");
+
+ZFS_MODULE_PARAM(zfs, zfs_, scan_spill_max_runs, UINT, ZMOD_RW,
+	"Max number of spilled sorted runs per top-level vdev");
+
+ZFS_MODULE_PARAM(zfs, zfs_, scan_spill_load_mem, U64, ZMOD_RW,
+	"Bytes of spilled scan queue merged back into memory at a time");
+
+ZFS_MODULE_PARAM(zfs, zfs_, scan_spill_txg_max, U64, ZMOD_RW,
+	"Max bytes of scan queue spilled to disk per txg");
+
 ZFS_MODULE_PARAM(zfs, zfs_, scan_fill_weight, UINT, ZMOD_RW,
 	"Tunable to adjust bias towards more filled segments during scans");
 
@@ -311,6 +311,21 @@ static int zfs_livelist_condense_zthr_cancel = 0;
  */
 static int zfs_livelist_condense_new_alloc = 0;
 
+/*
+ * Maximum number of sublists of a destroyed clone's livelist that the
+ * livelist delete zthr processes at once, each on its own thread.  Every
+ * sublist being processed holds the list of blocks it will free in memory.
+ */
+static uint_t zfs_livelist_delete_sublists = 4;
+
+/*
+ * Maximum number of dedup blocks a single livelist delete txg frees, like
+ * zfs_max_async_dedup_frees does for async destroys: each one may need a
+ * DDT lookup.  A sublist is never split, so a txg frees at least one sublist.
+ * Zero means no limit.
+ */
+static uint64_t zfs_livelist_delete_max_dedup_frees = 100000;
+
 /*
  * Time variable to decide how often the txg should be added into the
  * database (in seconds).
@@ -2066,6 +2081,10 @@ spa_destroy_aux_threads(spa_t *spa)
 		zthr_destroy(spa->spa_livelist_delete_zthr);
 		spa->spa_livelist_delete_zthr = NULL;
 	}
+	if (spa->spa_livelist_delete_taskq != NULL) {
+		taskq_destroy(spa->spa_livelist_delete_taskq);
+		spa->spa_livelist_delete_taskq = NULL;
+	}
 	if (spa->spa_livelist_condense_zthr != NULL) {
 		zthr_destroy(spa->spa_livelist_condense_zthr);
 		spa->spa_livelist_condense_zthr = NULL;
@@ -3110,17 +3129,6 @@ spa_livelist_delete_cb_check(void *arg, zthr_t *z)
 	return (spa_livelist_delete_check(spa));
 }
 
-static int
-delete_blkptr_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
-{
-	spa_t *spa = arg;
-	zio_free(spa, tx->tx_txg, bp);
-	dsl_dir_diduse_space(tx->tx_pool->dp_free_dir, DD_USED_HEAD,
-	    -bp_get_dsize_sync(spa, bp),
-	    -BP_GET_PSIZE(bp), -BP_GET_UCSIZE(bp), tx);
-	return (0);
-}
-
 static int
 dsl_get_next_livelist_obj(objset_t *os, uint64_t zap_obj, uint64_t *llp)
 {
@@ -3136,6 +3144,33 @@ dsl_get_next_livelist_obj(objset_t *os, uint64_t zap_obj, uint64_t *llp)
 	return (err);
 }
 
+/*
+ * A sublist of a destroyed clone's livelist, and the blocks it frees once
+ * processed.
+ */
+typedef struct livelist_sublist {
+	struct livelist_batch	*ls_batch;
+	bpobj_t			*ls_bpobj;
+	uint64_t		ls_key;
+	bplist_t		ls_to_free;
+	uint64_t		ls_dedup_frees;
+	int			ls_err;
+} livelist_sublist_t;
+
+/*
+ * The first sublists of a livelist, processed in parallel on
+ * spa_livelist_delete_taskq.
+ */
+typedef struct livelist_batch {
+	kmutex_t		lb_lock;
+	kcondvar_t		lb_cv;
+	uint_t			lb_pending;	/* sublists being processed */
+	boolean_t		lb_cancelled;
+	uint_t			lb_count;
+	uint_t			lb_max;
+	livelist_sublist_t	*lb_sublists;
+} livelist_batch_t;
+
 /*
  * Components of livelist deletion that must be performed in syncing
  * context: freeing block pointers and updating the pool-wide data
@@ -3144,21 +3179,41 @@ dsl_get_next_livelist_obj(objset_t *os, uint64_t zap_obj, uint64_t *llp)
 typedef struct sublist_delete_arg {
 	spa_t *spa;
 	dsl_deadlist_t *ll;
-	uint64_t key;
-	bplist_t *to_free;
+	livelist_sublist_t **sublists;
+	uint_t count;
+	uint64_t blocks, bytes, dedup_blocks;
 } sublist_delete_arg_t;
 
+static int
+delete_blkptr_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
+{
+	sublist_delete_arg_t *sda = arg;
+	spa_t *spa = sda->spa;
+	uint64_t dsize = bp_get_dsize_sync(spa, bp);
+
+	zio_free(spa, tx->tx_txg, bp);
+	dsl_dir_diduse_space(tx->tx_pool->dp_free_dir, DD_USED_HEAD,
+	    -dsize, -BP_GET_PSIZE(bp), -BP_GET_UCSIZE(bp), tx);
+	sda->blocks++;
+	sda->bytes += dsize;
+	if (BP_GET_DEDUP(bp))
+		sda->dedup_blocks++;
+	return (0);
+}
+
 static void
 sublist_delete_sync(void *arg, dmu_tx_t *tx)
 {
 	sublist_delete_arg_t *sda = arg;
-	spa_t *spa = sda->spa;
-	dsl_deadlist_t *ll = sda->ll;
-	uint64_t key = sda->key;
-	bplist_t *to_free = sda->to_free;
 
-	bplist_iterate(to_free, delete_blkptr_cb, spa, tx);
-	dsl_deadlist_remove_entry(ll, key, tx);
+	for (uint_t i = 0; i < sda->count; i++) {
+		livelist_sublist_t *ls = sda->sublists[i];
+
+		bplist_iterate(&ls->ls_to_free, delete_blkptr_cb, sda, tx);
+		dsl_deadlist_remove_entry(sda->ll, ls->ls_key, tx);
+	}
+	spa_livelist_stats_freed(sda->spa, sda->count, sda->blocks,
+	    sda->bytes, sda->dedup_blocks);
 }
 
 typedef struct livelist_delete_arg {
@@ -3188,21 +3243,64 @@ livelist_delete_sync(void *arg, dmu_tx_t *tx)
 		    DMU_POOL_DELETED_CLONES, tx));
 		VERIFY0(zap_destroy(mos, zap_obj, tx));
 		spa->spa_livelists_to_delete = 0;
+		spa_livelist_stats_pending(spa, 0, 0);
 		spa_notify_waiters(spa);
 	}
 }
 
+static int
+livelist_delete_collect_cb(void *arg, dsl_deadlist_entry_t *dle)
+{
+	livelist_batch_t *lb = arg;
+	livelist_sublist_t *ls = &lb->lb_sublists[lb->lb_count++];
+
+	ls->ls_batch = lb;
+	ls->ls_bpobj = &dle->dle_bpobj;
+	ls->ls_key = dle->dle_mintxg;
+	bplist_create(&ls->ls_to_free);
+	return (lb->lb_count == lb->lb_max);
+}
+
+/*
+ * Determine which block pointers of a sublist should actually be freed.
+ * Runs on spa_livelist_delete_taskq.
+ */
+static void
+spa_livelist_delete_sublist(void *arg)
+{
+	livelist_sublist_t *ls = arg;
+	livelist_batch_t *lb = ls->ls_batch;
+
+	ls->ls_err = dsl_process_sub_livelist_cancel(ls->ls_bpobj,
+	    &ls->ls_to_free, &lb->lb_cancelled);
+	if (ls->ls_err == 0) {
+		for (bplist_entry_t *bpe = list_head(&ls->ls_to_free.bpl_list);
+		    bpe != NULL;
+		    bpe = list_next(&ls->ls_to_free.bpl_list, bpe)) {
+			if (BP_GET_DEDUP(&bpe->bpe_blk))
+				ls->ls_dedup_frees++;
+		}
+	}
+
+	mutex_enter(&lb->lb_lock);
+	lb->lb_pending--;
+	cv_broadcast(&lb->lb_cv);
+	mutex_exit(&lb->lb_lock);
+}
+
 /*
  * Load in the value for the livelist to be removed and open it. Then,
- * load its first sublist and determine which block pointers should actually
- * be freed. Then, call a synctask which performs the actual frees and updates
- * the pool-wide livelist data.
+ * process its first zfs_livelist_delete_sublists sublists in parallel to
+ * determine which block pointers should actually be freed. Then, call
+ * synctasks which perform the actual frees and update the pool-wide
+ * livelist data, packing as many sublists into each txg as
+ * zfs_livelist_delete_max_dedup_frees allows.
  */
 static void
 spa_livelist_delete_cb(void *arg, zthr_t *z)
 {
 	spa_t *spa = arg;
-	uint64_t ll_obj = 0, count;
+	uint64_t ll_obj = 0, count, nlivelists;
 	objset_t *mos = spa->spa_meta_objset;
 	uint64_t zap_obj = spa->spa_livelists_to_delete;
 	/*
@@ -3211,36 +3309,92 @@ spa_livelist_delete_cb(void *arg, zthr_t *z)
 	 */
 	VERIFY0(dsl_get_next_livelist_obj(mos, zap_obj, &ll_obj));
 	VERIFY0(zap_count(mos, ll_obj, &count));
+	VERIFY0(zap_count(mos, zap_obj, &nlivelists));
+	spa_livelist_stats_pending(spa, nlivelists, count);
 	if (count > 0) {
 		dsl_deadlist_t *ll;
-		dsl_deadlist_entry_t *dle;
-		bplist_t to_free;
+		livelist_batch_t lb = { 0 };
 		ll = kmem_zalloc(sizeof (dsl_deadlist_t), KM_SLEEP);
 		VERIFY0(dsl_deadlist_open(ll, mos, ll_obj));
-		dle = dsl_deadlist_first(ll);
-		ASSERT3P(dle, !=, NULL);
-		bplist_create(&to_free);
-		int err = dsl_process_sub_livelist(&dle->dle_bpobj, &to_free,
-		    z, NULL);
-		if (err == 0) {
+
+		mutex_init(&lb.lb_lock, NULL, MUTEX_DEFAULT, NULL);
+		cv_init(&lb.lb_cv, NULL, CV_DEFAULT, NULL);
+		lb.lb_max = MAX(zfs_livelist_delete_sublists, 1);
+		lb.lb_sublists = kmem_zalloc(lb.lb_max *
+		    sizeof (livelist_sublist_t), KM_SLEEP);
+		dsl_deadlist_iterate(ll, livelist_delete_collect_cb, &lb);
+		ASSERT3U(lb.lb_count, >, 0);
+
+		lb.lb_pending = lb.lb_count;
+		for (uint_t i = 0; i < lb.lb_count; i++) {
+			(void) taskq_dispatch(spa->spa_livelist_delete_taskq,
+			    spa_livelist_delete_sublist, &lb.lb_sublists[i],
+			    TQ_SLEEP);
+		}
+
+		/*
+		 * The workers can't check the zthr for cancellation
+		 * themselves, so poll it for them while they run.
+		 */
+		mutex_enter(&lb.lb_lock);
+		while (lb.lb_pending > 0) {
+			(void) cv_timedwait(&lb.lb_cv, &lb.lb_lock,
+			    ddi_get_lbolt() + MSEC_TO_TICK(100));
+			if (!lb.lb_cancelled &&
+			    (zthr_has_waiters(z) || zthr_iscancelled(z)))
+				lb.lb_cancelled = B_TRUE;
+		}
+		mutex_exit(&lb.lb_lock);
+
+		/*
+		 * Sublists are independent of each other, so free those that
+		 * were processed even if an earlier one was interrupted.
+		 */
+		livelist_sublist_t **done = kmem_alloc(lb.lb_count *
+		    sizeof (livelist_sublist_t *), KM_SLEEP);
+		uint_t ndone = 0;
+		for (uint_t i = 0; i < lb.lb_count; i++) {
+			if (lb.lb_sublists[i].ls_err == 0)
+				done[ndone++] = &lb.lb_sublists[i];
+			else
+				VERIFY3U(lb.lb_sublists[i].ls_err, ==, EINTR);
+		}
+
+		uint64_t limit = zfs_livelist_delete_max_dedup_frees;
+		for (uint_t i = 0, n; i < ndone; i += n) {
+			uint64_t dedup_frees = done[i]->ls_dedup_frees;
+
+			for (n = 1; i + n < ndone; n++) {
+				dedup_frees += done[i + n]->ls_dedup_frees;
+				if (limit != 0 && dedup_frees > limit)
+					break;
+			}
 			sublist_delete_arg_t sync_arg = {
 			    .spa = spa,
 			    .ll = ll,
-			    .key = dle->dle_mintxg,
-			    .to_free = &to_free
+			    .sublists = &done[i],
+			    .count = n
 			};
-			zfs_dbgmsg("deleting sublist (id %llu) from"
-			    " livelist %llu, %lld remaining",
-			    (u_longlong_t)dle->dle_bpobj.bpo_object,
-			    (u_longlong_t)ll_obj, (longlong_t)count - 1);
+			zfs_dbgmsg("deleting %u sublists (first id %llu) from"
+			    " livelist %llu, %lld remaining", n,
+			    (u_longlong_t)done[i]->ls_bpobj->bpo_object,
+			    (u_longlong_t)ll_obj, (longlong_t)count - n);
 			VERIFY0(dsl_sync_task(spa_name(spa), NULL,
 			    sublist_delete_sync, &sync_arg, 0,
 			    ZFS_SPACE_CHECK_DESTROY));
-		} else {
-			VERIFY3U(err, ==, EINTR);
+			count -= n;
+			spa_livelist_stats_pending(spa, nlivelists, count);
+		}
+		kmem_free(done, lb.lb_count * sizeof (livelist_sublist_t *));
+
+		for (uint_t i = 0; i < lb.lb_count; i++) {
+			bplist_clear(&lb.lb_sublists[i].ls_to_free);
+			bplist_destroy(&lb.lb_sublists[i].ls_to_free);
 		}
-		bplist_clear(&to_free);
-		bplist_destroy(&to_free);
+		kmem_free(lb.lb_sublists, lb.lb_max *
+		    sizeof (livelist_sublist_t));
+		cv_destroy(&lb.lb_cv);
+		mutex_destroy(&lb.lb_lock);
 		dsl_deadlist_close(ll);
 		kmem_free(ll, sizeof (dsl_deadlist_t));
 	} else {
@@ -3260,6 +3414,9 @@ static void
 spa_start_livelist_destroy_thread(spa_t *spa)
 {
 	ASSERT0P(spa->spa_livelist_delete_zthr);
+	spa->spa_livelist_delete_taskq = taskq_create("z_livelist_delete",
+	    100, minclsyspri, 1, INT_MAX,
+	    TASKQ_DYNAMIC | TASKQ_THREADS_CPU_PCT);
 	spa->spa_livelist_delete_zthr =
 	    zthr_create("z_livelist_destroy",
 	    spa_livelist_delete_cb_check, spa_livelist_delete_cb, spa,
@@ -10159,6 +10316,14 @@ spa_sync_iterate_to_convergence(spa_t *spa, dmu_tx_t *tx)
 	do {
 		int pass = ++spa->spa_sync_pass;
 
+		/*
+		 * All dirty user data was written out in the first pass, the
+		 * remaining passes only converge the MOS.  Let the next txg
+		 * start quiescing in the meantime.
+		 */
+		if (pass == 2)
+			txg_sync_converging(dp, txg);
+
 		spa_sync_config_object(spa, tx);
 		spa_sync_aux_dev(spa, &spa->spa_spares, tx,
 		    ZPOOL_CONFIG_SPARES, DMU_POOL_SPARES);
@@ -11239,6 +11404,12 @@ ZFS_MODULE_PARAM(zfs, zfs_, max_missing_tvds, U64, ZMOD_RW,
 	"Allow importing pool with up to this number of missing top-level "
 	"vdevs (in read-only mode)");
 
+ZFS_MODULE_PARAM(zfs_livelist, zfs_livelist_, delete_sublists, UINT, ZMOD_RW,
+	"Max livelist sublists processed at once when freeing a clone");
+
+ZFS_MODULE_PARAM(zfs_livelist, zfs_livelist_, delete_max_dedup_frees, U64,
+	ZMOD_RW, "Max dedup blocks freed per txg when freeing a clone");
+
 ZFS_MODULE_PARAM(zfs_livelist_condense, zfs_livelist_condense_, zthr_pause, INT,
 	ZMOD_RW, "Set the livelist condense zthr to pause");
 
@@ -716,6 +716,7 @@ spa_add(const char *name, nvlist_t *config, const char *altroot)
 	mutex_init(&spa->spa_flushed_ms_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&spa->spa_activities_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&spa->spa_txg_log_time_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&spa->spa_dedup_scan_lock, NULL, MUTEX_DEFAULT, NULL);
 
 	cv_init(&spa->spa_async_cv, NULL, CV_DEFAULT, NULL);
 	cv_init(&spa->spa_evicting_os_cv, NULL, CV_DEFAULT, NULL);
@@ -904,6 +905,7 @@ spa_remove(spa_t *spa)
 	mutex_destroy(&spa->spa_feat_stats_lock);
 	mutex_destroy(&spa->spa_activities_lock);
 	mutex_destroy(&spa->spa_txg_log_time_lock);
+	mutex_destroy(&spa->spa_dedup_scan_lock);
 
 	kmem_free(spa, sizeof (spa_t));
 }
@@ -2661,6 +2663,16 @@ spa_has_slogs(spa_t *spa)
 	return (spa->spa_log_class->mc_groups != 0);
 }
 
+/*
+ * Return the number of dedicated slog devices. Same as above, no locking
+ * needed since the result is only used as a performance hint.
+ */
+uint64_t
+spa_slog_count(spa_t *spa)
+{
+	return (spa->spa_log_class->mc_groups);
+}
+
 boolean_t
 spa_has_special(spa_t *spa)
 {
@@ -2813,6 +2825,74 @@ spa_scan_get_stats(spa_t *spa, pool_scan_stat_t *ps)
 	return (0);
 }
 
+/*
+ * Offline dedup scan progress.  Only one scan may run per pool at a time;
+ * the statistics are kept in memory and reported through the pool config
+ * until the pool is exported, like the pass statistics above.
+ */
+int
+spa_dedup_scan_begin(spa_t *spa, const char *dsname, uint64_t to_examine)
+{
+	pool_dedup_scan_stat_t *pdss = &spa->spa_dedup_scan_stats;
+
+	mutex_enter(&spa->spa_dedup_scan_lock);
+	if (pdss->pdss_state == DSS_SCANNING) {
+		mutex_exit(&spa->spa_dedup_scan_lock);
+		return (SET_ERROR(EBUSY));
+	}
+	memset(pdss, 0, sizeof (*pdss));
+	pdss->pdss_state = DSS_SCANNING;
+	pdss->pdss_start_time = gethrestime_sec();
+	pdss->pdss_to_examine = to_examine;
+	(void) strlcpy(spa->spa_dedup_scan_dataset, dsname,
+	    sizeof (spa->spa_dedup_scan_dataset));
+	mutex_exit(&spa->spa_dedup_scan_lock);
+
+	return (0);
+}
+
+void
+spa_dedup_scan_update(spa_t *spa, uint64_t examined, uint64_t deduped,
+    uint64_t deduped_blocks)
+{
+	pool_dedup_scan_stat_t *pdss = &spa->spa_dedup_scan_stats;
+
+	mutex_enter(&spa->spa_dedup_scan_lock);
+	ASSERT3U(pdss->pdss_state, ==, DSS_SCANNING);
+	pdss->pdss_examined += examined;
+	pdss->pdss_deduped += deduped;
+	pdss->pdss_deduped_blocks += deduped_blocks;
+	mutex_exit(&spa->spa_dedup_scan_lock);
+}
+
+void
+spa_dedup_scan_end(spa_t *spa, boolean_t canceled)
+{
+	pool_dedup_scan_stat_t *pdss = &spa->spa_dedup_scan_stats;
+
+	mutex_enter(&spa->spa_dedup_scan_lock);
+	ASSERT3U(pdss->pdss_state, ==, DSS_SCANNING);
+	pdss->pdss_state = canceled ? DSS_CANCELED : DSS_FINISHED;
+	pdss->pdss_end_time = gethrestime_sec();
+	mutex_exit(&spa->spa_dedup_scan_lock);
+}
+
+int
+spa_dedup_scan_get_stats(spa_t *spa, pool_dedup_scan_stat_t *pdss,
+    char *dsname, size_t dsnamelen)
+{
+	mutex_enter(&spa->spa_dedup_scan_lock);
+	if (spa->spa_dedup_scan_stats.pdss_state == DSS_NONE) {
+		mutex_exit(&spa->spa_dedup_scan_lock);
+		return (SET_ERROR(ENOENT));
+	}
+	*pdss = spa->spa_dedup_scan_stats;
+	(void) strlcpy(dsname, spa->spa_dedup_scan_dataset, dsnamelen);
+	mutex_exit(&spa->spa_dedup_scan_lock);
+
+	return (0);
+}
+
 int
 spa_maxblocksize(spa_t *spa)
 {
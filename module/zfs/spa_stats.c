@@ -24,6 +24,7 @@
 #include <sys/spa_impl.h>
 #include <sys/vdev_impl.h>
 #include <sys/spa.h>
+#include <sys/zil.h>
 #include <zfs_comutil.h>
 
 /*
@@ -46,6 +47,11 @@ static uint_t zfs_txg_history = 100;
  */
 static uint_t zfs_multihost_history = B_FALSE;
 
+/*
+ * Keeps stats on the last 32 receive writer threads by default.
+ */
+static uint_t zfs_recv_writer_history = 32;
+
 /*
  * ==========================================================================
  * SPA Read History Routines
@@ -771,6 +777,136 @@ spa_mmp_history_add(spa_t *spa, uint64_t txg, uint64_t timestamp,
 	mutex_exit(&shl->procfs_list.pl_lock);
 }
 
+/*
+ * ==========================================================================
+ * SPA Receive Writer History Routines
+ * ==========================================================================
+ */
+
+/*
+ * Receive writer statistics - what each writer thread of a receive applied,
+ * and how long it was busy doing so.  A receive with zfs_recv_writer_threads
+ * set to N adds N entries when it ends; a single-threaded one adds one.
+ */
+typedef struct spa_recv_writer_history {
+	uint64_t	timestamp;	/* UTC time the receive ended */
+	uint_t		writer;		/* index of this writer */
+	uint_t		nwriters;	/* writers used by the receive */
+	uint64_t	records;	/* records applied by this writer */
+	uint64_t	bytes;		/* payload bytes applied */
+	hrtime_t	busy;		/* time spent applying them */
+	char		*dsname;	/* dataset received into */
+	procfs_list_node_t	srw_node;
+} spa_recv_writer_history_t;
+
+static int
+spa_recv_writer_history_show_header(struct seq_file *f)
+{
+	seq_printf(f, "%-10s %-6s %-7s %-10s %-12s %-10s %-10s %s\n",
+	    "timestamp", "writer", "writers", "records", "bytes", "busy_ms",
+	    "KiB/s", "dataset");
+	return (0);
+}
+
+static int
+spa_recv_writer_history_show(struct seq_file *f, void *data)
+{
+	spa_recv_writer_history_t *srw = (spa_recv_writer_history_t *)data;
+
+	seq_printf(f, "%-10llu %-6u %-7u %-10llu %-12llu %-10llu %-10llu "
+	    "%s\n", (u_longlong_t)srw->timestamp, srw->writer, srw->nwriters,
+	    (u_longlong_t)srw->records, (u_longlong_t)srw->bytes,
+	    (u_longlong_t)NSEC2MSEC(srw->busy),
+	    (u_longlong_t)(srw->bytes * (NANOSEC / 1024) /
+	    MAX(srw->busy, 1)), srw->dsname);
+
+	return (0);
+}
+
+/* Remove oldest elements from list until there are no more than 'size' left */
+static void
+spa_recv_writer_history_truncate(spa_history_list_t *shl, unsigned int size)
+{
+	spa_recv_writer_history_t *srw;
+	while (shl->size > size) {
+		srw = list_remove_head(&shl->procfs_list.pl_list);
+		kmem_strfree(srw->dsname);
+		kmem_free(srw, sizeof (spa_recv_writer_history_t));
+		shl->size--;
+	}
+
+	if (size == 0)
+		ASSERT(list_is_empty(&shl->procfs_list.pl_list));
+}
+
+static int
+spa_recv_writer_history_clear(procfs_list_t *procfs_list)
+{
+	spa_history_list_t *shl = procfs_list->pl_private;
+	mutex_enter(&procfs_list->pl_lock);
+	spa_recv_writer_history_truncate(shl, 0);
+	mutex_exit(&procfs_list->pl_lock);
+	return (0);
+}
+
+static void
+spa_recv_writer_history_init(spa_t *spa)
+{
+	spa_history_list_t *shl = &spa->spa_stats.recv_writers;
+
+	shl->size = 0;
+
+	shl->procfs_list.pl_private = shl;
+	procfs_list_install("zfs",
+	    spa_name(spa),
+	    "recv_writers",
+	    0644,
+	    &shl->procfs_list,
+	    spa_recv_writer_history_show,
+	    spa_recv_writer_history_show_header,
+	    spa_recv_writer_history_clear,
+	    offsetof(spa_recv_writer_history_t, srw_node));
+}
+
+static void
+spa_recv_writer_history_destroy(spa_t *spa)
+{
+	spa_history_list_t *shl = &spa->spa_stats.recv_writers;
+	procfs_list_uninstall(&shl->procfs_list);
+	spa_recv_writer_history_truncate(shl, 0);
+	procfs_list_destroy(&shl->procfs_list);
+}
+
+/*
+ * Add the statistics of one writer thread of a receive that just ended.
+ * Writers of a receive are added in order, from 0 to nwriters - 1.
+ */
+void
+spa_recv_writer_history_add(spa_t *spa, const char *dsname, uint_t writer,
+    uint_t nwriters, uint64_t records, uint64_t bytes, hrtime_t busy)
+{
+	spa_history_list_t *shl = &spa->spa_stats.recv_writers;
+	spa_recv_writer_history_t *srw;
+
+	if (zfs_recv_writer_history == 0 && shl->size == 0)
+		return;
+
+	srw = kmem_zalloc(sizeof (spa_recv_writer_history_t), KM_SLEEP);
+	srw->timestamp = gethrestime_sec();
+	srw->writer = writer;
+	srw->nwriters = nwriters;
+	srw->records = records;
+	srw->bytes = bytes;
+	srw->busy = busy;
+	srw->dsname = kmem_strdup(dsname);
+
+	mutex_enter(&shl->procfs_list.pl_lock);
+	procfs_list_add(&shl->procfs_list, srw);
+	shl->size++;
+	spa_recv_writer_history_truncate(shl, zfs_recv_writer_history);
+	mutex_exit(&shl->procfs_list.pl_lock);
+}
+
 static void *
 spa_state_addr(kstat_t *ksp, loff_t n)
 {
@@ -1037,6 +1173,225 @@ spa_iostats_destroy(spa_t *spa)
 	mutex_destroy(&shk->lock);
 }
 
+/*
+ * Progress of the livelist delete zthr, exported as
+ * /proc/spl/kstat/zfs/<pool>/livelist_delete.  The pending counts are the
+ * deleted clones whose livelists are still to be freed and the sublists
+ * left in the livelist being freed; the rest are cumulative.
+ */
+static const spa_livelist_stats_t spa_livelist_stats_template = {
+	{ "livelists_pending",			KSTAT_DATA_UINT64 },
+	{ "sublists_pending",			KSTAT_DATA_UINT64 },
+	{ "sublists_deleted",			KSTAT_DATA_UINT64 },
+	{ "blocks_freed",			KSTAT_DATA_UINT64 },
+	{ "bytes_freed",			KSTAT_DATA_UINT64 },
+	{ "dedup_blocks_freed",			KSTAT_DATA_UINT64 },
+};
+
+void
+spa_livelist_stats_pending(spa_t *spa, uint64_t livelists, uint64_t sublists)
+{
+	kstat_t *ksp = spa->spa_stats.livelist.kstat;
+
+	if (ksp == NULL)
+		return;
+
+	spa_livelist_stats_t *lls = ksp->ks_data;
+	atomic_store_64(&lls->livelists_pending.value.ui64, livelists);
+	atomic_store_64(&lls->sublists_pending.value.ui64, sublists);
+}
+
+void
+spa_livelist_stats_freed(spa_t *spa, uint64_t sublists, uint64_t blocks,
+    uint64_t bytes, uint64_t dedup_blocks)
+{
+	kstat_t *ksp = spa->spa_stats.livelist.kstat;
+
+	if (ksp == NULL)
+		return;
+
+	spa_livelist_stats_t *lls = ksp->ks_data;
+	atomic_add_64(&lls->sublists_deleted.value.ui64, sublists);
+	atomic_add_64(&lls->blocks_freed.value.ui64, blocks);
+	atomic_add_64(&lls->bytes_freed.value.ui64, bytes);
+	atomic_add_64(&lls->dedup_blocks_freed.value.ui64, dedup_blocks);
+}
+
+static void
+spa_livelist_stats_init(spa_t *spa)
+{
+	spa_history_kstat_t *shk = &spa->spa_stats.livelist;
+
+	mutex_init(&shk->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	char *name = kmem_asprintf("zfs/%s", spa_name(spa));
+	kstat_t *ksp = kstat_create(name, 0, "livelist_delete", "misc",
+	    KSTAT_TYPE_NAMED,
+	    sizeof (spa_livelist_stats_t) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+
+	shk->kstat = ksp;
+	if (ksp) {
+		int size = sizeof (spa_livelist_stats_t);
+		ksp->ks_lock = &shk->lock;
+		ksp->ks_private = spa;
+		ksp->ks_data = kmem_alloc(size, KM_SLEEP);
+		memcpy(ksp->ks_data, &spa_livelist_stats_template, size);
+		kstat_install(ksp);
+	}
+
+	kmem_strfree(name);
+}
+
+static void
+spa_livelist_stats_destroy(spa_t *spa)
+{
+	spa_history_kstat_t *shk = &spa->spa_stats.livelist;
+	kstat_t *ksp = shk->kstat;
+	if (ksp) {
+		kmem_free(ksp->ks_data, sizeof (spa_livelist_stats_t));
+		kstat_delete(ksp);
+	}
+
+	mutex_destroy(&shk->lock);
+}
+
+/*
+ * Throughput of the frees of destroyed datasets and the free_bpobj done in
+ * syncing context, exported as /proc/spl/kstat/zfs/<pool>/async_destroy.
+ * The last_* values describe the last txg which freed anything, and the
+ * prefetch_* values the last read ahead of the bptree traversal; the rest
+ * are cumulative.
+ */
+static const spa_async_destroy_stats_t spa_async_destroy_stats_template = {
+	{ "blocks_freed",			KSTAT_DATA_UINT64 },
+	{ "bytes_freed",			KSTAT_DATA_UINT64 },
+	{ "txgs",				KSTAT_DATA_UINT64 },
+	{ "last_txg_blocks",			KSTAT_DATA_UINT64 },
+	{ "last_txg_bytes",			KSTAT_DATA_UINT64 },
+	{ "last_txg_ms",			KSTAT_DATA_UINT64 },
+	{ "last_bytes_per_sec",			KSTAT_DATA_UINT64 },
+	{ "prefetch_window",			KSTAT_DATA_UINT64 },
+	{ "prefetch_bytes",			KSTAT_DATA_UINT64 },
+};
+
+void
+spa_async_destroy_stats_txg(spa_t *spa, uint64_t blocks, uint64_t bytes,
+    hrtime_t elapsed)
+{
+	kstat_t *ksp = spa->spa_stats.async_destroy.kstat;
+
+	if (ksp == NULL)
+		return;
+
+	spa_async_destroy_stats_t *ads = ksp->ks_data;
+	atomic_add_64(&ads->blocks_freed.value.ui64, blocks);
+	atomic_add_64(&ads->bytes_freed.value.ui64, bytes);
+	atomic_inc_64(&ads->txgs.value.ui64);
+	atomic_store_64(&ads->last_txg_blocks.value.ui64, blocks);
+	atomic_store_64(&ads->last_txg_bytes.value.ui64, bytes);
+	atomic_store_64(&ads->last_txg_ms.value.ui64, NSEC2MSEC(elapsed));
+	/* bytes * NANOSEC would overflow past a few GiB freed in a txg */
+	atomic_store_64(&ads->last_bytes_per_sec.value.ui64, elapsed > 0 ?
+	    bytes / MAX(NSEC2MSEC(elapsed), 1) * MILLISEC : 0);
+}
+
+void
+spa_async_destroy_stats_prefetch(spa_t *spa, uint64_t window, uint64_t bytes)
+{
+	kstat_t *ksp = spa->spa_stats.async_destroy.kstat;
+
+	if (ksp == NULL)
+		return;
+
+	spa_async_destroy_stats_t *ads = ksp->ks_data;
+	atomic_store_64(&ads->prefetch_window.value.ui64, window);
+	atomic_store_64(&ads->prefetch_bytes.value.ui64, bytes);
+}
+
+static void
+spa_async_destroy_stats_init(spa_t *spa)
+{
+	spa_history_kstat_t *shk = &spa->spa_stats.async_destroy;
+
+	mutex_init(&shk->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	char *name = kmem_asprintf("zfs/%s", spa_name(spa));
+	kstat_t *ksp = kstat_create(name, 0, "async_destroy", "misc",
+	    KSTAT_TYPE_NAMED,
+	    sizeof (spa_async_destroy_stats_t) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+
+	shk->kstat = ksp;
+	if (ksp) {
+		int size = sizeof (spa_async_destroy_stats_t);
+		ksp->ks_lock = &shk->lock;
+		ksp->ks_private = spa;
+		ksp->ks_data = kmem_alloc(size, KM_SLEEP);
+		memcpy(ksp->ks_data, &spa_async_destroy_stats_template, size);
+		kstat_install(ksp);
+	}
+
+	kmem_strfree(name);
+}
+
+static void
+spa_async_destroy_stats_destroy(spa_t *spa)
+{
+	spa_history_kstat_t *shk = &spa->spa_stats.async_destroy;
+	kstat_t *ksp = shk->kstat;
+	if (ksp) {
+		kmem_free(ksp->ks_data, sizeof (spa_async_destroy_stats_t));
+		kstat_delete(ksp);
+	}
+
+	mutex_destroy(&shk->lock);
+}
+
+/*
+ * Per-pool rollup of the ZIL counters and latency histograms of all the
+ * datasets in the pool, exported as /proc/spl/kstat/zfs/<pool>/zil and
+ * /proc/spl/kstat/zfs/<pool>/zil_latency.  The sums outlive the kstats,
+ * which may fail to be created, since every zilog of the pool points
+ * at them.
+ */
+static void
+spa_zil_init(spa_t *spa)
+{
+	spa_history_kstat_t *shk = &spa->spa_stats.zil;
+	zil_sums_t *zs;
+
+	shk->size = sizeof (zil_sums_t);
+	shk->priv = zs = kmem_zalloc(shk->size, KM_SLEEP);
+	zil_sums_init(zs);
+
+	char *name = kmem_asprintf("zfs/%s", spa_name(spa));
+	shk->kstat = zil_kstat_create(name, "zil", zs);
+	spa->spa_stats.zil_latency.kstat =
+	    zil_latency_kstat_create(name, "zil_latency", zs);
+	kmem_strfree(name);
+}
+
+static void
+spa_zil_destroy(spa_t *spa)
+{
+	spa_history_kstat_t *shk = &spa->spa_stats.zil;
+
+	if (spa->spa_stats.zil_latency.kstat != NULL)
+		kstat_delete(spa->spa_stats.zil_latency.kstat);
+	if (shk->kstat != NULL)
+		zil_kstat_destroy(shk->kstat);
+
+	zil_sums_fini(shk->priv);
+	kmem_free(shk->priv, shk->size);
+}
+
+zil_sums_t *
+spa_zil_sums(spa_t *spa)
+{
+	return (spa->spa_stats.zil.priv);
+}
+
 void
 spa_stats_init(spa_t *spa)
 {
@@ -1044,20 +1399,28 @@ spa_stats_init(spa_t *spa)
 	spa_txg_history_init(spa);
 	spa_tx_assign_init(spa);
 	spa_mmp_history_init(spa);
+	spa_recv_writer_history_init(spa);
 	spa_state_init(spa);
 	spa_guid_init(spa);
 	spa_iostats_init(spa);
+	spa_zil_init(spa);
+	spa_livelist_stats_init(spa);
+	spa_async_destroy_stats_init(spa);
 }
 
 void
 spa_stats_destroy(spa_t *spa)
 {
+	spa_async_destroy_stats_destroy(spa);
+	spa_livelist_stats_destroy(spa);
+	spa_zil_destroy(spa);
 	spa_iostats_destroy(spa);
 	spa_health_destroy(spa);
 	spa_tx_assign_destroy(spa);
 	spa_txg_history_destroy(spa);
 	spa_read_history_destroy(spa);
 	spa_mmp_history_destroy(spa);
+	spa_recv_writer_history_destroy(spa);
 	spa_guid_destroy(spa);
 }
 
@@ -1072,3 +1435,6 @@ ZFS_MODULE_PARAM(zfs_txg, zfs_txg_, history, UINT, ZMOD_RW,
 
 ZFS_MODULE_PARAM(zfs_multihost, zfs_multihost_, history, UINT, ZMOD_RW,
 	"Historical statistics for last N multihost writes");
+
+ZFS_MODULE_PARAM(zfs_recv, zfs_recv_, writer_history, UINT, ZMOD_RW,
+	"Historical statistics for the last N receive writer threads");
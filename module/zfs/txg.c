@@ -115,6 +115,12 @@ static __attribute__((noreturn)) void txg_quiesce_thread(void *arg);
 
 uint_t zfs_txg_timeout = 5;	/* max seconds worth of delta per txg */
 
+/*
+ * When set, the next txg is allowed to start quiescing while the syncing
+ * txg is still converging the MOS, see txg_sync_converging().
+ */
+int zfs_txg_sync_overlap = 1;
+
 /*
  * Prepare the txg subsystem.
  */
@@ -834,6 +840,41 @@ txg_kick(dsl_pool_t *dp, uint64_t txg)
 	mutex_exit(&tx->tx_sync_lock);
 }
 
+/*
+ * Called in syncing context once the syncing txg has written out all of
+ * its user data and the remaining sync passes only converge the MOS. The
+ * vdevs are mostly idle from here until the uberblock is written, so if a
+ * sync of the next txg has already been requested (by txg_kick() or a
+ * txg_wait_synced() caller), start quiescing it now. It is then handed
+ * off as soon as this txg completes, instead of the sync thread first
+ * having to wait for all of its holds to drain.
+ *
+ * Only the quiesce is overlapped; the next txg's dirty data is still
+ * written strictly after this txg's uberblock, so the on-disk state moves
+ * from one consistent txg to the next exactly as before.
+ */
+void
+txg_sync_converging(dsl_pool_t *dp, uint64_t txg)
+{
+	tx_state_t *tx = &dp->dp_tx;
+
+	if (!zfs_txg_sync_overlap || tx->tx_sync_txg_waiting <= txg)
+		return;
+
+	mutex_enter(&tx->tx_sync_lock);
+	ASSERT3U(tx->tx_syncing_txg, ==, txg);
+	if (tx->tx_sync_txg_waiting > txg &&
+	    tx->tx_open_txg == txg + 1 &&
+	    tx->tx_quiesce_txg_waiting <= tx->tx_open_txg &&
+	    !txg_is_quiescing(dp) && !txg_has_quiesced_to_sync(dp)) {
+		tx->tx_quiesce_txg_waiting = tx->tx_open_txg + 1;
+		DTRACE_PROBE2(txg__quiesce__early, dsl_pool_t *, dp,
+		    uint64_t, txg + 1);
+		cv_broadcast(&tx->tx_quiesce_more_cv);
+	}
+	mutex_exit(&tx->tx_sync_lock);
+}
+
 boolean_t
 txg_stalled(dsl_pool_t *dp)
 {
@@ -1095,3 +1136,6 @@ EXPORT_SYMBOL(txg_sync_waiting);
 
 ZFS_MODULE_PARAM(zfs_txg, zfs_txg_, timeout, UINT, ZMOD_RW,
 	"Max seconds worth of delta per txg");
+
+ZFS_MODULE_PARAM(zfs_txg, zfs_txg_, sync_overlap, INT, ZMOD_RW,
+	"Quiesce the next txg while the syncing txg converges the MOS");
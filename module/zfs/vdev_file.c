@@ -52,6 +52,18 @@ static taskq_t *vdev_file_taskq;
 static uint_t vdev_file_logical_ashift = SPA_MINBLOCKSHIFT;
 static uint_t vdev_file_physical_ashift = SPA_MINBLOCKSHIFT;
 
+/*
+ * When set, synchronous writes of file-based log devices are performed by
+ * the issuing thread instead of being handed off to vdev_file_taskq.  This
+ * is intended for log files on byte-addressable storage, such as a DAX
+ * filesystem on persistent memory (or tmpfs for testing), where the write
+ * is a copy into the mapped media, and the taskq round trip dominates the
+ * latency of a ZIL commit.  On ordinary storage it stalls the issuing
+ * thread.  Cache flushes always go through the taskq: the ZIL issues them
+ * from zio completion, and an fsync must not block the interrupt taskq.
+ */
+static int vdev_file_inline_log = 0;
+
 void
 vdev_file_init(void)
 {
@@ -200,6 +212,11 @@ vdev_file_close(vdev_t *vd)
 		(void) zfs_file_close(vf->vf_file);
 	}
 
+	if (vf->vf_inline_writes != 0) {
+		zfs_dbgmsg("vdev_file %s: %llu log writes issued inline",
+		    vd->vdev_path, (u_longlong_t)vf->vf_inline_writes);
+	}
+
 	vd->vdev_delayed_close = B_FALSE;
 	kmem_free(vf, sizeof (vdev_file_t));
 	vd->vdev_tsd = NULL;
@@ -261,6 +278,22 @@ vdev_file_io_deallocate(void *arg)
 	zio_interrupt(zio);
 }
 
+/*
+ * Returns true if the write should be performed in the issuing thread; see
+ * vdev_file_inline_log.
+ */
+static boolean_t
+vdev_file_io_inline(zio_t *zio)
+{
+	vdev_t *tvd = zio->io_vd->vdev_top;
+
+	if (!vdev_file_inline_log || tvd == NULL || !tvd->vdev_islog)
+		return (B_FALSE);
+
+	return (zio->io_type == ZIO_TYPE_WRITE &&
+	    zio->io_priority == ZIO_PRIORITY_SYNC_WRITE);
+}
+
 static void
 vdev_file_io_start(zio_t *zio)
 {
@@ -298,6 +331,14 @@ vdev_file_io_start(zio_t *zio)
 	ASSERT(zio->io_type == ZIO_TYPE_READ || zio->io_type == ZIO_TYPE_WRITE);
 	zio->io_target_timestamp = zio_handle_io_delay(zio);
 
+	if (vdev_file_io_inline(zio)) {
+		vdev_file_t *vf = vd->vdev_tsd;
+
+		atomic_inc_64(&vf->vf_inline_writes);
+		vdev_file_io_strategy(zio);
+		return;
+	}
+
 	VERIFY3U(taskq_dispatch(vdev_file_taskq, vdev_file_io_strategy, zio,
 	    TQ_SLEEP), !=, TASKQID_INVALID);
 }
@@ -370,3 +411,5 @@ ZFS_MODULE_PARAM(zfs_vdev_file, vdev_file_, logical_ashift, UINT, ZMOD_RW,
 	"Logical ashift for file-based devices");
 ZFS_MODULE_PARAM(zfs_vdev_file, vdev_file_, physical_ashift, UINT, ZMOD_RW,
 	"Physical ashift for file-based devices");
+ZFS_MODULE_PARAM(zfs_vdev_file, vdev_file_, inline_log, INT, ZMOD_RW,
+	"Issue sync writes of file-based log devices inline");
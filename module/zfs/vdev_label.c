@@ -436,6 +436,18 @@ root_vdev_actions_getprogress(vdev_t *vd, nvlist_t *nvl)
 		    ZPOOL_CONFIG_RAIDZ_EXPAND_STATS, (uint64_t *)&pres,
 		    sizeof (pres) / sizeof (uint64_t));
 	}
+
+	pool_dedup_scan_stat_t pdss;
+	char *dsname = kmem_alloc(ZFS_MAX_DATASET_NAME_LEN, KM_SLEEP);
+	if (spa_dedup_scan_get_stats(spa, &pdss, dsname,
+	    ZFS_MAX_DATASET_NAME_LEN) == 0) {
+		fnvlist_add_uint64_array(nvl,
+		    ZPOOL_CONFIG_DEDUP_SCAN_STATS, (uint64_t *)&pdss,
+		    sizeof (pdss) / sizeof (uint64_t));
+		fnvlist_add_string(nvl, ZPOOL_CONFIG_DEDUP_SCAN_DATASET,
+		    dsname);
+	}
+	kmem_free(dsname, ZFS_MAX_DATASET_NAME_LEN);
 }
 
 static void
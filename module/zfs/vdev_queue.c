@@ -204,6 +204,12 @@ static uint_t zfs_vdev_aggregation_limit_non_rotating = SPA_OLD_MAXBLOCKSIZE;
 static uint_t zfs_vdev_read_gap_limit = 32 << 10;
 static uint_t zfs_vdev_write_gap_limit = 4 << 10;
 
+/*
+ * A leaf that hasn't completed any sync I/O for this long is considered idle
+ * by vdev_queue_sync_latency().
+ */
+#define	VDEV_QUEUE_SYNC_IDLE	SEC2NSEC(1)
+
 static int
 vdev_queue_offset_compare(const void *x1, const void *x2)
 {
@@ -954,6 +960,21 @@ vdev_queue_io_done(zio_t *zio)
 	vq->vq_io_complete_ts = now;
 	vq->vq_io_delta_ts = zio->io_delta = now - zio->io_timestamp;
 
+	/*
+	 * Track the latency seen by synchronous I/O so that background work
+	 * such as scrub can back off when it starts to hurt; see
+	 * vdev_queue_sync_latency().
+	 */
+	if (zio->io_priority == ZIO_PRIORITY_SYNC_READ ||
+	    zio->io_priority == ZIO_PRIORITY_SYNC_WRITE) {
+		hrtime_t lat = vq->vq_sync_lat;
+
+		if (now - vq->vq_sync_ts > VDEV_QUEUE_SYNC_IDLE)
+			lat = zio->io_delta;
+		vq->vq_sync_lat = lat + ((zio->io_delta - lat) >> 3);
+		vq->vq_sync_ts = now;
+	}
+
 	mutex_enter(&vq->vq_lock);
 	vdev_queue_pending_remove(vq, zio);
 
@@ -1053,6 +1074,21 @@ vdev_queue_last_offset(vdev_t *vd)
 	return (vd->vdev_queue.vq_last_offset);
 }
 
+/*
+ * Moving average of the latency of recent sync reads and writes on a leaf
+ * vdev, or 0 if it hasn't completed any in the last VDEV_QUEUE_SYNC_IDLE.
+ * Like vdev_queue_length(), this is read without vq_lock.
+ */
+hrtime_t
+vdev_queue_sync_latency(vdev_t *vd)
+{
+	vdev_queue_t *vq = &vd->vdev_queue;
+
+	if (gethrtime() - vq->vq_sync_ts > VDEV_QUEUE_SYNC_IDLE)
+		return (0);
+	return (vq->vq_sync_lat);
+}
+
 uint64_t
 vdev_queue_class_length(vdev_t *vd, zio_priority_t p)
 {
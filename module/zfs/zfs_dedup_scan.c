@@ -0,0 +1,603 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or https://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Offline (post-process) deduplication of a mounted filesystem.
+ *
+ * A background thread walks every plain file of the dataset in object
+ * order, reading the level-0 block pointers of each file in chunks.  The
+ * checksum, physical properties and number of copies of every block are
+ * remembered in an in-core table; when a later block is found with the same
+ * key but a different DVA, the later block is replaced with a clone of the
+ * earlier one through the block reference table, exactly as if the user had
+ * called copy_file_range() for that single block.  Blocks written with
+ * different copies settings are never merged, so a merge cannot lower the
+ * redundancy of a file.  If the kept block is itself a dedup block,
+ * brt_pending_apply() turns the clone into a DDT reference, so files
+ * written with and without dedup=on converge.
+ *
+ * The merge does not change file contents, so it is not logged to the
+ * ZIL and does not update timestamps.  Both blocks are re-read under
+ * range locks before the merge, and the data is compared byte-for-byte
+ * unless the checksum is strong enough for dedup (or always, when
+ * zfs_dedup_scan_verify is set).
+ *
+ * Only one scan may run per pool.  Progress is recorded in the spa and
+ * reported by "zpool status"; it is not persistent, and an interrupted
+ * scan starts over from the beginning the next time it is requested.
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/sysmacros.h>
+#include <sys/kmem.h>
+#include <sys/errno.h>
+#include <sys/stat.h>
+#include <sys/avl.h>
+#include <sys/fs/zfs.h>
+#include <sys/dmu.h>
+#include <sys/dmu_objset.h>
+#include <sys/dmu_tx.h>
+#include <sys/dbuf.h>
+#include <sys/spa.h>
+#include <sys/policy.h>
+#include <sys/vdev.h>
+#include <sys/zfeature.h>
+#include <sys/zio_checksum.h>
+#include <sys/zfs_rlock.h>
+#include <sys/zfs_vfsops.h>
+#include <sys/zfs_vnops.h>
+#include <sys/zfs_znode.h>
+
+/*
+ * Maximum number of distinct blocks remembered by a scan.  Each entry
+ * costs roughly 100 bytes; once the table is full, blocks are still
+ * matched against it, but no new blocks are added.
+ */
+static uint64_t zfs_dedup_scan_max_entries = 1ULL << 20;
+
+/* Number of blocks whose pointers are read at once. */
+static uint_t zfs_dedup_scan_chunk_blocks = 64;
+
+/* Time to sleep between chunks while the pool is busy with other I/O. */
+static uint_t zfs_dedup_scan_busy_delay_ms = 100;
+
+/* Compare data before merging even if the checksum is dedup-capable. */
+static int zfs_dedup_scan_verify = 0;
+
+typedef struct zfs_dedup_scan_entry {
+	avl_node_t	dse_node;
+	zio_cksum_t	dse_cksum;
+	uint32_t	dse_lsize;
+	uint32_t	dse_psize;
+	uint8_t		dse_checksum;
+	uint8_t		dse_compress;
+	uint8_t		dse_ndvas;	/* copies, never merged with fewer */
+	dva_t		dse_dva;	/* first DVA of the kept block */
+	uint64_t	dse_object;	/* where the kept block lives */
+	uint64_t	dse_offset;
+} zfs_dedup_scan_entry_t;
+
+typedef struct zfs_dedup_scan {
+	zfsvfs_t	*zds_zfsvfs;
+	kmutex_t	zds_lock;	/* protects zds_thread and zds_cancel */
+	kcondvar_t	zds_cv;
+	kthread_t	*zds_thread;	/* non-NULL while a scan is running */
+	boolean_t	zds_cancel;
+	avl_tree_t	zds_tree;	/* only touched by zds_thread */
+	uint64_t	zds_nentries;
+} zfs_dedup_scan_t;
+
+static int
+zfs_dedup_scan_compare(const void *x1, const void *x2)
+{
+	const zfs_dedup_scan_entry_t *e1 = x1;
+	const zfs_dedup_scan_entry_t *e2 = x2;
+	int cmp;
+
+	for (int i = 0; i < ZIO_CHECKSUM_WORDS; i++) {
+		cmp = TREE_CMP(e1->dse_cksum.zc_word[i],
+		    e2->dse_cksum.zc_word[i]);
+		if (cmp != 0)
+			return (cmp);
+	}
+
+	cmp = TREE_CMP(e1->dse_checksum, e2->dse_checksum);
+	if (cmp != 0)
+		return (cmp);
+	cmp = TREE_CMP(e1->dse_compress, e2->dse_compress);
+	if (cmp != 0)
+		return (cmp);
+	cmp = TREE_CMP(e1->dse_ndvas, e2->dse_ndvas);
+	if (cmp != 0)
+		return (cmp);
+	cmp = TREE_CMP(e1->dse_lsize, e2->dse_lsize);
+	if (cmp != 0)
+		return (cmp);
+	return (TREE_CMP(e1->dse_psize, e2->dse_psize));
+}
+
+static void
+zfs_dedup_scan_entry_fill(zfs_dedup_scan_entry_t *dse, const blkptr_t *bp)
+{
+	dse->dse_cksum = bp->blk_cksum;
+	dse->dse_lsize = BP_GET_LSIZE(bp);
+	dse->dse_psize = BP_GET_PSIZE(bp);
+	dse->dse_checksum = BP_GET_CHECKSUM(bp);
+	dse->dse_compress = BP_GET_COMPRESS(bp);
+	dse->dse_ndvas = BP_GET_NDVAS(bp);
+	dse->dse_dva = bp->blk_dva[0];
+}
+
+static boolean_t
+zfs_dedup_scan_bp_matches(const zfs_dedup_scan_entry_t *dse,
+    const blkptr_t *bp)
+{
+	zfs_dedup_scan_entry_t search;
+
+	if (BP_IS_HOLE(bp) || BP_IS_EMBEDDED(bp))
+		return (B_FALSE);
+
+	zfs_dedup_scan_entry_fill(&search, bp);
+	return (zfs_dedup_scan_compare(dse, &search) == 0);
+}
+
+/*
+ * Blocks the scan can merge: non-gang, unencrypted data blocks with a
+ * checksum that actually identifies their contents.
+ */
+static boolean_t
+zfs_dedup_scan_bp_eligible(const blkptr_t *bp)
+{
+	if (BP_IS_GANG(bp) || BP_USES_CRYPT(bp))
+		return (B_FALSE);
+
+	enum zio_checksum c = BP_GET_CHECKSUM(bp);
+	return (c != ZIO_CHECKSUM_OFF && c != ZIO_CHECKSUM_NOPARITY);
+}
+
+static int
+zfs_dedup_scan_verify_data(objset_t *os, uint64_t sobj, uint64_t soff,
+    uint64_t dobj, uint64_t doff, uint64_t size)
+{
+	void *sbuf = vmem_alloc(size, KM_SLEEP);
+	void *dbuf = vmem_alloc(size, KM_SLEEP);
+	int error;
+
+	error = dmu_read(os, sobj, soff, size, sbuf, DMU_READ_NO_PREFETCH);
+	if (error == 0) {
+		error = dmu_read(os, dobj, doff, size, dbuf,
+		    DMU_READ_NO_PREFETCH);
+	}
+	if (error == 0 && memcmp(sbuf, dbuf, size) != 0)
+		error = SET_ERROR(ECKSUM);
+
+	vmem_free(dbuf, size);
+	vmem_free(sbuf, size);
+
+	return (error);
+}
+
+/*
+ * Replace the block of dzp at doff with a clone of the block recorded in
+ * dse.  Both blocks are re-read under range locks, so anything that has
+ * changed since the chunk was scanned is simply skipped.
+ */
+static int
+zfs_dedup_scan_merge(zfs_dedup_scan_t *zds, const zfs_dedup_scan_entry_t *dse,
+    znode_t *dzp, uint64_t doff)
+{
+	zfsvfs_t *zfsvfs = zds->zds_zfsvfs;
+	objset_t *os = zfsvfs->z_os;
+	zfs_locked_range_t *slr, *dlr;
+	znode_t *szp;
+	blkptr_t sbp, dbp;
+	dmu_buf_impl_t *db;
+	dmu_tx_t *tx;
+	uint64_t soff = dse->dse_offset;
+	uint64_t size = dse->dse_lsize;
+	size_t nbps;
+	int error;
+
+	if ((error = zfs_zget(zfsvfs, dse->dse_object, &szp)) != 0)
+		return (error);
+
+	if (!S_ISREG(szp->z_mode) || szp->z_unlinked ||
+	    (szp == dzp && soff == doff)) {
+		zrele(szp);
+		return (SET_ERROR(ENOENT));
+	}
+
+	/*
+	 * Maintain the same lock order as zfs_clone_range().
+	 */
+	if (szp < dzp || (szp == dzp && soff < doff)) {
+		slr = zfs_rangelock_enter(&szp->z_rangelock, soff, size,
+		    RL_READER);
+		dlr = zfs_rangelock_enter(&dzp->z_rangelock, doff, size,
+		    RL_WRITER);
+	} else {
+		dlr = zfs_rangelock_enter(&dzp->z_rangelock, doff, size,
+		    RL_WRITER);
+		slr = zfs_rangelock_enter(&szp->z_rangelock, soff, size,
+		    RL_READER);
+	}
+
+	/*
+	 * The block size of either file could have changed since the block
+	 * was recorded, in which case the offsets no longer name one block.
+	 */
+	if (szp->z_blksz != size || dzp->z_blksz != size ||
+	    soff >= szp->z_size || doff >= dzp->z_size) {
+		error = SET_ERROR(ESTALE);
+		goto out;
+	}
+
+	nbps = 1;
+	error = dmu_read_l0_bps(os, szp->z_id, soff, size, &sbp, &nbps);
+	if (error != 0)
+		goto out;
+	nbps = 1;
+	error = dmu_read_l0_bps(os, dzp->z_id, doff, size, &dbp, &nbps);
+	if (error != 0)
+		goto out;
+
+	if (!zfs_dedup_scan_bp_matches(dse, &sbp) ||
+	    !zfs_dedup_scan_bp_matches(dse, &dbp) ||
+	    DVA_EQUAL(&sbp.blk_dva[0], &dbp.blk_dva[0])) {
+		error = SET_ERROR(ESTALE);
+		goto out;
+	}
+
+	if (zfs_dedup_scan_verify || !(zio_checksum_table[
+	    BP_GET_CHECKSUM(&sbp)].ci_flags & ZCHECKSUM_FLAG_DEDUP)) {
+		error = zfs_dedup_scan_verify_data(os, szp->z_id, soff,
+		    dzp->z_id, doff, size);
+		if (error != 0)
+			goto out;
+	}
+
+	tx = dmu_tx_create(os);
+	db = (dmu_buf_impl_t *)sa_get_db(dzp->z_sa_hdl);
+	DB_DNODE_ENTER(db);
+	dmu_tx_hold_clone_by_dnode(tx, DB_DNODE(db), doff, size, size);
+	DB_DNODE_EXIT(db);
+	error = dmu_tx_assign(tx, DMU_TX_WAIT);
+	if (error != 0) {
+		dmu_tx_abort(tx);
+		goto out;
+	}
+
+	error = dmu_brt_clone(os, dzp->z_id, doff, size, tx, &sbp, 1);
+	dmu_tx_commit(tx);
+
+out:
+	zfs_rangelock_exit(slr);
+	zfs_rangelock_exit(dlr);
+	zrele(szp);
+
+	return (error);
+}
+
+/*
+ * Scan one chunk of blocks of the given object, starting at *offsetp.
+ * Returns B_TRUE when the object is done and the scan should move on.
+ */
+static boolean_t
+zfs_dedup_scan_chunk(zfs_dedup_scan_t *zds, uint64_t object,
+    uint64_t *offsetp, blkptr_t *bps, size_t maxbps)
+{
+	zfsvfs_t *zfsvfs = zds->zds_zfsvfs;
+	objset_t *os = zfsvfs->z_os;
+	spa_t *spa = dmu_objset_spa(os);
+	dmu_object_info_t doi;
+	zfs_locked_range_t *lr;
+	znode_t *zp;
+	uint64_t examined = 0, deduped = 0, deduped_blocks = 0;
+	size_t nbps;
+	int error;
+
+	if (dmu_object_info(os, object, &doi) != 0 ||
+	    doi.doi_type != DMU_OT_PLAIN_FILE_CONTENTS)
+		return (B_TRUE);
+
+	if (zfs_zget(zfsvfs, object, &zp) != 0)
+		return (B_TRUE);
+
+	if (!S_ISREG(zp->z_mode) || zp->z_unlinked ||
+	    *offsetp >= zp->z_size) {
+		zrele(zp);
+		return (B_TRUE);
+	}
+
+	uint64_t blksz = zp->z_blksz;
+	uint64_t off = *offsetp - *offsetp % blksz;
+	maxbps = MIN(maxbps, MAX(DMU_MAX_ACCESS / 2 / blksz, 1));
+	uint64_t len = MIN(blksz * maxbps, zp->z_size - off);
+
+	lr = zfs_rangelock_enter(&zp->z_rangelock, off, len, RL_READER);
+	nbps = maxbps;
+	error = dmu_read_l0_bps(os, object, off, len, bps, &nbps);
+	zfs_rangelock_exit(lr);
+
+	/*
+	 * Blocks dirty in the open txg come back as EAGAIN; they are being
+	 * rewritten anyway, so just skip over them.
+	 */
+	if (error != 0)
+		nbps = 0;
+
+	for (size_t i = 0; i < nbps && !zds->zds_cancel; i++) {
+		const blkptr_t *bp = &bps[i];
+		zfs_dedup_scan_entry_t search, *dse;
+		avl_index_t where;
+
+		if (BP_IS_HOLE(bp) || BP_IS_EMBEDDED(bp))
+			continue;
+
+		uint64_t dsize = bp_get_dsize(spa, bp);
+		examined += dsize;
+
+		if (!zfs_dedup_scan_bp_eligible(bp))
+			continue;
+
+		zfs_dedup_scan_entry_fill(&search, bp);
+		dse = avl_find(&zds->zds_tree, &search, &where);
+		if (dse == NULL) {
+			if (zds->zds_nentries >= zfs_dedup_scan_max_entries)
+				continue;
+			dse = kmem_alloc(sizeof (*dse), KM_SLEEP);
+			*dse = search;
+			dse->dse_object = object;
+			dse->dse_offset = off + i * blksz;
+			avl_insert(&zds->zds_tree, dse, where);
+			zds->zds_nentries++;
+			continue;
+		}
+
+		if (DVA_EQUAL(&dse->dse_dva, &bp->blk_dva[0]))
+			continue;
+
+		if (zfs_dedup_scan_merge(zds, dse, zp, off + i * blksz) == 0) {
+			deduped += dsize;
+			deduped_blocks++;
+		}
+	}
+
+	*offsetp = off + len;
+	boolean_t done = (*offsetp >= zp->z_size);
+	zrele(zp);
+
+	spa_dedup_scan_update(spa, examined, deduped, deduped_blocks);
+
+	return (done);
+}
+
+static __attribute__((noreturn)) void
+zfs_dedup_scan_thread(void *arg)
+{
+	zfs_dedup_scan_t *zds = arg;
+	zfsvfs_t *zfsvfs = zds->zds_zfsvfs;
+	spa_t *spa = dmu_objset_spa(zfsvfs->z_os);
+	size_t maxbps = MAX(zfs_dedup_scan_chunk_blocks, 1);
+	blkptr_t *bps = vmem_alloc(sizeof (blkptr_t) * maxbps, KM_SLEEP);
+	uint64_t object = 0, offset = 0;
+	boolean_t next = B_TRUE;
+	void *cookie = NULL;
+	zfs_dedup_scan_entry_t *dse;
+	int error = 0;
+
+	while (!zds->zds_cancel) {
+		/*
+		 * Re-enter the filesystem for every chunk, so a rollback or
+		 * receive can suspend it between chunks.
+		 */
+		if ((error = zfs_enter(zfsvfs, FTAG)) != 0)
+			break;
+
+		if (next) {
+			error = dmu_object_next(zfsvfs->z_os, &object,
+			    B_FALSE, 0);
+			offset = 0;
+		}
+		if (error == 0) {
+			next = zfs_dedup_scan_chunk(zds, object, &offset, bps,
+			    maxbps);
+		}
+
+		zfs_exit(zfsvfs, FTAG);
+
+		if (error != 0) {
+			if (error == ESRCH)
+				error = 0;
+			break;
+		}
+
+		if (zfs_dedup_scan_busy_delay_ms != 0 &&
+		    vdev_queue_pool_busy(spa)) {
+			mutex_enter(&zds->zds_lock);
+			if (!zds->zds_cancel) {
+				(void) cv_timedwait_idle(&zds->zds_cv,
+				    &zds->zds_lock, ddi_get_lbolt() +
+				    MSEC_TO_TICK(zfs_dedup_scan_busy_delay_ms));
+			}
+			mutex_exit(&zds->zds_lock);
+		}
+	}
+
+	vmem_free(bps, sizeof (blkptr_t) * maxbps);
+	while ((dse = avl_destroy_nodes(&zds->zds_tree, &cookie)) != NULL)
+		kmem_free(dse, sizeof (*dse));
+	avl_destroy(&zds->zds_tree);
+	zds->zds_nentries = 0;
+
+	spa_dedup_scan_end(spa, zds->zds_cancel || error != 0);
+
+	mutex_enter(&zds->zds_lock);
+	zds->zds_thread = NULL;
+	cv_broadcast(&zds->zds_cv);
+	mutex_exit(&zds->zds_lock);
+
+	thread_exit();
+}
+
+/*
+ * Cancel the running scan, if any, and wait for its thread to exit.
+ */
+static int
+zfs_dedup_scan_cancel(zfs_dedup_scan_t *zds)
+{
+	int error = 0;
+
+	mutex_enter(&zds->zds_lock);
+	if (zds->zds_thread == NULL) {
+		error = SET_ERROR(ENOENT);
+	} else {
+		zds->zds_cancel = B_TRUE;
+		cv_broadcast(&zds->zds_cv);
+		while (zds->zds_thread != NULL)
+			cv_wait(&zds->zds_cv, &zds->zds_lock);
+	}
+	mutex_exit(&zds->zds_lock);
+
+	return (error);
+}
+
+/*
+ * Start or stop the offline dedup scan of the filesystem containing zp.
+ *
+ *	IN:	zp	- any znode of the filesystem to scan.
+ *		flags	- ZFS_DEDUP_SCAN_* flags.
+ *
+ *	RETURN:	0 if success
+ *		error code if failure
+ */
+int
+zfs_dedup_scan(znode_t *zp, uint64_t flags)
+{
+	zfsvfs_t *zfsvfs = ZTOZSB(zp);
+	zfs_dedup_scan_t *zds;
+	int error;
+
+	if ((flags & ~ZFS_DEDUP_SCAN_STOP) != 0)
+		return (SET_ERROR(EINVAL));
+
+	if ((error = secpolicy_sys_config(CRED(), B_FALSE)) != 0)
+		return (error);
+
+	if ((error = zfs_enter_verify_zp(zfsvfs, zp, FTAG)) != 0)
+		return (error);
+
+	mutex_enter(&zfsvfs->z_lock);
+	if ((zds = zfsvfs->z_dedup_scan) == NULL) {
+		zds = kmem_zalloc(sizeof (*zds), KM_SLEEP);
+		zds->zds_zfsvfs = zfsvfs;
+		mutex_init(&zds->zds_lock, NULL, MUTEX_DEFAULT, NULL);
+		cv_init(&zds->zds_cv, NULL, CV_DEFAULT, NULL);
+		zfsvfs->z_dedup_scan = zds;
+	}
+	mutex_exit(&zfsvfs->z_lock);
+
+	if (flags & ZFS_DEDUP_SCAN_STOP) {
+		/*
+		 * The scan thread enters the filesystem itself, so we must
+		 * not hold it while waiting.  The open file keeps zfsvfs
+		 * from being unmounted underneath us.
+		 */
+		zfs_exit(zfsvfs, FTAG);
+		return (zfs_dedup_scan_cancel(zds));
+	}
+
+	objset_t *os = zfsvfs->z_os;
+	spa_t *spa = dmu_objset_spa(os);
+
+	if (!spa_feature_is_enabled(spa, SPA_FEATURE_BLOCK_CLONING) ||
+	    os->os_encrypted) {
+		zfs_exit(zfsvfs, FTAG);
+		return (SET_ERROR(EOPNOTSUPP));
+	}
+
+	if (zfs_is_readonly(zfsvfs)) {
+		zfs_exit(zfsvfs, FTAG);
+		return (SET_ERROR(EROFS));
+	}
+
+	mutex_enter(&zds->zds_lock);
+	if (zds->zds_thread != NULL) {
+		mutex_exit(&zds->zds_lock);
+		zfs_exit(zfsvfs, FTAG);
+		return (SET_ERROR(EBUSY));
+	}
+
+	uint64_t refd, avail, usedobjs, availobjs;
+	dmu_objset_space(os, &refd, &avail, &usedobjs, &availobjs);
+
+	char *dsname = kmem_alloc(ZFS_MAX_DATASET_NAME_LEN, KM_SLEEP);
+	dmu_objset_name(os, dsname);
+	error = spa_dedup_scan_begin(spa, dsname, refd);
+	kmem_free(dsname, ZFS_MAX_DATASET_NAME_LEN);
+
+	if (error == 0) {
+		avl_create(&zds->zds_tree, zfs_dedup_scan_compare,
+		    sizeof (zfs_dedup_scan_entry_t),
+		    offsetof(zfs_dedup_scan_entry_t, dse_node));
+		zds->zds_cancel = B_FALSE;
+		zds->zds_thread = thread_create(NULL, 0, zfs_dedup_scan_thread,
+		    zds, 0, &p0, TS_RUN, minclsyspri);
+	}
+	mutex_exit(&zds->zds_lock);
+
+	zfs_exit(zfsvfs, FTAG);
+
+	return (error);
+}
+
+/*
+ * Stop the scan, if any, and release its state.  Called on unmount.
+ */
+void
+zfs_dedup_scan_stop_wait(zfsvfs_t *zfsvfs)
+{
+	zfs_dedup_scan_t *zds = zfsvfs->z_dedup_scan;
+
+	if (zds == NULL)
+		return;
+
+	(void) zfs_dedup_scan_cancel(zds);
+
+	zfsvfs->z_dedup_scan = NULL;
+	cv_destroy(&zds->zds_cv);
+	mutex_destroy(&zds->zds_lock);
+	kmem_free(zds, sizeof (*zds));
+}
+
+ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, scan_max_entries, U64, ZMOD_RW,
+	"Max number of distinct blocks remembered by an offline dedup scan");
+
+ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, scan_chunk_blocks, UINT, ZMOD_RW,
+	"Number of block pointers read at once by an offline dedup scan");
+
+ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, scan_busy_delay_ms, UINT, ZMOD_RW,
+	"Delay between offline dedup scan chunks while the pool is busy");
+
+ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, scan_verify, INT, ZMOD_RW,
+	"Always compare data before merging blocks in an offline dedup scan");
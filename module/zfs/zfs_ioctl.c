@@ -1938,6 +1938,73 @@ zfs_ioc_obj_to_stats(zfs_cmd_t *zc)
 	return (error);
 }
 
+/*
+ * innvl: {
+ *     "objects" -> uint64 array of object numbers
+ * }
+ *
+ * outnvl: {
+ *     "<object>" -> {
+ *         "error" -> int32, from looking up the object
+ *         "path" -> path to the object, if it could be found
+ *         "stat" -> uint64 array of gen, mode, links and ctime[2]
+ *     }
+ * }
+ *
+ * Resolve a batch of objects to paths and stats, as ZFS_IOC_OBJ_TO_STATS
+ * does for one object, holding the objset only once.
+ */
+static const zfs_ioc_key_t zfs_keys_obj_to_stats_batch[] = {
+	{ZFS_OBJ_STATS_OBJECTS,	DATA_TYPE_UINT64_ARRAY,	0},
+};
+
+static int
+zfs_ioc_obj_to_stats_batch(const char *fsname, nvlist_t *innvl,
+    nvlist_t *outnvl)
+{
+	objset_t *os;
+	uint64_t *objs;
+	uint_t count;
+	int error;
+
+	objs = fnvlist_lookup_uint64_array(innvl, ZFS_OBJ_STATS_OBJECTS,
+	    &count);
+	if (count > ZFS_OBJ_STATS_BATCH_MAX)
+		return (SET_ERROR(E2BIG));
+
+	/* XXX reading from objset not owned */
+	if ((error = dmu_objset_hold_flags(fsname, B_TRUE, FTAG, &os)) != 0)
+		return (error);
+	if (dmu_objset_type(os) != DMU_OST_ZFS) {
+		dmu_objset_rele_flags(os, B_TRUE, FTAG);
+		return (SET_ERROR(EINVAL));
+	}
+
+	char *buf = kmem_alloc(MAXPATHLEN * 2, KM_SLEEP);
+	for (uint_t i = 0; i < count; i++) {
+		zfs_stat_t zs = { 0 };
+		char key[32];
+
+		error = zfs_obj_to_stats(os, objs[i], &zs, buf,
+		    MAXPATHLEN * 2);
+
+		nvlist_t *nv = fnvlist_alloc();
+		fnvlist_add_int32(nv, ZFS_OBJ_STATS_ERROR, error);
+		if (error == 0)
+			fnvlist_add_string(nv, ZFS_OBJ_STATS_PATH, buf);
+		fnvlist_add_uint64_array(nv, ZFS_OBJ_STATS_STAT,
+		    (uint64_t *)&zs, sizeof (zs) / sizeof (uint64_t));
+		(void) snprintf(key, sizeof (key), "%llu",
+		    (u_longlong_t)objs[i]);
+		fnvlist_add_nvlist(outnvl, key, nv);
+		fnvlist_free(nv);
+	}
+	kmem_free(buf, MAXPATHLEN * 2);
+	dmu_objset_rele_flags(os, B_TRUE, FTAG);
+
+	return (0);
+}
+
 static int
 zfs_ioc_vdev_add(zfs_cmd_t *zc)
 {
@@ -2468,6 +2535,257 @@ zfs_ioc_snapshot_list_next(zfs_cmd_t *zc)
 	return (error);
 }
 
+/*
+ * Build the ZFS_IOC_LIST_BATCH entry for one dataset.  Native properties
+ * whose slot in the props table is zero are left out, the same way
+ * zfs_prune_proplist() would drop them in libzfs.
+ */
+static int
+zfs_list_batch_one(dsl_dataset_t *ds, boolean_t simple, const uint8_t *props,
+    uint_t nprops, nvlist_t **entryp)
+{
+	dmu_objset_stats_t stat = { 0 };
+	nvlist_t *nv = NULL;
+	objset_t *os = NULL;
+	int error;
+
+	if (simple && ds->ds_is_snapshot) {
+		dsl_dataset_fast_stat(ds, &stat);
+	} else {
+		if ((error = dmu_objset_from_ds(ds, &os)) != 0)
+			return (error);
+		dmu_objset_fast_stat(os, &stat);
+	}
+
+	if (!simple) {
+		if ((error = dsl_prop_get_all(os, &nv)) != 0)
+			return (error);
+		dmu_objset_stats(os, nv);
+		/* XXX reading without owning, see zfs_ioc_objset_stats_impl */
+		if (!stat.dds_inconsistent &&
+		    dmu_objset_type(os) == DMU_OST_ZVOL) {
+			if ((error = zvol_get_stats(os, nv)) != 0) {
+				nvlist_free(nv);
+				return (error);
+			}
+		}
+
+		nvpair_t *pair = nvlist_next_nvpair(nv, NULL);
+		while (props != NULL && pair != NULL) {
+			nvpair_t *next = nvlist_next_nvpair(nv, pair);
+			zfs_prop_t prop = zfs_name_to_prop(nvpair_name(pair));
+
+			if (prop != ZPROP_USERPROP && (uint_t)prop < nprops &&
+			    props[prop] == 0)
+				fnvlist_remove_nvpair(nv, pair);
+			pair = next;
+		}
+	}
+
+	*entryp = fnvlist_alloc();
+	fnvlist_add_byte_array(*entryp, ZFS_LIST_BATCH_STATS,
+	    (uchar_t *)&stat, sizeof (stat));
+	if (nv != NULL) {
+		fnvlist_add_nvlist(*entryp, ZFS_LIST_BATCH_PROPS, nv);
+		nvlist_free(nv);
+	}
+	return (0);
+}
+
+/*
+ * innvl: {
+ *     "snapshots" -> (optional) list snapshots instead of child filesystems
+ *     "cursor" -> (optional) uint64, from the previous call
+ *     "count" -> (optional) uint64, most datasets to return
+ *     "maxbytes" -> (optional) uint64, rough limit on the size of outnvl
+ *     "simple" -> (optional) return only the stats of each dataset
+ *     "props" -> (optional) uint8 array indexed by zfs_prop_t; native
+ *         properties whose entry is zero are not returned
+ *     "snap_iter_min_txg" -> (optional) uint64
+ *     "snap_iter_max_txg" -> (optional) uint64
+ * }
+ *
+ * outnvl: {
+ *     "entries" -> {
+ *         "<dataset>" -> {
+ *             "stats" -> dmu_objset_stats_t, as a byte array
+ *             "props" -> property nvlist, unless "simple" was given
+ *         }
+ *         ...
+ *     }
+ *     "cursor" -> uint64, for the next call; absent once the last
+ *         dataset has been returned
+ * }
+ *
+ * Return what a series of ZFS_IOC_DATASET_LIST_NEXT or
+ * ZFS_IOC_SNAPSHOT_LIST_NEXT calls would, for many datasets at once.
+ * Entries are in listing order.  "maxbytes" defaults to
+ * ZFS_LIST_BATCH_BYTES, and is capped at ZFS_LIST_BATCH_BYTES_MAX.
+ *
+ * Holding the parent holds the pool config lock, which blocks txg sync
+ * from starting any sync task, so the parent is released and held again
+ * after every ZFS_LIST_BATCH_PER_HOLD datasets.  The cursor makes that
+ * safe: a listing resumed from it is what a new call would return.
+ */
+static const zfs_ioc_key_t zfs_keys_list_batch[] = {
+	{ZFS_LIST_BATCH_SNAPSHOTS,	DATA_TYPE_BOOLEAN,	ZK_OPTIONAL},
+	{ZFS_LIST_BATCH_CURSOR,		DATA_TYPE_UINT64,	ZK_OPTIONAL},
+	{ZFS_LIST_BATCH_COUNT,		DATA_TYPE_UINT64,	ZK_OPTIONAL},
+	{ZFS_LIST_BATCH_MAXBYTES,	DATA_TYPE_UINT64,	ZK_OPTIONAL},
+	{ZFS_LIST_BATCH_SIMPLE,		DATA_TYPE_BOOLEAN,	ZK_OPTIONAL},
+	{ZFS_LIST_BATCH_PROPS,		DATA_TYPE_UINT8_ARRAY,	ZK_OPTIONAL},
+	{SNAP_ITER_MIN_TXG,		DATA_TYPE_UINT64,	ZK_OPTIONAL},
+	{SNAP_ITER_MAX_TXG,		DATA_TYPE_UINT64,	ZK_OPTIONAL},
+};
+
+#define	ZFS_LIST_BATCH_BYTES_MAX	(16 << 20)
+#define	ZFS_LIST_BATCH_PER_HOLD		32
+
+static int
+zfs_ioc_list_batch(const char *fsname, nvlist_t *innvl, nvlist_t *outnvl)
+{
+	boolean_t snapshots = nvlist_exists(innvl, ZFS_LIST_BATCH_SNAPSHOTS);
+	boolean_t simple = nvlist_exists(innvl, ZFS_LIST_BATCH_SIMPLE);
+	uint64_t cursor = 0, count = ZFS_LIST_BATCH_MAX;
+	uint64_t maxbytes = ZFS_LIST_BATCH_BYTES, size = 0, n = 0;
+	uint64_t min_txg = 0, max_txg = 0;
+	uint8_t *props = NULL;
+	uint_t nprops = 0;
+	objset_t *os;
+	dsl_pool_t *dp;
+	int error;
+
+	(void) nvlist_lookup_uint64(innvl, ZFS_LIST_BATCH_CURSOR, &cursor);
+	(void) nvlist_lookup_uint64(innvl, ZFS_LIST_BATCH_COUNT, &count);
+	(void) nvlist_lookup_uint64(innvl, ZFS_LIST_BATCH_MAXBYTES, &maxbytes);
+	(void) nvlist_lookup_uint8_array(innvl, ZFS_LIST_BATCH_PROPS, &props,
+	    &nprops);
+	(void) nvlist_lookup_uint64(innvl, SNAP_ITER_MIN_TXG, &min_txg);
+	(void) nvlist_lookup_uint64(innvl, SNAP_ITER_MAX_TXG, &max_txg);
+	count = MIN(MAX(count, 1), ZFS_LIST_BATCH_MAX);
+	maxbytes = MIN(maxbytes, ZFS_LIST_BATCH_BYTES_MAX);
+
+	if (strchr(fsname, '@') != NULL)
+		return (SET_ERROR(EINVAL));
+
+	if ((error = dmu_objset_hold(fsname, FTAG, &os)) != 0)
+		return (error == ENOENT ? SET_ERROR(ESRCH) : error);
+	dp = dmu_objset_pool(os);
+
+	char *name = kmem_alloc(ZFS_MAX_DATASET_NAME_LEN, KM_SLEEP);
+	size_t prefix = snprintf(name, ZFS_MAX_DATASET_NAME_LEN, "%s%c",
+	    fsname, snapshots ? '@' : '/');
+	nvlist_t *entries = fnvlist_alloc();
+
+	/*
+	 * A dataset name of maximum length cannot have any children or
+	 * snapshots.
+	 */
+	if (prefix >= ZFS_MAX_DATASET_NAME_LEN)
+		error = SET_ERROR(ESRCH);
+
+	for (uint_t held = 0; error == 0 && n < count; held++) {
+		uint64_t next = cursor, obj = 0;
+		dsl_dataset_t *ds;
+		nvlist_t *entry;
+
+		if (issig()) {
+			error = SET_ERROR(EINTR);
+			break;
+		}
+
+		if (held == ZFS_LIST_BATCH_PER_HOLD) {
+			dmu_objset_rele(os, FTAG);
+			if ((error = dmu_objset_hold(fsname, FTAG, &os)) != 0) {
+				os = NULL;
+				break;
+			}
+			dp = dmu_objset_pool(os);
+			held = 0;
+		}
+
+		name[prefix] = '\0';
+		if (snapshots) {
+			error = dmu_snapshot_list_next(os,
+			    ZFS_MAX_DATASET_NAME_LEN - prefix, name + prefix,
+			    &obj, &next, NULL);
+		} else {
+			error = dmu_dir_list_next(os,
+			    ZFS_MAX_DATASET_NAME_LEN - prefix, name + prefix,
+			    NULL, &next);
+		}
+		if (error == ENOENT) {
+			error = SET_ERROR(ESRCH);
+			break;
+		} else if (error != 0) {
+			break;
+		}
+
+		if (snapshots) {
+			error = dsl_dataset_hold_obj(dp, obj, FTAG, &ds);
+		} else if (zfs_dataset_name_hidden(name)) {
+			cursor = next;
+			continue;
+		} else {
+			error = dsl_dataset_hold(dp, name, FTAG, &ds);
+			if (error == ENOENT) {
+				/* We lost a race with destroy, skip it. */
+				cursor = next;
+				error = 0;
+				continue;
+			}
+		}
+		if (error != 0)
+			break;
+
+		if (snapshots &&
+		    ((min_txg != 0 && dsl_get_creationtxg(ds) < min_txg) ||
+		    (max_txg != 0 && dsl_get_creationtxg(ds) > max_txg))) {
+			dsl_dataset_rele(ds, FTAG);
+			cursor = next;
+			continue;
+		}
+
+		error = zfs_list_batch_one(ds, simple, props, nprops, &entry);
+		dsl_dataset_rele(ds, FTAG);
+		if (error != 0)
+			break;
+
+		/*
+		 * Always return at least one dataset, so that the caller
+		 * makes progress and grows its buffer if it needs to.
+		 */
+		uint64_t esize = fnvlist_size(entry) + strlen(name) + 64;
+		if (n > 0 && size + esize > maxbytes) {
+			nvlist_free(entry);
+			break;
+		}
+		fnvlist_add_nvlist(entries, name, entry);
+		nvlist_free(entry);
+		size += esize;
+		n++;
+		cursor = next;
+	}
+	if (os != NULL)
+		dmu_objset_rele(os, FTAG);
+	kmem_free(name, ZFS_MAX_DATASET_NAME_LEN);
+
+	/*
+	 * An error after some datasets were listed is returned by the next
+	 * call, which starts from the dataset that failed.
+	 */
+	if (error != 0 && error != ESRCH && n == 0) {
+		nvlist_free(entries);
+		return (error);
+	}
+	fnvlist_add_nvlist(outnvl, ZFS_LIST_BATCH_ENTRIES, entries);
+	nvlist_free(entries);
+	if (error != ESRCH)
+		fnvlist_add_uint64(outnvl, ZFS_LIST_BATCH_CURSOR, cursor);
+
+	return (0);
+}
+
 static int
 zfs_prop_set_userquota(const char *dsname, nvpair_t *pair)
 {
@@ -5023,6 +5341,23 @@ zfs_check_settable(const char *dsname, nvpair_t *pair, cred_t *cr)
 		}
 		break;
 
+	case ZFS_PROP_CHANGE_LOG:
+		/* A change log can only be kept with the feature enabled */
+		if (nvpair_value_uint64(pair, &intval) == 0 && intval != 0) {
+			spa_t *spa;
+
+			if ((err = spa_open(dsname, &spa, FTAG)) != 0)
+				return (err);
+
+			if (!spa_feature_is_enabled(spa,
+			    SPA_FEATURE_CHANGE_LOG)) {
+				spa_close(spa, FTAG);
+				return (SET_ERROR(ENOTSUP));
+			}
+			spa_close(spa, FTAG);
+		}
+		break;
+
 	case ZFS_PROP_SHARESMB:
 		if (zpl_earlier_version(dsname, ZPL_VERSION_FUID))
 			return (SET_ERROR(ENOTSUP));
@@ -5917,6 +6252,9 @@ zfs_ioc_send(zfs_cmd_t *zc)
 	boolean_t compressok = (zc->zc_flags & 0x4);
 	boolean_t rawok = (zc->zc_flags & 0x8);
 	boolean_t savedok = (zc->zc_flags & 0x10);
+	enum zio_compress stream_compress = (zc->zc_flags & 0x40) ?
+	    ZIO_COMPRESS_ZSTD : (zc->zc_flags & 0x20) ?
+	    ZIO_COMPRESS_LZ4 : ZIO_COMPRESS_OFF;
 
 	if (zc->zc_obj != 0) {
 		dsl_pool_t *dp;
@@ -5966,7 +6304,8 @@ zfs_ioc_send(zfs_cmd_t *zc)
 		}
 
 		error = dmu_send_estimate_fast(tosnap, fromsnap, NULL,
-		    compressok || rawok, savedok, &zc->zc_objset_type);
+		    compressok || rawok || stream_compress != ZIO_COMPRESS_OFF,
+		    savedok, &zc->zc_objset_type);
 
 		if (fromsnap != NULL)
 			dsl_dataset_rele(fromsnap, FTAG);
@@ -5982,7 +6321,7 @@ zfs_ioc_send(zfs_cmd_t *zc)
 		off = zfs_file_off(dba.dba_fp);
 		error = dmu_send_obj(zc->zc_name, zc->zc_sendobj,
 		    zc->zc_fromobj, embedok, large_block_ok, compressok,
-		    rawok, savedok, zc->zc_cookie, &off, &out);
+		    rawok, savedok, stream_compress, zc->zc_cookie, &off, &out);
 
 		dump_bytes_fini(&dba);
 	}
@@ -6887,6 +7226,27 @@ zfs_ioc_space_snaps(const char *lastsnap, nvlist_t *innvl, nvlist_t *outnvl)
 	return (error);
 }
 
+/*
+ * Look up the algorithm requested by the optional "streamcompress" key of a
+ * send or send space ioctl.
+ */
+static int
+zfs_send_stream_compress(nvlist_t *innvl, enum zio_compress *compressp)
+{
+	const char *name;
+
+	*compressp = ZIO_COMPRESS_OFF;
+	if (nvlist_lookup_string(innvl, "streamcompress", &name) != 0)
+		return (0);
+	if (strcmp(name, "lz4") == 0)
+		*compressp = ZIO_COMPRESS_LZ4;
+	else if (strcmp(name, "zstd") == 0)
+		*compressp = ZIO_COMPRESS_ZSTD;
+	else
+		return (SET_ERROR(EINVAL));
+	return (0);
+}
+
 /*
  * innvl: {
  *     "fd" -> file descriptor to write stream to (int32)
@@ -6899,6 +7259,9 @@ zfs_ioc_space_snaps(const char *lastsnap, nvlist_t *innvl, nvlist_t *outnvl)
  *         presence indicates compressed DRR_WRITE records are permitted
  *     (optional) "rawok" -> (value ignored)
  *         presence indicates raw encrypted records should be used.
+ *     (optional) "streamcompress" -> (string)
+ *         if present ("lz4" or "zstd"), uncompressed DRR_WRITE payloads are
+ *         compressed with this algorithm for transport
  *     (optional) "savedok" -> (value ignored)
  *         presence indicates we should send a partially received snapshot
  *     (optional) "resume_object" and "resume_offset" -> (uint64)
@@ -6918,6 +7281,7 @@ static const zfs_ioc_key_t zfs_keys_send_new[] = {
 	{"compressok",		DATA_TYPE_BOOLEAN,	ZK_OPTIONAL},
 	{"rawok",		DATA_TYPE_BOOLEAN,	ZK_OPTIONAL},
 	{"savedok",		DATA_TYPE_BOOLEAN,	ZK_OPTIONAL},
+	{"streamcompress",	DATA_TYPE_STRING,	ZK_OPTIONAL},
 	{"resume_object",	DATA_TYPE_UINT64,	ZK_OPTIONAL},
 	{"resume_offset",	DATA_TYPE_UINT64,	ZK_OPTIONAL},
 	{"redactbook",		DATA_TYPE_STRING,	ZK_OPTIONAL},
@@ -6936,6 +7300,7 @@ zfs_ioc_send_new(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
 	boolean_t compressok;
 	boolean_t rawok;
 	boolean_t savedok;
+	enum zio_compress stream_compress;
 	uint64_t resumeobj = 0;
 	uint64_t resumeoff = 0;
 	const char *redactbook = NULL;
@@ -6949,6 +7314,9 @@ zfs_ioc_send_new(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
 	compressok = nvlist_exists(innvl, "compressok");
 	rawok = nvlist_exists(innvl, "rawok");
 	savedok = nvlist_exists(innvl, "savedok");
+	error = zfs_send_stream_compress(innvl, &stream_compress);
+	if (error != 0)
+		return (error);
 
 	(void) nvlist_lookup_uint64(innvl, "resume_object", &resumeobj);
 	(void) nvlist_lookup_uint64(innvl, "resume_offset", &resumeoff);
@@ -6963,7 +7331,7 @@ zfs_ioc_send_new(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
 
 	off = zfs_file_off(dba.dba_fp);
 	error = dmu_send(snapname, fromname, embedok, largeblockok,
-	    compressok, rawok, savedok, resumeobj, resumeoff,
+	    compressok, rawok, savedok, stream_compress, resumeobj, resumeoff,
 	    redactbook, fd, &off, &out);
 
 	dump_bytes_fini(&dba);
@@ -6996,6 +7364,9 @@ send_space_sum(objset_t *os, void *buf, int len, void *arg)
  *         presence indicates compressed DRR_WRITE records are permitted
  *     (optional) "rawok" -> (value ignored)
  *         presence indicates raw encrypted records should be used.
+ *     (optional) "streamcompress" -> (string)
+ *         if present ("lz4" or "zstd"), uncompressed DRR_WRITE payloads are
+ *         compressed with this algorithm for transport
  *     (optional) "resume_object" and "resume_offset" -> (uint64)
  *         if present, resume send stream from specified object and offset.
  *     (optional) "fd" -> file descriptor to use as a cookie for progress
@@ -7013,6 +7384,7 @@ static const zfs_ioc_key_t zfs_keys_send_space[] = {
 	{"embedok",		DATA_TYPE_BOOLEAN,	ZK_OPTIONAL},
 	{"compressok",		DATA_TYPE_BOOLEAN,	ZK_OPTIONAL},
 	{"rawok",		DATA_TYPE_BOOLEAN,	ZK_OPTIONAL},
+	{"streamcompress",	DATA_TYPE_STRING,	ZK_OPTIONAL},
 	{"fd",			DATA_TYPE_INT32,	ZK_OPTIONAL},
 	{"redactbook",		DATA_TYPE_STRING,	ZK_OPTIONAL},
 	{"resume_object",	DATA_TYPE_UINT64,	ZK_OPTIONAL},
@@ -7034,6 +7406,7 @@ zfs_ioc_send_space(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
 	boolean_t compressok;
 	boolean_t rawok;
 	boolean_t savedok;
+	enum zio_compress stream_compress;
 	uint64_t space = 0;
 	boolean_t full_estimate = B_FALSE;
 	uint64_t resumeobj = 0;
@@ -7042,6 +7415,10 @@ zfs_ioc_send_space(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
 	int32_t fd = -1;
 	zfs_bookmark_phys_t zbm = {0};
 
+	error = zfs_send_stream_compress(innvl, &stream_compress);
+	if (error != 0)
+		return (error);
+
 	error = dsl_pool_hold(snapname, FTAG, &dp);
 	if (error != 0)
 		return (error);
@@ -7132,12 +7509,17 @@ zfs_ioc_send_space(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
 		dsl_dataset_rele(tosnap, FTAG);
 		dsl_pool_rele(dp, FTAG);
 		error = dmu_send(snapname, fromname, embedok, largeblockok,
-		    compressok, rawok, savedok, resumeobj, resumeoff,
-		    redactlist_book, fd, &off, &out);
+		    compressok, rawok, savedok, stream_compress, resumeobj,
+		    resumeoff, redactlist_book, fd, &off, &out);
 	} else {
+		/*
+		 * Blocks compressed for transport are counted at their size on
+		 * disk, like compressed WRITE records.
+		 */
 		error = dmu_send_estimate_fast(tosnap, fromsnap,
 		    (from && strchr(fromname, '#') != NULL ? &zbm : NULL),
-		    compressok || rawok, savedok, &space);
+		    compressok || rawok || stream_compress != ZIO_COMPRESS_OFF,
+		    savedok, &space);
 		space -= resume_bytes;
 		if (fromsnap != NULL)
 			dsl_dataset_rele(fromsnap, FTAG);
@@ -7632,6 +8014,17 @@ zfs_ioctl_init(void)
 	    POOL_CHECK_SUSPENDED | POOL_CHECK_READONLY, B_TRUE, B_TRUE,
 	    zfs_keys_ddt_prune, ARRAY_SIZE(zfs_keys_ddt_prune));
 
+	zfs_ioctl_register("obj_to_stats_batch", ZFS_IOC_OBJ_TO_STATS_BATCH,
+	    zfs_ioc_obj_to_stats_batch, zfs_secpolicy_diff, DATASET_NAME,
+	    POOL_CHECK_SUSPENDED, B_FALSE, B_FALSE,
+	    zfs_keys_obj_to_stats_batch,
+	    ARRAY_SIZE(zfs_keys_obj_to_stats_batch));
+
+	zfs_ioctl_register("list_batch", ZFS_IOC_LIST_BATCH,
+	    zfs_ioc_list_batch, zfs_secpolicy_read, DATASET_NAME,
+	    POOL_CHECK_SUSPENDED, B_FALSE, B_FALSE,
+	    zfs_keys_list_batch, ARRAY_SIZE(zfs_keys_list_batch));
+
 	/* IOCTLS that use the legacy function signature */
 
 	zfs_ioctl_register_legacy(ZFS_IOC_POOL_FREEZE, zfs_ioc_pool_freeze,
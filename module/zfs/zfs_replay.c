@@ -848,10 +848,12 @@ zfs_replay_write(void *arg1, void *arg2, boolean_t byteswap)
 	 * write needs to be there. So we write the whole block and
 	 * reduce the eof. This needs to be done within the single dmu
 	 * transaction created within vn_rdwr -> zfs_write. So a possible
-	 * new end of file is passed through in zfsvfs->z_replay_eof
+	 * new end of file is passed through in zp->z_replay_eof.  It is
+	 * kept per znode, since writes to different files may be replayed
+	 * concurrently (see zil_replay_threads).
 	 */
 
-	zfsvfs->z_replay_eof = 0; /* 0 means don't change end of file */
+	zp->z_replay_eof = 0; /* 0 means don't change end of file */
 
 	/* If it's a dmu_sync() block, write the whole block */
 	if (lr->lr_common.lrc_reclen == sizeof (lr_write_t)) {
@@ -861,11 +863,11 @@ zfs_replay_write(void *arg1, void *arg2, boolean_t byteswap)
 			length = blocksize;
 		}
 		if (zp->z_size < eod)
-			zfsvfs->z_replay_eof = eod;
+			zp->z_replay_eof = eod;
 	}
 	error = zfs_write_simple(zp, data, length, offset, NULL);
+	zp->z_replay_eof = 0;	/* safety */
 	zrele(zp);
-	zfsvfs->z_replay_eof = 0;	/* safety */
 
 	return (error);
 }
@@ -78,6 +78,12 @@ int zfs_bclone_enabled = 1;
  */
 int zfs_bclone_wait_dirty = 1;
 
+/*
+ * Maximum number of ranges cloned under a single transaction by
+ * zfs_clone_range_batch().
+ */
+static uint_t zfs_bclone_batch_max = 64;
+
 /*
  * Enable Direct I/O. If this setting is 0, then all I/O requests will be
  * directed through the ARC acting as though the dataset property direct was
@@ -1015,11 +1021,11 @@ zfs_write(znode_t *zp, zfs_uio_t *uio, int ioflag, cred_t *cr)
 		}
 		/*
 		 * If we are replaying and eof is non zero then force
-		 * the file size to the specified eof. Note, there's no
-		 * concurrency during replay.
+		 * the file size to the specified eof. Note, writes to
+		 * the same file are never replayed concurrently.
 		 */
-		if (zfsvfs->z_replay && zfsvfs->z_replay_eof != 0)
-			zp->z_size = zfsvfs->z_replay_eof;
+		if (zfsvfs->z_replay && zp->z_replay_eof != 0)
+			zp->z_size = zp->z_replay_eof;
 
 		error1 = sa_bulk_update(zp->z_sa_hdl, bulk, count, tx);
 		if (error1 != 0)
@@ -1547,77 +1553,27 @@ zfs_exit_two(zfsvfs_t *zfsvfs1, zfsvfs_t *zfsvfs2, const char *tag)
 }
 
 /*
- * We split each clone request in chunks that can fit into a single ZIL
- * log entry. Each ZIL log entry can fit 130816 bytes for a block cloning
- * operation (see zil_max_log_data() and zfs_log_clone_range()). This gives
- * us room for storing 1022 block pointers.
- *
- * On success, the function return the number of bytes copied in *lenp.
- * Note, it doesn't return how much bytes are left to be copied.
- * On errors which are caused by any file system limitations or
- * brt limitations `EINVAL` is returned. In the most cases a user
- * requested bad parameters, it could be possible to clone the file but
- * some parameters don't match the requirements.
+ * Dataset level checks for cloning from inzfsvfs to outzfsvfs.
  */
-int
-zfs_clone_range(znode_t *inzp, uint64_t *inoffp, znode_t *outzp,
-    uint64_t *outoffp, uint64_t *lenp, cred_t *cr)
+static int
+zfs_clone_range_check_os(zfsvfs_t *inzfsvfs, zfsvfs_t *outzfsvfs)
 {
-	zfsvfs_t	*inzfsvfs, *outzfsvfs;
-	objset_t	*inos, *outos;
-	zfs_locked_range_t *inlr, *outlr;
-	dmu_buf_impl_t	*db;
-	dmu_tx_t	*tx;
-	zilog_t		*zilog;
-	uint64_t	inoff, outoff, len, done;
-	uint64_t	outsize, size;
-	int		error;
-	int		count = 0;
-	sa_bulk_attr_t	bulk[3];
-	uint64_t	mtime[2], ctime[2];
-	uint64_t	uid, gid, projid;
-	blkptr_t	*bps;
-	size_t		maxblocks, nbps;
-	uint_t		inblksz;
-	uint64_t	clear_setid_bits_txg = 0;
-	uint64_t	last_synced_txg = 0;
-
-	inoff = *inoffp;
-	outoff = *outoffp;
-	len = *lenp;
-	done = 0;
-
-	inzfsvfs = ZTOZSB(inzp);
-	outzfsvfs = ZTOZSB(outzp);
-
-	/*
-	 * We need to call zfs_enter() potentially on two different datasets,
-	 * so we need a dedicated function for that.
-	 */
-	error = zfs_enter_two(inzfsvfs, outzfsvfs, FTAG);
-	if (error != 0)
-		return (error);
-
-	inos = inzfsvfs->z_os;
-	outos = outzfsvfs->z_os;
+	objset_t *inos = inzfsvfs->z_os;
+	objset_t *outos = outzfsvfs->z_os;
 
 	/*
 	 * Both source and destination have to belong to the same storage pool.
 	 */
-	if (dmu_objset_spa(inos) != dmu_objset_spa(outos)) {
-		zfs_exit_two(inzfsvfs, outzfsvfs, FTAG);
+	if (dmu_objset_spa(inos) != dmu_objset_spa(outos))
 		return (SET_ERROR(EXDEV));
-	}
 
 	/*
 	 * outos and inos belongs to the same storage pool.
 	 * see a few lines above, only one check.
 	 */
 	if (!spa_feature_is_enabled(dmu_objset_spa(outos),
-	    SPA_FEATURE_BLOCK_CLONING)) {
-		zfs_exit_two(inzfsvfs, outzfsvfs, FTAG);
+	    SPA_FEATURE_BLOCK_CLONING))
 		return (SET_ERROR(EOPNOTSUPP));
-	}
 
 	ASSERT(!outzfsvfs->z_replay);
 
@@ -1625,101 +1581,90 @@ zfs_clone_range(znode_t *inzp, uint64_t *inoffp, znode_t *outzp,
 	 * Block cloning from an unencrypted dataset into an encrypted
 	 * dataset and vice versa is not supported.
 	 */
-	if (inos->os_encrypted != outos->os_encrypted) {
-		zfs_exit_two(inzfsvfs, outzfsvfs, FTAG);
+	if (inos->os_encrypted != outos->os_encrypted)
 		return (SET_ERROR(EXDEV));
-	}
 
 	/*
 	 * Cloning across encrypted datasets is possible only if they
 	 * share the same master key.
 	 */
 	if (inos != outos && inos->os_encrypted &&
-	    !dmu_objset_crypto_key_equal(inos, outos)) {
-		zfs_exit_two(inzfsvfs, outzfsvfs, FTAG);
+	    !dmu_objset_crypto_key_equal(inos, outos))
 		return (SET_ERROR(EXDEV));
-	}
+
+	return (0);
+}
+
+/*
+ * File level checks for cloning, done before the range locks are taken.
+ * Clamps *lenp to the end of the source file; if that leaves nothing to
+ * clone, *lenp is set to zero and zero is returned.
+ */
+static int
+zfs_clone_range_check_zp(znode_t *inzp, uint64_t inoff, znode_t *outzp,
+    uint64_t outoff, uint64_t *lenp)
+{
+	uint64_t len = *lenp;
+	int error;
 
 	error = zfs_verify_zp(inzp);
 	if (error == 0)
 		error = zfs_verify_zp(outzp);
-	if (error != 0) {
-		zfs_exit_two(inzfsvfs, outzfsvfs, FTAG);
+	if (error != 0)
 		return (error);
-	}
 
 	/*
 	 * We don't copy source file's flags that's why we don't allow to clone
 	 * files that are in quarantine.
 	 */
-	if (inzp->z_pflags & ZFS_AV_QUARANTINED) {
-		zfs_exit_two(inzfsvfs, outzfsvfs, FTAG);
+	if (inzp->z_pflags & ZFS_AV_QUARANTINED)
 		return (SET_ERROR(EACCES));
-	}
 
 	if (inoff >= inzp->z_size) {
 		*lenp = 0;
-		zfs_exit_two(inzfsvfs, outzfsvfs, FTAG);
 		return (0);
 	}
 	if (len > inzp->z_size - inoff) {
 		len = inzp->z_size - inoff;
 	}
-	if (len == 0) {
-		*lenp = 0;
-		zfs_exit_two(inzfsvfs, outzfsvfs, FTAG);
+	*lenp = len;
+	if (len == 0)
 		return (0);
-	}
 
 	/*
 	 * Callers might not be able to detect properly that we are read-only,
 	 * so check it explicitly here.
 	 */
-	if (zfs_is_readonly(outzfsvfs)) {
-		zfs_exit_two(inzfsvfs, outzfsvfs, FTAG);
+	if (zfs_is_readonly(ZTOZSB(outzp)))
 		return (SET_ERROR(EROFS));
-	}
 
 	/*
 	 * If immutable or not appending then return EPERM.
 	 * Intentionally allow ZFS_READONLY through here.
 	 * See zfs_zaccess_common()
 	 */
-	if ((outzp->z_pflags & ZFS_IMMUTABLE) != 0) {
-		zfs_exit_two(inzfsvfs, outzfsvfs, FTAG);
+	if ((outzp->z_pflags & ZFS_IMMUTABLE) != 0)
 		return (SET_ERROR(EPERM));
-	}
 
 	/*
 	 * No overlapping if we are cloning within the same file.
 	 */
 	if (inzp == outzp) {
-		if (inoff < outoff + len && outoff < inoff + len) {
-			zfs_exit_two(inzfsvfs, outzfsvfs, FTAG);
+		if (inoff < outoff + len && outoff < inoff + len)
 			return (SET_ERROR(EINVAL));
-		}
 	}
 
-	/* Flush any mmap()'d data to disk */
-	if (zn_has_cached_data(inzp, inoff, inoff + len - 1))
-		zn_flush_cached_data(inzp, B_TRUE);
-
-	/*
-	 * Maintain predictable lock order.
-	 */
-	if (inzp < outzp || (inzp == outzp && inoff < outoff)) {
-		inlr = zfs_rangelock_enter(&inzp->z_rangelock, inoff, len,
-		    RL_READER);
-		outlr = zfs_rangelock_enter(&outzp->z_rangelock, outoff, len,
-		    RL_WRITER);
-	} else {
-		outlr = zfs_rangelock_enter(&outzp->z_rangelock, outoff, len,
-		    RL_WRITER);
-		inlr = zfs_rangelock_enter(&inzp->z_rangelock, inoff, len,
-		    RL_READER);
-	}
+	return (0);
+}
 
-	inblksz = inzp->z_blksz;
+/*
+ * Checks for cloning that need the range locks held.
+ */
+static int
+zfs_clone_range_check_locked(znode_t *inzp, uint64_t inoff, znode_t *outzp,
+    uint64_t outoff, uint64_t len, zfs_locked_range_t *outlr)
+{
+	uint_t inblksz = inzp->z_blksz;
 
 	/*
 	 * We cannot clone into a file with different block size if we can't
@@ -1728,40 +1673,30 @@ zfs_clone_range(znode_t *inzp, uint64_t *inoffp, znode_t *outzp,
 	 * grow to fail, but we cover what we can before opening transaction
 	 * and the rest detect after we try to do it.
 	 */
-	if (inblksz < outzp->z_blksz) {
-		error = SET_ERROR(EINVAL);
-		goto unlock;
-	}
+	if (inblksz < outzp->z_blksz)
+		return (SET_ERROR(EINVAL));
 	if (inblksz != outzp->z_blksz && (outzp->z_size > outzp->z_blksz ||
-	    outlr->lr_length != UINT64_MAX)) {
-		error = SET_ERROR(EINVAL);
-		goto unlock;
-	}
+	    outlr->lr_length != UINT64_MAX))
+		return (SET_ERROR(EINVAL));
 
 	/*
 	 * Block size must be power-of-2 if destination offset != 0.
 	 * There can be no multiple blocks of non-power-of-2 size.
 	 */
-	if (outoff != 0 && !ISP2(inblksz)) {
-		error = SET_ERROR(EINVAL);
-		goto unlock;
-	}
+	if (outoff != 0 && !ISP2(inblksz))
+		return (SET_ERROR(EINVAL));
 
 	/*
 	 * Offsets and len must be at block boundries.
 	 */
-	if ((inoff % inblksz) != 0 || (outoff % inblksz) != 0) {
-		error = SET_ERROR(EINVAL);
-		goto unlock;
-	}
+	if ((inoff % inblksz) != 0 || (outoff % inblksz) != 0)
+		return (SET_ERROR(EINVAL));
 	/*
 	 * Length must be multipe of blksz, except for the end of the file.
 	 */
 	if ((len % inblksz) != 0 &&
-	    (len < inzp->z_size - inoff || len < outzp->z_size - outoff)) {
-		error = SET_ERROR(EINVAL);
-		goto unlock;
-	}
+	    (len < inzp->z_size - inoff || len < outzp->z_size - outoff))
+		return (SET_ERROR(EINVAL));
 
 	/*
 	 * If we are copying only one block and it is smaller than recordsize
@@ -1770,21 +1705,111 @@ zfs_clone_range(znode_t *inzp, uint64_t *inoffp, znode_t *outzp,
 	 * that block size forever, that can be as small as 512 bytes, no
 	 * matter how big the destination grow later.
 	 */
-	if (len <= inblksz && inblksz < outzfsvfs->z_max_blksz &&
-	    outzp->z_size <= inblksz && outoff + len > inblksz) {
-		error = SET_ERROR(EINVAL);
-		goto unlock;
+	if (len <= inblksz && inblksz < ZTOZSB(outzp)->z_max_blksz &&
+	    outzp->z_size <= inblksz && outoff + len > inblksz)
+		return (SET_ERROR(EINVAL));
+
+	int error = zn_rlimit_fsize(outoff + len);
+	if (error != 0)
+		return (error);
+
+	if (inoff >= MAXOFFSET_T || outoff >= MAXOFFSET_T)
+		return (SET_ERROR(EFBIG));
+
+	return (0);
+}
+
+/*
+ * We split each clone request in chunks that can fit into a single ZIL
+ * log entry. Each ZIL log entry can fit 130816 bytes for a block cloning
+ * operation (see zil_max_log_data() and zfs_log_clone_range()). This gives
+ * us room for storing 1022 block pointers.
+ *
+ * On success, the function return the number of bytes copied in *lenp.
+ * Note, it doesn't return how much bytes are left to be copied.
+ * On errors which are caused by any file system limitations or
+ * brt limitations `EINVAL` is returned. In the most cases a user
+ * requested bad parameters, it could be possible to clone the file but
+ * some parameters don't match the requirements.
+ */
+int
+zfs_clone_range(znode_t *inzp, uint64_t *inoffp, znode_t *outzp,
+    uint64_t *outoffp, uint64_t *lenp, cred_t *cr)
+{
+	zfsvfs_t	*inzfsvfs, *outzfsvfs;
+	objset_t	*inos, *outos;
+	zfs_locked_range_t *inlr, *outlr;
+	dmu_buf_impl_t	*db;
+	dmu_tx_t	*tx;
+	zilog_t		*zilog;
+	uint64_t	inoff, outoff, len, done;
+	uint64_t	outsize, size;
+	int		error;
+	int		count = 0;
+	sa_bulk_attr_t	bulk[3];
+	uint64_t	mtime[2], ctime[2];
+	uint64_t	uid, gid, projid;
+	blkptr_t	*bps;
+	size_t		maxblocks, nbps;
+	uint_t		inblksz;
+	uint64_t	clear_setid_bits_txg = 0;
+	uint64_t	last_synced_txg = 0;
+
+	inoff = *inoffp;
+	outoff = *outoffp;
+	len = *lenp;
+	done = 0;
+
+	inzfsvfs = ZTOZSB(inzp);
+	outzfsvfs = ZTOZSB(outzp);
+
+	/*
+	 * We need to call zfs_enter() potentially on two different datasets,
+	 * so we need a dedicated function for that.
+	 */
+	error = zfs_enter_two(inzfsvfs, outzfsvfs, FTAG);
+	if (error != 0)
+		return (error);
+
+	inos = inzfsvfs->z_os;
+	outos = outzfsvfs->z_os;
+
+	error = zfs_clone_range_check_os(inzfsvfs, outzfsvfs);
+	if (error == 0)
+		error = zfs_clone_range_check_zp(inzp, inoff, outzp, outoff,
+		    &len);
+	if (error != 0 || len == 0) {
+		if (error == 0)
+			*lenp = 0;
+		zfs_exit_two(inzfsvfs, outzfsvfs, FTAG);
+		return (error);
 	}
 
-	error = zn_rlimit_fsize(outoff + len);
-	if (error != 0) {
-		goto unlock;
+	/* Flush any mmap()'d data to disk */
+	if (zn_has_cached_data(inzp, inoff, inoff + len - 1))
+		zn_flush_cached_data(inzp, B_TRUE);
+
+	/*
+	 * Maintain predictable lock order.
+	 */
+	if (inzp < outzp || (inzp == outzp && inoff < outoff)) {
+		inlr = zfs_rangelock_enter(&inzp->z_rangelock, inoff, len,
+		    RL_READER);
+		outlr = zfs_rangelock_enter(&outzp->z_rangelock, outoff, len,
+		    RL_WRITER);
+	} else {
+		outlr = zfs_rangelock_enter(&outzp->z_rangelock, outoff, len,
+		    RL_WRITER);
+		inlr = zfs_rangelock_enter(&inzp->z_rangelock, inoff, len,
+		    RL_READER);
 	}
 
-	if (inoff >= MAXOFFSET_T || outoff >= MAXOFFSET_T) {
-		error = SET_ERROR(EFBIG);
+	inblksz = inzp->z_blksz;
+
+	error = zfs_clone_range_check_locked(inzp, inoff, outzp, outoff, len,
+	    outlr);
+	if (error != 0)
 		goto unlock;
-	}
 
 	SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_MTIME(outzfsvfs), NULL,
 	    &mtime, 16);
@@ -1976,6 +2001,431 @@ unlock:
 	return (error);
 }
 
+/*
+ * Per-entry state while a group of ranges is cloned by
+ * zfs_clone_range_group().
+ */
+typedef enum {
+	ZCG_DONE,	/* finished, zcr_error and zcr_len are final */
+	ZCG_LOCKED,	/* range locks taken */
+	ZCG_READY,	/* block pointers read, ready to clone */
+	ZCG_FALLBACK,	/* to be cloned by zfs_clone_range() */
+} zfs_clone_group_state_t;
+
+typedef struct zfs_clone_group_ent {
+	zfs_clone_range_t	*zcg_zcr;
+	zfs_clone_group_state_t	zcg_state;
+	zfs_locked_range_t	*zcg_inlr;
+	zfs_locked_range_t	*zcg_outlr;
+	blkptr_t		*zcg_bps;
+	size_t			zcg_nbps;
+	uint_t			zcg_blksz;
+} zfs_clone_group_ent_t;
+
+typedef struct zfs_clone_group_lock {
+	znode_t			*zgl_zp;
+	uint64_t		zgl_off;
+	uint64_t		zgl_len;
+	zfs_rangelock_type_t	zgl_type;
+	zfs_locked_range_t	**zgl_lrp;
+} zfs_clone_group_lock_t;
+
+static void
+zfs_clone_group_lock_init(zfs_clone_group_lock_t *zgl, znode_t *zp,
+    uint64_t off, uint64_t len, zfs_rangelock_type_t type,
+    zfs_locked_range_t **lrp)
+{
+	zgl->zgl_zp = zp;
+	zgl->zgl_off = off;
+	zgl->zgl_len = len;
+	zgl->zgl_type = type;
+	zgl->zgl_lrp = lrp;
+}
+
+static void
+zfs_clone_range_one(zfs_clone_range_t *zcr, cred_t *cr)
+{
+	uint64_t inoff = zcr->zcr_inoff;
+	uint64_t outoff = zcr->zcr_outoff;
+
+	zcr->zcr_error = zfs_clone_range(zcr->zcr_inzp, &inoff,
+	    zcr->zcr_outzp, &outoff, &zcr->zcr_len, cr);
+	if (zcr->zcr_error != 0 && inoff == zcr->zcr_inoff)
+		zcr->zcr_len = 0;
+}
+
+static void
+zfs_clone_group_ent_done(zfs_clone_group_ent_t *zcg, int error, uint64_t len)
+{
+	zcg->zcg_zcr->zcr_error = error;
+	zcg->zcg_zcr->zcr_len = len;
+	zcg->zcg_state = ZCG_DONE;
+}
+
+/*
+ * Number of entries from the head of zcr that can be cloned as one group:
+ * all of them must be between the same pair of datasets and no file may
+ * appear more than once, so that the range locks of the whole group can
+ * be taken in a single pass without risking self-deadlock.
+ */
+static uint_t
+zfs_clone_range_group_size(zfs_clone_range_t *zcr, uint_t count)
+{
+	zfsvfs_t *inzfsvfs = ZTOZSB(zcr[0].zcr_inzp);
+	zfsvfs_t *outzfsvfs = ZTOZSB(zcr[0].zcr_outzp);
+	uint_t max = MAX(zfs_bclone_batch_max, 1);
+	uint_t n;
+
+	for (n = 0; n < count && n < max; n++) {
+		znode_t *inzp = zcr[n].zcr_inzp;
+		znode_t *outzp = zcr[n].zcr_outzp;
+
+		if (zcr[n].zcr_error != 0 || inzp == outzp ||
+		    ZTOZSB(inzp) != inzfsvfs || ZTOZSB(outzp) != outzfsvfs)
+			break;
+		for (uint_t j = 0; j < n; j++) {
+			if (zcr[j].zcr_inzp == inzp ||
+			    zcr[j].zcr_inzp == outzp ||
+			    zcr[j].zcr_outzp == inzp ||
+			    zcr[j].zcr_outzp == outzp)
+				return (n);
+		}
+	}
+
+	return (MAX(n, 1));
+}
+
+/*
+ * Clone a group of ranges built by zfs_clone_range_group_size().  Every
+ * range that fits into a single intent log record is cloned under one
+ * shared transaction; the remainder is handed to zfs_clone_range().
+ */
+static void
+zfs_clone_range_group(zfs_clone_range_t *zcr, uint_t n, cred_t *cr)
+{
+	zfsvfs_t	*inzfsvfs = ZTOZSB(zcr[0].zcr_inzp);
+	zfsvfs_t	*outzfsvfs = ZTOZSB(zcr[0].zcr_outzp);
+	objset_t	*inos = inzfsvfs->z_os;
+	objset_t	*outos = outzfsvfs->z_os;
+	zilog_t		*zilog = outzfsvfs->z_log;
+	zfs_clone_group_ent_t *zcg;
+	zfs_clone_group_lock_t *zgl;
+	dmu_tx_t	*tx;
+	blkptr_t	*bps;
+	size_t		maxblocks, nbps;
+	uint_t		nlocks = 0, nready = 0;
+	boolean_t	cloned = B_FALSE;
+	int		error;
+
+	error = zfs_enter_two(inzfsvfs, outzfsvfs, FTAG);
+	if (error != 0) {
+		for (uint_t i = 0; i < n; i++) {
+			zcr[i].zcr_error = error;
+			zcr[i].zcr_len = 0;
+		}
+		return;
+	}
+
+	error = zfs_clone_range_check_os(inzfsvfs, outzfsvfs);
+	if (error != 0) {
+		for (uint_t i = 0; i < n; i++) {
+			zcr[i].zcr_error = error;
+			zcr[i].zcr_len = 0;
+		}
+		zfs_exit_two(inzfsvfs, outzfsvfs, FTAG);
+		return;
+	}
+
+	zcg = kmem_zalloc(n * sizeof (*zcg), KM_SLEEP);
+	zgl = kmem_alloc(2 * n * sizeof (*zgl), KM_SLEEP);
+
+	for (uint_t i = 0; i < n; i++) {
+		zfs_clone_range_t *z = &zcr[i];
+
+		zcg[i].zcg_zcr = z;
+		error = zfs_clone_range_check_zp(z->zcr_inzp, z->zcr_inoff,
+		    z->zcr_outzp, z->zcr_outoff, &z->zcr_len);
+		if (error != 0 || z->zcr_len == 0) {
+			zfs_clone_group_ent_done(&zcg[i], error, 0);
+			continue;
+		}
+
+		/* Flush any mmap()'d data to disk */
+		if (zn_has_cached_data(z->zcr_inzp, z->zcr_inoff,
+		    z->zcr_inoff + z->zcr_len - 1))
+			zn_flush_cached_data(z->zcr_inzp, B_TRUE);
+
+		zfs_clone_group_lock_init(&zgl[nlocks++], z->zcr_inzp,
+		    z->zcr_inoff, z->zcr_len, RL_READER, &zcg[i].zcg_inlr);
+		zfs_clone_group_lock_init(&zgl[nlocks++], z->zcr_outzp,
+		    z->zcr_outoff, z->zcr_len, RL_WRITER, &zcg[i].zcg_outlr);
+		zcg[i].zcg_state = ZCG_LOCKED;
+	}
+
+	/*
+	 * Maintain predictable lock order: take the range locks sorted by
+	 * znode address, the same order zfs_clone_range() uses.  All the
+	 * znodes in a group are distinct.
+	 */
+	for (uint_t i = 1; i < nlocks; i++) {
+		zfs_clone_group_lock_t tmp = zgl[i];
+		uint_t j;
+
+		for (j = i; j > 0 && zgl[j - 1].zgl_zp > tmp.zgl_zp; j--)
+			zgl[j] = zgl[j - 1];
+		zgl[j] = tmp;
+	}
+	for (uint_t i = 0; i < nlocks; i++) {
+		zfs_clone_group_lock_t *l = &zgl[i];
+
+		*l->zgl_lrp = zfs_rangelock_enter(&l->zgl_zp->z_rangelock,
+		    l->zgl_off, l->zgl_len, l->zgl_type);
+	}
+
+	maxblocks = zil_max_log_data(zilog, sizeof (lr_clone_range_t)) /
+	    sizeof (bps[0]);
+	bps = vmem_alloc(sizeof (bps[0]) * maxblocks, KM_SLEEP);
+
+	for (uint_t i = 0; i < n; i++) {
+		zfs_clone_group_ent_t *g = &zcg[i];
+		zfs_clone_range_t *z = g->zcg_zcr;
+		znode_t *inzp = z->zcr_inzp;
+		znode_t *outzp = z->zcr_outzp;
+		uint64_t projid = outzp->z_projid;
+
+		if (g->zcg_state != ZCG_LOCKED)
+			continue;
+
+		error = zfs_clone_range_check_locked(inzp, z->zcr_inoff,
+		    outzp, z->zcr_outoff, z->zcr_len, g->zcg_outlr);
+		if (error != 0) {
+			zfs_clone_group_ent_done(g, error, 0);
+			continue;
+		}
+
+		/*
+		 * Ranges that need more than one log record are cloned in
+		 * chunks by zfs_clone_range().
+		 */
+		g->zcg_blksz = inzp->z_blksz;
+		if (z->zcr_len > (uint64_t)g->zcg_blksz * maxblocks) {
+			g->zcg_state = ZCG_FALLBACK;
+			continue;
+		}
+
+		if (zfs_id_overblockquota(outzfsvfs, DMU_USERUSED_OBJECT,
+		    KUID_TO_SUID(ZTOUID(outzp))) ||
+		    zfs_id_overblockquota(outzfsvfs, DMU_GROUPUSED_OBJECT,
+		    KGID_TO_SGID(ZTOGID(outzp))) ||
+		    (projid != ZFS_DEFAULT_PROJID &&
+		    zfs_id_overblockquota(outzfsvfs, DMU_PROJECTUSED_OBJECT,
+		    projid))) {
+			zfs_clone_group_ent_done(g, SET_ERROR(EDQUOT), 0);
+			continue;
+		}
+
+		nbps = maxblocks;
+		error = dmu_read_l0_bps(inos, inzp->z_id, z->zcr_inoff,
+		    z->zcr_len, bps, &nbps);
+		if (error == EAGAIN) {
+			/*
+			 * Source blocks are dirty in the open txg; let
+			 * zfs_clone_range() wait for them or shorten the
+			 * range as zfs_bclone_wait_dirty says.
+			 */
+			g->zcg_state = ZCG_FALLBACK;
+			continue;
+		} else if (error != 0) {
+			zfs_clone_group_ent_done(g, error, 0);
+			continue;
+		}
+
+		g->zcg_bps = kmem_alloc(sizeof (bps[0]) * nbps, KM_SLEEP);
+		memcpy(g->zcg_bps, bps, sizeof (bps[0]) * nbps);
+		g->zcg_nbps = nbps;
+		g->zcg_state = ZCG_READY;
+		nready++;
+	}
+
+	vmem_free(bps, sizeof (bps[0]) * maxblocks);
+
+	if (nready > 0) {
+		tx = dmu_tx_create(outos);
+		for (uint_t i = 0; i < n; i++) {
+			zfs_clone_group_ent_t *g = &zcg[i];
+			znode_t *outzp = g->zcg_zcr->zcr_outzp;
+			dmu_buf_impl_t *db;
+
+			if (g->zcg_state != ZCG_READY)
+				continue;
+
+			dmu_tx_hold_sa(tx, outzp->z_sa_hdl, B_FALSE);
+			db = (dmu_buf_impl_t *)sa_get_db(outzp->z_sa_hdl);
+			DB_DNODE_ENTER(db);
+			dmu_tx_hold_clone_by_dnode(tx, DB_DNODE(db),
+			    g->zcg_zcr->zcr_outoff, g->zcg_zcr->zcr_len,
+			    g->zcg_blksz);
+			DB_DNODE_EXIT(db);
+			zfs_sa_upgrade_txholds(tx, outzp);
+		}
+		error = dmu_tx_assign(tx, DMU_TX_WAIT);
+		if (error != 0) {
+			dmu_tx_abort(tx);
+			tx = NULL;
+		}
+
+		for (uint_t i = 0; i < n; i++) {
+			zfs_clone_group_ent_t *g = &zcg[i];
+			zfs_clone_range_t *z = g->zcg_zcr;
+			znode_t *outzp = z->zcr_outzp;
+			uint64_t outoff = z->zcr_outoff;
+			uint64_t len = z->zcr_len;
+			uint64_t clear_setid_bits_txg = 0;
+			uint64_t mtime[2], ctime[2];
+			uint64_t outsize;
+			sa_bulk_attr_t bulk[3];
+			int count = 0;
+
+			if (g->zcg_state != ZCG_READY)
+				continue;
+
+			if (tx == NULL) {
+				zfs_clone_group_ent_done(g, error, 0);
+				continue;
+			}
+
+			/*
+			 * Copy source znode's block size, see
+			 * zfs_clone_range().
+			 */
+			if (g->zcg_outlr->lr_length == UINT64_MAX) {
+				zfs_grow_blocksize(outzp, g->zcg_blksz, tx);
+				if (g->zcg_blksz != outzp->z_blksz) {
+					zfs_clone_group_ent_done(g,
+					    SET_ERROR(EINVAL), 0);
+					continue;
+				}
+				zfs_rangelock_reduce(g->zcg_outlr, outoff,
+				    ((len - 1) / g->zcg_blksz + 1) *
+				    g->zcg_blksz);
+			}
+
+			int err = dmu_brt_clone(outos, outzp->z_id, outoff,
+			    len, tx, g->zcg_bps, g->zcg_nbps);
+			if (err != 0) {
+				zfs_clone_group_ent_done(g, err, 0);
+				continue;
+			}
+
+			if (zn_has_cached_data(outzp, outoff, outoff + len - 1))
+				update_pages(outzp, outoff, len, outos);
+
+			zfs_clear_setid_bits_if_necessary(outzfsvfs, outzp, cr,
+			    &clear_setid_bits_txg, tx);
+
+			zfs_tstamp_update_setup(outzp, CONTENT_MODIFIED, mtime,
+			    ctime);
+
+			while ((outsize = outzp->z_size) < outoff + len) {
+				(void) atomic_cas_64(&outzp->z_size, outsize,
+				    outoff + len);
+			}
+
+			SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_MTIME(outzfsvfs),
+			    NULL, &mtime, 16);
+			SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_CTIME(outzfsvfs),
+			    NULL, &ctime, 16);
+			SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_SIZE(outzfsvfs),
+			    NULL, &outzp->z_size, 8);
+			err = sa_bulk_update(outzp->z_sa_hdl, bulk, count, tx);
+
+			zfs_log_clone_range(zilog, tx, TX_CLONE_RANGE, outzp,
+			    outoff, len, g->zcg_blksz, g->zcg_bps,
+			    g->zcg_nbps);
+
+			zfs_clone_group_ent_done(g, err, len);
+			cloned = B_TRUE;
+		}
+
+		if (tx != NULL)
+			dmu_tx_commit(tx);
+	}
+
+	for (uint_t i = 0; i < n; i++) {
+		zfs_clone_group_ent_t *g = &zcg[i];
+
+		if (g->zcg_inlr == NULL)
+			continue;
+		zfs_znode_update_vfs(g->zcg_zcr->zcr_outzp);
+		zfs_rangelock_exit(g->zcg_outlr);
+		zfs_rangelock_exit(g->zcg_inlr);
+		if (g->zcg_zcr->zcr_len > 0 && g->zcg_state == ZCG_DONE)
+			ZFS_ACCESSTIME_STAMP(inzfsvfs, g->zcg_zcr->zcr_inzp);
+		if (g->zcg_bps != NULL)
+			kmem_free(g->zcg_bps, sizeof (blkptr_t) * g->zcg_nbps);
+	}
+
+	if (cloned && outos->os_sync == ZFS_SYNC_ALWAYS) {
+		error = zil_commit(zilog, 0);
+		for (uint_t i = 0; error != 0 && i < n; i++) {
+			if (zcg[i].zcg_state == ZCG_DONE &&
+			    zcr[i].zcr_error == 0 && zcr[i].zcr_len > 0)
+				zcr[i].zcr_error = error;
+		}
+	}
+
+	zfs_exit_two(inzfsvfs, outzfsvfs, FTAG);
+
+	for (uint_t i = 0; i < n; i++) {
+		if (zcg[i].zcg_state == ZCG_FALLBACK)
+			zfs_clone_range_one(&zcr[i], cr);
+	}
+
+	kmem_free(zgl, 2 * n * sizeof (*zgl));
+	kmem_free(zcg, n * sizeof (*zcg));
+}
+
+/*
+ * Clone a batch of ranges.  Runs of entries between the same pair of
+ * datasets are cloned in groups of up to zfs_bclone_batch_max, each group
+ * under a single transaction, which saves a tx assignment and a pass
+ * through the range locks per range when cloning many small files.
+ * Entries with zcr_error already set are skipped.  On return zcr_error
+ * holds the result for each entry and zcr_len the number of bytes cloned,
+ * which may be short as for zfs_clone_range().
+ */
+void
+zfs_clone_range_batch(zfs_clone_range_t *zcr, uint_t count, cred_t *cr)
+{
+	uint_t i = 0;
+
+	while (i < count) {
+		uint_t n;
+
+		if (zcr[i].zcr_error != 0) {
+			zcr[i].zcr_len = 0;
+			i++;
+			continue;
+		}
+
+		if (issig()) {
+			for (; i < count; i++) {
+				if (zcr[i].zcr_error == 0)
+					zcr[i].zcr_error = SET_ERROR(EINTR);
+				zcr[i].zcr_len = 0;
+			}
+			break;
+		}
+
+		n = zfs_clone_range_group_size(&zcr[i], count - i);
+		if (n == 1)
+			zfs_clone_range_one(&zcr[i], cr);
+		else
+			zfs_clone_range_group(&zcr[i], n, cr);
+		i += n;
+	}
+}
+
 /*
  * Usual pattern would be to call zfs_clone_range() from zfs_replay_clone(),
  * but we cannot do that, because when replaying we don't have source znode
@@ -2082,6 +2532,9 @@ ZFS_MODULE_PARAM(zfs, zfs_, bclone_enabled, INT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs, zfs_, bclone_wait_dirty, INT, ZMOD_RW,
 	"Wait for dirty blocks when cloning");
 
+ZFS_MODULE_PARAM(zfs, zfs_, bclone_batch_max, UINT, ZMOD_RW,
+	"Max ranges cloned under one transaction by a batched clone");
+
 ZFS_MODULE_PARAM(zfs, zfs_, dio_enabled, INT, ZMOD_RW,
 	"Enable Direct I/O");
 
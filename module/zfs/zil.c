@@ -98,7 +98,7 @@ static uint_t zfs_commit_timeout_pct = 10;
 /*
  * See zil.h for more information about these fields.
  */
-static zil_kstat_values_t zil_stats = {
+static const zil_kstat_values_t zil_kstat_values_template = {
 	{ "zil_commit_count",			KSTAT_DATA_UINT64 },
 	{ "zil_commit_writer_count",		KSTAT_DATA_UINT64 },
 	{ "zil_commit_error_count",		KSTAT_DATA_UINT64 },
@@ -122,6 +122,14 @@ static zil_kstat_values_t zil_stats = {
 	{ "zil_itx_metaslab_slog_alloc",	KSTAT_DATA_UINT64 },
 };
 
+/*
+ * Column names of the ZIL latency histograms, indexed by zil_lat_type_t.
+ */
+static const char *const zil_lat_names[ZIL_LAT_TYPES] = {
+	"commit", "lwb_fill", "lwb_write", "lwb_flush", "timeout"
+};
+
+static zil_kstat_values_t zil_stats;
 static zil_sums_t zil_sums_global;
 static kstat_t *zil_kstats_global;
 
@@ -130,6 +138,19 @@ static kstat_t *zil_kstats_global;
  */
 int zil_replay_disable = 0;
 
+/*
+ * Number of threads used to replay TX_WRITE records of different objects
+ * in parallel.  All other records are replayed in order as barriers.
+ * Zero or one replays all records serially in the calling thread.
+ */
+static uint_t zil_replay_threads = 0;
+
+/*
+ * Limit on the size of log records (including their data) queued for
+ * parallel replay but not yet applied.
+ */
+static uint64_t zil_replay_inflight_max = 64 * 1024 * 1024;
+
 /*
  * Disable the flush commands that are normally sent to the disk(s) by the ZIL
  * after an LWB write has completed. Setting this will cause ZIL corruption on
@@ -144,6 +165,14 @@ static int zil_nocacheflush = 0;
  */
 static uint64_t zil_slog_bulk = 64 * 1024 * 1024;
 
+/*
+ * Log blocks are allocated round-robin between SLOG vdevs and written in
+ * parallel, but a burst that fits into a single block is written to only
+ * one of them.  With several SLOGs, split bursts into one block per SLOG
+ * as long as each block gets at least this many bytes.  Zero disables.
+ */
+static uint_t zil_slog_stripe_min = 32 * 1024;
+
 static kmem_cache_t *zil_lwb_cache;
 static kmem_cache_t *zil_zcw_cache;
 
@@ -241,6 +270,149 @@ zil_kstats_global_update(kstat_t *ksp, int rw)
 	return (0);
 }
 
+static int
+zil_kstat_update(kstat_t *ksp, int rw)
+{
+	if (rw == KSTAT_WRITE)
+		return (SET_ERROR(EACCES));
+
+	zil_kstat_values_update(ksp->ks_data, ksp->ks_private);
+
+	return (0);
+}
+
+/*
+ * Create a kstat exporting the ZIL counters accumulated in zil_sums, using
+ * the same names as the global "zil" kstat.  Used for the per-pool rollup.
+ */
+kstat_t *
+zil_kstat_create(const char *module, const char *name, zil_sums_t *zil_sums)
+{
+	kstat_t *ksp = kstat_create(module, 0, name, "misc", KSTAT_TYPE_NAMED,
+	    sizeof (zil_kstat_values_t) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+
+	if (ksp != NULL) {
+		ksp->ks_data = kmem_alloc(sizeof (zil_kstat_values_t),
+		    KM_SLEEP);
+		memcpy(ksp->ks_data, &zil_kstat_values_template,
+		    sizeof (zil_kstat_values_t));
+		ksp->ks_update = zil_kstat_update;
+		ksp->ks_private = zil_sums;
+		kstat_install(ksp);
+	}
+
+	return (ksp);
+}
+
+void
+zil_kstat_destroy(kstat_t *ksp)
+{
+	zil_kstat_values_t *zs = ksp->ks_data;
+
+	kstat_delete(ksp);
+	kmem_free(zs, sizeof (zil_kstat_values_t));
+}
+
+static int
+zil_latency_kstat_headers(char *buf, size_t size)
+{
+	(void) snprintf(buf, size, "%-12s %12s %12s %12s %12s %12s\n", "ns",
+	    zil_lat_names[ZIL_LAT_COMMIT], zil_lat_names[ZIL_LAT_LWB_FILL],
+	    zil_lat_names[ZIL_LAT_LWB_WRITE], zil_lat_names[ZIL_LAT_LWB_FLUSH],
+	    zil_lat_names[ZIL_LAT_WAITER_TIMEOUT]);
+
+	return (0);
+}
+
+/*
+ * Print the rows of the latency histograms between the first and the last
+ * non-empty bucket.  Each row is labelled with the bucket's upper bound.
+ */
+static int
+zil_latency_kstat_data(char *buf, size_t size, void *data)
+{
+	zil_sums_t *zs = data;
+	int first = ZIL_LAT_BUCKETS, last = -1;
+	size_t off = 0;
+	int n;
+
+	for (int b = 0; b < ZIL_LAT_BUCKETS; b++) {
+		for (int t = 0; t < ZIL_LAT_TYPES; t++) {
+			if (zs->zil_latency[b][t] != 0) {
+				first = MIN(first, b);
+				last = b;
+			}
+		}
+	}
+
+	buf[0] = '\0';
+	for (int b = first; b <= last; b++) {
+		n = snprintf(buf + off, size - off, "%-12llu",
+		    (u_longlong_t)1 << b);
+		for (int t = 0; t < ZIL_LAT_TYPES; t++) {
+			if (n < 0 || n >= size - off)
+				return (SET_ERROR(ENOMEM));
+			off += n;
+			n = snprintf(buf + off, size - off, " %12llu",
+			    (u_longlong_t)zs->zil_latency[b][t]);
+		}
+		if (n < 0 || n >= size - off - 1)
+			return (SET_ERROR(ENOMEM));
+		off += n;
+		buf[off++] = '\n';
+		buf[off] = '\0';
+	}
+
+	return (0);
+}
+
+static void *
+zil_latency_kstat_addr(kstat_t *ksp, loff_t n)
+{
+	if (n == 0)
+		return (ksp->ks_private);	/* return the zil_sums_t */
+	return (NULL);
+}
+
+/*
+ * Create a kstat printing the latency histograms accumulated in zil_sums
+ * as a table, one column per zil_lat_type_t.
+ */
+kstat_t *
+zil_latency_kstat_create(const char *module, const char *name,
+    zil_sums_t *zil_sums)
+{
+	kstat_t *ksp = kstat_create(module, 0, name, "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+
+	if (ksp != NULL) {
+		ksp->ks_data = NULL;
+		ksp->ks_private = zil_sums;
+		kstat_set_raw_ops(ksp, zil_latency_kstat_headers,
+		    zil_latency_kstat_data, zil_latency_kstat_addr);
+		kstat_install(ksp);
+	}
+
+	return (ksp);
+}
+
+/*
+ * Account a sample of the given zil_commit() phase in the histograms of
+ * the dataset and of the pool.
+ */
+static void
+zil_latency_add(zilog_t *zilog, zil_lat_type_t type, hrtime_t delta)
+{
+	uint_t b = (delta > 1) ? highbit64(delta - 1) : 0;
+
+	b = MIN(b, ZIL_LAT_BUCKETS - 1);
+	if (zilog->zl_sums != NULL)
+		atomic_inc_64(&zilog->zl_sums->zil_latency[b][type]);
+	if (zilog->zl_pool_sums != NULL)
+		atomic_inc_64(&zilog->zl_pool_sums->zil_latency[b][type]);
+}
+
 /*
  * Read a log block and make sure it's valid.
  */
@@ -385,6 +557,7 @@ zil_sums_init(zil_sums_t *zs)
 	wmsum_init(&zs->zil_itx_metaslab_slog_bytes, 0);
 	wmsum_init(&zs->zil_itx_metaslab_slog_write, 0);
 	wmsum_init(&zs->zil_itx_metaslab_slog_alloc, 0);
+	memset(zs->zil_latency, 0, sizeof (zs->zil_latency));
 }
 
 void
@@ -853,7 +1026,9 @@ zil_alloc_lwb(zilog_t *zilog, blkptr_t *bp, int min_sz, int sz,
 	lwb->lwb_child_zio = NULL;
 	lwb->lwb_write_zio = NULL;
 	lwb->lwb_root_zio = NULL;
+	lwb->lwb_opened_timestamp = 0;
 	lwb->lwb_issued_timestamp = 0;
+	lwb->lwb_written_timestamp = 0;
 	lwb->lwb_issued_txg = 0;
 	lwb->lwb_alloc_txg = txg;
 	lwb->lwb_max_txg = 0;
@@ -1469,7 +1644,13 @@ zil_lwb_flush_vdevs_done(zio_t *zio)
 
 	spa_config_exit(zilog->zl_spa, SCL_STATE, lwb);
 
-	hrtime_t t = gethrtime() - lwb->lwb_issued_timestamp;
+	hrtime_t now = gethrtime();
+	hrtime_t t = now - lwb->lwb_issued_timestamp;
+
+	if (zio->io_error == 0 && lwb->lwb_written_timestamp != 0) {
+		zil_latency_add(zilog, ZIL_LAT_LWB_FLUSH,
+		    now - lwb->lwb_written_timestamp);
+	}
 
 	mutex_enter(&zilog->zl_lock);
 
@@ -1588,6 +1769,12 @@ zil_lwb_write_done(zio_t *zio)
 	zio_buf_free(lwb->lwb_buf, lwb->lwb_sz);
 	lwb->lwb_buf = NULL;
 
+	if (zio->io_error == 0) {
+		lwb->lwb_written_timestamp = gethrtime();
+		zil_latency_add(zilog, ZIL_LAT_LWB_WRITE,
+		    lwb->lwb_written_timestamp - lwb->lwb_issued_timestamp);
+	}
+
 	mutex_enter(&zilog->zl_lock);
 	ASSERT3S(lwb->lwb_state, ==, LWB_STATE_ISSUED);
 	lwb->lwb_state = LWB_STATE_WRITE_DONE;
@@ -1747,6 +1934,7 @@ zil_lwb_write_open(zilog_t *zilog, lwb_t *lwb)
 	zilog->zl_last_lwb_opened = lwb;
 	mutex_exit(&zilog->zl_lock);
 	mutex_exit(&lwb->lwb_lock);
+	lwb->lwb_opened_timestamp = gethrtime();
 
 	/*
 	 * Allocate buffer and set up LWB capacities.
@@ -1770,6 +1958,22 @@ zil_lwb_write_open(zilog_t *zilog, lwb_t *lwb)
  */
 static uint_t zil_maxblocksize = SPA_OLD_MAXBLOCKSIZE;
 
+/*
+ * Number of blocks to stripe the provided burst size across SLOG vdevs.
+ */
+static uint_t
+zil_lwb_stripe(zilog_t *zilog, uint64_t size, uint_t waste)
+{
+	if (zil_slog_stripe_min == 0)
+		return (1);
+
+	uint64_t nslogs = spa_slog_count(zilog->zl_spa);
+	if (nslogs < 2)
+		return (1);
+
+	return (MAX(MIN(nslogs, size / MAX(zil_slog_stripe_min, waste)), 1));
+}
+
 /*
  * Plan splitting of the provided burst size between several blocks.
  */
@@ -1779,8 +1983,11 @@ zil_lwb_plan(zilog_t *zilog, uint64_t size, uint_t *minsize)
 	uint_t md = zilog->zl_max_block_size - sizeof (zil_chain_t);
 	uint_t waste = zil_max_waste_space(zilog);
 	waste = MAX(waste, zilog->zl_cur_max);
+	uint_t stripe = 1;
+	if (size <= 8 * md)
+		stripe = zil_lwb_stripe(zilog, size, waste);
 
-	if (size <= md) {
+	if (size <= md && stripe <= 1) {
 		/*
 		 * Small bursts are written as-is in one block.
 		 */
@@ -1798,15 +2005,23 @@ zil_lwb_plan(zilog_t *zilog, uint64_t size, uint_t *minsize)
 
 	/*
 	 * Medium bursts try to divide evenly to better utilize several SLOG
-	 * VDEVs.  The first block size we predict assuming the worst case of
-	 * maxing out others.  Fall back to using maximum blocks if due to
-	 * large records or wasted space we can not predict anything better.
+	 * VDEVs, using at least one block per SLOG if it is big enough.  The
+	 * first block size we predict assuming the worst case of maxing out
+	 * others.  Fall back to using maximum blocks if due to large records
+	 * or wasted space we can not predict anything better.
 	 */
 	uint_t s = size;
 	uint_t n = DIV_ROUND_UP(s, md - sizeof (lr_write_t));
+	n = MAX(n, stripe);
 	uint_t chunk = DIV_ROUND_UP(s, n);
 	if (chunk <= md - waste) {
-		*minsize = MAX(s - (md - waste) * (n - 1), waste);
+		/*
+		 * When striping, the burst may be smaller than what the other
+		 * blocks could take, in which case the first one needs only
+		 * the minimum.
+		 */
+		uint_t others = (md - waste) * (n - 1);
+		*minsize = MAX(s > others ? s - others : 0, waste);
 		return (chunk);
 	} else {
 		*minsize = waste;
@@ -2129,6 +2344,8 @@ next_lwb:
 		    BP_GET_LSIZE(&lwb->lwb_blk));
 	}
 	lwb->lwb_issued_timestamp = gethrtime();
+	zil_latency_add(zilog, ZIL_LAT_LWB_FILL,
+	    lwb->lwb_issued_timestamp - lwb->lwb_opened_timestamp);
 	if (lwb->lwb_child_zio)
 		zio_nowait(lwb->lwb_child_zio);
 	zio_nowait(lwb->lwb_write_zio);
@@ -3600,7 +3817,8 @@ zil_commit_waiter(zilog_t *zilog, zil_commit_waiter_t *zcw)
 	 */
 	int pct = MAX(zfs_commit_timeout_pct, 1);
 	hrtime_t sleep = (zilog->zl_last_lwb_latency * pct) / 100;
-	hrtime_t wakeup = gethrtime() + sleep;
+	hrtime_t start = gethrtime();
+	hrtime_t wakeup = start + sleep;
 	boolean_t timedout = B_FALSE;
 
 	while (!zcw->zcw_done) {
@@ -3646,6 +3864,8 @@ zil_commit_waiter(zilog_t *zilog, zil_commit_waiter_t *zcw)
 				continue;
 
 			timedout = B_TRUE;
+			zil_latency_add(zilog, ZIL_LAT_WAITER_TIMEOUT,
+			    gethrtime() - start);
 			zil_commit_waiter_timeout(zilog, zcw);
 
 			if (!zcw->zcw_done) {
@@ -4054,6 +4274,8 @@ out:
 static int
 zil_commit_impl(zilog_t *zilog, uint64_t foid)
 {
+	hrtime_t start = gethrtime();
+
 	ZIL_STAT_BUMP(zilog, zil_commit_count);
 
 	/*
@@ -4110,6 +4332,7 @@ zil_commit_impl(zilog_t *zilog, uint64_t foid)
 	}
 
 	zil_free_commit_waiter(zcw);
+	zil_latency_add(zilog, ZIL_LAT_COMMIT, gethrtime() - start);
 
 	if (err == 0)
 		return (0);
@@ -4248,6 +4471,7 @@ zil_init(void)
 	zil_zcw_cache = kmem_cache_create("zil_zcw_cache",
 	    sizeof (zil_commit_waiter_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
 
+	memcpy(&zil_stats, &zil_kstat_values_template, sizeof (zil_stats));
 	zil_sums_init(&zil_sums_global);
 	zil_kstats_global = kstat_create("zfs", 0, "zil", "misc",
 	    KSTAT_TYPE_NAMED, sizeof (zil_stats) / sizeof (kstat_named_t),
@@ -4297,6 +4521,7 @@ zil_alloc(objset_t *os, zil_header_t *zh_phys)
 	zilog->zl_header = zh_phys;
 	zilog->zl_os = os;
 	zilog->zl_spa = dmu_objset_spa(os);
+	zilog->zl_pool_sums = spa_zil_sums(zilog->zl_spa);
 	zilog->zl_dmu_pool = dmu_objset_pool(os);
 	zilog->zl_destroy_txg = TXG_INITIAL - 1;
 	zilog->zl_logbias = dmu_objset_logbias(os);
@@ -4661,14 +4886,35 @@ typedef struct zil_replay_arg {
 	void		*zr_arg;
 	boolean_t	zr_byteswap;
 	char		*zr_lr;
+
+	/* Parallel replay state, see zil_replay_dispatch(). */
+	uint_t		zr_nthreads;	/* number of replay taskqs */
+	taskq_t		**zr_taskqs;	/* single-threaded, one per thread */
+	kmutex_t	zr_lock;	/* protects following members */
+	kcondvar_t	zr_cv;		/* signalled when zr_inflight drops */
+	uint64_t	zr_inflight;	/* bytes queued to zr_taskqs */
+	int		zr_error;	/* first error of a queued record */
+	lr_t		zr_error_lr;	/* header of that record */
 } zil_replay_arg_t;
 
+typedef struct zil_replay_task {
+	zilog_t		*zrt_zilog;
+	zil_replay_arg_t *zrt_zr;
+	uint64_t	zrt_txtype;
+	size_t		zrt_size;
+	char		zrt_lr[];	/* record, followed by its data */
+} zil_replay_task_t;
+
 static int
 zil_replay_error(zilog_t *zilog, const lr_t *lr, int error)
 {
 	char name[ZFS_MAX_DATASET_NAME_LEN];
 
-	zilog->zl_replaying_seq--;	/* didn't actually replay this one */
+	/*
+	 * Didn't actually replay this one.  With parallel replay lr is the
+	 * failed queued record, which was logged before the current one.
+	 */
+	zilog->zl_replaying_seq = lr->lrc_seq - 1;
 
 	dmu_objset_name(zilog->zl_os, name);
 
@@ -4681,6 +4927,152 @@ zil_replay_error(zilog_t *zilog, const lr_t *lr, int error)
 	return (error);
 }
 
+/*
+ * Invoke the replay vector for a record already copied into lrbuf and
+ * byteswapped back to its original byte order.
+ */
+static int
+zil_replay_apply(zilog_t *zilog, zil_replay_arg_t *zr, uint64_t txtype,
+    char *lrbuf)
+{
+	int error;
+
+	error = zr->zr_replay[txtype](zr->zr_arg, lrbuf, zr->zr_byteswap);
+	if (error != 0) {
+		/*
+		 * The DMU's dnode layer doesn't see removes until the txg
+		 * commits, so a subsequent claim can spuriously fail with
+		 * EEXIST. So if we receive any error we try syncing out
+		 * any removes then retry the transaction.  Note that we
+		 * specify B_FALSE for byteswap now, so we don't do it twice.
+		 */
+		txg_wait_synced(spa_get_dsl(zilog->zl_spa), 0);
+		error = zr->zr_replay[txtype](zr->zr_arg, lrbuf, B_FALSE);
+	}
+	return (error);
+}
+
+/*
+ * Replay a record queued by zil_replay_dispatch().  Records of the same
+ * object are always queued to the same single-threaded taskq, so they are
+ * still applied in log order.
+ */
+static void
+zil_replay_task(void *arg)
+{
+	zil_replay_task_t *zrt = arg;
+	zil_replay_arg_t *zr = zrt->zrt_zr;
+	zilog_t *zilog = zrt->zrt_zilog;
+	lr_t *lr = (lr_t *)zrt->zrt_lr;
+	lr_t lrc = *lr;
+	int error;
+
+	mutex_enter(&zr->zr_lock);
+	error = zr->zr_error;
+	mutex_exit(&zr->zr_lock);
+
+	/*
+	 * Once any record has failed the replay is going to be aborted,
+	 * so don't bother applying anything else.
+	 */
+	if (error == 0 && zrt->zrt_txtype == TX_WRITE &&
+	    lr->lrc_reclen == sizeof (lr_write_t)) {
+		error = zil_read_log_data(zilog, (lr_write_t *)lr,
+		    zrt->zrt_lr + lr->lrc_reclen);
+	}
+	if (error == 0) {
+		if (zr->zr_byteswap)
+			byteswap_uint64_array(zrt->zrt_lr, lrc.lrc_reclen);
+		error = zil_replay_apply(zilog, zr, zrt->zrt_txtype,
+		    zrt->zrt_lr);
+	}
+
+	mutex_enter(&zr->zr_lock);
+	if (error != 0 && zr->zr_error == 0) {
+		zr->zr_error = error;
+		zr->zr_error_lr = lrc;
+	}
+	zr->zr_inflight -= zrt->zrt_size;
+	cv_broadcast(&zr->zr_cv);
+	mutex_exit(&zr->zr_lock);
+
+	vmem_free(zrt, offsetof(zil_replay_task_t, zrt_lr) + zrt->zrt_size);
+}
+
+/*
+ * Wait for all queued records to be replayed.  Any record which is not
+ * replayed in parallel is an ordering barrier, it can only be applied
+ * once everything logged before it has been.
+ */
+static int
+zil_replay_wait(zilog_t *zilog, zil_replay_arg_t *zr)
+{
+	if (!zilog->zl_replay_parallel)
+		return (0);
+
+	for (uint_t i = 0; i < zr->zr_nthreads; i++)
+		taskq_wait(zr->zr_taskqs[i]);
+	ASSERT0(zr->zr_inflight);
+	zilog->zl_replay_parallel = B_FALSE;
+
+	if (zr->zr_error != 0)
+		return (zil_replay_error(zilog, &zr->zr_error_lr,
+		    zr->zr_error));
+	return (0);
+}
+
+/*
+ * Queue a TX_WRITE or TX_WRITE2 record to be replayed in parallel with
+ * records of other objects.  Its data, if not embedded in the record,
+ * is read by the replay thread, so that log data reads are parallel too.
+ */
+static int
+zil_replay_dispatch(zilog_t *zilog, zil_replay_arg_t *zr, const lr_t *lr,
+    uint64_t txtype)
+{
+	const lr_write_t *lrw = (const lr_write_t *)lr;
+	uint64_t size = lr->lrc_reclen;
+	int error;
+
+	if (txtype == TX_WRITE && lr->lrc_reclen == sizeof (lr_write_t)) {
+		size += MAX(BP_GET_LSIZE(&lrw->lr_blkptr),
+		    lrw->lr_length);
+	}
+
+	mutex_enter(&zr->zr_lock);
+	while (zr->zr_error == 0 && zr->zr_inflight > 0 &&
+	    zr->zr_inflight + size > zil_replay_inflight_max)
+		cv_wait(&zr->zr_cv, &zr->zr_lock);
+	error = zr->zr_error;
+	if (error == 0)
+		zr->zr_inflight += size;
+	mutex_exit(&zr->zr_lock);
+
+	if (error != 0)
+		return (zil_replay_wait(zilog, zr));
+
+	zil_replay_task_t *zrt = vmem_alloc(
+	    offsetof(zil_replay_task_t, zrt_lr) + size, KM_SLEEP);
+	zrt->zrt_zilog = zilog;
+	zrt->zrt_zr = zr;
+	zrt->zrt_txtype = txtype;
+	zrt->zrt_size = size;
+	memcpy(zrt->zrt_lr, lr, lr->lrc_reclen);
+
+	/*
+	 * Replay threads must not advance the replayed sequence number,
+	 * since records of other objects logged before this one may not
+	 * have been applied yet.  See zil_replaying().
+	 */
+	zilog->zl_replay_parallel = B_TRUE;
+
+	uint64_t obj = LR_FOID_GET_OBJ(lrw->lr_foid);
+	VERIFY3U(taskq_dispatch(zr->zr_taskqs[obj % zr->zr_nthreads],
+	    zil_replay_task, zrt, TQ_SLEEP), !=, TASKQID_INVALID);
+
+	return (0);
+}
+
 static int
 zil_replay_log_record(zilog_t *zilog, const lr_t *lr, void *zra,
     uint64_t claim_txg)
@@ -4716,6 +5108,15 @@ zil_replay_log_record(zilog_t *zilog, const lr_t *lr, void *zra,
 			return (0);
 	}
 
+	if (zr->zr_nthreads > 1) {
+		if (txtype == TX_WRITE || txtype == TX_WRITE2)
+			return (zil_replay_dispatch(zilog, zr, lr, txtype));
+
+		error = zil_replay_wait(zilog, zr);
+		if (error != 0)
+			return (error);
+	}
+
 	/*
 	 * Make a copy of the data so we can revise and extend it.
 	 */
@@ -4747,20 +5148,9 @@ zil_replay_log_record(zilog_t *zilog, const lr_t *lr, void *zra,
 	 * we did so. At the end of each replay function the sequence number
 	 * is updated if we are in replay mode.
 	 */
-	error = zr->zr_replay[txtype](zr->zr_arg, zr->zr_lr, zr->zr_byteswap);
-	if (error != 0) {
-		/*
-		 * The DMU's dnode layer doesn't see removes until the txg
-		 * commits, so a subsequent claim can spuriously fail with
-		 * EEXIST. So if we receive any error we try syncing out
-		 * any removes then retry the transaction.  Note that we
-		 * specify B_FALSE for byteswap now, so we don't do it twice.
-		 */
-		txg_wait_synced(spa_get_dsl(zilog->zl_spa), 0);
-		error = zr->zr_replay[txtype](zr->zr_arg, zr->zr_lr, B_FALSE);
-		if (error != 0)
-			return (zil_replay_error(zilog, lr, error));
-	}
+	error = zil_replay_apply(zilog, zr, txtype, zr->zr_lr);
+	if (error != 0)
+		return (zil_replay_error(zilog, lr, error));
 	return (0);
 }
 
@@ -4790,11 +5180,24 @@ zil_replay(objset_t *os, void *arg,
 		return (zil_destroy(zilog, B_TRUE));
 	}
 
+	memset(&zr, 0, sizeof (zr));
 	zr.zr_replay = replay_func;
 	zr.zr_arg = arg;
 	zr.zr_byteswap = BP_SHOULD_BYTESWAP(&zh->zh_log);
 	zr.zr_lr = vmem_alloc(2 * SPA_MAXBLOCKSIZE, KM_SLEEP);
 
+	zr.zr_nthreads = zil_replay_threads;
+	if (zr.zr_nthreads > 1) {
+		mutex_init(&zr.zr_lock, NULL, MUTEX_DEFAULT, NULL);
+		cv_init(&zr.zr_cv, NULL, CV_DEFAULT, NULL);
+		zr.zr_taskqs = kmem_alloc(zr.zr_nthreads * sizeof (taskq_t *),
+		    KM_SLEEP);
+		for (uint_t i = 0; i < zr.zr_nthreads; i++) {
+			zr.zr_taskqs[i] = taskq_create("z_zil_replay", 1,
+			    defclsyspri, 1, INT_MAX, 0);
+		}
+	}
+
 	/*
 	 * Wait for in-progress removes to sync before starting replay.
 	 */
@@ -4807,6 +5210,15 @@ zil_replay(objset_t *os, void *arg,
 	    zh->zh_claim_txg, B_TRUE);
 	vmem_free(zr.zr_lr, 2 * SPA_MAXBLOCKSIZE);
 
+	if (zr.zr_nthreads > 1) {
+		(void) zil_replay_wait(zilog, &zr);
+		for (uint_t i = 0; i < zr.zr_nthreads; i++)
+			taskq_destroy(zr.zr_taskqs[i]);
+		kmem_free(zr.zr_taskqs, zr.zr_nthreads * sizeof (taskq_t *));
+		cv_destroy(&zr.zr_cv);
+		mutex_destroy(&zr.zr_lock);
+	}
+
 	zil_destroy(zilog, B_FALSE);
 	txg_wait_synced(zilog->zl_dmu_pool, zilog->zl_destroy_txg);
 	zilog->zl_replay = B_FALSE;
@@ -4822,8 +5234,16 @@ zil_replaying(zilog_t *zilog, dmu_tx_t *tx)
 
 	if (zilog->zl_replay) {
 		dsl_dataset_dirty(dmu_objset_ds(zilog->zl_os), tx);
-		zilog->zl_replayed_seq[dmu_tx_get_txg(tx) & TXG_MASK] =
-		    zilog->zl_replaying_seq;
+		/*
+		 * While records are being replayed in parallel, the replayed
+		 * sequence is only advanced by the next ordering barrier.
+		 * If we crash before that the records since the previous
+		 * barrier are simply replayed again.
+		 */
+		if (!zilog->zl_replay_parallel) {
+			zilog->zl_replayed_seq[dmu_tx_get_txg(tx) & TXG_MASK] =
+			    zilog->zl_replaying_seq;
+		}
 		return (B_TRUE);
 	}
 
@@ -4876,12 +5296,21 @@ ZFS_MODULE_PARAM(zfs, zfs_, commit_timeout_pct, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_zil, zil_, replay_disable, INT, ZMOD_RW,
 	"Disable intent logging replay");
 
+ZFS_MODULE_PARAM(zfs_zil, zil_, replay_threads, UINT, ZMOD_RW,
+	"Threads replaying TX_WRITE records of different objects in parallel");
+
+ZFS_MODULE_PARAM(zfs_zil, zil_, replay_inflight_max, U64, ZMOD_RW,
+	"Limit in bytes of log records queued for parallel replay");
+
 ZFS_MODULE_PARAM(zfs_zil, zil_, nocacheflush, INT, ZMOD_RW,
 	"Disable ZIL cache flushes");
 
 ZFS_MODULE_PARAM(zfs_zil, zil_, slog_bulk, U64, ZMOD_RW,
 	"Limit in bytes slog sync writes per commit");
 
+ZFS_MODULE_PARAM(zfs_zil, zil_, slog_stripe_min, UINT, ZMOD_RW,
+	"Minimum ZIL block size when striping bursts across SLOGs");
+
 ZFS_MODULE_PARAM(zfs_zil, zil_, maxblocksize, UINT, ZMOD_RW,
 	"Limit in bytes of ZIL log block size");
 
@@ -24,8 +24,9 @@
 
 /*
  * This program is to test the availability and behaviour of copy_file_range,
- * FICLONE, FICLONERANGE and FIDEDUPERANGE in the Linux kernel. It should
- * compile and run even if these features aren't exposed through the libc.
+ * FICLONE, FICLONERANGE and FIDEDUPERANGE in the Linux kernel, and of
+ * lzc_clone_range_batch(). It should compile and run even if these features
+ * aren't exposed through the libc.
  */
 
 #include <sys/ioctl.h>
@@ -40,6 +41,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <libzfs_core.h>
 
 #ifndef __NR_copy_file_range
 #if defined(__x86_64__)
@@ -132,6 +134,7 @@ typedef enum {
 	CF_MODE_CLONERANGE,
 	CF_MODE_COPYFILERANGE,
 	CF_MODE_DEDUPERANGE,
+	CF_MODE_BATCH,
 } cf_mode_t;
 
 static int
@@ -146,7 +149,9 @@ usage(void)
 	    "  copy_file_range:\n"
 	    "    clonefile -f <src> <dst> [<soff> <doff> <len | \"all\">]\n"
 	    "  FIDEDUPERANGE:\n"
-	    "    clonefile -d <src> <dst> <soff> <doff> <len>\n");
+	    "    clonefile -d <src> <dst> <soff> <doff> <len>\n"
+	    "  lzc_clone_range_batch:\n"
+	    "    clonefile -b <src> <dst> [<src> <dst>]...\n");
 	return (1);
 }
 
@@ -154,6 +159,7 @@ int do_clone(int sfd, int dfd);
 int do_clonerange(int sfd, int dfd, loff_t soff, loff_t doff, size_t len);
 int do_copyfilerange(int sfd, int dfd, loff_t soff, loff_t doff, size_t len);
 int do_deduperange(int sfd, int dfd, loff_t soff, loff_t doff, size_t len);
+int do_batch(int npaths, char **paths);
 
 int quiet = 0;
 
@@ -163,7 +169,7 @@ main(int argc, char **argv)
 	cf_mode_t mode = CF_MODE_NONE;
 
 	int c;
-	while ((c = getopt(argc, argv, "crfdq")) != -1) {
+	while ((c = getopt(argc, argv, "crfdbq")) != -1) {
 		switch (c) {
 			case 'c':
 				mode = CF_MODE_CLONE;
@@ -177,6 +183,9 @@ main(int argc, char **argv)
 			case 'd':
 				mode = CF_MODE_DEDUPERANGE;
 				break;
+			case 'b':
+				mode = CF_MODE_BATCH;
+				break;
 			case 'q':
 				quiet = 1;
 				break;
@@ -199,6 +208,10 @@ main(int argc, char **argv)
 			if ((argc-optind) != 2 && (argc-optind) != 5)
 				return (usage());
 			break;
+		case CF_MODE_BATCH:
+			if ((argc-optind) < 2 || (argc-optind) % 2 != 0)
+				return (usage());
+			return (do_batch(argc-optind, argv+optind));
 		default:
 			abort();
 	}
@@ -374,3 +387,59 @@ do_deduperange(int sfd, int dfd, loff_t soff, loff_t doff, size_t len)
 
 	return (err);
 }
+
+/*
+ * Clone each whole <src> to its <dst>, all in one lzc_clone_range_batch()
+ * call. Every range is tried; fails if any of them did.
+ */
+int
+do_batch(int npaths, char **paths)
+{
+	int count = npaths / 2;
+	zfs_clone_batch_ent_t *ents = calloc(count, sizeof (*ents));
+	int err = 0;
+
+	if (!quiet)
+		fprintf(stderr, "using lzc_clone_range_batch\n");
+
+	for (int i = 0; i < count; i++) {
+		const char *src = paths[2 * i], *dst = paths[2 * i + 1];
+		struct stat sb;
+
+		ents[i].src_fd = open(src, O_RDONLY);
+		if (ents[i].src_fd < 0 || fstat(ents[i].src_fd, &sb) < 0) {
+			fprintf(stderr, "open: %s: %s\n", src, strerror(errno));
+			return (1);
+		}
+		ents[i].dst_fd = open(dst, O_WRONLY|O_CREAT,
+		    S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+		if (ents[i].dst_fd < 0) {
+			fprintf(stderr, "open: %s: %s\n", dst, strerror(errno));
+			return (1);
+		}
+		ents[i].len = sb.st_size;
+	}
+
+	err = lzc_clone_range_batch(ents[0].dst_fd, ents, count);
+	if (err != 0) {
+		fprintf(stderr, "lzc_clone_range_batch: %s\n", strerror(err));
+		return (1);
+	}
+
+	for (int i = 0; i < count; i++) {
+		if (ents[i].error != 0) {
+			fprintf(stderr, "clone %s -> %s: %s\n", paths[2 * i],
+			    paths[2 * i + 1], strerror(ents[i].error));
+			err = 1;
+		} else if (!quiet) {
+			fprintf(stderr, "clone %s -> %s: %ju bytes\n",
+			    paths[2 * i], paths[2 * i + 1],
+			    (uintmax_t)ents[i].len);
+		}
+		close(ents[i].dst_fd);
+		close(ents[i].src_fd);
+	}
+	free(ents);
+
+	return (err);
+}
@@ -502,6 +502,7 @@ test_send_new(const char *snapshot, int fd)
 	fnvlist_add_boolean(optional, "embedok");
 	fnvlist_add_boolean(optional, "compressok");
 	fnvlist_add_boolean(optional, "rawok");
+	fnvlist_add_string(optional, "streamcompress", "lz4");
 
 	/*
 	 * TODO - Resumable send is harder to set up. So we currently
@@ -586,6 +587,7 @@ test_send_space(const char *snapshot1, const char *snapshot2)
 	fnvlist_add_boolean(optional, "embedok");
 	fnvlist_add_boolean(optional, "compressok");
 	fnvlist_add_boolean(optional, "rawok");
+	fnvlist_add_string(optional, "streamcompress", "lz4");
 
 	IOC_INPUT_TEST(ZFS_IOC_SEND_SPACE, snapshot2, NULL, optional, 0);
 
@@ -772,6 +774,40 @@ test_wait_fs(const char *dataset)
 	nvlist_free(required);
 }
 
+static void
+test_obj_to_stats_batch(const char *snapshot)
+{
+	nvlist_t *required = fnvlist_alloc();
+	uint64_t objs[] = { 1, 2, 3 };
+
+	fnvlist_add_uint64_array(required, ZFS_OBJ_STATS_OBJECTS, objs,
+	    ARRAY_SIZE(objs));
+
+	IOC_INPUT_TEST(ZFS_IOC_OBJ_TO_STATS_BATCH, snapshot, required, NULL, 0);
+
+	nvlist_free(required);
+}
+
+static void
+test_list_batch(const char *dataset)
+{
+	nvlist_t *optional = fnvlist_alloc();
+	uint8_t props[ZFS_NUM_PROPS] = { 0 };
+
+	fnvlist_add_boolean(optional, ZFS_LIST_BATCH_SNAPSHOTS);
+	fnvlist_add_uint64(optional, ZFS_LIST_BATCH_CURSOR, 0);
+	fnvlist_add_uint64(optional, ZFS_LIST_BATCH_COUNT, 16);
+	fnvlist_add_uint64(optional, ZFS_LIST_BATCH_MAXBYTES, 64 * 1024);
+	fnvlist_add_uint8_array(optional, ZFS_LIST_BATCH_PROPS, props,
+	    ZFS_NUM_PROPS);
+	fnvlist_add_uint64(optional, SNAP_ITER_MIN_TXG, 1);
+	fnvlist_add_uint64(optional, SNAP_ITER_MAX_TXG, UINT64_MAX);
+
+	IOC_INPUT_TEST(ZFS_IOC_LIST_BATCH, dataset, NULL, optional, 0);
+
+	nvlist_free(optional);
+}
+
 static void
 test_get_bootenv(const char *pool)
 {
@@ -844,6 +880,8 @@ zfs_ioc_input_tests(const char *pool)
 	test_snapshot(pool, snapshot);
 
 	test_space_snaps(snapshot);
+	test_obj_to_stats_batch(snapshot);
+	test_list_batch(dataset);
 	test_send_space(snapbase, snapshot);
 	test_send_new(snapshot, tmpfd);
 	test_recv_new(backup, tmpfd);
@@ -1040,6 +1078,8 @@ validate_ioc_values(void)
 	CHECK(ZFS_IOC_BASE + 83 == ZFS_IOC_WAIT);
 	CHECK(ZFS_IOC_BASE + 84 == ZFS_IOC_WAIT_FS);
 	CHECK(ZFS_IOC_BASE + 87 == ZFS_IOC_POOL_SCRUB);
+	CHECK(ZFS_IOC_BASE + 90 == ZFS_IOC_OBJ_TO_STATS_BATCH);
+	CHECK(ZFS_IOC_BASE + 91 == ZFS_IOC_LIST_BATCH);
 	CHECK(ZFS_IOC_PLATFORM_BASE + 1 == ZFS_IOC_EVENTS_NEXT);
 	CHECK(ZFS_IOC_PLATFORM_BASE + 2 == ZFS_IOC_EVENTS_CLEAR);
 	CHECK(ZFS_IOC_PLATFORM_BASE + 3 == ZFS_IOC_EVENTS_SEEK);